@@ -2,29 +2,100 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <onnxoptimizer/model_writer.h>
 #include <onnxoptimizer/optimize.h>
 
 #include <onnx/checker.h>
 #include <onnx/onnx_pb.h>
 
+#include <cstdlib>
 #include <fstream>
+#include <string>
+#include <vector>
 
+static bool loadModel(const std::string &path,
+                      ONNX_NAMESPACE::ModelProto *model) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!model->ParseFromIstream(&ifs)) {
+    std::cout << "load failed: " << path << std::endl;
+    return false;
+  }
+  onnx::checker::check_model(*model);
+  return true;
+}
+
+// External data of a model is read from its location next to the input
+// file, and copied next to the output file if it is in another directory.
+static std::string directoryOf(const std::string &path) {
+  const auto separator = path.find_last_of("/\\");
+  return separator == std::string::npos ? std::string()
+                                        : path.substr(0, separator);
+}
+
+static bool saveModel(ONNX_NAMESPACE::ModelProto &&model,
+                      const std::string &path,
+                      const onnx::optimization::ModelWriterOptions &options) {
+  onnx::checker::check_model(model);
+  if (!onnx::optimization::WriteModel(std::move(model), path, options)) {
+    std::cout << "save failed: " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Usage: onnx_optimizer_exec input.onnx output.onnx [threshold]
+// Initializers of at least threshold bytes are saved as external data in
+// output.onnx.data.
+//
+// Usage: onnx_optimizer_exec --batch num_threads in1.onnx out1.onnx ...
+// Optimizes all the models concurrently on num_threads threads, 0 meaning
+// as many as the hardware runs at once.
 int main(int argc, char **argv) {
+  const bool batch = argc > 1 && std::string(argv[1]) == "--batch";
+  if (batch ? argc < 5 || argc % 2 != 1 : argc < 3) {
+    std::cout << "usage: " << argv[0] << " input.onnx output.onnx [threshold]"
+              << std::endl
+              << "       " << argv[0]
+              << " --batch num_threads in1.onnx out1.onnx [in2.onnx "
+                 "out2.onnx ...]"
+              << std::endl;
+    return -1;
+  }
+  const auto names = onnx::optimization::GetFuseAndEliminationPass();
+  onnx::optimization::ModelWriterOptions options;
+
+  if (batch) {
+    std::vector<onnx::optimization::OptimizationTask> tasks((argc - 3) / 2);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      const std::string input_path = argv[3 + 2 * i];
+      if (!loadModel(input_path, &tasks[i].model)) {
+        return -1;
+      }
+      tasks[i].names = names;
+      tasks[i].external_data_dir = directoryOf(input_path);
+    }
+    onnx::optimization::OptimizeBatch(tasks,
+                                      std::strtoull(argv[2], nullptr, 10));
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      options.external_data_dir = tasks[i].external_data_dir;
+      if (!saveModel(std::move(tasks[i].model), argv[4 + 2 * i], options)) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+
   ONNX_NAMESPACE::ModelProto model;
-  std::ifstream ifs(argv[1]);
-  bool success = model.ParseFromIstream(&ifs);
-  if (!success) {
-    std::cout << "load failed" << std::endl;
+  if (!loadModel(argv[1], &model)) {
     return -1;
   }
-  onnx::checker::check_model(model);
-  const auto new_model = onnx::optimization::Optimize(
-      model, onnx::optimization::GetFuseAndEliminationPass());
-  onnx::checker::check_model(new_model);
-  std::ofstream ofs(argv[2]);
-  success = new_model.SerializePartialToOstream(&ofs);
-  if (!success) {
-    std::cout << "save failed" << std::endl;
+  onnx::optimization::Optimizer optimizer(names, false, directoryOf(argv[1]));
+  auto new_model = optimizer.optimize(std::move(model));
+  if (argc > 3) {
+    options.external_data_threshold = std::strtoull(argv[3], nullptr, 10);
+  }
+  options.external_data_dir = directoryOf(argv[1]);
+  if (!saveModel(std::move(new_model), argv[2], options)) {
     return -1;
   }
   return 0;
@@ -15,41 +15,141 @@ from __future__ import unicode_literals
 import onnx
 import onnxoptimizer.onnx_opt_cpp2py_export as C
 from onnx import ModelProto
-from typing import Text, Sequence, Optional
+from typing import Any, Dict, List, Text, Sequence, Optional
 
 get_available_passes = C.get_available_passes
 
 get_fuse_and_elimination_passes = C.get_fuse_and_elimination_passes
 
 
-def optimize(model, passes=None, fixed_point=False):  # type: (ModelProto, Optional[Sequence[Text]], bool) -> ModelProto
+_DEFAULT_PASSES = ['eliminate_nop_transpose',
+                   'eliminate_nop_pad',
+                   'fuse_consecutive_transposes',
+                   'fuse_transpose_into_gemm']
+
+
+def _default_passes():  # type: () -> Sequence[Text]
+    print('WARNING: defualt optimization passes will be enlarged to all fuse and elimination passes in the next version')
+    return _DEFAULT_PASSES
+
+
+def optimize(model, passes=None, fixed_point=False, return_statistics=False, propagate_shapes=True):  # type: (Any, Optional[Sequence[Text]], bool, bool, bool) -> Any
     """Apply the optimization on the serialized ModelProto.
 
     Arguments:
-        input (ModelProto): model
+        input (ModelProto): model, or the serialized model in any object
+            supporting the buffer protocol (bytes, memoryview, mmap, ...),
+            which is read without being copied
         names (list of string): list of optimization names
+        return_statistics (bool): also return what every pass did
+        propagate_shapes (bool): infer the shapes of the graph before the
+            passes and after every pass that changed it, which the passes
+            matching shapes rely on but costs time on large models
 
     Return:
         return (ModelProto) optimized model
+        With return_statistics, a tuple of the optimized model and a dict
+        holding 'passes', a list with the 'name', 'num_runs',
+        'num_transforms', 'num_nodes_visited', 'num_initializers_added',
+        'num_initializers_erased' and 'seconds' of every pass in the order
+        they were run, as well as 'num_fixed_point_iterations' and the total
+        'seconds'. Passes run in a single traversal are reported one by one.
+
+    The GIL is released while the model is optimized.
+    """
+
+    if isinstance(model, ModelProto):
+        model = model.SerializeToString()
+    result = optimize_serialized(model, passes, fixed_point, return_statistics,
+                                 propagate_shapes)
+    if return_statistics:
+        return onnx.load_from_string(result[0]), result[1]
+    return onnx.load_from_string(result)
+
+
+def optimize_serialized(model, passes=None, fixed_point=False, return_statistics=False, propagate_shapes=True):  # type: (Any, Optional[Sequence[Text]], bool, bool, bool) -> Any
+    """Same as optimize, but the optimized model is returned serialized.
+
+    Arguments:
+        input: the serialized model in any object supporting the buffer
+            protocol (bytes, memoryview, mmap, ...), which is read without
+            being copied
+
+    Return:
+        return (bytes) the serialized optimized model, in a tuple with the
+        statistics with return_statistics
     """
 
     if passes is None:
-        print('WARNING: defualt optimization passes will be enlarged to all fuse and elimination passes in the next version')
-        passes = ['eliminate_nop_transpose',
-                  'eliminate_nop_pad',
-                  'fuse_consecutive_transposes',
-                  'fuse_transpose_into_gemm']
-    if not isinstance(model, ModelProto):
+        passes = _default_passes()
+    try:
+        model_str = memoryview(model)
+    except TypeError:
         raise ValueError(
-            'Optimizer only accepts ModelProto, incorrect type: {}'.format(type(model)))
+            'Optimizer only accepts ModelProto or a serialized model, incorrect type: {}'.format(type(model)))
 
-    model_str = model.SerializeToString()
+    if return_statistics:
+        return C.optimize_with_statistics(model_str, passes, fixed_point,
+                                          propagate_shapes)
     if fixed_point:
-        optimized_model_str = C.optimize_fixedpoint(model_str, passes)
-    else:
-        optimized_model_str = C.optimize(model_str, passes)
+        return C.optimize_fixedpoint(model_str, passes, propagate_shapes)
+    return C.optimize(model_str, passes, propagate_shapes)
+
+
+def optimize_batch(models, passes=None, fixed_point=False, num_threads=0, propagate_shapes=True):  # type: (Sequence[Any], Optional[Sequence[Text]], bool, int, bool) -> List[ModelProto]
+    """Optimize several models concurrently.
+
+    Arguments:
+        models (list): models, each a ModelProto or a serialized model in any
+            object supporting the buffer protocol
+        names (list of string): list of optimization names, the same for all
+            models
+        num_threads (int): number of threads optimizing the models, 0 for as
+            many as the hardware runs at once
+        propagate_shapes (bool): as for optimize
 
-    return onnx.load_from_string(optimized_model_str)
+    Return:
+        return (list of ModelProto) the optimized models, in the same order
+
+    The GIL is released while the models are optimized.
+    """
+
+    if passes is None:
+        passes = _default_passes()
+    buffers = [model.SerializeToString() if isinstance(model, ModelProto)
+               else memoryview(model) for model in models]
+    return [onnx.load_from_string(optimized_model_str)
+            for optimized_model_str in C.optimize_batch(
+                buffers, passes, fixed_point, num_threads, propagate_shapes)]
+
+
+def optimize_file(input_path, output_path, passes=None, fixed_point=False, external_data_threshold=0, propagate_shapes=True):  # type: (Text, Text, Optional[Sequence[Text]], bool, int, bool) -> Dict[Text, Any]
+    """Optimize the model stored at input_path and save it to output_path.
+
+    The model is read, optimized and written without going through Python
+    or holding the GIL. External data of the input model is read from its
+    location next to input_path. It is still referred to there if
+    output_path is in the same directory, and copied to output_path + '.data'
+    otherwise.
+
+    Arguments:
+        input_path (string): path of the model
+        output_path (string): path of the optimized model
+        names (list of string): list of optimization names
+        external_data_threshold (int): initializers holding at least this
+            many bytes are saved as external data in output_path + '.data',
+            0 disables it
+        propagate_shapes (bool): as for optimize
+
+    Return:
+        return (dict) what every pass did, as returned by optimize with
+        return_statistics
+    """
+
+    if passes is None:
+        passes = _default_passes()
+    return C.optimize_file(input_path, output_path, passes, fixed_point,
+                           external_data_threshold, propagate_shapes)
 
 
-__all__ = ['optimize', 'get_available_passes', 'get_fuse_and_elimination_passes']
+__all__ = ['optimize', 'optimize_serialized', 'optimize_batch', 'optimize_file', 'get_available_passes', 'get_fuse_and_elimination_passes']
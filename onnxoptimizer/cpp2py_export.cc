@@ -2,6 +2,8 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdexcept>
+
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include "onnx/py_utils.h"
@@ -11,30 +13,152 @@
 namespace ONNX_NAMESPACE {
 namespace py = pybind11;
 using namespace pybind11::literals;
+
+// Parses a model from any object supporting the buffer protocol, such as
+// bytes, memoryview or mmap, without copying it first. The GIL is released
+// while parsing, the buffer stays locked by the view in the meantime. The
+// bytes of the buffer have to be contiguous, as a slice with a step may not.
+static void ParseModelFromBuffer(ModelProto* proto, const py::buffer& buffer) {
+  const py::buffer_info info = buffer.request();
+  py::ssize_t stride = info.itemsize;
+  for (py::ssize_t i = info.ndim - 1; i >= 0; --i) {
+    if (info.shape[i] > 1 && info.strides[i] != stride) {
+      throw std::invalid_argument("the model buffer is not C-contiguous");
+    }
+    stride *= info.shape[i];
+  }
+  const char* data = static_cast<const char*>(info.ptr);
+  const size_t size = static_cast<size_t>(info.size * info.itemsize);
+  bool success;
+  {
+    py::gil_scoped_release release;
+    success = ParseProtoFromBytes(proto, data, size);
+  }
+  if (!success) {
+    throw std::runtime_error("unable to parse the model");
+  }
+}
+
+// Serializes a model straight into a new bytes object, without the GIL.
+static py::bytes SerializeModelToPyBytes(const ModelProto& proto) {
+  const size_t size = proto.ByteSizeLong();
+  PyObject* bytes = PyBytes_FromStringAndSize(nullptr, size);
+  if (bytes == nullptr) {
+    throw py::error_already_set();
+  }
+  {
+    py::gil_scoped_release release;
+    proto.SerializeWithCachedSizesToArray(
+        reinterpret_cast<uint8_t*>(PyBytes_AS_STRING(bytes)));
+  }
+  return py::reinterpret_steal<py::bytes>(bytes);
+}
+
+static py::dict StatisticsToPyDict(
+    const optimization::PassStatisticsAnalysis& statistics) {
+  py::list passes;
+  for (const auto& pass : statistics.passes) {
+    passes.append(py::dict(
+        "name"_a = pass.pass_name,
+        "num_runs"_a = pass.num_runs,
+        "num_transforms"_a = pass.num_transforms,
+        "num_nodes_visited"_a = pass.num_nodes_visited,
+        "num_initializers_added"_a = pass.num_initializers_added,
+        "num_initializers_erased"_a = pass.num_initializers_erased,
+        "seconds"_a = pass.seconds));
+  }
+  return py::dict(
+      "passes"_a = passes,
+      "num_fixed_point_iterations"_a = statistics.num_fixed_point_iterations,
+      "seconds"_a = statistics.seconds);
+}
+
+// Optimizes the model in buffer with the GIL released, so that models can be
+// optimized concurrently from several Python threads.
+static py::bytes OptimizeBuffer(
+    const py::buffer& buffer,
+    const std::vector<std::string>& names,
+    bool fixed_point,
+    bool propagate_shapes,
+    optimization::PassStatisticsAnalysis* statistics) {
+  ModelProto proto{};
+  ParseModelFromBuffer(&proto, buffer);
+  ModelProto result;
+  {
+    py::gil_scoped_release release;
+    result = fixed_point
+        ? optimization::OptimizeFixed(
+              std::move(proto), names, statistics, propagate_shapes)
+        : optimization::Optimize(
+              std::move(proto), names, statistics, propagate_shapes);
+  }
+  return SerializeModelToPyBytes(result);
+}
+
 PYBIND11_MODULE(onnx_opt_cpp2py_export, onnx_opt_cpp2py_export) {
   onnx_opt_cpp2py_export.doc() = "ONNX Optimizer";
 
   onnx_opt_cpp2py_export.def(
       "optimize",
-      [](const py::bytes& bytes, const std::vector<std::string>& names) {
-        ModelProto proto{};
-        ParseProtoFromPyBytes(&proto, bytes);
-        auto const result = optimization::Optimize(proto, names);
-        std::string out;
-        result.SerializeToString(&out);
-        return py::bytes(out);
+      [](const py::buffer& buffer, const std::vector<std::string>& names,
+         bool propagate_shapes) {
+        return OptimizeBuffer(buffer, names, false, propagate_shapes, nullptr);
       });
 
   onnx_opt_cpp2py_export.def(
       "optimize_fixedpoint",
-      [](const py::bytes& bytes, const std::vector<std::string>& names) {
-        ModelProto proto{};
-        ParseProtoFromPyBytes(&proto, bytes);
-        auto const result =
-            optimization::OptimizeFixed(proto, names);
-        std::string out;
-        result.SerializeToString(&out);
-        return py::bytes(out);
+      [](const py::buffer& buffer, const std::vector<std::string>& names,
+         bool propagate_shapes) {
+        return OptimizeBuffer(buffer, names, true, propagate_shapes, nullptr);
+      });
+
+  onnx_opt_cpp2py_export.def(
+      "optimize_with_statistics",
+      [](const py::buffer& buffer, const std::vector<std::string>& names,
+         bool fixed_point, bool propagate_shapes) {
+        optimization::PassStatisticsAnalysis statistics;
+        py::bytes result = OptimizeBuffer(buffer, names, fixed_point,
+                                          propagate_shapes, &statistics);
+        return py::make_tuple(result, StatisticsToPyDict(statistics));
+      });
+
+  onnx_opt_cpp2py_export.def(
+      "optimize_file",
+      [](const std::string& input_path, const std::string& output_path,
+         const std::vector<std::string>& names, bool fixed_point,
+         size_t external_data_threshold, bool propagate_shapes) {
+        optimization::ModelWriterOptions options;
+        options.external_data_threshold = external_data_threshold;
+        optimization::PassStatisticsAnalysis statistics;
+        {
+          py::gil_scoped_release release;
+          optimization::OptimizeFile(input_path, output_path, names,
+                                     fixed_point, options, &statistics,
+                                     propagate_shapes);
+        }
+        return StatisticsToPyDict(statistics);
+      });
+  onnx_opt_cpp2py_export.def(
+      "optimize_batch",
+      [](const std::vector<py::buffer>& buffers,
+         const std::vector<std::string>& names, bool fixed_point,
+         size_t num_threads, bool propagate_shapes) {
+        std::vector<optimization::OptimizationTask> tasks(buffers.size());
+        for (size_t i = 0; i < tasks.size(); ++i) {
+          ParseModelFromBuffer(&tasks[i].model, buffers[i]);
+          tasks[i].names = names;
+          tasks[i].fixed_point = fixed_point;
+          tasks[i].propagate_shapes = propagate_shapes;
+        }
+        {
+          py::gil_scoped_release release;
+          optimization::OptimizeBatch(tasks, num_threads);
+        }
+        py::list result;
+        for (const auto& task : tasks) {
+          result.append(SerializeModelToPyBytes(task.model));
+        }
+        return result;
       });
   onnx_opt_cpp2py_export.def("get_available_passes", &optimization::GetAvailablePasses);
   onnx_opt_cpp2py_export.def("get_fuse_and_elimination_passes", &optimization::GetFuseAndEliminationPass);
@@ -0,0 +1,235 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "onnxoptimizer/external_data.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+thread_local ExternalDataStore* active_store = nullptr;
+
+std::string joinPath(const std::string& dir, const std::string& location) {
+  if (dir.empty()) {
+    return location;
+  }
+  const char last = dir.back();
+  if (last == '/' || last == '\\') {
+    return dir + location;
+  }
+  return dir + "/" + location;
+}
+
+} // namespace
+
+#ifndef _WIN32
+MappedFile::MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* addr =
+        mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE,
+             fd, 0);
+    if (addr != MAP_FAILED) {
+      data_ = static_cast<const char*>(addr);
+      size_ = static_cast<size_t>(st.st_size);
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+#else
+MappedFile::MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) {
+    return;
+  }
+  contents_.assign(
+      std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  data_ = contents_.data();
+  size_ = contents_.size();
+}
+
+MappedFile::~MappedFile() {}
+#endif
+
+ExternalDataStore::ExternalDataStore(std::string base_dir)
+    : base_dir(std::move(base_dir)) {}
+
+ExternalDataStore::~ExternalDataStore() {}
+
+void ExternalDataStore::detach(GraphProto* graph) {
+  for (auto& initializer : *graph->mutable_initializer()) {
+    ExternalTensor tensor;
+    if (tensors.count(initializer.name()) > 0 ||
+        !GetExternalData(initializer, &tensor.location, &tensor.offset,
+                         &tensor.length)) {
+      continue;
+    }
+    tensor.external_data.Swap(initializer.mutable_external_data());
+    tensor.data_type = initializer.data_type();
+    tensor.dims.assign(initializer.dims().begin(), initializer.dims().end());
+    initializer.clear_data_location();
+    initializer.mutable_raw_data()->clear();
+    tensors.emplace(initializer.name(), std::move(tensor));
+  }
+}
+
+void ExternalDataStore::reattach(GraphProto* graph) {
+  for (auto& initializer : *graph->mutable_initializer()) {
+    auto entry = tensors.find(initializer.name());
+    if (entry == tensors.end()) {
+      continue;
+    }
+    ExternalTensor& tensor = entry->second;
+    // Passes create new initializers instead of modifying existing ones, so
+    // one with the same name and type still has the original content.
+    if (initializer.data_type() != tensor.data_type ||
+        static_cast<size_t>(initializer.dims_size()) != tensor.dims.size() ||
+        !std::equal(
+            tensor.dims.begin(), tensor.dims.end(),
+            initializer.dims().begin())) {
+      continue;
+    }
+    initializer.clear_raw_data();
+    initializer.set_data_location(TensorProto_DataLocation_EXTERNAL);
+    initializer.mutable_external_data()->Swap(&tensor.external_data);
+    tensors.erase(entry);
+  }
+}
+
+const MappedFile* ExternalDataStore::file(const std::string& location) {
+  std::unique_ptr<MappedFile>& mapped = files[location];
+  if (!mapped) {
+    mapped.reset(new MappedFile(joinPath(base_dir, location)));
+    if (!mapped->valid()) {
+      std::cerr << "Warning: onnx optimizer is unable to read external data "
+                << joinPath(base_dir, location) << std::endl;
+    }
+  }
+  return mapped.get();
+}
+
+bool ExternalDataStore::view(
+    const std::string& name,
+    const char** data,
+    size_t* size) {
+  auto entry = tensors.find(name);
+  if (entry == tensors.end()) {
+    return false;
+  }
+  const ExternalTensor& tensor = entry->second;
+  const MappedFile* mapped = file(tensor.location);
+  if (!mapped->valid() || tensor.offset > mapped->size()) {
+    return false;
+  }
+  const size_t available = mapped->size() - tensor.offset;
+  if (tensor.length >= 0 && static_cast<size_t>(tensor.length) > available) {
+    return false;
+  }
+  *data = mapped->data() + tensor.offset;
+  *size =
+      tensor.length >= 0 ? static_cast<size_t>(tensor.length) : available;
+  return true;
+}
+
+bool ExternalDataStore::load(const Tensor& tensor) {
+  if (!tensor.is_raw_data() || !tensor.raw().empty()) {
+    return true;
+  }
+  const char* data;
+  size_t size;
+  if (!view(tensor.name(), &data, &size)) {
+    return !detached(tensor.name());
+  }
+  // this hack is due to Graph lacking mutable access to initializers
+  const_cast<Tensor&>(tensor).set_raw_data(std::string(data, size));
+  return true;
+}
+
+ExternalDataStore* ExternalDataStore::active() {
+  return active_store;
+}
+
+ExternalDataScope::ExternalDataScope(ExternalDataStore* store)
+    : previous(active_store) {
+  active_store = store;
+}
+
+ExternalDataScope::~ExternalDataScope() {
+  active_store = previous;
+}
+
+std::string ExternalDataPath(
+    const std::string& base_dir,
+    const std::string& location) {
+  return joinPath(base_dir, location);
+}
+
+bool GetExternalData(
+    const TensorProto& tensor,
+    std::string* location,
+    size_t* offset,
+    int64_t* length) {
+  if (tensor.data_location() != TensorProto_DataLocation_EXTERNAL) {
+    return false;
+  }
+  location->clear();
+  *offset = 0;
+  *length = -1;
+  for (const auto& entry : tensor.external_data()) {
+    if (entry.key() == "location") {
+      *location = entry.value();
+    } else if (entry.key() == "offset") {
+      *offset = std::stoull(entry.value());
+    } else if (entry.key() == "length") {
+      *length = std::stoll(entry.value());
+    }
+  }
+  return !location->empty();
+}
+
+void SetExternalData(
+    TensorProto* tensor,
+    const std::string& location,
+    size_t offset,
+    size_t length) {
+  const std::pair<std::string, std::string> entries[] = {
+      {"location", location},
+      {"offset", std::to_string(offset)},
+      {"length", std::to_string(length)}};
+  tensor->clear_raw_data();
+  tensor->clear_external_data();
+  for (const auto& entry : entries) {
+    auto* external_data = tensor->add_external_data();
+    external_data->set_key(entry.first);
+    external_data->set_value(entry.second);
+  }
+  tensor->set_data_location(TensorProto_DataLocation_EXTERNAL);
+}
+
+} // namespace optimization
+} // namespace ONNX_NAMESPACE
@@ -0,0 +1,134 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "onnx/common/ir.h"
+#include "onnx/onnx_pb.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// A file mapped read-only into memory. Falls back to reading the whole file
+// where mmap is not available.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool valid() const {
+    return data_ != nullptr;
+  }
+  const char *data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  const char *data_;
+  size_t size_;
+#ifdef _WIN32
+  std::string contents_;
+#endif
+};
+
+// Keeps track of the initializers of a model stored in ONNX external data.
+// Detached initializers are imported without data, and their content is only
+// loaded from the memory-mapped data files when a pass reads them through
+// InitializerIndex. Reattaching points the ones still present in the
+// optimized model back at their original location.
+class ExternalDataStore {
+ public:
+  // Locations of external data are relative to base_dir.
+  explicit ExternalDataStore(std::string base_dir);
+  ~ExternalDataStore();
+
+  // Takes over the external initializers of the main graph, leaving them
+  // with empty raw data.
+  void detach(GraphProto *graph);
+  // Restores the external data references of the initializers detached
+  // earlier, dropping whatever data was loaded for them.
+  void reattach(GraphProto *graph);
+  // Returns how many initializers are still detached.
+  size_t size() const {
+    return tensors.size();
+  }
+  bool detached(const std::string &name) const {
+    return tensors.count(name) > 0;
+  }
+
+  // The external content of an initializer, without copying it. Returns
+  // false if name was not detached or its data can't be read.
+  bool view(const std::string &name, const char **data, size_t *size);
+  // Loads the content of a detached initializer that has not been read yet.
+  // Returns false if the data can't be read.
+  bool load(const Tensor &tensor);
+
+  // The store of the model being optimized on the current thread, nullptr if
+  // there is none.
+  static ExternalDataStore *active();
+
+ private:
+  struct ExternalTensor {
+    google::protobuf::RepeatedPtrField<StringStringEntryProto> external_data;
+    std::string location;
+    size_t offset;
+    // -1 when the tensor extends to the end of the file.
+    int64_t length;
+    int32_t data_type;
+    std::vector<int64_t> dims;
+  };
+
+  const MappedFile *file(const std::string &location);
+
+  std::string base_dir;
+  std::unordered_map<std::string, ExternalTensor> tensors;
+  std::unordered_map<std::string, std::unique_ptr<MappedFile>> files;
+
+  friend class ExternalDataScope;
+};
+
+// Makes store the active ExternalDataStore of the current thread for as long
+// as the scope is alive.
+class ExternalDataScope {
+ public:
+  explicit ExternalDataScope(ExternalDataStore *store);
+  ~ExternalDataScope();
+
+  ExternalDataScope(const ExternalDataScope &) = delete;
+  ExternalDataScope &operator=(const ExternalDataScope &) = delete;
+
+ private:
+  ExternalDataStore *previous;
+};
+
+// The path of the external data file location, relative to base_dir.
+std::string ExternalDataPath(const std::string &base_dir,
+                             const std::string &location);
+
+// Reads where the content of tensor is stored as external data, with length
+// -1 when it extends to the end of the file. Returns false if tensor is not
+// stored as external data or has no location.
+bool GetExternalData(const TensorProto &tensor, std::string *location,
+                     size_t *offset, int64_t *length);
+
+// Makes tensor refer to length bytes at offset of the external data file
+// location, dropping its raw data.
+void SetExternalData(TensorProto *tensor, const std::string &location,
+                     size_t offset, size_t length);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,145 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "onnx/common/assertions.h"
+
+#include "onnxoptimizer/initializer_index.h"
+
+#include "onnxoptimizer/external_data.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+typedef std::unordered_map<const Graph*, std::unique_ptr<InitializerIndex>>
+    InitializerIndexMap;
+
+thread_local InitializerIndexMap* active_indices = nullptr;
+
+} // namespace
+
+InitializerIndex::InitializerIndex(Graph& graph) : graph(graph) {
+  rebuild();
+}
+
+void InitializerIndex::rebuild() {
+  positions.clear();
+  const auto& names = graph.initializer_names();
+  for (size_t i = 0; i < names.size(); ++i) {
+    // Graph::getInitializer returns the first of duplicated names.
+    positions.emplace(names[i], i);
+  }
+  num_indexed = names.size();
+}
+
+void InitializerIndex::reindexFrom(size_t first_position) {
+  const auto& names = graph.initializer_names();
+  for (size_t i = first_position; i < names.size(); ++i) {
+    auto entry = positions.find(names[i]);
+    if (entry != positions.end() && entry->second >= first_position) {
+      positions.erase(entry);
+    }
+  }
+  for (size_t i = first_position; i < names.size(); ++i) {
+    positions.emplace(names[i], i);
+  }
+  num_indexed = names.size();
+}
+
+std::vector<Tensor>::const_iterator InitializerIndex::find(
+    const std::string& name) {
+  const auto& names = graph.initializer_names();
+  if (names.size() != num_indexed) {
+    rebuild();
+  }
+  auto entry = positions.find(name);
+  if (entry == positions.end()) {
+    return end();
+  }
+  if (entry->second >= names.size() || names[entry->second] != name) {
+    rebuild();
+    return find(name);
+  }
+  auto initializer = graph.initializers().begin() + entry->second;
+  ExternalDataStore* external_data = ExternalDataStore::active();
+  if (external_data != nullptr && !external_data->load(*initializer)) {
+    return end();
+  }
+  return initializer;
+}
+
+Value* InitializerIndex::addInitializerAndInput(const Tensor& initializer) {
+  Value* value = graph.addInitializerAndInput(initializer);
+  indexAdded();
+  return value;
+}
+
+Value* InitializerIndex::addInitializerAndInput(
+    const Tensor& initializer,
+    const std::string& name) {
+  Value* value = graph.addInitializerAndInput(initializer, name);
+  indexAdded();
+  return value;
+}
+
+void InitializerIndex::indexAdded() {
+  const auto& names = graph.initializer_names();
+  positions.emplace(names.back(), names.size() - 1);
+  num_indexed = names.size();
+}
+
+void InitializerIndex::eraseInitializerAndInput(Value* value) {
+  const std::string name = value->uniqueName();
+  auto entry = positions.find(name);
+  const size_t first_position =
+      entry == positions.end() ? 0 : entry->second;
+  graph.eraseInitializerAndInput(value);
+  if (entry != positions.end()) {
+    positions.erase(entry);
+  }
+  reindexFrom(first_position);
+}
+
+void InitializerIndex::eraseInitializer(const std::string& name) {
+  // name may be owned by the initializer being erased.
+  const std::string erased_name = name;
+  auto entry = positions.find(erased_name);
+  const size_t first_position =
+      entry == positions.end() ? 0 : entry->second;
+  graph.eraseInitializer(erased_name);
+  if (entry != positions.end()) {
+    positions.erase(entry);
+  }
+  reindexFrom(first_position);
+}
+
+InitializerIndex& InitializerIndex::get(const Graph& graph) {
+  ONNX_ASSERTM(
+      active_indices != nullptr,
+      "InitializerIndex::get requires an active InitializerIndexScope");
+  std::unique_ptr<InitializerIndex>& index = (*active_indices)[&graph];
+  if (!index) {
+    // this hack is due to the Graph accessors lacking const versions
+    index.reset(new InitializerIndex(const_cast<Graph&>(graph)));
+  }
+  return *index;
+}
+
+InitializerIndexScope::InitializerIndexScope()
+    : outermost(active_indices == nullptr) {
+  if (outermost) {
+    active_indices = new InitializerIndexMap();
+  }
+}
+
+InitializerIndexScope::~InitializerIndexScope() {
+  if (outermost) {
+    delete active_indices;
+    active_indices = nullptr;
+  }
+}
+
+} // namespace optimization
+} // namespace ONNX_NAMESPACE
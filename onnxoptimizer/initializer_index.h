@@ -0,0 +1,75 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "onnx/common/ir.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// Looks up the initializers of a graph by name in constant time, where
+// Graph::getInitializer scans all of them. The index only stays accurate if
+// initializers are added and erased through it while it is in use.
+class InitializerIndex {
+ public:
+  explicit InitializerIndex(Graph &graph);
+
+  // Same contract as Graph::getInitializer, end() is returned when the graph
+  // has no initializer with that name. Initializers stored as external data
+  // are loaded on their first lookup, end() is returned if that fails.
+  std::vector<Tensor>::const_iterator find(const std::string &name);
+  std::vector<Tensor>::const_iterator end() const {
+    return graph.initializers().end();
+  }
+
+  Value *addInitializerAndInput(const Tensor &initializer);
+  Value *addInitializerAndInput(const Tensor &initializer,
+                                const std::string &name);
+  void eraseInitializerAndInput(Value *value);
+  void eraseInitializer(const std::string &name);
+
+  // The index of graph shared by all passes run on the current thread. Only
+  // available while an InitializerIndexScope is alive.
+  static InitializerIndex &get(const Graph &graph);
+
+ private:
+  void rebuild();
+  void indexAdded();
+  // Recomputes the positions from first_position on, after an erase shifted
+  // them.
+  void reindexFrom(size_t first_position);
+
+  Graph &graph;
+  // Number of initializers when the index was last updated, to notice the
+  // graph being changed behind its back.
+  size_t num_indexed;
+  std::unordered_map<std::string, size_t> positions;
+};
+
+// Keeps one InitializerIndex per graph for InitializerIndex::get on the
+// current thread. Nested scopes share the indices of the outermost one,
+// which drops them when it goes away.
+class InitializerIndexScope {
+ public:
+  explicit InitializerIndexScope();
+  ~InitializerIndexScope();
+
+  InitializerIndexScope(const InitializerIndexScope &) = delete;
+  InitializerIndexScope &operator=(const InitializerIndexScope &) = delete;
+
+ private:
+  bool outermost;
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
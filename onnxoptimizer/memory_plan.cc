@@ -0,0 +1,295 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#include "onnxoptimizer/memory_plan.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <unordered_set>
+
+#include "onnxoptimizer/tensor_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+// The values of the innermost DimParamsScope of the current thread.
+thread_local const std::unordered_map<std::string, int64_t>*
+    active_dim_params = nullptr;
+
+std::string trim(const std::string& text) {
+  const size_t begin = text.find_first_not_of(" \t");
+  if (begin == std::string::npos) {
+    return std::string();
+  }
+  return text.substr(begin, text.find_last_not_of(" \t") + 1 - begin);
+}
+
+// Adds the names of the values of enclosing graphs that the nodes of graph
+// and of its subgraphs read to names.
+void addCapturedNames(const Graph& graph,
+                      std::unordered_set<std::string>* names) {
+  for (const Node* n : graph.nodes()) {
+    if (n->kind() == kCaptured) {
+      names->insert(n->output()->uniqueName());
+    }
+    for (Symbol name : n->attributeNames()) {
+      if (n->kindOf(name) == AttributeKind::g) {
+        addCapturedNames(*n->g(name), names);
+      } else if (n->kindOf(name) == AttributeKind::gs) {
+        for (const std::shared_ptr<Graph>& subgraph : n->gs(name)) {
+          addCapturedNames(*subgraph, names);
+        }
+      }
+    }
+  }
+}
+
+// The size in bytes of value, false if it isn't known or doesn't fit into
+// an int64_t.
+bool valueBytes(const Value* value,
+                const std::unordered_map<std::string, int64_t>& dim_params,
+                int64_t* bytes) {
+  const size_t element_size = ElementSize(value->elemType());
+  if (element_size == 0 || !value->has_sizes()) {
+    return false;
+  }
+  const int64_t max = std::numeric_limits<int64_t>::max();
+  int64_t count = 1;
+  for (const Dimension& dim : value->sizes()) {
+    int64_t size = 0;
+    if (dim.is_int) {
+      size = dim.dim;
+    } else if (!dim.is_unknown && dim_params.count(dim.param) != 0) {
+      size = dim_params.at(dim.param);
+    } else {
+      return false;
+    }
+    if (size < 0 || (size != 0 && count > max / size)) {
+      return false;
+    }
+    count *= size;
+  }
+  if (count > max / static_cast<int64_t>(element_size)) {
+    return false;
+  }
+  *bytes = count * static_cast<int64_t>(element_size);
+  return true;
+}
+
+int64_t alignUp(int64_t bytes, int64_t alignment) {
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+bool overlap(const MemoryPlanBuffer& a, const MemoryPlanBuffer& b) {
+  return a.first_node <= b.last_node && b.first_node <= a.last_node;
+}
+
+void appendJsonString(const std::string& value, std::string* json) {
+  json->push_back('"');
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      json->push_back('\\');
+      json->push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      json->append(escaped);
+    } else {
+      json->push_back(c);
+    }
+  }
+  json->push_back('"');
+}
+
+}  // namespace
+
+MemoryPlan PlanMemory(
+    const Graph& graph, int64_t alignment,
+    const std::unordered_map<std::string, int64_t>& dim_params) {
+  MemoryPlan plan;
+  plan.alignment = std::max<int64_t>(alignment, 1);
+  std::unordered_map<const Value*, size_t> buffer_indices;
+  size_t num_nodes = 0;
+  for (const Node* n : graph.nodes()) {
+    // These aren't exported, the indices are the ones of the model nodes
+    if (n->kind() == kUndefined || n->kind() == kCaptured) {
+      continue;
+    }
+    const size_t node_index = num_nodes++;
+    for (const Value* input : n->inputs()) {
+      const auto it = buffer_indices.find(input);
+      if (it != buffer_indices.end()) {
+        plan.buffers[it->second].last_node = node_index;
+      }
+    }
+    std::unordered_set<std::string> captured;
+    for (Symbol name : n->attributeNames()) {
+      if (n->kindOf(name) == AttributeKind::g) {
+        addCapturedNames(*n->g(name), &captured);
+      } else if (n->kindOf(name) == AttributeKind::gs) {
+        for (const std::shared_ptr<Graph>& subgraph : n->gs(name)) {
+          addCapturedNames(*subgraph, &captured);
+        }
+      }
+    }
+    if (!captured.empty()) {
+      for (MemoryPlanBuffer& buffer : plan.buffers) {
+        if (captured.count(buffer.name) != 0) {
+          buffer.last_node = node_index;
+        }
+      }
+    }
+    if (n->kind() == kConstant) {
+      continue;
+    }
+    for (const Value* output : n->outputs()) {
+      MemoryPlanBuffer buffer;
+      if (!valueBytes(output, dim_params, &buffer.size)) {
+        plan.unplanned.push_back(output->uniqueName());
+        continue;
+      }
+      buffer.name = output->uniqueName();
+      buffer.first_node = node_index;
+      buffer.last_node = node_index;
+      buffer_indices.emplace(output, plan.buffers.size());
+      plan.buffers.push_back(std::move(buffer));
+    }
+  }
+  for (const Value* output : graph.outputs()) {
+    const auto it = buffer_indices.find(output);
+    if (it != buffer_indices.end()) {
+      plan.buffers[it->second].last_node = num_nodes - 1;
+    }
+  }
+
+  // Places the largest buffers first, below the ones placed already that
+  // are alive at the same time, in the first gap which is large enough.
+  std::vector<size_t> order(plan.buffers.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&plan](size_t a, size_t b) {
+    return plan.buffers[a].size > plan.buffers[b].size;
+  });
+  std::vector<size_t> placed;
+  std::vector<std::pair<int64_t, int64_t>> taken;
+  for (size_t i : order) {
+    MemoryPlanBuffer& buffer = plan.buffers[i];
+    const int64_t size = alignUp(buffer.size, plan.alignment);
+    taken.clear();
+    for (size_t j : placed) {
+      const MemoryPlanBuffer& other = plan.buffers[j];
+      if (overlap(buffer, other)) {
+        taken.emplace_back(other.offset,
+                           other.offset + alignUp(other.size, plan.alignment));
+      }
+    }
+    std::sort(taken.begin(), taken.end());
+    int64_t offset = 0;
+    for (const auto& range : taken) {
+      if (offset + size <= range.first) {
+        break;
+      }
+      offset = std::max(offset, range.second);
+    }
+    buffer.offset = offset;
+    plan.arena_bytes = std::max(plan.arena_bytes, offset + size);
+    placed.push_back(i);
+  }
+
+  std::vector<int64_t> live_bytes(num_nodes + 1, 0);
+  for (const MemoryPlanBuffer& buffer : plan.buffers) {
+    live_bytes[buffer.first_node] += alignUp(buffer.size, plan.alignment);
+    live_bytes[buffer.last_node + 1] -= alignUp(buffer.size, plan.alignment);
+  }
+  int64_t bytes = 0;
+  for (int64_t change : live_bytes) {
+    bytes += change;
+    plan.peak_bytes = std::max(plan.peak_bytes, bytes);
+  }
+  return plan;
+}
+
+std::string MemoryPlanToJson(const MemoryPlan& plan) {
+  std::string json = "{\"alignment\": " + std::to_string(plan.alignment) +
+                     ", \"arena_bytes\": " + std::to_string(plan.arena_bytes) +
+                     ", \"peak_bytes\": " + std::to_string(plan.peak_bytes) +
+                     ", \"buffers\": [";
+  for (size_t i = 0; i < plan.buffers.size(); ++i) {
+    const MemoryPlanBuffer& buffer = plan.buffers[i];
+    json += i == 0 ? "{\"name\": " : ", {\"name\": ";
+    appendJsonString(buffer.name, &json);
+    json += ", \"offset\": " + std::to_string(buffer.offset) +
+            ", \"size\": " + std::to_string(buffer.size) +
+            ", \"first_node\": " + std::to_string(buffer.first_node) +
+            ", \"last_node\": " + std::to_string(buffer.last_node) + "}";
+  }
+  json += "], \"unplanned\": [";
+  for (size_t i = 0; i < plan.unplanned.size(); ++i) {
+    if (i != 0) {
+      json += ", ";
+    }
+    appendJsonString(plan.unplanned[i], &json);
+  }
+  json += "]}";
+  return json;
+}
+
+bool ParseDimParams(
+    const std::string& text,
+    std::unordered_map<std::string, int64_t>* dim_params) {
+  size_t begin = 0;
+  while (begin <= text.size()) {
+    size_t end = text.find(',', begin);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    const std::string item = text.substr(begin, end - begin);
+    begin = end + 1;
+    if (trim(item).empty() && end == text.size()) {
+      break;
+    }
+    const size_t separator = item.find('=');
+    if (separator == std::string::npos) {
+      return false;
+    }
+    const std::string name = trim(item.substr(0, separator));
+    const std::string value = trim(item.substr(separator + 1));
+    char* value_end = nullptr;
+    errno = 0;
+    const long long dim = std::strtoll(value.c_str(), &value_end, 10);
+    if (name.empty() || value.empty() || *value_end != '\0' ||
+        errno == ERANGE || dim < 0) {
+      return false;
+    }
+    (*dim_params)[name] = static_cast<int64_t>(dim);
+  }
+  return true;
+}
+
+DimParamsScope::DimParamsScope(
+    const std::unordered_map<std::string, int64_t>* dim_params)
+    : previous(active_dim_params) {
+  active_dim_params = dim_params;
+}
+
+DimParamsScope::~DimParamsScope() {
+  active_dim_params = previous;
+}
+
+const std::unordered_map<std::string, int64_t>& DimParamsScope::active() {
+  static const std::unordered_map<std::string, int64_t> none;
+  return active_dim_params == nullptr ? none : *active_dim_params;
+}
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
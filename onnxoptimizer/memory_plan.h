@@ -0,0 +1,93 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "onnx/common/ir.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// A tensor computed by a node of the graph, placed in the arena.
+struct MemoryPlanBuffer {
+  std::string name;
+  // Offset into the arena, a multiple of the alignment of the plan.
+  int64_t offset = 0;
+  // Size in bytes, not rounded up to the alignment.
+  int64_t size = 0;
+  // Indices of the node computing the tensor and of the last node reading
+  // it, in the order of the nodes of the exported graph. Graph outputs are
+  // read by the last node.
+  size_t first_node = 0;
+  size_t last_node = 0;
+};
+
+// Where the tensors computed while running the graph live in a single arena,
+// which tensors whose lifetimes don't overlap share.
+struct MemoryPlan {
+  int64_t alignment = 0;
+  // Buffers in the order the nodes compute them.
+  std::vector<MemoryPlanBuffer> buffers;
+  // Tensors whose size isn't known, which have to be allocated at runtime.
+  std::vector<std::string> unplanned;
+  // Size of the arena, at least peak_bytes.
+  int64_t arena_bytes = 0;
+  // Most bytes that the buffers alive at once take, each rounded up to the
+  // alignment, i.e. the smallest arena any plan could do with.
+  int64_t peak_bytes = 0;
+};
+
+// Plans the memory of the tensors that the nodes of graph compute, from
+// their elem types and shapes. Graph inputs, initializers and Constant
+// nodes are not planned, nor are the values of subgraphs, whose reads of
+// the values of graph count as reads by the node holding the subgraph. Dims
+// are static or dim_params given a value in dim_params, tensors with other
+// dims or unknown types are unplanned. Buffers are placed from the largest
+// to the smallest at the lowest aligned offset free during their lifetime.
+MemoryPlan PlanMemory(
+    const Graph &graph, int64_t alignment = 64,
+    const std::unordered_map<std::string, int64_t> &dim_params = {});
+
+// Reads the values of dim_params from text, a comma separated list of
+// name=value such as "batch=8,seq=128". Returns false if text is malformed
+// or a value is negative.
+bool ParseDimParams(const std::string &text,
+                    std::unordered_map<std::string, int64_t> *dim_params);
+
+// Makes dim_params the values that plan_activation_memory gives to the
+// dim_params of the graphs it plans on the current thread, for as long as
+// the scope is alive.
+class DimParamsScope {
+ public:
+  explicit DimParamsScope(
+      const std::unordered_map<std::string, int64_t> *dim_params);
+  ~DimParamsScope();
+
+  DimParamsScope(const DimParamsScope &) = delete;
+  DimParamsScope &operator=(const DimParamsScope &) = delete;
+
+  // The values of the innermost scope of the current thread, none outside
+  // of any scope.
+  static const std::unordered_map<std::string, int64_t> &active();
+
+ private:
+  const std::unordered_map<std::string, int64_t> *previous;
+};
+
+// The plan as a JSON object with "alignment", "arena_bytes", "peak_bytes",
+// "buffers", a list of objects with the fields of MemoryPlanBuffer, and
+// "unplanned", a list of names.
+std::string MemoryPlanToJson(const MemoryPlan &plan);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,219 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "onnxoptimizer/model_writer.h"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
+#include "onnxoptimizer/external_data.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+using google::protobuf::io::CodedOutputStream;
+
+const uint32_t kLengthDelimited = 2;
+
+uint32_t lengthDelimitedTag(int field_number) {
+  return (static_cast<uint32_t>(field_number) << 3) | kLengthDelimited;
+}
+
+// Bytes taken by a length-delimited field holding size bytes.
+size_t fieldSize(int field_number, size_t size) {
+  return CodedOutputStream::VarintSize32(lengthDelimitedTag(field_number)) +
+         CodedOutputStream::VarintSize64(size) + size;
+}
+
+void writeFieldHeader(CodedOutputStream *output, int field_number,
+                      size_t size) {
+  output->WriteTag(lengthDelimitedTag(field_number));
+  output->WriteVarint64(size);
+}
+
+std::string directoryOf(const std::string &path) {
+  const auto separator = path.find_last_of("/\\");
+  return separator == std::string::npos ? std::string()
+                                        : path.substr(0, separator + 1);
+}
+
+std::string fileNameOf(const std::string &path) {
+  const auto separator = path.find_last_of("/\\");
+  return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+// Whether both paths name the same existing file or directory.
+bool sameFile(const std::string &a, const std::string &b) {
+#ifndef _WIN32
+  struct stat a_stat, b_stat;
+  return stat(a.c_str(), &a_stat) == 0 && stat(b.c_str(), &b_stat) == 0 &&
+         a_stat.st_dev == b_stat.st_dev && a_stat.st_ino == b_stat.st_ino;
+#else
+  return a == b;
+#endif
+}
+
+// Turns initializer into a reference to length bytes at offset of location,
+// handing its raw data over to data.
+void makeExternal(TensorProto *initializer, const std::string &location,
+                  size_t offset, std::string *data) {
+  data->swap(*initializer->mutable_raw_data());
+  SetExternalData(initializer, location, offset, data->size());
+}
+
+}  // namespace
+
+bool WriteModel(ModelProto &&model, const std::string &path,
+                const ModelWriterOptions &options) {
+  std::unique_ptr<GraphProto> graph(model.release_graph());
+  google::protobuf::RepeatedPtrField<TensorProto> initializers;
+  if (graph) {
+    initializers.Swap(graph->mutable_initializer());
+  }
+
+  // Spilled and copied initializers are turned into external references up
+  // front, as the size of the graph has to be known before any of it is
+  // written.
+  const std::string location = options.external_data_location.empty()
+                                   ? fileNameOf(path) + ".data"
+                                   : options.external_data_location;
+  const std::string data_path = directoryOf(path) + location;
+  const bool copy_external =
+      !sameFile(directoryOf(path).empty() ? "." : directoryOf(path),
+                options.external_data_dir.empty() ? "."
+                                                  : options.external_data_dir);
+  std::vector<std::string> spilled_data(initializers.size());
+  // Copied external data, which points into the mapped source files.
+  std::vector<std::pair<const char *, size_t>> copied_data(
+      initializers.size(), std::pair<const char *, size_t>(nullptr, 0));
+  std::unordered_map<std::string, std::unique_ptr<MappedFile>> sources;
+  std::string overwritten;
+  bool has_spilled = false;
+  size_t offset = 0;
+  for (int i = 0; i < initializers.size(); ++i) {
+    TensorProto *initializer = initializers.Mutable(i);
+    std::string source_location;
+    size_t source_offset = 0;
+    int64_t length = -1;
+    if (GetExternalData(*initializer, &source_location, &source_offset,
+                        &length)) {
+      const std::string source_path =
+          ExternalDataPath(options.external_data_dir, source_location);
+      if (sameFile(source_path, data_path)) {
+        overwritten = source_path;
+      }
+      if (!copy_external) {
+        continue;
+      }
+      std::unique_ptr<MappedFile> &source = sources[source_path];
+      if (!source) {
+        source.reset(new MappedFile(source_path));
+      }
+      if (!source->valid() || source_offset > source->size() ||
+          (length >= 0 &&
+           static_cast<size_t>(length) > source->size() - source_offset)) {
+        std::cerr << "onnx optimizer is unable to read external data "
+                  << source_path << std::endl;
+        return false;
+      }
+      const size_t size = length >= 0 ? static_cast<size_t>(length)
+                                       : source->size() - source_offset;
+      copied_data[i] = std::make_pair(source->data() + source_offset, size);
+      SetExternalData(initializer, location, offset, size);
+      offset += size;
+      has_spilled = true;
+      continue;
+    }
+    if (options.external_data_threshold == 0 ||
+        !initializer->has_raw_data() ||
+        initializer->raw_data().size() < options.external_data_threshold) {
+      continue;
+    }
+    makeExternal(initializer, location, offset, &spilled_data[i]);
+    offset += spilled_data[i].size();
+    has_spilled = true;
+  }
+  if (has_spilled && !overwritten.empty()) {
+    std::cerr << "onnx optimizer refuses to overwrite " << overwritten
+              << ", which holds external data of the model" << std::endl;
+    return false;
+  }
+
+  std::ofstream data_file;
+  if (has_spilled) {
+    data_file.open(data_path,
+                   std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!data_file) {
+      return false;
+    }
+  }
+  std::ofstream model_file(path, std::ios::binary | std::ios::out |
+                                     std::ios::trunc);
+  if (!model_file) {
+    return false;
+  }
+
+  {
+    google::protobuf::io::OstreamOutputStream model_stream(&model_file);
+    CodedOutputStream output(&model_stream);
+    // Fields may come in any order, so the graph is written after the rest
+    // of the model, and its initializers after the rest of the graph.
+    if (!model.SerializePartialToCodedStream(&output)) {
+      return false;
+    }
+    if (graph) {
+      size_t graph_size = graph->ByteSizeLong();
+      for (const auto &initializer : initializers) {
+        graph_size += fieldSize(GraphProto::kInitializerFieldNumber,
+                                initializer.ByteSizeLong());
+      }
+      writeFieldHeader(&output, ModelProto::kGraphFieldNumber, graph_size);
+      if (!graph->SerializePartialToCodedStream(&output)) {
+        return false;
+      }
+      graph.reset();
+      for (int i = 0; i < initializers.size(); ++i) {
+        TensorProto *initializer = initializers.Mutable(i);
+        std::string &data = spilled_data[i];
+        if (!data.empty() && !data_file.write(data.data(), data.size())) {
+          return false;
+        }
+        std::string().swap(data);
+        const auto &copied = copied_data[i];
+        if (copied.second > 0 &&
+            !data_file.write(copied.first, copied.second)) {
+          return false;
+        }
+        writeFieldHeader(&output, GraphProto::kInitializerFieldNumber,
+                         initializer->ByteSizeLong());
+        if (!initializer->SerializePartialToCodedStream(&output)) {
+          return false;
+        }
+        // Releases the content of the tensor now that it is written.
+        TensorProto().Swap(initializer);
+      }
+    }
+    if (output.HadError()) {
+      return false;
+    }
+  }
+  return static_cast<bool>(model_file.flush()) &&
+         (!has_spilled || static_cast<bool>(data_file.flush()));
+}
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
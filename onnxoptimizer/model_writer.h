@@ -0,0 +1,43 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <string>
+
+#include "onnx/onnx_pb.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct ModelWriterOptions {
+  // Initializers whose raw data holds at least this many bytes are written
+  // to external_data_location instead of the model file. 0 disables it.
+  size_t external_data_threshold = 0;
+  // Data file of spilled initializers, relative to the directory of the
+  // model file. Defaults to the model file name followed by ".data".
+  std::string external_data_location;
+  // Directory the locations of the external data model already refers to
+  // are relative to, usually the one of the model it was optimized from.
+  // When it is not the directory of the model file, that data is copied to
+  // external_data_location so that the written model stays valid.
+  std::string external_data_dir;
+};
+
+// Writes model to path one graph element at a time, instead of serializing
+// it as a whole, releasing the content of every initializer once it is
+// written. Together with spilling large initializers to external data, this
+// bounds the memory the writer needs by the largest tensor, and lets models
+// past the 2GB protobuf limit be saved. model is left without a graph.
+// Returns false if a file can't be written, or if writing the data file
+// would overwrite external data that model still refers to, e.g. when the
+// model is written in place.
+bool WriteModel(ModelProto &&model, const std::string &path,
+                const ModelWriterOptions &options = ModelWriterOptions());
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -7,6 +7,11 @@
 
 #include "onnxoptimizer/optimize.h"
 
+#include <fstream>
+#include <stdexcept>
+
+#include "onnxoptimizer/parallel.h"
+
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
@@ -14,33 +19,205 @@ GlobalPassRegistry Optimizer::passes;
 
 Optimizer::Optimizer(
     const std::vector<std::string>& names,
-    const bool fixed_point) {
-  if (fixed_point) {
-    this->pass_manager =
-        std::shared_ptr<FixedPointPassManager>(new FixedPointPassManager());
-  } else {
-    this->pass_manager =
-        std::shared_ptr<GeneralPassManager>(new GeneralPassManager());
-  }
+    const bool fixed_point,
+    const std::string& external_data_dir,
+    bool propagate_shapes)
+    : names(names),
+      fixed_point(fixed_point),
+      external_data_dir(external_data_dir),
+      propagate_shapes(propagate_shapes) {
+  // Fails on unknown pass names here rather than in optimize.
   for (const auto& name : names) {
-    auto pass = passes.find(name);
-    this->pass_manager->add(pass);
+    passes.find(name);
+  }
+  // The memory plan only holds for the graph that no pass changes anymore
+  for (size_t i = 0; i + 1 < names.size(); ++i) {
+    ONNX_ASSERTM(names[i] != "plan_activation_memory",
+                 "plan_activation_memory must be the last pass.");
   }
 }
 Optimizer::~Optimizer() {}
 
+std::shared_ptr<PassManager> Optimizer::createPassManager(
+    bool collect_statistics) const {
+  // Exported models often come without value_info, the passes matching
+  // shapes need them inferred unless the caller opted out.
+  std::shared_ptr<PassManager> pass_manager;
+  if (this->fixed_point) {
+    pass_manager =
+        std::shared_ptr<FixedPointPassManager>(new FixedPointPassManager(
+            true, true, this->propagate_shapes, collect_statistics));
+  } else {
+    pass_manager = std::shared_ptr<GeneralPassManager>(new GeneralPassManager(
+        false, this->propagate_shapes, collect_statistics));
+  }
+  for (const auto& name : this->names) {
+    pass_manager->add(passes.find(name));
+  }
+  return pass_manager;
+}
+
+void Optimizer::AddAnalysesToMetadata(
+    const PassStatisticsAnalysis& analysis,
+    ModelProto* model) {
+  const MemoryPlanAnalysis* memory_plan = nullptr;
+  for (const PassStatistics& pass : analysis.passes) {
+    const auto* pass_memory_plan =
+        dynamic_cast<const MemoryPlanAnalysis*>(pass.analysis.get());
+    if (pass_memory_plan != nullptr) {
+      memory_plan = pass_memory_plan;
+    }
+  }
+  // A plan the input model carried doesn't hold for the optimized one.
+  const std::string key = "onnxoptimizer.memory_plan";
+  auto* properties = model->mutable_metadata_props();
+  for (int i = properties->size() - 1; i >= 0; --i) {
+    if (properties->Get(i).key() == key) {
+      properties->DeleteSubrange(i, 1);
+    }
+  }
+  if (memory_plan != nullptr) {
+    StringStringEntryProto* entry = model->add_metadata_props();
+    entry->set_key(key);
+    entry->set_value(MemoryPlanToJson(memory_plan->plan));
+  }
+}
+
+std::unordered_map<std::string, int64_t> Optimizer::ReadDimParams(
+    const ModelProto& model) {
+  std::unordered_map<std::string, int64_t> dim_params;
+  for (const auto& property : model.metadata_props()) {
+    if (property.key() != "onnxoptimizer.dim_params") {
+      continue;
+    }
+    if (!ParseDimParams(property.value(), &dim_params)) {
+      std::cerr << "Warning: onnx optimizer ignores the malformed "
+                << "onnxoptimizer.dim_params " << property.value()
+                << std::endl;
+      dim_params.clear();
+    }
+  }
+  return dim_params;
+}
+
+Optimizer::RawDataMap Optimizer::MoveOutRawData(GraphProto* graph) {
+  RawDataMap raw_data;
+  for (auto& initializer : *graph->mutable_initializer()) {
+    if (!initializer.has_raw_data()) {
+      continue;
+    }
+    auto entry = raw_data.emplace(initializer.name(), std::string());
+    if (entry.second) {
+      entry.first->second.swap(*initializer.mutable_raw_data());
+    }
+  }
+  return raw_data;
+}
+
+Optimizer::RawDataMap Optimizer::MoveOutRawData(Graph* graph) {
+  RawDataMap raw_data;
+  for (const Tensor& initializer : graph->initializers()) {
+    if (!initializer.is_raw_data()) {
+      continue;
+    }
+    auto entry = raw_data.emplace(initializer.name(), std::string());
+    if (entry.second) {
+      // this hack is due to Graph lacking mutable access to initializers
+      entry.first->second.swap(const_cast<std::string&>(initializer.raw()));
+    }
+  }
+  return raw_data;
+}
+
+void Optimizer::MoveInRawData(GraphProto* graph, RawDataMap* raw_data) {
+  for (auto& initializer : *graph->mutable_initializer()) {
+    auto entry = raw_data->find(initializer.name());
+    if (entry != raw_data->end() && initializer.has_raw_data()) {
+      initializer.mutable_raw_data()->swap(entry->second);
+      raw_data->erase(entry);
+    }
+  }
+}
+
+void Optimizer::MoveInRawData(Graph* graph, RawDataMap* raw_data) {
+  for (const Tensor& initializer : graph->initializers()) {
+    auto entry = raw_data->find(initializer.name());
+    if (entry != raw_data->end() && initializer.is_raw_data()) {
+      // this hack is due to Graph lacking mutable access to initializers
+      const_cast<Tensor&>(initializer).set_raw_data(std::move(entry->second));
+      raw_data->erase(entry);
+    }
+  }
+}
+
 ModelProto Optimize(
     const ModelProto& mp_in,
     const std::vector<std::string>& names) {
   Optimizer current_opt(names, false);
   return current_opt.optimize(mp_in);
 }
+ModelProto Optimize(
+    ModelProto&& mp_in,
+    const std::vector<std::string>& names,
+    PassStatisticsAnalysis* statistics,
+    bool propagate_shapes) {
+  Optimizer current_opt(names, false, "", propagate_shapes);
+  return current_opt.optimize(std::move(mp_in), statistics);
+}
 ModelProto OptimizeFixed(
     const ModelProto& mp_in,
     const std::vector<std::string>& names) {
   Optimizer current_opt(names, true);
   return current_opt.optimize(mp_in);
 }
+ModelProto OptimizeFixed(
+    ModelProto&& mp_in,
+    const std::vector<std::string>& names,
+    PassStatisticsAnalysis* statistics,
+    bool propagate_shapes) {
+  Optimizer current_opt(names, true, "", propagate_shapes);
+  return current_opt.optimize(std::move(mp_in), statistics);
+}
+void OptimizeFile(
+    const std::string& input_path,
+    const std::string& output_path,
+    const std::vector<std::string>& names,
+    bool fixed_point,
+    const ModelWriterOptions& options,
+    PassStatisticsAnalysis* statistics,
+    bool propagate_shapes) {
+  ModelProto model;
+  {
+    std::ifstream ifs(input_path, std::ios::binary);
+    if (!ifs || !model.ParseFromIstream(&ifs)) {
+      throw std::runtime_error("unable to read model " + input_path);
+    }
+  }
+  const auto separator = input_path.find_last_of("/\\");
+  const std::string input_dir = separator == std::string::npos
+      ? std::string()
+      : input_path.substr(0, separator);
+  Optimizer optimizer(names, fixed_point, input_dir, propagate_shapes);
+  ModelWriterOptions writer_options = options;
+  writer_options.external_data_dir = input_dir;
+  if (!WriteModel(
+          optimizer.optimize(std::move(model), statistics),
+          output_path,
+          writer_options)) {
+    throw std::runtime_error("unable to write model " + output_path);
+  }
+}
+
+void OptimizeBatch(std::vector<OptimizationTask>& tasks, size_t num_threads) {
+  ParallelFor(tasks.size(), num_threads, [&tasks](size_t i) {
+    OptimizationTask& task = tasks[i];
+    Optimizer optimizer(
+        task.names, task.fixed_point, task.external_data_dir,
+        task.propagate_shapes);
+    task.model = optimizer.optimize(std::move(task.model));
+  });
+}
+
 const std::vector<std::string> GetAvailablePasses() {
   return Optimizer::passes.GetAvailablePasses();
 }
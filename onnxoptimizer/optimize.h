@@ -12,63 +12,142 @@
 #include "onnx/common/stl_backports.h"
 #include "onnx/proto_utils.h"
 
+#include "onnxoptimizer/external_data.h"
+#include "onnxoptimizer/memory_plan.h"
+#include "onnxoptimizer/model_writer.h"
 #include "onnxoptimizer/pass_manager.h"
 #include "onnxoptimizer/pass_registry.h"
 
+#include "unordered_map"
+#include "unordered_set"
 #include "vector"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
+// Every call to optimize runs its own instances of the passes, so one
+// Optimizer can optimize several models at once from different threads.
 struct Optimizer {
   static GlobalPassRegistry passes;
 
  public:
-  Optimizer(const std::vector<std::string> &names, const bool fixed_point);
+  // Locations of initializers stored as external data are relative to
+  // external_data_dir, usually the directory of the model file. With
+  // propagate_shapes, the shapes of the graph are inferred before the first
+  // pass and after every pass that changed it, so that the passes matching
+  // shapes find them, which costs time on large models.
+  Optimizer(const std::vector<std::string> &names, const bool fixed_point,
+            const std::string &external_data_dir = "",
+            bool propagate_shapes = true);
   ~Optimizer();
 
-  ModelProto optimize(const ModelProto &mp_in) {
-    ModelProto mp_compatible = AddInitializerToInput(mp_in);
+  ModelProto optimize(const ModelProto &mp_in) const {
+    ModelProto model = mp_in;
+    return optimize(std::move(model));
+  }
+
+  // Takes ownership of the model so that the raw data of its initializers
+  // can be moved, rather than copied, into the IR graph and from there into
+  // the returned model. What every pass did is stored in statistics, unless
+  // it is nullptr.
+  ModelProto optimize(ModelProto &&mp_in,
+                      PassStatisticsAnalysis *statistics = nullptr) const {
+    const int original_input_size = mp_in.graph().input_size();
+    AddInitializerToInput(&mp_in);
     bool has_initializer_not_in_input =
-        (mp_in.graph().input_size() != mp_compatible.graph().input_size());
-    std::shared_ptr<Graph> g(ImportModelProto(mp_compatible));
+        (original_input_size != mp_in.graph().input_size());
+    // External initializers are imported without data, and only loaded when
+    // a pass reads them.
+    ExternalDataStore external_data(this->external_data_dir);
+    external_data.detach(mp_in.mutable_graph());
+    ExternalDataScope external_data_scope(&external_data);
+    RawDataMap raw_data = MoveOutRawData(mp_in.mutable_graph());
+    std::shared_ptr<Graph> g(ImportModelProto(mp_in));
 
     if (g.get() == nullptr) {
       std::cerr << "Warning: onnx optimizer is unable to parse input model. "
                 << "(The IR version of the ONNX model may be too old.)"
                 << std::endl;
       // If we can't parse the file, just return the input.
-      return mp_in;
+      MoveInRawData(mp_in.mutable_graph(), &raw_data);
+      external_data.reattach(mp_in.mutable_graph());
+      mp_in.mutable_graph()->mutable_input()->DeleteSubrange(
+          original_input_size,
+          mp_in.graph().input_size() - original_input_size);
+      return std::move(mp_in);
     }
+    MoveInRawData(g.get(), &raw_data);
+    // Everything the graph proto holds is in the IR graph by now.
+    mp_in.clear_graph();
 
     ModelProto mp_out = PrepareOutput(mp_in);
-    this->pass_manager->run(*g);
+    const std::unordered_map<std::string, int64_t> dim_params =
+        ReadDimParams(mp_in);
+    DimParamsScope dim_params_scope(&dim_params);
+    std::shared_ptr<PassStatisticsAnalysis> analysis =
+        std::static_pointer_cast<PassStatisticsAnalysis>(
+            createPassManager(statistics != nullptr)->run(*g));
+    AddAnalysesToMetadata(*analysis, &mp_out);
+    if (statistics != nullptr) {
+      *statistics = *analysis;
+    }
+    raw_data = MoveOutRawData(g.get());
     ExportModelProto(&mp_out, g);
+    MoveInRawData(mp_out.mutable_graph(), &raw_data);
+    external_data.reattach(mp_out.mutable_graph());
     // `has_initializer_not_in_input` means the original model prefer
     // initializer to be not in input, so the new initializer introduced by
     // both `AddInitializerToInput` and optimization passes will be remove from
     // input
     if (has_initializer_not_in_input) {
       mp_out.mutable_graph()->mutable_input()->DeleteSubrange(
-          mp_in.graph().input_size(),
-          mp_out.graph().input_size() - mp_in.graph().input_size());
+          original_input_size,
+          mp_out.graph().input_size() - original_input_size);
     }
     return mp_out;
   }
 
  private:
-  std::shared_ptr<PassManager> pass_manager;
-
-  ModelProto AddInitializerToInput(const ModelProto &original_model) {
-    ModelProto model = original_model;
-    std::vector<std::string> input_names;
-    for (const auto &x : model.graph().input()) {
-      input_names.push_back(x.name());
+  std::vector<std::string> names;
+  bool fixed_point;
+  std::string external_data_dir;
+  bool propagate_shapes;
+
+  // Without collect_statistics, the pass manager skips the statistics that
+  // cost time to gather.
+  std::shared_ptr<PassManager> createPassManager(
+      bool collect_statistics) const;
+
+  // Stores the analyses that passes returned and that the model can carry,
+  // such as memory plans, in the metadata_props of model, replacing or
+  // removing the ones it carried before.
+  static void AddAnalysesToMetadata(const PassStatisticsAnalysis &analysis,
+                                    ModelProto *model);
+
+  // The values of the dim_params that the "onnxoptimizer.dim_params"
+  // metadata_props entry of model binds, none if it is malformed.
+  static std::unordered_map<std::string, int64_t> ReadDimParams(
+      const ModelProto &model);
+
+  // Raw data of initializers, by initializer name.
+  typedef std::unordered_map<std::string, std::string> RawDataMap;
+
+  // Only the initializers of the main graph are handled by the functions
+  // below, the ones of subgraphs are copied as usual.
+  static RawDataMap MoveOutRawData(GraphProto *graph);
+  static RawDataMap MoveOutRawData(Graph *graph);
+  static void MoveInRawData(GraphProto *graph, RawDataMap *raw_data);
+  static void MoveInRawData(Graph *graph, RawDataMap *raw_data);
+
+  static void AddInitializerToInput(ModelProto *model) {
+    std::unordered_set<std::string> input_names;
+    for (const auto &x : model->graph().input()) {
+      input_names.insert(x.name());
     }
-    for (const auto &x : model.graph().initializer()) {
-      if (std::find(input_names.begin(), input_names.end(), x.name()) ==
-          input_names.end()) {
-        auto *value_info = model.mutable_graph()->add_input();
+    GraphProto *graph = model->mutable_graph();
+    for (const auto &x : graph->initializer()) {
+      if (input_names.count(x.name()) == 0) {
+        auto *value_info = graph->add_input();
         value_info->set_name(x.name());
         TypeProto *type = value_info->mutable_type();
         auto *tensor = type->mutable_tensor_type();
@@ -80,7 +159,6 @@ struct Optimizer {
         }
       }
     }
-    return model;
   }
 };
 
@@ -91,7 +169,45 @@ const std::vector<std::string> GetFuseAndEliminationPass();
 ModelProto Optimize(const ModelProto &mp_in,
                     const std::vector<std::string> &names);
 
+ModelProto Optimize(ModelProto &&mp_in, const std::vector<std::string> &names,
+                    PassStatisticsAnalysis *statistics = nullptr,
+                    bool propagate_shapes = true);
+
 ModelProto OptimizeFixed(const ModelProto &mp_in,
                          const std::vector<std::string> &names);
+
+ModelProto OptimizeFixed(ModelProto &&mp_in,
+                         const std::vector<std::string> &names,
+                         PassStatisticsAnalysis *statistics = nullptr,
+                         bool propagate_shapes = true);
+
+// Optimizes the model stored at input_path and writes the result to
+// output_path. External data of the input is read from its location next to
+// input_path, and still referred to there when output_path is in the same
+// directory, otherwise it is copied to the external data file of the output.
+// Throws std::runtime_error if a file can't be read or written.
+void OptimizeFile(const std::string &input_path,
+                  const std::string &output_path,
+                  const std::vector<std::string> &names, bool fixed_point,
+                  const ModelWriterOptions &options = ModelWriterOptions(),
+                  PassStatisticsAnalysis *statistics = nullptr,
+                  bool propagate_shapes = true);
+
+// A model to optimize with OptimizeBatch, which replaces it with the
+// optimized model.
+struct OptimizationTask {
+  ModelProto model;
+  std::vector<std::string> names;
+  bool fixed_point = false;
+  std::string external_data_dir;
+  bool propagate_shapes = true;
+};
+
+// Optimizes the models of tasks concurrently on num_threads threads, or on
+// as many as the hardware runs at once if it is 0. If optimizing a model
+// throws, the remaining tasks are abandoned and the exception is rethrown
+// once all threads are done.
+void OptimizeBatch(std::vector<OptimizationTask> &tasks,
+                   size_t num_threads = 0);
 }  // namespace optimization
 }  // namespace ONNX_NAMESPACE
@@ -0,0 +1,178 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#include "onnxoptimizer/parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+// Whether the current thread runs the body of a ParallelFor.
+thread_local bool in_parallel_for = false;
+
+class ParallelForScope {
+ public:
+  ParallelForScope() : previous(in_parallel_for) {
+    in_parallel_for = true;
+  }
+  ~ParallelForScope() {
+    in_parallel_for = previous;
+  }
+
+ private:
+  bool previous;
+};
+
+// Threads kept alive between calls to ParallelFor, which hand them the
+// helpers of their loops. The pool is never destroyed, so its threads don't
+// have to be joined while the process exits.
+class ThreadPool {
+ public:
+  static ThreadPool& get() {
+    static ThreadPool* pool = new ThreadPool();
+    return *pool;
+  }
+
+  // Runs task on one of the threads of the pool, starting a thread if fewer
+  // than num_threads are running.
+  void run(std::function<void()> task, size_t num_threads) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (threads.size() < num_threads) {
+      threads.emplace_back([this]() { loop(); });
+      threads.back().detach();
+    }
+    tasks.push_back(std::move(task));
+    task_added.notify_one();
+  }
+
+ private:
+  ThreadPool() = default;
+
+  void loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      task_added.wait(lock, [this]() { return !tasks.empty(); });
+      std::function<void()> task = std::move(tasks.front());
+      tasks.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable task_added;
+  std::deque<std::function<void()>> tasks;
+  std::vector<std::thread> threads;
+};
+
+// What the threads running a ParallelFor share. Helpers of the pool that
+// only start once the calling thread is done find the loop closed and
+// return without touching fn, so the caller never waits for them.
+struct LoopState {
+  LoopState(size_t count, const std::function<void(size_t)>& fn)
+      : count(count), fn(&fn) {}
+
+  void work() {
+    ParallelForScope scope;
+    for (size_t i = next_index++; i < count && !failed; i = next_index++) {
+      try {
+        (*fn)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        failed = true;
+      }
+    }
+  }
+
+  void help() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (closed) {
+        return;
+      }
+      ++num_helping;
+    }
+    work();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--num_helping == 0) {
+      helpers_done.notify_all();
+    }
+  }
+
+  // Waits for the helpers that started, turning away the others.
+  void close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    closed = true;
+    helpers_done.wait(lock, [this]() { return num_helping == 0; });
+  }
+
+  const size_t count;
+  const std::function<void(size_t)>* const fn;
+  std::atomic<size_t> next_index{0};
+  std::atomic<bool> failed{false};
+  std::mutex mutex;
+  std::condition_variable helpers_done;
+  std::exception_ptr error;
+  size_t num_helping = 0;
+  bool closed = false;
+};
+
+} // namespace
+
+size_t DefaultThreadCount() {
+  if (in_parallel_for) {
+    return 1;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void ParallelFor(
+    size_t count,
+    size_t num_threads,
+    const std::function<void(size_t)>& fn) {
+  if (num_threads == 0) {
+    num_threads = DefaultThreadCount();
+  }
+  num_threads = std::min(num_threads, count);
+  if (num_threads <= 1) {
+    // Not worth handing out.
+    ParallelForScope scope;
+    for (size_t i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+  const auto state = std::make_shared<LoopState>(count, fn);
+  for (size_t i = 1; i < num_threads; ++i) {
+    ThreadPool::get().run([state]() { state->help(); }, num_threads - 1);
+  }
+  // The calling thread takes its share of the work too, and may well do all
+  // of it if the pool is busy.
+  state->work();
+  state->close();
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+} // namespace optimization
+} // namespace ONNX_NAMESPACE
@@ -0,0 +1,34 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#include "onnx/onnx_pb.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// Number of threads to use when the caller does not say: as many as the
+// hardware runs at once, but 1 inside ParallelFor, so that nested loops,
+// e.g. the passes of models optimized by OptimizeBatch, don't oversubscribe
+// the machine.
+size_t DefaultThreadCount();
+
+// Calls fn(i) for every i below count on up to num_threads threads, the
+// calling one included, or DefaultThreadCount() threads if num_threads is 0.
+// The other threads come from a pool that lives as long as the process, and
+// the calling thread runs the loop alone when a single thread is asked for.
+// If fn throws, the remaining indices are abandoned and the first exception
+// is rethrown once all threads are done.
+void ParallelFor(size_t count, size_t num_threads,
+                 const std::function<void(size_t)> &fn);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
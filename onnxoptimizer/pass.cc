@@ -2,9 +2,17 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <unordered_set>
+
 #include "onnx/common/assertions.h"
 
 #include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/parallel.h"
+#include "onnxoptimizer/tensor_util.h"
+#include "onnxoptimizer/vector_math.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
@@ -56,12 +64,17 @@ void Pass::DescendOnGraphAttributesUnconstrained(
 
 PredicateBasedPass::~PredicateBasedPass() {}
 
-unsigned int PredicateBasedPass::_runPassInternal(Graph& graph) {
+unsigned int PredicateBasedPass::_runPassInternal(
+    Graph& graph,
+    size_t& num_nodes_visited) {
   unsigned int num_changes = false;
   for (auto it = graph.begin(); it != graph.end(); ++it) {
     auto* n = *it;
     num_changes += this->DescendOnGraphAttributesAndCount(
-        n, [this](Graph& g) { return _runPassInternal(g); });
+        n, [this, &num_nodes_visited](Graph& g) {
+          return _runPassInternal(g, num_nodes_visited);
+        });
+    ++num_nodes_visited;
     if (this->patternMatchPredicate(n)) {
       NodeDestroyType destroy_type = NodeDestroyType::DestroyZero;
       num_changes += this->runTransform(n, graph, destroy_type);
@@ -78,17 +91,435 @@ unsigned int PredicateBasedPass::_runPassInternal(Graph& graph) {
   return num_changes;
 }
 
+static bool isGraphBoundary(const Node* n) {
+  return n->kind() == kParam || n->kind() == kReturn;
+}
+
+unsigned int PredicateBasedPass::_runPassWithWorklist(
+    Graph& graph,
+    size_t& num_nodes_visited) {
+  unsigned int num_changes = 0;
+  // A node is only dereferenced after being found in live_nodes. Since a
+  // transform may only destroy the matched node and the producers of its
+  // inputs, which ONNX_OPTIMIZER_VERIFY_WORKLIST builds check, those are
+  // dropped from live_nodes after each transform and the survivors are found
+  // again through the values still feeding live nodes.
+  std::unordered_set<Node*> live_nodes;
+  std::unordered_set<Node*> queued_nodes;
+  std::deque<Node*> worklist;
+  for (auto* n : graph.nodes()) {
+    live_nodes.insert(n);
+  }
+
+  const auto enqueue = [&](Node* n) {
+    if (queued_nodes.insert(n).second) {
+      worklist.push_back(n);
+    }
+  };
+  // Marks the producers of n's inputs alive, walking into the nodes a
+  // transform has just created in front of n.
+  std::function<void(Node*, bool)> revive_producers = [&](Node* n,
+                                                          bool requeue) {
+    for (Value* input : n->inputs()) {
+      Node* producer = input->node();
+      if (isGraphBoundary(producer)) {
+        continue;
+      }
+      if (live_nodes.insert(producer).second) {
+        revive_producers(producer, requeue);
+      }
+      if (requeue) {
+        enqueue(producer);
+      }
+    }
+  };
+
+  const auto visit = [&](graph_node_list_iterator& it) {
+    Node* n = *it;
+    num_changes += this->DescendOnGraphAttributesAndCount(
+        n, [this, &num_nodes_visited](Graph& g) {
+          return _runPassWithWorklist(g, num_nodes_visited);
+        });
+    ++num_nodes_visited;
+    if (!this->patternMatchPredicate(n)) {
+      return;
+    }
+    std::vector<Node*> producers;
+    std::vector<Node*> consumers;
+    for (Value* input : n->inputs()) {
+      Node* producer = input->node();
+      if (isGraphBoundary(producer)) {
+        continue;
+      }
+      producers.push_back(producer);
+      for (Value* output : producer->outputs()) {
+        for (const auto& use : output->uses()) {
+          consumers.push_back(use.user);
+        }
+      }
+    }
+    for (Value* output : n->outputs()) {
+      for (const auto& use : output->uses()) {
+        consumers.push_back(use.user);
+      }
+    }
+
+    NodeDestroyType destroy_type = NodeDestroyType::DestroyZero;
+    const bool changed = this->runTransform(n, graph, destroy_type);
+    num_changes += changed;
+
+    // Some transforms destroy producers even when reporting no change, so
+    // the liveness bookkeeping is done unconditionally.
+    for (Node* producer : producers) {
+      live_nodes.erase(producer);
+    }
+#ifdef ONNX_OPTIMIZER_VERIFY_WORKLIST
+    // Any other node destroyed by the transform would be dereferenced later
+    // on, so the rule is checked against the nodes left in the graph. This
+    // walks the whole graph after every transform, hence the opt-in.
+    std::unordered_set<Node*> graph_nodes;
+    for (Node* node : graph.nodes()) {
+      graph_nodes.insert(node);
+    }
+    for (Node* node : live_nodes) {
+      ONNX_ASSERTM(
+          graph_nodes.count(node) != 0,
+          "%s destroyed a node besides the matched one and the producers of "
+          "its inputs",
+          this->getPassName().c_str());
+    }
+#endif
+    revive_producers(n, changed);
+    for (Node* consumer : consumers) {
+      if (consumer == n || live_nodes.count(consumer) == 0) {
+        continue;
+      }
+      revive_producers(consumer, changed);
+      if (changed) {
+        enqueue(consumer);
+      }
+    }
+    if (changed && destroy_type == NodeDestroyType::DestroyZero) {
+      enqueue(n);
+    }
+
+    if (destroy_type == NodeDestroyType::DestroyOne) {
+      live_nodes.erase(*it);
+      it.destroyCurrent();
+    }
+    if (destroy_type == NodeDestroyType::DestroyTwo) {
+      live_nodes.erase(*it);
+      it.destroyCurrent();
+      live_nodes.erase(*it);
+      it.destroyCurrent();
+    }
+  };
+
+  // The first sweep visits the nodes in the same order as _runPassInternal,
+  // later ones only visit what the previous transforms touched.
+  for (auto it = graph.begin(); it != graph.end(); ++it) {
+    visit(it);
+  }
+  while (!worklist.empty()) {
+    Node* n = worklist.front();
+    worklist.pop_front();
+    queued_nodes.erase(n);
+    if (live_nodes.count(n) == 0) {
+      continue;
+    }
+    graph_node_list_iterator it(n, kNextDirection);
+    visit(it);
+  }
+  return num_changes;
+}
+
 PassAnalysisType PredicateBasedPass::getPassAnalysisType() const {
   return PassAnalysisType::CountBased;
 }
 
 std::shared_ptr<PostPassAnalysis> PredicateBasedPass::runPass(Graph& graph) {
+  InitializerIndexScope initializer_index_scope;
+  bool initialized_pass = this->initializePass(graph);
+  size_t num_nodes_visited = 0;
+  unsigned int touched_optimizations =
+      this->_runPassInternal(graph, num_nodes_visited);
+  bool finalized_pass = this->finalizePass(graph);
+
+  auto analysis = std::make_shared<CountBasedPassAnalysis>(
+      this, touched_optimizations, initialized_pass, finalized_pass);
+  analysis->num_nodes_visited = num_nodes_visited;
+  return analysis;
+}
+
+std::shared_ptr<PostPassAnalysis> PredicateBasedPass::runPassToFixedPoint(
+    Graph& graph) {
+  InitializerIndexScope initializer_index_scope;
   bool initialized_pass = this->initializePass(graph);
-  unsigned int touched_optimizations = this->_runPassInternal(graph);
+  size_t num_nodes_visited = 0;
+  unsigned int touched_optimizations =
+      this->_runPassWithWorklist(graph, num_nodes_visited);
   bool finalized_pass = this->finalizePass(graph);
 
-  return std::shared_ptr<PostPassAnalysis>(new CountBasedPassAnalysis(
-      this, touched_optimizations, initialized_pass, finalized_pass));
+  auto analysis = std::make_shared<CountBasedPassAnalysis>(
+      this, touched_optimizations, initialized_pass, finalized_pass);
+  analysis->num_nodes_visited = num_nodes_visited;
+  return analysis;
+}
+
+PredicateBasedPassGroup::~PredicateBasedPassGroup() {}
+
+namespace {
+
+// Calls fn, adding the time it took to *seconds unless it is nullptr.
+template <typename Fn>
+auto timed(double* seconds, const Fn& fn) -> decltype(fn()) {
+  if (seconds == nullptr) {
+    return fn();
+  }
+  const auto start = std::chrono::steady_clock::now();
+  auto result = fn();
+  *seconds += std::chrono::duration<double>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  return result;
+}
+
+} // namespace
+
+void PredicateBasedPassGroup::add(std::shared_ptr<PredicateBasedPass> pass) {
+  const size_t index = passes.size();
+  const std::vector<NodeKind> kinds = pass->getMatchedNodeKinds();
+  if (kinds.empty()) {
+    passes_for_any_kind.push_back(index);
+    for (auto& entry : passes_by_kind) {
+      entry.second.push_back(index);
+    }
+  }
+  for (const NodeKind& kind : kinds) {
+    auto entry = passes_by_kind.find(kind);
+    if (entry == passes_by_kind.end()) {
+      entry = passes_by_kind.emplace(kind, passes_for_any_kind).first;
+    }
+    if (entry->second.empty() || entry->second.back() != index) {
+      entry->second.push_back(index);
+    }
+  }
+  passes.push_back(std::move(pass));
+  member_statistics.emplace_back();
+}
+
+std::vector<PredicateBasedPassGroup::MemberStatistics>
+PredicateBasedPassGroup::takeMemberStatistics() {
+  std::vector<MemberStatistics> statistics(passes.size());
+  statistics.swap(member_statistics);
+  return statistics;
+}
+
+std::string PredicateBasedPassGroup::getPassName() const {
+  std::string name;
+  for (const auto& pass : passes) {
+    if (!name.empty()) {
+      name += ",";
+    }
+    name += pass->getPassName();
+  }
+  return name;
+}
+
+void PredicateBasedPassGroup::recordInitializers(
+    const Graph& graph,
+    size_t index) {
+  if (&graph != main_graph) {
+    return;
+  }
+  std::unordered_set<std::string> names;
+  for (const Tensor& initializer : graph.initializers()) {
+    names.insert(initializer.name());
+  }
+  MemberStatistics& statistics = member_statistics[index];
+  for (const std::string& name : names) {
+    statistics.num_initializers_added += initializer_names.count(name) == 0;
+  }
+  for (const std::string& name : initializer_names) {
+    statistics.num_initializers_erased += names.count(name) == 0;
+  }
+  initializer_names.swap(names);
+}
+
+bool PredicateBasedPassGroup::initializePass(Graph& graph) {
+  main_graph = recording ? &graph : nullptr;
+  initializer_names.clear();
+  if (recording) {
+    for (const Tensor& initializer : graph.initializers()) {
+      initializer_names.insert(initializer.name());
+    }
+  }
+  bool initialized = false;
+  for (size_t i = 0; i < passes.size(); ++i) {
+    initialized |=
+        timed(recording ? &member_statistics[i].seconds : nullptr,
+              [&]() { return passes[i]->initializePass(graph); });
+    recordInitializers(graph, i);
+  }
+  return initialized;
+}
+
+bool PredicateBasedPassGroup::finalizePass(Graph& graph) {
+  bool finalized = false;
+  for (size_t i = 0; i < passes.size(); ++i) {
+    finalized |=
+        timed(recording ? &member_statistics[i].seconds : nullptr,
+              [&]() { return passes[i]->finalizePass(graph); });
+    recordInitializers(graph, i);
+  }
+  main_graph = nullptr;
+  initializer_names.clear();
+  return finalized;
+}
+
+const std::vector<size_t>& PredicateBasedPassGroup::candidates(
+    const Node* node) const {
+  auto entry = passes_by_kind.find(node->kind());
+  if (entry == passes_by_kind.end()) {
+    return passes_for_any_kind;
+  }
+  return entry->second;
+}
+
+bool PredicateBasedPassGroup::patternMatchPredicate(Node* node) {
+  num_offered = 0;
+  for (size_t i : candidates(node)) {
+    MemberStatistics& statistics = member_statistics[i];
+    ++num_offered;
+    ++statistics.num_nodes_visited;
+    if (timed(recording ? &statistics.seconds : nullptr,
+              [&]() { return passes[i]->patternMatchPredicate(node); })) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PredicateBasedPassGroup::runTransform(
+    Node* node,
+    Graph& graph,
+    NodeDestroyType& destroy_current) {
+  bool changed = false;
+  const std::vector<size_t>& indices = candidates(node);
+  for (size_t k = 0; k < indices.size(); ++k) {
+    const size_t i = indices[k];
+    MemberStatistics& statistics = member_statistics[i];
+    double* seconds = recording ? &statistics.seconds : nullptr;
+    if (k >= num_offered) {
+      ++statistics.num_nodes_visited;
+    }
+    // An earlier pass may have rewritten the node, so match it again.
+    if (!timed(seconds,
+               [&]() { return passes[i]->patternMatchPredicate(node); })) {
+      continue;
+    }
+    const bool transformed = timed(seconds, [&]() {
+      return passes[i]->runTransform(node, graph, destroy_current);
+    });
+    statistics.num_transforms += transformed;
+    changed |= transformed;
+    recordInitializers(graph, i);
+    if (destroy_current != NodeDestroyType::DestroyZero) {
+      break;
+    }
+  }
+  return changed;
+}
+
+InitializerFoldingPass::~InitializerFoldingPass() {}
+
+namespace {
+
+// A batch of foldings stops growing at this many nodes, or once the
+// initializers they read hold this many bytes, which bounds the memory the
+// initializers computed ahead of their rewrites take.
+const size_t kMaxFoldingBatchNodes = 64;
+const size_t kMaxFoldingBatchBytes = size_t(256) << 20;
+// Batches reading fewer bytes are folded on the calling thread.
+const size_t kMinParallelFoldingBytes = size_t(1) << 20;
+
+} // namespace
+
+void InitializerFoldingPass::foldBatch(Node* node, Graph& graph) {
+  std::vector<PrecomputedFolding*> foldings;
+  size_t num_bytes = 0;
+  for (auto it = node->iterator(); it != graph.end() &&
+       foldings.size() < kMaxFoldingBatchNodes &&
+       num_bytes < kMaxFoldingBatchBytes;
+       ++it) {
+    Node* n = *it;
+    if (precomputed.count(n) != 0 || !this->patternMatchPredicate(n)) {
+      continue;
+    }
+    PrecomputedFolding entry;
+    entry.folding = this->prepareFolding(n, graph, entry.inputs);
+    if (!entry.folding) {
+      continue;
+    }
+    for (Value* input : entry.inputs) {
+      entry.input_names.push_back(input->uniqueName());
+      const Tensor* tensor = getConstantTensor(input, graph);
+      if (tensor != nullptr) {
+        num_bytes += static_cast<size_t>(ElementCount(tensor->sizes())) *
+            ElementSize(tensor->elem_type());
+      }
+    }
+    PrecomputedFolding& stored = precomputed[n];
+    stored = std::move(entry);
+    foldings.push_back(&stored);
+  }
+  const size_t num_threads = num_bytes < kMinParallelFoldingBytes ? 1 : 0;
+  ParallelFor(foldings.size(), num_threads, [&foldings](size_t i) {
+    PrecomputedFolding& folding = *foldings[i];
+    folding.succeeded = folding.folding(folding.initializers);
+    // The tensors it captured may not outlive the next rewrite.
+    folding.folding = nullptr;
+  });
+}
+
+bool InitializerFoldingPass::initializePass(Graph&) {
+  precomputed.clear();
+  return false;
+}
+
+bool InitializerFoldingPass::finalizePass(Graph&) {
+  precomputed.clear();
+  return false;
+}
+
+bool InitializerFoldingPass::foldedInitializers(
+    Node* node,
+    Graph& graph,
+    std::vector<Tensor>& initializers) {
+  std::vector<Value*> inputs;
+  const Folding folding = this->prepareFolding(node, graph, inputs);
+  if (!folding) {
+    return false;
+  }
+  auto entry = precomputed.find(node);
+  if (entry == precomputed.end()) {
+    foldBatch(node, graph);
+    entry = precomputed.find(node);
+  }
+  if (entry != precomputed.end()) {
+    PrecomputedFolding precomputed_folding = std::move(entry->second);
+    precomputed.erase(entry);
+    bool same_inputs = precomputed_folding.inputs == inputs;
+    for (size_t i = 0; same_inputs && i < inputs.size(); ++i) {
+      same_inputs =
+          precomputed_folding.input_names[i] == inputs[i]->uniqueName();
+    }
+    if (same_inputs) {
+      initializers = std::move(precomputed_folding.initializers);
+      return precomputed_folding.succeeded;
+    }
+  }
+  return folding(initializers);
 }
 
 CountBasedPassAnalysis::CountBasedPassAnalysis(
@@ -100,9 +531,242 @@ CountBasedPassAnalysis::CountBasedPassAnalysis(
   this->num_positive_transforms = num_positive_transforms;
   this->initialization_done = initialization_done;
   this->finalization_done = finalization_done;
+  this->num_nodes_visited = 0;
 }
 
 FullGraphBasedPass::~FullGraphBasedPass() {}
 
+const Tensor* getConstantTensor(const Value* value, const Graph& graph) {
+  const Node* producer = value->node();
+  if (producer->kind() == kConstant &&
+      producer->kindOf(kvalue) == AttributeKind::t) {
+    return &producer->t(kvalue);
+  }
+  if (producer->kind() != kParam || value->owningGraph() != &graph) {
+    return nullptr;
+  }
+  InitializerIndex& initializers = InitializerIndex::get(graph);
+  auto it = initializers.find(value->uniqueName());
+  if (it == initializers.end()) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+bool isConstantValue(const Value* value, const Graph& graph) {
+  return getConstantTensor(value, graph) != nullptr;
+}
+
+void destroyDeadNodes(std::vector<Node*> nodes) {
+  bool destroyed = true;
+  while (destroyed) {
+    destroyed = false;
+    for (Node* node : nodes) {
+      if (!node->hasUses() && node->kind() != kParam &&
+          node->kind() != kUndefined) {
+        nodes.erase(std::remove(nodes.begin(), nodes.end(), node), nodes.end());
+        node->destroy();
+        destroyed = true;
+        break;
+      }
+    }
+  }
+}
+
+void removeInputsAndDeadProducers(Node* node) {
+  std::vector<Node*> producers;
+  for (Value* input : node->inputs()) {
+    producers.push_back(input->node());
+  }
+  node->removeAllInputs();
+  destroyDeadNodes(std::move(producers));
+}
+
+void removeInputsAndDeadProducers(
+    Node* node,
+    std::unordered_set<std::string>& dead_values) {
+  for (Value* input : node->inputs()) {
+    dead_values.insert(input->uniqueName());
+    for (Value* producer_input : input->node()->inputs()) {
+      dead_values.insert(producer_input->uniqueName());
+    }
+  }
+  removeInputsAndDeadProducers(node);
+}
+
+namespace {
+
+bool destroyDeadProducersIn(
+    Graph& graph,
+    std::unordered_set<std::string>& dead_values) {
+  bool destroyed = false;
+  for (Node* n : graph.nodes()) {
+    for (auto name : n->attributeNames()) {
+      if (n->kindOf(name) == AttributeKind::g) {
+        destroyed |= destroyDeadProducersIn(*n->g(name), dead_values);
+      }
+      if (n->kindOf(name) == AttributeKind::gs) {
+        for (auto& g : n->gs(name)) {
+          destroyed |= destroyDeadProducersIn(*g, dead_values);
+        }
+      }
+    }
+  }
+  // Consumers come before their producers in reverse order, so the whole
+  // dead chain above a value goes in one walk
+  auto nodes = graph.nodes().reverse();
+  for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+    Node* n = *it;
+    if (n->hasUses() || n->kind() == kUndefined) {
+      continue;
+    }
+    bool dead_value = false;
+    for (Value* output : n->outputs()) {
+      dead_value |= dead_values.count(output->uniqueName()) != 0;
+    }
+    if (!dead_value) {
+      continue;
+    }
+    for (Value* input : n->inputs()) {
+      dead_values.insert(input->uniqueName());
+    }
+    it.destroyCurrent();
+    destroyed = true;
+  }
+  return destroyed;
+}
+
+} // namespace
+
+bool destroyDeadProducers(
+    Graph& graph,
+    std::unordered_set<std::string>& dead_values) {
+  if (dead_values.empty()) {
+    return false;
+  }
+  const bool destroyed = destroyDeadProducersIn(graph, dead_values);
+  dead_values.clear();
+  return destroyed;
+}
+
+bool sameDim(const Dimension& a, const Dimension& b) {
+  if (a.is_unknown || b.is_unknown || a.is_int != b.is_int) {
+    return false;
+  }
+  return a.is_int ? a.dim == b.dim : a.param == b.param;
+}
+
+bool sameSizes(const Value* a, const Value* b) {
+  if (!a->has_sizes() || !b->has_sizes() ||
+      a->sizes().size() != b->sizes().size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a->sizes().size(); ++i) {
+    if (!sameDim(a->sizes()[i], b->sizes()[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool getConstantScalar(const Value* value, const Graph& graph, float* result) {
+  const Tensor* tensor = getConstantTensor(value, graph);
+  if (tensor == nullptr) {
+    return false;
+  }
+  std::string scratch;
+  const char* data;
+  size_t size;
+  if (ElementCount(tensor->sizes()) != 1 ||
+      !ElementBytes(*tensor, scratch, &data, &size) ||
+      size != ElementSize(tensor->elem_type())) {
+    return false;
+  }
+  return ConvertElements(
+      tensor->elem_type(), data, TensorProto_DataType_FLOAT, result, 1);
+}
+
+bool getConstantInts(
+    const Value* value,
+    const Graph& graph,
+    std::vector<int64_t>* result) {
+  const Tensor* tensor = getConstantTensor(value, graph);
+  std::string scratch;
+  const char* data;
+  size_t size;
+  if (tensor == nullptr || tensor->elem_type() != TensorProto_DataType_INT64 ||
+      !ElementBytes(*tensor, scratch, &data, &size)) {
+    return false;
+  }
+  result->resize(size / sizeof(int64_t));
+  return ConvertElements(
+      TensorProto_DataType_INT64,
+      data,
+      TensorProto_DataType_INT64,
+      result->data(),
+      result->size());
+}
+
+bool getConstantFloats(
+    const Value* value,
+    const Graph& graph,
+    std::vector<float>* result) {
+  const Tensor* tensor = getConstantTensor(value, graph);
+  std::string scratch;
+  const char* data;
+  size_t size;
+  if (tensor == nullptr || ElementSize(tensor->elem_type()) == 0 ||
+      !ElementBytes(*tensor, scratch, &data, &size)) {
+    return false;
+  }
+  result->resize(size / ElementSize(tensor->elem_type()));
+  return ConvertElements(
+      tensor->elem_type(),
+      data,
+      TensorProto_DataType_FLOAT,
+      result->data(),
+      result->size());
+}
+
+Value* addTransposedConstant(
+    const Value* value,
+    const std::vector<int64_t>& perm,
+    Graph& graph) {
+  const Tensor* tensor = getConstantTensor(value, graph);
+  if (tensor == nullptr || tensor->sizes().size() > perm.size()) {
+    return nullptr;
+  }
+  std::vector<int64_t> dims(perm.size() - tensor->sizes().size(), 1);
+  dims.insert(dims.end(), tensor->sizes().begin(), tensor->sizes().end());
+  std::string scratch;
+  const char* data;
+  size_t size;
+  std::string bytes;
+  if (!ElementBytes(*tensor, scratch, &data, &size) ||
+      size != ElementCount(dims) * ElementSize(tensor->elem_type()) ||
+      !TransposeElements(tensor->elem_type(), dims, perm, data, bytes)) {
+    return nullptr;
+  }
+  std::vector<int64_t> transposed_dims;
+  for (int64_t axis : perm) {
+    transposed_dims.push_back(dims[axis]);
+  }
+  return InitializerIndex::get(graph).addInitializerAndInput(MakeRawTensor(
+      tensor->elem_type(), std::move(transposed_dims), std::move(bytes)));
+}
+
+void ensureOpsetImport(
+    Graph& graph,
+    const std::string& domain,
+    int64_t version) {
+  auto& opsets = graph.opset_versions_mutable();
+  for (const OpSetID& opset : opsets) {
+    if (opset.domain() == domain) {
+      return;
+    }
+  }
+  opsets.emplace_back(domain, version);
+}
+
 } // namespace optimization
 } // namespace ONNX_NAMESPACE
@@ -7,9 +7,14 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "onnx/common/ir.h"
 #include "onnx/onnx_pb.h"
+#include "onnxoptimizer/initializer_index.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
@@ -39,7 +44,10 @@ enum PassAnalysisType {
   Empty = 0,
   // A count based analysis is returned. Most likely of type
   // CountBasedPassAnalysis
-  CountBased = 1
+  CountBased = 1,
+  // A plan of the memory of the tensors is returned, of type
+  // MemoryPlanAnalysis
+  MemoryPlanBased = 2
 };
 
 enum PassEfficiency {
@@ -141,6 +149,9 @@ struct CountBasedPassAnalysis : PostPassAnalysis {
   unsigned int num_positive_transforms;
   bool initialization_done;
   bool finalization_done;
+  // Number of nodes offered to patternMatchPredicate, only set by predicate
+  // based passes.
+  size_t num_nodes_visited;
 
  public:
   explicit CountBasedPassAnalysis(Pass *pass,
@@ -177,16 +188,32 @@ class PredicateBasedPass : public Pass {
   ~PredicateBasedPass() override;
 
   virtual bool patternMatchPredicate(Node *node) = 0;
+  // Kinds of the nodes patternMatchPredicate can accept, used to dispatch
+  // nodes in a PredicateBasedPassGroup. An empty list means any kind.
+  virtual std::vector<NodeKind> getMatchedNodeKinds() const {
+    return {};
+  }
   // Run transform is given the current node in the iterator, a reference to the
   // current graph as well as a reference describing how to treat the current
   // node in the iterator post transform. Run transform is then responsible for
   // running the actual transform as well as describing how to treat the
   // iterator node. By default the current node will not call destroy. Do not
   // internally delete node instead set the correct destroy_current type.
+  // Besides the current node, only nodes producing its inputs may be
+  // destroyed by the transform, which builds defining
+  // ONNX_OPTIMIZER_VERIFY_WORKLIST check when running to a fixed point.
+  // Initializers are looked up, added and erased through
+  // InitializerIndex::get(graph), which is available while the pass runs.
   virtual bool runTransform(Node *node, Graph &graph,
                             NodeDestroyType &destroy_current) = 0;
 
   std::shared_ptr<PostPassAnalysis> runPass(Graph &graph) override;
+  // Same as runPass, but the neighbours of every node rewritten by a
+  // transform (producers of its inputs and consumers of the affected values)
+  // are matched again until nothing changes. One call therefore reaches the
+  // fixed point that would otherwise take repeated runPass calls, each of
+  // them walking the whole graph.
+  std::shared_ptr<PostPassAnalysis> runPassToFixedPoint(Graph &graph);
   PassAnalysisType getPassAnalysisType() const override;
 
   static int getOpsetVersion(const Graph &g) {
@@ -201,7 +228,124 @@ class PredicateBasedPass : public Pass {
   }
 
  private:
-  unsigned int _runPassInternal(Graph &graph);
+  unsigned int _runPassInternal(Graph &graph, size_t &num_nodes_visited);
+  unsigned int _runPassWithWorklist(Graph &graph, size_t &num_nodes_visited);
+};
+
+// Runs several predicate based passes in a single traversal of the graph.
+// The passes are indexed by the node kinds they match, so each node is only
+// offered to the passes that can accept it, in the order they were added.
+// Interleaving the passes node by node may leave work for another traversal,
+// hence the group is always partially efficient.
+class PredicateBasedPassGroup : public PredicateBasedPass {
+ public:
+  // What one pass of the group did since its statistics were last taken.
+  // Seconds and initializers are only recorded with setRecording(true), as
+  // they take timing every match and comparing the initializers of the
+  // graph after every transform.
+  struct MemberStatistics {
+    unsigned int num_transforms = 0;
+    size_t num_nodes_visited = 0;
+    size_t num_initializers_added = 0;
+    size_t num_initializers_erased = 0;
+    double seconds = 0;
+  };
+
+  explicit PredicateBasedPassGroup()
+      : PredicateBasedPass(PassType::Other, PassEfficiency::Partial,
+                           PassOptimizationType::Compute) {}
+  ~PredicateBasedPassGroup() override;
+
+  void add(std::shared_ptr<PredicateBasedPass> pass);
+  const std::vector<std::shared_ptr<PredicateBasedPass>> &getPasses() const {
+    return passes;
+  }
+  void setRecording(bool recording) {
+    this->recording = recording;
+  }
+  // Statistics of the passes in the order they were added, which start over
+  // from zero afterwards.
+  std::vector<MemberStatistics> takeMemberStatistics();
+
+  std::string getPassName() const override;
+  bool initializePass(Graph &graph) override;
+  bool finalizePass(Graph &graph) override;
+  bool patternMatchPredicate(Node *node) override;
+  bool runTransform(Node *node, Graph &graph,
+                    NodeDestroyType &destroy_current) override;
+
+ private:
+  // Indices into passes of the passes that can accept node.
+  const std::vector<size_t> &candidates(const Node *node) const;
+  // Adds the initializers that the main graph gained and lost since the
+  // last call to the statistics of passes[index].
+  void recordInitializers(const Graph &graph, size_t index);
+
+  std::vector<std::shared_ptr<PredicateBasedPass>> passes;
+  std::vector<MemberStatistics> member_statistics;
+  std::unordered_map<NodeKind, std::vector<size_t>> passes_by_kind;
+  // Passes matching any kind, also appended to every list of passes_by_kind.
+  std::vector<size_t> passes_for_any_kind;
+  // Number of candidates the last patternMatchPredicate call offered the
+  // node to, which runTransform doesn't count as visits again.
+  size_t num_offered = 0;
+  bool recording = false;
+  // The graph the group was initialized on and the names of its
+  // initializers, while recording.
+  const Graph *main_graph = nullptr;
+  std::unordered_set<std::string> initializer_names;
+};
+
+// A predicate based pass whose transforms compute new initializers from
+// existing ones. Transforms get them through foldedInitializers, which
+// computes those of the node and of the next nodes the pass matches in
+// parallel, in a batch small enough for the computed initializers not to
+// take much memory. The following transforms use the initializers computed
+// beforehand, or compute them on the spot if another transform changed
+// their inputs in the meantime.
+class InitializerFoldingPass : public PredicateBasedPass {
+ public:
+  explicit InitializerFoldingPass(PassType pass_type,
+                                  PassEfficiency pass_efficiency,
+                                  PassOptimizationType pass_optimization_type)
+      : PredicateBasedPass(pass_type, pass_efficiency,
+                           pass_optimization_type) {}
+  ~InitializerFoldingPass() override;
+
+  bool initializePass(Graph &graph) override;
+  bool finalizePass(Graph &graph) override;
+
+ protected:
+  // Computes the new initializers of a node, returning false if it can't.
+  // It may run on another thread, so it may only read the tensors it was
+  // prepared with.
+  typedef std::function<bool(std::vector<Tensor> &)> Folding;
+
+  // Looks up the initializers the transform of node would be computed from
+  // and appends their values to inputs. Returns an empty Folding if node
+  // can't be transformed.
+  virtual Folding prepareFolding(Node *node, Graph &graph,
+                                 std::vector<Value *> &inputs) = 0;
+
+  // The initializers computed for node by the Folding of prepareFolding.
+  // Returns false if there is none or it failed.
+  bool foldedInitializers(Node *node, Graph &graph,
+                          std::vector<Tensor> &initializers);
+
+ private:
+  struct PrecomputedFolding {
+    std::vector<Value *> inputs;
+    std::vector<std::string> input_names;
+    Folding folding;
+    bool succeeded = false;
+    std::vector<Tensor> initializers;
+  };
+
+  // Computes the initializers of node and of the nodes following it in
+  // graph that the pass matches, until the batch reaches its limits.
+  void foldBatch(Node *node, Graph &graph);
+
+  std::unordered_map<Node *, PrecomputedFolding> precomputed;
 };
 
 // The most general pass which allows the user to run a pass given only a graph.
@@ -255,5 +399,72 @@ inline bool tryReplacingAllUsesWith(Node *oldNode, Node *newNode) {
   return true;
 }
 
+// The tensor of value if it is a Constant node or an initializer of graph,
+// but not of an enclosing graph, nullptr otherwise. Needs an
+// InitializerIndexScope.
+const Tensor *getConstantTensor(const Value *value, const Graph &graph);
+
+// Whether value is a Constant node or an initializer of graph, but not of an
+// enclosing graph, which other passes may not expect to be rewritten. Needs
+// an InitializerIndexScope.
+bool isConstantValue(const Value *value, const Graph &graph);
+
+// Destroys the nodes without uses, as well as the nodes which have no uses
+// left after that, until none of them can be destroyed. Graph inputs and
+// the values standing for omitted inputs are kept.
+void destroyDeadNodes(std::vector<Node *> nodes);
+
+// Removes all inputs of node and destroys the nodes producing them which
+// are left without uses. A transform may not destroy more than that, so the
+// rest of a fused pattern is left to eliminate_deadend.
+void removeInputsAndDeadProducers(Node *node);
+
+// Same as removeInputsAndDeadProducers, also adding the unique names of the
+// values the rest of the pattern may be left dead from to dead_values, for
+// destroyDeadProducers to remove once the traversal is over.
+void removeInputsAndDeadProducers(Node *node,
+                                  std::unordered_set<std::string> &dead_values);
+
+// Destroys the nodes of graph and its subgraphs which have no uses and
+// produce one of dead_values, as well as the nodes left without uses by
+// that, and clears dead_values. Returns whether any node was destroyed.
+bool destroyDeadProducers(Graph &graph,
+                          std::unordered_set<std::string> &dead_values);
+
+// Whether the dims are known to be equal, being the same static value or the
+// same dim_param.
+bool sameDim(const Dimension &a, const Dimension &b);
+
+// Whether a and b are known to have the same shape, every dim of one being
+// the same as that of the other.
+bool sameSizes(const Value *a, const Value *b);
+
+// Reads value, which must be a single element Constant node or initializer
+// of graph, converted to float. Needs an InitializerIndexScope.
+bool getConstantScalar(const Value *value, const Graph &graph, float *result);
+
+// Reads value, which must be an INT64 Constant node or initializer of graph.
+// Needs an InitializerIndexScope.
+bool getConstantInts(const Value *value, const Graph &graph,
+                     std::vector<int64_t> *result);
+
+// Reads value, which must be a Constant node or initializer of graph of a
+// numeric type, converted to float. Needs an InitializerIndexScope.
+bool getConstantFloats(const Value *value, const Graph &graph,
+                       std::vector<float> *result);
+
+// Adds an initializer holding the Constant node or initializer value of
+// graph transposed by perm, after prepending dims of 1 to it up to the rank
+// of perm as broadcasting does. Returns nullptr if value is not such a
+// constant or its type is not supported. Needs an InitializerIndexScope.
+Value *addTransposedConstant(const Value *value,
+                             const std::vector<int64_t> &perm, Graph &graph);
+
+// Adds the opset of domain to the imports of graph, unless some version of
+// it is imported already. Used by passes that emit operators of other
+// domains than the default one.
+void ensureOpsetImport(Graph &graph, const std::string &domain,
+                       int64_t version);
+
 }  // namespace optimization
 }  // namespace ONNX_NAMESPACE
@@ -4,6 +4,11 @@
 
 #include "onnxoptimizer/pass_manager.h"
 
+#include <chrono>
+#include <unordered_set>
+
+#include "onnxoptimizer/shape_inference.h"
+
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
@@ -14,24 +19,195 @@ GeneralPassManager::~GeneralPassManager() {
   this->passes.clear();
 }
 void GeneralPassManager::add(std::shared_ptr<Pass> pass) {
+  auto predicate_pass = std::dynamic_pointer_cast<PredicateBasedPass>(pass);
+  if (this->fuse_predicate_passes && predicate_pass) {
+    std::shared_ptr<PredicateBasedPassGroup> group;
+    if (!this->passes.empty()) {
+      group = std::dynamic_pointer_cast<PredicateBasedPassGroup>(
+          this->passes.back());
+    }
+    if (!group) {
+      group = std::make_shared<PredicateBasedPassGroup>();
+      group->setRecording(this->collect_statistics);
+      this->passes.push_back(group);
+    }
+    group->add(std::move(predicate_pass));
+    return;
+  }
   this->passes.push_back(std::move(pass));
 }
 
-std::shared_ptr<PassManagerAnalysis> GeneralPassManager::run(Graph& graph) {
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+std::unordered_set<std::string> initializerNames(const Graph& graph) {
+  std::unordered_set<std::string> names;
+  for (const Tensor& initializer : graph.initializers()) {
+    names.insert(initializer.name());
+  }
+  return names;
+}
+
+// Whether the pass may have changed the graph, as far as its analysis tells.
+bool changedGraph(const Pass& pass, const PostPassAnalysis* analysis) {
+  if (pass.getPassType() == PassType::Immutable) {
+    return false;
+  }
+  if (pass.getPassAnalysisType() != PassAnalysisType::CountBased) {
+    return true;
+  }
+  return static_cast<const CountBasedPassAnalysis*>(analysis)
+             ->num_positive_transforms > 0;
+}
+
+} // namespace
+
+std::shared_ptr<PostPassAnalysis> GeneralPassManager::runAndRecord(
+    Pass& pass,
+    Graph& graph,
+    PassStatistics* statistics,
+    const std::function<std::shared_ptr<PostPassAnalysis>()>& run) {
+  // Groups record what each of their passes did themselves
+  auto* group = dynamic_cast<PredicateBasedPassGroup*>(&pass);
+  std::unordered_set<std::string> initializers_before;
+  if (this->collect_statistics && group == nullptr) {
+    initializers_before = initializerNames(graph);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  std::shared_ptr<PostPassAnalysis> analysis = run();
+  const double seconds = secondsSince(start);
+  if (group != nullptr) {
+    const std::vector<PredicateBasedPassGroup::MemberStatistics> members =
+        group->takeMemberStatistics();
+    for (size_t i = 0; i < members.size(); ++i) {
+      PassStatistics& member = statistics[i];
+      ++member.num_runs;
+      member.num_transforms += members[i].num_transforms;
+      member.num_nodes_visited += members[i].num_nodes_visited;
+      member.num_initializers_added += members[i].num_initializers_added;
+      member.num_initializers_erased += members[i].num_initializers_erased;
+      member.seconds += members[i].seconds;
+    }
+  } else {
+    statistics->seconds += seconds;
+    ++statistics->num_runs;
+    if (pass.getPassAnalysisType() == PassAnalysisType::CountBased) {
+      const auto* count_analysis =
+          static_cast<const CountBasedPassAnalysis*>(analysis.get());
+      statistics->num_transforms += count_analysis->num_positive_transforms;
+      statistics->num_nodes_visited += count_analysis->num_nodes_visited;
+    } else if (pass.getPassAnalysisType() != PassAnalysisType::Empty) {
+      statistics->analysis = analysis;
+    }
+  }
+  if (this->collect_statistics && group == nullptr) {
+    const std::unordered_set<std::string> initializers_after =
+        initializerNames(graph);
+    for (const std::string& name : initializers_after) {
+      statistics->num_initializers_added +=
+          initializers_before.count(name) == 0;
+    }
+    for (const std::string& name : initializers_before) {
+      statistics->num_initializers_erased +=
+          initializers_after.count(name) == 0;
+    }
+  }
+  if (changedGraph(pass, analysis.get())) {
+    propagateShapes(graph);
+  }
+  return analysis;
+}
+
+void GeneralPassManager::propagateShapes(Graph& graph) {
+  if (this->propagate_shapes) {
+    PropagateShapes(graph, &this->inferred_values);
+  }
+}
+
+void GeneralPassManager::forgetInferredShapes(Graph& graph) {
+  ForgetInferredShapes(graph, this->inferred_values);
+  this->inferred_values.clear();
+}
+
+std::shared_ptr<PassStatisticsAnalysis> GeneralPassManager::newStatistics(
+    std::vector<PassStatistics*>* pass_statistics) const {
+  auto statistics = std::make_shared<PassStatisticsAnalysis>();
+  std::vector<size_t> first_entries;
   for (const std::shared_ptr<Pass>& pass : this->passes) {
-    auto pass_analysis = pass->runPass(graph);
+    first_entries.push_back(statistics->passes.size());
+    auto* group = dynamic_cast<PredicateBasedPassGroup*>(pass.get());
+    if (group == nullptr) {
+      statistics->passes.emplace_back();
+      statistics->passes.back().pass_name = pass->getPassName();
+      continue;
+    }
+    for (const auto& member : group->getPasses()) {
+      statistics->passes.emplace_back();
+      statistics->passes.back().pass_name = member->getPassName();
+    }
+  }
+  pass_statistics->clear();
+  for (size_t first_entry : first_entries) {
+    pass_statistics->push_back(statistics->passes.data() + first_entry);
+  }
+  return statistics;
+}
+
+std::shared_ptr<PassManagerAnalysis> GeneralPassManager::run(Graph& graph) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<PassStatistics*> pass_statistics;
+  std::shared_ptr<PassStatisticsAnalysis> statistics =
+      newStatistics(&pass_statistics);
+  propagateShapes(graph);
+  for (size_t i = 0; i < this->passes.size(); ++i) {
+    Pass& pass = *this->passes[i];
+    runAndRecord(pass, graph, pass_statistics[i],
+                 [&pass, &graph]() { return pass.runPass(graph); });
   }
-  return std::shared_ptr<PassManagerAnalysis>(new EmptyPassManagerAnalysis());
+  forgetInferredShapes(graph);
+  statistics->num_fixed_point_iterations = 1;
+  statistics->seconds = secondsSince(start);
+  return statistics;
 }
 
 std::shared_ptr<PassManagerAnalysis> FixedPointPassManager::run(Graph& graph) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<PassStatistics*> pass_statistics;
+  std::shared_ptr<PassStatisticsAnalysis> statistics =
+      newStatistics(&pass_statistics);
   bool fixed_point_optimization_done;
+  propagateShapes(graph);
 
   do {
     fixed_point_optimization_done = false;
-    for (const std::shared_ptr<Pass>& pass : this->passes) {
-      std::shared_ptr<PostPassAnalysis> analysis = pass->runPass(graph);
-      if (pass->getPassAnalysisType() == PassAnalysisType::Empty) {
+    ++statistics->num_fixed_point_iterations;
+    for (size_t i = 0; i < this->passes.size(); ++i) {
+      const std::shared_ptr<Pass>& pass = this->passes[i];
+      PassStatistics* statistics_of_pass = pass_statistics[i];
+      const auto run_pass = [&pass, &graph]() { return pass->runPass(graph); };
+      auto* predicate_pass = dynamic_cast<PredicateBasedPass*>(pass.get());
+      if (this->use_worklist && predicate_pass != nullptr &&
+          pass->getPassEfficiency() == PassEfficiency::Partial) {
+        std::shared_ptr<CountBasedPassAnalysis> count_analysis =
+            std::static_pointer_cast<CountBasedPassAnalysis>(
+                runAndRecord(*pass, graph, statistics_of_pass,
+                             [predicate_pass, &graph]() {
+                               return predicate_pass->runPassToFixedPoint(
+                                   graph);
+                             }));
+        if (count_analysis->fixedPointOptimizationNeeded()) {
+          fixed_point_optimization_done = true;
+        }
+        continue;
+      }
+      std::shared_ptr<PostPassAnalysis> analysis =
+          runAndRecord(*pass, graph, statistics_of_pass, run_pass);
+      if (pass->getPassAnalysisType() != PassAnalysisType::CountBased) {
         continue;
       }
       std::shared_ptr<CountBasedPassAnalysis> count_analysis =
@@ -39,13 +215,15 @@ std::shared_ptr<PassManagerAnalysis> FixedPointPassManager::run(Graph& graph) {
 
       while (count_analysis->fixedPointOptimizationNeeded()) {
         count_analysis = std::static_pointer_cast<CountBasedPassAnalysis>(
-            pass->runPass(graph));
+            runAndRecord(*pass, graph, statistics_of_pass, run_pass));
         fixed_point_optimization_done = true;
       }
     }
   } while (fixed_point_optimization_done);
+  forgetInferredShapes(graph);
 
-  return std::shared_ptr<PassManagerAnalysis>(new EmptyPassManagerAnalysis());
+  statistics->seconds = secondsSince(start);
+  return statistics;
 }
 } // namespace optimization
 } // namespace ONNX_NAMESPACE
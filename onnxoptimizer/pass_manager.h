@@ -6,6 +6,9 @@
 // ATTENTION: The code in this file is highly EXPERIMENTAL.
 // Adventurous users should note that the APIs will probably change.
 
+#include <functional>
+#include <string>
+#include <unordered_set>
 #include <vector>
 #include "onnxoptimizer/pass.h"
 
@@ -16,6 +19,34 @@ namespace optimization {
 struct PassManagerAnalysis {};
 struct EmptyPassManagerAnalysis : PassManagerAnalysis {};
 
+// What a pass did during a pass manager run, summed over all its runs.
+struct PassStatistics {
+  std::string pass_name;
+  unsigned int num_runs = 0;
+  // As reported by CountBasedPassAnalysis, 0 for passes without one.
+  unsigned int num_transforms = 0;
+  // Nodes offered to patternMatchPredicate, 0 for full graph passes. In a
+  // PredicateBasedPassGroup, only the nodes of the kinds the pass matches.
+  size_t num_nodes_visited = 0;
+  size_t num_initializers_added = 0;
+  size_t num_initializers_erased = 0;
+  double seconds = 0;
+  // What the last run returned, for the passes whose analysis is neither
+  // empty nor count based.
+  std::shared_ptr<PostPassAnalysis> analysis;
+};
+
+// Statistics of every pass added to the manager, in the order they were
+// added. Passes fused into a PredicateBasedPassGroup are reported one by
+// one, with the time the group takes to walk the graph left out.
+struct PassStatisticsAnalysis : PassManagerAnalysis {
+  std::vector<PassStatistics> passes;
+  // Number of times the pass list was run before reaching a fixed point, 1
+  // for a GeneralPassManager.
+  unsigned int num_fixed_point_iterations = 0;
+  double seconds = 0;
+};
+
 // Base class of all PassManager's. The class should be able to add new passes
 // as well as run the passes given a graph.
 class PassManager {
@@ -31,7 +62,20 @@ class PassManager {
 // once in a linear fashion.
 class GeneralPassManager : public PassManager {
  public:
-  GeneralPassManager() {}
+  // With fuse_predicate_passes, consecutive predicate based passes are added
+  // to a PredicateBasedPassGroup so that they share a single traversal. With
+  // propagate_shapes, the shapes of the graph are inferred by PropagateShapes
+  // before the first pass and again after every pass that changed the graph,
+  // so that passes find the shapes of the values they match. The shapes
+  // inferred for values that had no type are forgotten once all passes ran.
+  // Without collect_statistics, the initializers every pass added and erased
+  // and the time spent in each pass of a group are not recorded.
+  explicit GeneralPassManager(bool fuse_predicate_passes = false,
+                              bool propagate_shapes = false,
+                              bool collect_statistics = true)
+      : fuse_predicate_passes(fuse_predicate_passes),
+        propagate_shapes(propagate_shapes),
+        collect_statistics(collect_statistics) {}
   ~GeneralPassManager() override;
 
   void add(std::shared_ptr<Pass> pass) override;
@@ -42,12 +86,48 @@ class GeneralPassManager : public PassManager {
   // for some pass, order is critical, for example,
   // split_init and split_predict should be the last in the list
   std::vector<std::shared_ptr<Pass>> passes;
+
+  // Runs the pass with run and adds what it did to statistics, the entry of
+  // the pass or the first of the entries of the passes of a group, then
+  // brings the shapes up to date if the pass changed the graph.
+  std::shared_ptr<PostPassAnalysis> runAndRecord(
+      Pass& pass, Graph& graph, PassStatistics* statistics,
+      const std::function<std::shared_ptr<PostPassAnalysis>()>& run);
+  // Also stores where the entries of every pass start in pass_statistics.
+  std::shared_ptr<PassStatisticsAnalysis> newStatistics(
+      std::vector<PassStatistics*>* pass_statistics) const;
+  void propagateShapes(Graph& graph);
+  void forgetInferredShapes(Graph& graph);
+
+ private:
+  bool fuse_predicate_passes;
+  bool propagate_shapes;
+  bool collect_statistics;
+  // Names of the values which only have a type thanks to PropagateShapes.
+  std::unordered_set<std::string> inferred_values;
 };
 
 // Exhibits the same behavior as GeneralPassManager but will instead check
 // whether or not fixed point optimization is needed.
 class FixedPointPassManager : public GeneralPassManager {
+ public:
+  // With use_worklist, partially efficient predicate based passes reach their
+  // fixed point through PredicateBasedPass::runPassToFixedPoint instead of
+  // being re-run on the whole graph until nothing changes. Fusing the
+  // predicate based passes is safe by default here since the resulting group
+  // is run to its fixed point as well.
+  explicit FixedPointPassManager(bool use_worklist = true,
+                                 bool fuse_predicate_passes = true,
+                                 bool propagate_shapes = false,
+                                 bool collect_statistics = true)
+      : GeneralPassManager(fuse_predicate_passes, propagate_shapes,
+                           collect_statistics),
+        use_worklist(use_worklist) {}
+
   std::shared_ptr<PassManagerAnalysis> run(Graph& graph) override;
+
+ private:
+  bool use_worklist;
 };
 
 }  // namespace optimization
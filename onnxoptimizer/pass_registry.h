@@ -12,19 +12,26 @@
 #include "onnx/common/stl_backports.h"
 #include "onnx/proto_utils.h"
 
+#include "onnxoptimizer/passes/convert_to_nhwc.h"
+#include "onnxoptimizer/passes/eliminate_common_subexpressions.h"
 #include "onnxoptimizer/passes/eliminate_deadend.h"
 #include "onnxoptimizer/passes/eliminate_duplicate_initializer.h"
 #include "onnxoptimizer/passes/eliminate_identity.h"
 #include "onnxoptimizer/passes/eliminate_if_with_const_cond.h"
+#include "onnxoptimizer/passes/eliminate_nop_by_shape.h"
 #include "onnxoptimizer/passes/eliminate_nop_cast.h"
 #include "onnxoptimizer/passes/eliminate_nop_dropout.h"
 #include "onnxoptimizer/passes/eliminate_nop_flatten.h"
 #include "onnxoptimizer/passes/eliminate_nop_monotone_argmax.h"
 #include "onnxoptimizer/passes/eliminate_nop_pad.h"
 #include "onnxoptimizer/passes/eliminate_nop_transpose.h"
+#include "onnxoptimizer/passes/eliminate_slice_concat.h"
 #include "onnxoptimizer/passes/eliminate_unused_initializer.h"
 #include "onnxoptimizer/passes/extract_constant_to_initializer.h"
+#include "onnxoptimizer/passes/fold_constants.h"
+#include "onnxoptimizer/passes/fuse_activation_into_conv.h"
 #include "onnxoptimizer/passes/fuse_add_bias_into_conv.h"
+#include "onnxoptimizer/passes/fuse_attention.h"
 #include "onnxoptimizer/passes/fuse_bn_into_conv.h"
 #include "onnxoptimizer/passes/fuse_cast_into_initializer.h"
 #include "onnxoptimizer/passes/fuse_consecutive_concats.h"
@@ -32,28 +39,40 @@
 #include "onnxoptimizer/passes/fuse_consecutive_reduce_unsqueeze.h"
 #include "onnxoptimizer/passes/fuse_consecutive_squeezes.h"
 #include "onnxoptimizer/passes/fuse_consecutive_transposes.h"
+#include "onnxoptimizer/passes/fuse_consecutive_view_ops.h"
+#include "onnxoptimizer/passes/fuse_gelu.h"
+#include "onnxoptimizer/passes/fuse_layer_norm.h"
 #include "onnxoptimizer/passes/fuse_matmul_add_bias_into_gemm.h"
 #include "onnxoptimizer/passes/fuse_pad_into_conv.h"
 #include "onnxoptimizer/passes/fuse_transpose_into_gemm.h"
 #include "onnxoptimizer/passes/lift_lexical_references.h"
 #include "onnxoptimizer/passes/nop.h"
+#include "onnxoptimizer/passes/plan_activation_memory.h"
+#include "onnxoptimizer/passes/push_down_transposes.h"
 #include "onnxoptimizer/passes/split.h"
 
+#include <functional>
 #include <unordered_set>
 #include <vector>
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
-// Registry containing all passes available in ONNX.
+// Registry containing all passes available in ONNX. It is not modified once
+// constructed, so it can be used from several threads at once.
 struct GlobalPassRegistry {
+  // One instance of every pass, describing it.
   std::map<std::string, std::shared_ptr<Pass>> passes;
+  std::map<std::string, std::function<std::shared_ptr<Pass>()>> factories;
 
   GlobalPassRegistry() {
     // Register the optimization passes to the optimizer.
     registerPass<NopEmptyPass>();
+    registerPass<ConvertToNHWC>();
+    registerPass<EliminateCommonSubexpressions>();
     registerPass<EliminateDeadEnd>();
     registerPass<EliminateDuplicateInitializer>();
+    registerPass<EliminateNopByShape>();
     registerPass<EliminateNopCast>();
     registerPass<EliminateNopDropout>();
     registerPass<EliminateNopFlatten>();
@@ -62,9 +81,14 @@ struct GlobalPassRegistry {
     registerPass<EliminateNopMonotoneArgmax>();
     registerPass<EliminateNopPad>();
     registerPass<EliminateNopTranspose>();
+    registerPass<EliminateSliceConcat>();
     registerPass<EliminateUnusedInitializer>();
     registerPass<ExtractConstantToInitializer>();
+    registerPass<FoldConstants>();
+    registerPass<FuseActivationIntoConv>();
     registerPass<FuseAddBiasIntoConv>();
+    registerPass<FuseAttention>();
+    registerPass<FuseAttentionStandardOps>();
     registerPass<FuseBNIntoConv>();
     registerPass<FuseCastIntoInitializer>();
     registerPass<FuseConsecutiveConcats>();
@@ -72,23 +96,33 @@ struct GlobalPassRegistry {
     registerPass<FuseConsecutiveReduceUnsqueeze>();
     registerPass<FuseConsecutiveSqueezes>();
     registerPass<FuseConsecutiveTransposes>();
+    registerPass<FuseConsecutiveViewOps>();
+    registerPass<FuseGelu>();
+    registerPass<FuseGeluWithContribOps>();
+    registerPass<FuseLayerNorm>();
+    registerPass<FuseLayerNormWithContribOps>();
     registerPass<FuseMatMulAddBiasIntoGemm>();
     registerPass<FusePadIntoConv>();
     registerPass<FuseTransposeIntoGemm>();
     registerPass<LiftLexicalReferences>();
+    registerPass<PlanActivationMemory>();
+    registerPass<PushDownTransposes>();
     registerPass<SplitInit>();
     registerPass<SplitPredict>();
   }
 
   ~GlobalPassRegistry() {
     this->passes.clear();
+    this->factories.clear();
   }
 
-  std::shared_ptr<Pass> find(std::string pass_name) {
-    auto it = this->passes.find(pass_name);
-    ONNX_ASSERTM(it != this->passes.end(), "pass %s is unknown.",
+  // Returns a new instance of the pass, since passes may keep state while
+  // they run and must not be shared between threads.
+  std::shared_ptr<Pass> find(std::string pass_name) const {
+    auto it = this->factories.find(pass_name);
+    ONNX_ASSERTM(it != this->factories.end(), "pass %s is unknown.",
                  pass_name.c_str());
-    return it->second;
+    return it->second();
   }
   const std::vector<std::string> GetAvailablePasses();
 
@@ -99,6 +133,9 @@ struct GlobalPassRegistry {
     static_assert(std::is_base_of<Pass, T>::value, "T must inherit from Pass");
     std::shared_ptr<Pass> pass(new T());
     passes[pass->getPassName()] = pass;
+    factories[pass->getPassName()] = []() {
+      return std::shared_ptr<Pass>(new T());
+    };
   }
 };
 }  // namespace optimization
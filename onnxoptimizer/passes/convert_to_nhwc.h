@@ -0,0 +1,377 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   Y = Conv(X, W, B)
+//   Z = Relu(BatchNormalization(Y, scale, bias, mean, var))
+//   U = Conv(Z, W2)
+// After:
+//   X_t = Transpose(X, perm = [0, 2, 3, 1])
+//   Y_t = com.microsoft.NhwcConv(X_t, W, B)
+//   Z_t = Relu(Add(Mul(Y_t, S), C))
+//   U = Transpose(com.microsoft.NhwcConv(Z_t, W2), perm = [0, 3, 1, 2])
+//
+// Rewrites the 2D convolutions and pools into the channels-last operators of
+// ONNX Runtime, NhwcConv for float and float16 Conv and NhwcMaxPool for 8 bit
+// MaxPool, between Transposes from and back to NCHW. Where they are
+// connected to those operators through operators push_down_transposes moves
+// Transposes through, BatchNormalization with constant parameters becomes a
+// Mul and an Add by per-channel constants, GlobalAveragePool and
+// GlobalMaxPool a ReduceMean and a ReduceMax over the spatial axes, so that
+// they don't stop the Transposes. push_down_transposes then moves the
+// Transposes through the layout-agnostic operators in between, Resize
+// included, transposing their constants once here, and cancels them out,
+// so that only one conversion remains at each edge of a channels-last
+// region. The ranks and element types of the inputs come from the value
+// infos of the model, e.g. as left by ONNX shape inference.
+//
+// NhwcConv takes its weights in the standard layout of Conv, so they are
+// left as they are. The operators are contrib operators of ONNX Runtime,
+// not part of the ONNX standard, so the pass is of type Other and only
+// runs when asked for by name. It adds the com.microsoft opset to the model
+// when it emits them.
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/fuse_bn_into_conv.h"
+#include "onnxoptimizer/passes/push_down_transposes.h"
+#include "onnxoptimizer/tensor_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct ConvertToNHWC final : public FullGraphBasedPass {
+  explicit ConvertToNHWC()
+      : FullGraphBasedPass(PassType::Other, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "convert_to_nhwc";
+  }
+  PassAnalysisType getPassAnalysisType() const override {
+    return PassAnalysisType::CountBased;
+  }
+
+  std::shared_ptr<PostPassAnalysis> runPass(Graph& graph) override {
+    InitializerIndexScope initializer_index_scope;
+    bool emitted_contrib_ops = false;
+    // Subgraphs don't know their opset, so the one of the model is used
+    const unsigned int num_converted = convertAll(
+        graph, PredicateBasedPass::getOpsetVersion(graph), emitted_contrib_ops);
+    if (num_converted > 0) {
+      PushDownTransposes().runPassToFixedPoint(graph);
+    }
+    if (emitted_contrib_ops) {
+      ensureOpsetImport(graph, "com.microsoft", 1);
+    }
+    return std::shared_ptr<PostPassAnalysis>(
+        new CountBasedPassAnalysis(this, num_converted, false, false));
+  }
+
+ private:
+  static bool isDefaultDomain(const Node* node) {
+    return node->domain().empty() || node->domain() == "ai.onnx";
+  }
+
+  static int64_t rankOf(const Value* value) {
+    return value->has_sizes() ? static_cast<int64_t>(value->sizes().size())
+                              : -1;
+  }
+
+  // The element type of node, as known from its first input or output.
+  static int32_t elemTypeOf(const Node* node) {
+    if (node->inputs()[0]->elemType() != TensorProto_DataType_UNDEFINED) {
+      return node->inputs()[0]->elemType();
+    }
+    return node->outputs()[0]->elemType();
+  }
+
+  static bool isLowered(const Node* node) {
+    const NodeKind kind = node->kind();
+    return kind == Symbol("BatchNormalization") ||
+        kind == Symbol("GlobalAveragePool") || kind == Symbol("GlobalMaxPool");
+  }
+
+  unsigned int convertAll(Graph& graph, int opset_version,
+                          bool& emitted_contrib_ops) {
+    unsigned int num_converted = 0;
+    std::vector<Node*> nodes;
+    for (Node* n : graph.nodes()) {
+      DescendOnGraphAttributesUnconstrained(
+          n, [this, &num_converted, opset_version,
+              &emitted_contrib_ops](Graph& g) {
+            num_converted += convertAll(g, opset_version, emitted_contrib_ops);
+          });
+      if (isDefaultDomain(n) && n->outputs().size() == 1 &&
+          !n->inputs().empty()) {
+        nodes.push_back(n);
+      }
+    }
+    // The NCHW values going into and coming out of the converted operators,
+    // then the values connected to them through the operators the
+    // Transposes can move through.
+    std::unordered_set<const Value*> region;
+    std::vector<Node*> candidates;
+    // A conversion only destroys the node it converts
+    for (Node* n : nodes) {
+      if (n->kind() != kConv && n->kind() != Symbol("MaxPool")) {
+        candidates.push_back(n);
+        continue;
+      }
+      Value* input = n->inputs()[0];
+      Value* output = convertToContribOp(n, graph);
+      if (output != nullptr) {
+        region.insert(input);
+        region.insert(output);
+        emitted_contrib_ops = true;
+        ++num_converted;
+      }
+    }
+    if (region.empty()) {
+      return num_converted;
+    }
+    const auto propagates = [](const Node* n) {
+      return isLowered(n) || PushDownTransposes::numLayoutInputs(n) > 0;
+    };
+    for (Node* n : candidates) {
+      if (propagates(n) && region.count(n->inputs()[0]) != 0) {
+        region.insert(n->output());
+      }
+    }
+    for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+      if (propagates(*it) && region.count((*it)->output()) != 0) {
+        region.insert((*it)->inputs()[0]);
+      }
+    }
+    std::vector<Node*> lowered;
+    for (Node* n : candidates) {
+      if (isLowered(n) && (region.count(n->inputs()[0]) != 0 ||
+                           region.count(n->output()) != 0)) {
+        lowered.push_back(n);
+      }
+    }
+    for (Node* n : lowered) {
+      if (n->kind() == Symbol("BatchNormalization")) {
+        num_converted += lowerBatchNorm(n, graph);
+      } else {
+        num_converted += lowerGlobalPool(n, graph, opset_version);
+      }
+    }
+    return num_converted;
+  }
+
+  static Value* transposed(Value* value, const std::vector<int64_t>& perm,
+                           Node* before, Graph& graph) {
+    Node* transpose = graph.create(kTranspose, 1);
+    transpose->addInput(value);
+    transpose->is_(kperm, std::vector<int64_t>(perm));
+    transpose->insertBefore(before);
+    transpose->output()->setElemType(value->elemType());
+    if (value->has_sizes()) {
+      std::vector<Dimension> sizes;
+      for (int64_t axis : perm) {
+        sizes.push_back(value->sizes()[axis]);
+      }
+      transpose->output()->setSizes(sizes);
+    }
+    return transpose->output();
+  }
+
+  // Replaces a 4D Conv computing in a floating point type by NhwcConv, or a
+  // MaxPool of 8 bit integers without indices by NhwcMaxPool. Returns the
+  // output of the Transpose back to NCHW, or nullptr if node is left as it
+  // is.
+  static Value* convertToContribOp(Node* node, Graph& graph) {
+    const int32_t elem_type = elemTypeOf(node);
+    const bool is_conv = node->kind() == kConv;
+    if (rankOf(node->inputs()[0]) != 4) {
+      return nullptr;
+    }
+    if (is_conv) {
+      // ONNX Runtime doesn't register NhwcConv for double
+      if (elem_type != TensorProto_DataType_FLOAT &&
+          elem_type != TensorProto_DataType_FLOAT16) {
+        return nullptr;
+      }
+    } else if ((elem_type != TensorProto_DataType_INT8 &&
+                elem_type != TensorProto_DataType_UINT8) ||
+               (node->hasAttribute(Symbol("storage_order")) &&
+                node->i(Symbol("storage_order")) != 0)) {
+      return nullptr;
+    }
+
+    Node* nhwc =
+        graph.create(Symbol(is_conv ? "NhwcConv" : "NhwcMaxPool"), 1);
+    nhwc->setDomain("com.microsoft");
+    nhwc->addInput(transposed(node->inputs()[0], {0, 2, 3, 1}, node, graph));
+    for (size_t i = 1; i < node->inputs().size(); ++i) {
+      nhwc->addInput(node->inputs()[i]);
+    }
+    nhwc->copyAttributes(*node);
+    if (nhwc->hasAttribute(Symbol("storage_order"))) {
+      nhwc->removeAttribute(Symbol("storage_order"));
+    }
+    nhwc->insertBefore(node);
+    nhwc->output()->setElemType(node->output()->elemType());
+    Value* output = transposed(nhwc->output(), {0, 3, 1, 2}, node, graph);
+    if (node->output()->has_sizes()) {
+      const auto& sizes = node->output()->sizes();
+      nhwc->output()->setSizes({sizes[0], sizes[2], sizes[3], sizes[1]});
+    }
+    output->copyMetadata(node->output());
+    node->output()->replaceAllUsesWith(output);
+    node->destroy();
+    return output;
+  }
+
+  // Replaces BatchNormalization in inference mode by
+  // Add(Mul(X, scale / sqrt(var + epsilon)), bias - mean * that), both
+  // constants of dims [C, 1, ..., 1] and of the type of X, which may differ
+  // from the one of the parameters since opset 15.
+  static bool lowerBatchNorm(Node* bn, Graph& graph) {
+    const int64_t rank = rankOf(bn->inputs()[0]);
+    const int32_t elem_type = elemTypeOf(bn);
+    if (elem_type != TensorProto_DataType_FLOAT &&
+        elem_type != TensorProto_DataType_FLOAT16 &&
+        elem_type != TensorProto_DataType_BFLOAT16 &&
+        elem_type != TensorProto_DataType_DOUBLE) {
+      return false;
+    }
+    if (bn->inputs().size() != 5 || rank < 3 ||
+        (bn->hasAttribute(Symbol("training_mode")) &&
+         bn->i(Symbol("training_mode")) != 0)) {
+      return false;
+    }
+    std::vector<const Tensor*> params;
+    for (size_t i = 1; i < 5; ++i) {
+      params.push_back(getConstantTensor(bn->inputs()[i], graph));
+      if (params.back() == nullptr) {
+        return false;
+      }
+    }
+    const float epsilon =
+        bn->hasAttribute(kepsilon) ? static_cast<float>(bn->f(kepsilon))
+                                   : 1e-5f;
+    Tensor factor, offset;
+    const bool folded =
+        params[0]->elem_type() == TensorProto_DataType_DOUBLE ||
+                elem_type == TensorProto_DataType_DOUBLE
+            ? fold<double>(TensorProto_DataType_DOUBLE, params, epsilon,
+                           elem_type, factor, offset)
+            : fold<float>(TensorProto_DataType_FLOAT, params, epsilon,
+                          elem_type, factor, offset);
+    if (!folded) {
+      return false;
+    }
+    std::vector<int64_t> dims(rank - 1, 1);
+    dims[0] = factor.sizes()[0];
+    factor.sizes() = dims;
+    offset.sizes() = dims;
+
+    InitializerIndex& initializers = InitializerIndex::get(graph);
+    Node* mul = graph.create(kMul, 1);
+    mul->addInput(bn->inputs()[0]);
+    mul->addInput(initializers.addInitializerAndInput(factor));
+    mul->insertBefore(bn);
+    mul->output()->setElemType(bn->output()->elemType());
+    if (bn->output()->has_sizes()) {
+      mul->output()->setSizes(bn->output()->sizes());
+    }
+    Node* add = graph.create(kAdd, 1);
+    add->addInput(mul->output());
+    add->addInput(initializers.addInitializerAndInput(offset));
+    add->insertBefore(bn);
+    add->output()->copyMetadata(bn->output());
+    bn->output()->replaceAllUsesWith(add->output());
+    std::vector<Value*> inputs(bn->inputs().begin() + 1, bn->inputs().end());
+    bn->destroy();
+    for (Value* input : inputs) {
+      if (input->uses().size() != 0) {
+        continue;
+      }
+      if (input->node()->kind() == kConstant) {
+        input->node()->destroy();
+      } else {
+        initializers.eraseInitializerAndInput(input);
+      }
+    }
+    return true;
+  }
+
+  template <typename T>
+  static bool fold(int32_t compute_type,
+                   const std::vector<const Tensor*>& params, float epsilon,
+                   int32_t elem_type, Tensor& factor, Tensor& offset) {
+    std::vector<T> scale, bias, mean, var;
+    if (!FuseBNIntoConv::load(*params[0], compute_type, scale) ||
+        !FuseBNIntoConv::load(*params[1], compute_type, bias) ||
+        !FuseBNIntoConv::load(*params[2], compute_type, mean) ||
+        !FuseBNIntoConv::load(*params[3], compute_type, var) ||
+        params[0]->sizes().size() != 1 || bias.size() != scale.size() ||
+        mean.size() != scale.size() || var.size() != scale.size()) {
+      return false;
+    }
+    // scale becomes the factor scale / sqrt(var + epsilon)
+    BatchNormScale(scale.data(), var.data(), static_cast<T>(epsilon),
+                   scale.size(), scale.data());
+    for (size_t i = 0; i < scale.size(); ++i) {
+      bias[i] -= mean[i] * scale[i];
+    }
+    factor = store(elem_type, compute_type, scale);
+    offset = store(elem_type, compute_type, bias);
+    return true;
+  }
+
+  // A 1D tensor of elem_type holding values.
+  template <typename T>
+  static Tensor store(int32_t elem_type, int32_t compute_type,
+                      const std::vector<T>& values) {
+    std::string bytes(values.size() * ElementSize(elem_type), '\0');
+    ConvertElements(compute_type, values.data(), elem_type, &bytes[0],
+                    values.size());
+    return MakeRawTensor(elem_type,
+                         {static_cast<int64_t>(values.size())},
+                         std::move(bytes));
+  }
+
+  // Replaces GlobalAveragePool or GlobalMaxPool by ReduceMean or ReduceMax
+  // over the spatial axes, keeping them. The axes are an input since opset
+  // 18, so pools are kept if the opset of the model is unknown.
+  static bool lowerGlobalPool(Node* pool, Graph& graph, int opset_version) {
+    const int64_t rank = rankOf(pool->inputs()[0]);
+    if (rank < 3 || opset_version == 0) {
+      return false;
+    }
+    std::vector<int64_t> axes;
+    for (int64_t axis = 2; axis < rank; ++axis) {
+      axes.push_back(axis);
+    }
+    const bool is_average = pool->kind() == Symbol("GlobalAveragePool");
+    Node* reduce = graph.create(
+        is_average ? kReduceMean : Symbol("ReduceMax"), 1);
+    reduce->addInput(pool->inputs()[0]);
+    if (opset_version < 18) {
+      reduce->is_(kaxes, std::move(axes));
+    } else {
+      Tensor t;
+      t.sizes().push_back(axes.size());
+      t.int64s() = axes;
+      t.elem_type() = TensorProto_DataType_INT64;
+      reduce->addInput(InitializerIndex::get(graph).addInitializerAndInput(t));
+    }
+    reduce->i_(kkeepdims, 1);
+    reduce->insertBefore(pool);
+    reduce->output()->copyMetadata(pool->output());
+    pool->output()->replaceAllUsesWith(reduce->output());
+    pool->destroy();
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,219 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   A = Shape(X)
+//   B = Gather(A, I)
+//   C = Shape(X)
+//   D = Gather(C, I)
+//   E = Concat(B, D)
+// After:
+//   A = Shape(X)
+//   B = Gather(A, I)
+//   E = Concat(B, B)
+//
+// Nodes of the same kind, with the same attributes and the same input
+// values compute the same outputs, so all but the first of them in
+// topological order are removed, their uses taking the outputs of the first
+// one. Visiting the nodes in that order merges whole duplicated chains.
+//
+// The pass leaves alone the impure operators of split.h and Dropout in
+// training mode, whose outputs may differ from one node to another, and the
+// nodes with subgraph attributes. Operators of other domains than the
+// default one are left alone too, since nothing tells whether they are
+// pure. Two nodes whose outputs are both graph outputs are kept as well.
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/split.h"
+#include "onnxoptimizer/tensor_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct EliminateCommonSubexpressions final : public FullGraphBasedPass {
+  explicit EliminateCommonSubexpressions()
+      : FullGraphBasedPass(PassType::Nop, PassEfficiency::Complete,
+                           PassOptimizationType::ComputeMemory) {}
+
+  std::string getPassName() const override {
+    return "eliminate_common_subexpressions";
+  }
+  PassAnalysisType getPassAnalysisType() const override {
+    return PassAnalysisType::CountBased;
+  }
+
+  std::shared_ptr<PostPassAnalysis> runPass(Graph& graph) override {
+    InitializerIndexScope initializer_index_scope;
+    const unsigned int num_eliminated = eliminateAll(graph);
+    return std::shared_ptr<PostPassAnalysis>(
+        new CountBasedPassAnalysis(this, num_eliminated, false, false));
+  }
+
+ private:
+  unsigned int eliminateAll(Graph& graph) {
+    unsigned int num_eliminated = 0;
+    // The first node of each hash, in topological order
+    std::unordered_multimap<size_t, Node*> seen;
+    for (auto it = graph.begin(); it != graph.end(); ++it) {
+      Node* n = *it;
+      DescendOnGraphAttributesUnconstrained(
+          n, [this, &num_eliminated](Graph& g) {
+            num_eliminated += eliminateAll(g);
+          });
+      if (!isDefaultDomain(n) || !is_pure_operator(n) ||
+          isTrainingDropout(n, graph) || hasSubgraphs(n)) {
+        continue;
+      }
+      const size_t hash = hashNode(n);
+      Node* original = nullptr;
+      auto range = seen.equal_range(hash);
+      for (auto entry = range.first; entry != range.second; ++entry) {
+        if (equivalent(entry->second, n)) {
+          original = entry->second;
+          break;
+        }
+      }
+      if (original == nullptr) {
+        seen.emplace(hash, n);
+        continue;
+      }
+      if (!tryReplacingAllUsesWith(n, original)) {
+        continue;
+      }
+      it.destroyCurrent();
+      ++num_eliminated;
+    }
+    return num_eliminated;
+  }
+
+  static bool isDefaultDomain(const Node* n) {
+    return n->domain().empty() || n->domain() == "ai.onnx";
+  }
+
+  // Dropout drops random elements in training mode, which is on unless its
+  // training_mode input is missing or a constant false, or before opset 7
+  // when its is_test attribute is 0.
+  static bool isTrainingDropout(Node* n, const Graph& graph) {
+    if (n->kind() != kDropout) {
+      return false;
+    }
+    if (n->hasAttribute(Symbol("is_test")) &&
+        n->kindOf(Symbol("is_test")) == AttributeKind::i &&
+        n->i(Symbol("is_test")) == 0) {
+      return true;
+    }
+    if (n->inputs().size() < 3 ||
+        n->inputs()[2]->node()->kind() == kUndefined) {
+      return false;
+    }
+    float training_mode;
+    return !getConstantScalar(n->inputs()[2], graph, &training_mode) ||
+           training_mode != 0;
+  }
+
+  static bool hasSubgraphs(Node* n) {
+    for (Symbol name : n->attributeNames()) {
+      const AttributeKind kind = n->kindOf(name);
+      if (kind == AttributeKind::g || kind == AttributeKind::gs) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void combine(size_t& hash, size_t value) {
+    hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  }
+
+  // Hashes the kind, domain, inputs and attribute names of n, which
+  // equivalent nodes share.
+  static size_t hashNode(Node* n) {
+    size_t hash = std::hash<uint32_t>()(n->kind());
+    combine(hash, std::hash<std::string>()(n->domain()));
+    combine(hash, n->outputs().size());
+    for (const Value* input : n->inputs()) {
+      combine(hash, std::hash<const Value*>()(input));
+    }
+    std::vector<Symbol> names = n->attributeNames();
+    std::sort(names.begin(), names.end());
+    for (Symbol name : names) {
+      combine(hash, std::hash<uint32_t>()(name));
+    }
+    return hash;
+  }
+
+  static bool equivalent(Node* a, Node* b) {
+    if (a->kind() != b->kind() || a->domain() != b->domain() ||
+        a->outputs().size() != b->outputs().size() ||
+        a->inputs().size() != b->inputs().size() ||
+        !std::equal(a->inputs().begin(), a->inputs().end(),
+                    b->inputs().begin())) {
+      return false;
+    }
+    std::vector<Symbol> names = a->attributeNames();
+    std::vector<Symbol> b_names = b->attributeNames();
+    std::sort(names.begin(), names.end());
+    std::sort(b_names.begin(), b_names.end());
+    if (names != b_names) {
+      return false;
+    }
+    for (Symbol name : names) {
+      if (!sameAttribute(a, b, name)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool sameAttribute(Node* a, Node* b, Symbol name) {
+    const AttributeKind kind = a->kindOf(name);
+    if (b->kindOf(name) != kind) {
+      return false;
+    }
+    switch (kind) {
+      case AttributeKind::f:
+        return a->f(name) == b->f(name);
+      case AttributeKind::fs:
+        return a->fs(name) == b->fs(name);
+      case AttributeKind::i:
+        return a->i(name) == b->i(name);
+      case AttributeKind::is:
+        return a->is(name) == b->is(name);
+      case AttributeKind::s:
+        return a->s(name) == b->s(name);
+      case AttributeKind::ss:
+        return a->ss(name) == b->ss(name);
+      case AttributeKind::t:
+        return sameTensor(a->t(name), b->t(name));
+      default:
+        // Tensor lists and type protos are not compared
+        return false;
+    }
+  }
+
+  static bool sameTensor(const Tensor& a, const Tensor& b) {
+    if (a.elem_type() != b.elem_type() || a.sizes() != b.sizes()) {
+      return false;
+    }
+    std::string a_scratch, b_scratch;
+    const char *a_data, *b_data;
+    size_t a_size, b_size;
+    return ElementBytes(a, a_scratch, &a_data, &a_size) &&
+           ElementBytes(b, b_scratch, &b_data, &b_size) && a_size == b_size &&
+           std::memcmp(a_data, b_data, a_size) == 0;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -27,8 +27,12 @@
 // we eliminate all duplicated initializers instead. That
 // may cause unexpected behavior in some rare cases.
 
-#include "onnx/defs/tensor_util.h"
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/tensor_util.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
@@ -43,106 +47,112 @@ struct EliminateDuplicateInitializer final : public FullGraphBasedPass {
   PassAnalysisType getPassAnalysisType() const override {
     return PassAnalysisType::CountBased;
   }
-  unsigned int EliminateInitializer(Graph &graph) {
-    unsigned int initializers_removed = 0;
-    const std::vector<Tensor> &initializers = graph.initializers();
-    std::map<std::vector<int64_t>, std::vector<std::string>> init_dict_by_shape;
 
+  // Fingerprint of the element type, shape and element bytes. Consumes the
+  // bytes a word at a time since initializers can be hundreds of megabytes.
+  static uint64_t fingerprint(const Tensor &tensor, const char *data,
+                              size_t size) {
+    const uint64_t kMul = 0x9e3779b97f4a7c15ULL;
+    uint64_t hash = static_cast<uint64_t>(tensor.elem_type()) * kMul;
+    const auto mix = [&hash, kMul](uint64_t word) {
+      word *= kMul;
+      word ^= word >> 32;
+      hash = (hash ^ word) * 0x100000001b3ULL;
+    };
+    for (int64_t dim : tensor.sizes()) {
+      mix(static_cast<uint64_t>(dim));
+    }
+    mix(size);
+    const size_t num_words = size / sizeof(uint64_t);
+    for (size_t i = 0; i < num_words; ++i) {
+      uint64_t word;
+      std::memcpy(&word, data + i * sizeof(uint64_t), sizeof(word));
+      mix(word);
+    }
+    uint64_t tail = 0;
+    if (size > num_words * sizeof(uint64_t)) {
+      std::memcpy(&tail, data + num_words * sizeof(uint64_t),
+                  size - num_words * sizeof(uint64_t));
+    }
+    mix(tail);
+    return hash;
+  }
+
+  static bool haveSameContent(const Tensor &a, const Tensor &b) {
+    if (a.elem_type() != b.elem_type() || a.sizes() != b.sizes()) {
+      return false;
+    }
+    std::string a_scratch;
+    std::string b_scratch;
+    const char *a_data;
+    const char *b_data;
+    size_t a_size;
+    size_t b_size;
+    return ElementBytes(a, a_scratch, &a_data, &a_size) &&
+           ElementBytes(b, b_scratch, &b_data, &b_size) && a_size == b_size &&
+           (a_size == 0 || std::memcmp(a_data, b_data, a_size) == 0);
+  }
+
+  unsigned int EliminateInitializer(Graph &graph) {
     // Make {name : Value} map
-    std::map<std::string, Value *> input_map;
+    std::unordered_map<std::string, Value *> input_map;
     for (auto inp : graph.inputs()) {
       if (inp->has_unique_name()) {
         input_map[inp->uniqueName()] = inp;
       }
     }
 
-    std::map<std::string, Value *> output_map;
+    std::unordered_set<std::string> output_names;
     for (auto out : graph.outputs()) {
       if (out->has_unique_name()) {
-        output_map[out->uniqueName()] = out;
+        output_names.insert(out->uniqueName());
       }
     }
 
-    // Cluster initializers by shape
-    for (auto initializer : initializers) {
+    // Initializers kept so far, by fingerprint. The graph is only modified
+    // once all duplicates are found, so pointers into it stay valid.
+    std::unordered_map<uint64_t, std::vector<const Tensor *>> kept;
+    std::vector<std::pair<Value *, Value *>> duplicates;
+    std::string scratch;
+    for (const Tensor &initializer : graph.initializers()) {
       if (!initializer.hasName()) {
         continue;
       }
       // Ignore initializer which is not an input
-      if (input_map.find(initializer.name()) == input_map.end()) {
+      const auto input = input_map.find(initializer.name());
+      if (input == input_map.end()) {
         continue;
       }
       // Ignore initializer which is output
-      if (output_map.find(initializer.name()) != output_map.end()) {
+      if (output_names.count(initializer.name()) > 0) {
         continue;
       }
-      auto initializers_iter = init_dict_by_shape.find(initializer.sizes());
-      if (initializers_iter != init_dict_by_shape.end()) {
-        initializers_iter->second.emplace_back(initializer.name());
+      const char *data;
+      size_t size;
+      if (!ElementBytes(initializer, scratch, &data, &size)) {
+        continue;
+      }
+      auto &candidates = kept[fingerprint(initializer, data, size)];
+      const Tensor *original = nullptr;
+      for (const Tensor *candidate : candidates) {
+        if (haveSameContent(*candidate, initializer)) {
+          original = candidate;
+          break;
+        }
+      }
+      if (original == nullptr) {
+        candidates.push_back(&initializer);
       } else {
-        std::vector<std::string> vec{initializer.name()};
-        init_dict_by_shape.insert(
-            std::make_pair(std::move(initializer.sizes()), vec));
+        duplicates.emplace_back(input->second,
+                                input_map.at(original->name()));
       }
     }
 
-    for (auto pair : init_dict_by_shape) {
-      std::set<std::string> visited;
-
-      // pair.second --> vector initializers with same shape
-      // Use iter_i, iter_j to loop it
-      for (auto iter_i = pair.second.begin(); iter_i != pair.second.end();
-           ++iter_i) {
-        if (visited.find(*iter_i) != visited.end()) {
-          continue;
-        }
-        const auto iter_i_initializer = graph.getInitializer(*iter_i);
-        if (iter_i_initializer == graph.initializers().end()) {
-          continue;
-        }
-        Tensor i_tensor = *iter_i_initializer;
-        Value *i_value = input_map.find(i_tensor.name())->second;
-
-#define DO_COMPARISON(data_type)                                             \
-  const std::vector<data_type> i_data = ParseData<data_type>(&i_tensor);     \
-  for (auto iter_j = iter_i + 1; iter_j != pair.second.end(); ++iter_j) {    \
-    const auto iter_j_initializer = graph.getInitializer(*iter_j);           \
-    if (iter_j_initializer == graph.initializers().end()) {                  \
-      visited.insert(*iter_j);                                               \
-      continue;                                                              \
-    }                                                                        \
-    Tensor j_tensor = *iter_j_initializer;                                   \
-    if (i_tensor.elem_type() != j_tensor.elem_type()) {                      \
-      continue;                                                              \
-    } else {                                                                 \
-      const std::vector<data_type> j_data = ParseData<data_type>(&j_tensor); \
-      if (std::equal(i_data.begin(), i_data.end(), j_data.begin())) {        \
-        visited.insert(*iter_j);                                             \
-        Value *j_value = input_map.find(j_tensor.name())->second;            \
-        j_value->replaceAllUsesWith(i_value);                                \
-        graph.eraseInitializerAndInput(j_value);                             \
-        initializers_removed++;                                              \
-      }                                                                      \
-    }                                                                        \
-  }
-#define CASE_DO_COMPARISON(ONNX_DTYPE_SUFFIX, CPP_DTYPE)           \
-  case ONNX_NAMESPACE::TensorProto_DataType_##ONNX_DTYPE_SUFFIX: { \
-    DO_COMPARISON(CPP_DTYPE)                                       \
-    break;                                                         \
-  }
-        switch (i_tensor.elem_type()) {
-          CASE_DO_COMPARISON(FLOAT, float)
-          CASE_DO_COMPARISON(DOUBLE, double)
-          CASE_DO_COMPARISON(INT32, int32_t)
-          CASE_DO_COMPARISON(INT64, int64_t)
-          default:
-            break;
-        }
-#undef CASE_DO_COMPARISON
-#undef DO_COMPARISON
-      }
+    for (const auto &duplicate : duplicates) {
+      duplicate.first->replaceAllUsesWith(duplicate.second);
+      graph.eraseInitializerAndInput(duplicate.first);
     }
-    return initializers_removed;
+    return duplicates.size();
   }
   std::shared_ptr<PostPassAnalysis> runPass(Graph &graph) override {
     auto initializers_removed = this->EliminateInitializer(graph);
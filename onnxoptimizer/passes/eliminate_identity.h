@@ -21,6 +21,10 @@ struct EliminateIdentity final : public PredicateBasedPass {
     return "eliminate_identity";
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kIdentity};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kIdentity;
   }
@@ -31,6 +31,9 @@ struct EliminateIfWithConstCond final : public PredicateBasedPass {
   }
 
   // step 1: find "if" node with constant cond (i.e. const true or false)
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kIf};
+  }
   bool patternMatchPredicate(Node *node) override {
     if (node->kind() == kIf) {
       const auto cond_value = node->input();
@@ -54,7 +57,8 @@ struct EliminateIfWithConstCond final : public PredicateBasedPass {
     if (cond_value->node()->kind() == kConstant) {
       cond_tensor = cond_value->node()->t(kvalue);
     } else {
-      cond_tensor = *graph.getInitializer(cond_value->uniqueName());
+      cond_tensor =
+          *InitializerIndex::get(graph).find(cond_value->uniqueName());
     }
     const bool cond = static_cast<bool>(cond_tensor.data<int32_t>()[0]);
     auto &parent_graph = graph;
@@ -0,0 +1,289 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   Y = Reshape(X, [0, 0, 16]), X has shape [batch, seq, 16]
+//   Z = Slice(Y, starts=[0], ends=[INT64_MAX], axes=[1])
+// After:
+//   Z = X
+//
+// Removes the nodes whose output is their first input, which the shape of
+// that input and the constant inputs or attributes of the node tell:
+// Reshape to the same shape, Expand and Tile that don't broadcast or
+// repeat, Slice over the full range of every sliced axis, Split into a
+// single output, Concat of a single input and Resize by a scale of 1. Dims
+// are compared statically or by their dim_param.
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct EliminateNopByShape final : public PredicateBasedPass {
+  explicit EliminateNopByShape()
+      : PredicateBasedPass(PassType::Nop, PassEfficiency::Complete,
+                           PassOptimizationType::ComputeMemory) {}
+
+  std::string getPassName() const override {
+    return "eliminate_nop_by_shape";
+  }
+
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kReshape, kExpand,  kTile,  kSlice,
+            kConcat,  kResize, Symbol("Split")};
+  }
+
+  bool initializePass(Graph& graph) override {
+    // Subgraphs don't know their opset, so the one of the model is used
+    opset_version = getOpsetVersion(graph);
+    return false;
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    const NodeKind kind = node->kind();
+    return (kind == kReshape || kind == kExpand || kind == kTile ||
+            kind == kSlice || kind == Symbol("Split") || kind == kConcat ||
+            kind == kResize) &&
+           !node->inputs().empty();
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    if (node->outputs().size() != 1 || !isNop(node, graph) ||
+        !tryReplacingAllUsesWith(node->output(), node->inputs()[0])) {
+      return false;
+    }
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+
+ private:
+  // The opset of the model, 0 if unknown
+  int opset_version = 0;
+
+  bool isNop(Node* node, const Graph& graph) const {
+    const NodeKind kind = node->kind();
+    if (kind == Symbol("Split")) {
+      return true;
+    }
+    if (kind == kConcat) {
+      return node->inputs().size() == 1;
+    }
+    // The output has the same shape as the input if inferred so, which is
+    // all it takes for the view-like operators.
+    if ((kind == kReshape || kind == kExpand || kind == kTile) &&
+        sameSizes(node->inputs()[0], node->output())) {
+      return true;
+    }
+    if (kind == kReshape) {
+      return isNopReshape(node, graph);
+    }
+    if (kind == kExpand) {
+      return isNopExpand(node, graph);
+    }
+    if (kind == kTile) {
+      return isNopTile(node, graph);
+    }
+    // The inputs of Slice and Resize depend on the opset
+    if (opset_version == 0) {
+      return false;
+    }
+    if (kind == kSlice) {
+      return isNopSlice(node, graph, opset_version);
+    }
+    return isNopResize(node, graph, opset_version);
+  }
+
+  static bool isStaticDim(const Dimension& dim, int64_t value) {
+    return dim.is_int && dim.dim == value;
+  }
+
+  // Every dim of the shape input is the input dim it stands for: a 0 that
+  // copies it, the one -1 left to infer it, or its static value.
+  static bool isNopReshape(Node* node, const Graph& graph) {
+    const Value* input = node->inputs()[0];
+    std::vector<int64_t> shape;
+    if (node->inputs().size() < 2 || !input->has_sizes() ||
+        !getConstantInts(node->inputs()[1], graph, &shape) ||
+        shape.size() != input->sizes().size()) {
+      return false;
+    }
+    const bool allowzero =
+        node->hasAttribute(Symbol("allowzero")) &&
+        node->i(Symbol("allowzero")) != 0;
+    bool inferred_dim = false;
+    for (size_t i = 0; i < shape.size(); ++i) {
+      if (shape[i] == 0 && !allowzero) {
+        continue;
+      }
+      if (shape[i] == -1 && !inferred_dim) {
+        inferred_dim = true;
+        continue;
+      }
+      if (!isStaticDim(input->sizes()[i], shape[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Every dim of the shape input is 1 or the input dim it is aligned with,
+  // so that broadcasting leaves the input shape alone.
+  static bool isNopExpand(Node* node, const Graph& graph) {
+    const Value* input = node->inputs()[0];
+    std::vector<int64_t> shape;
+    if (node->inputs().size() < 2 || !input->has_sizes() ||
+        !getConstantInts(node->inputs()[1], graph, &shape) ||
+        shape.size() > input->sizes().size()) {
+      return false;
+    }
+    const size_t offset = input->sizes().size() - shape.size();
+    for (size_t i = 0; i < shape.size(); ++i) {
+      if (shape[i] != 1 &&
+          !isStaticDim(input->sizes()[offset + i], shape[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool isNopTile(Node* node, const Graph& graph) {
+    std::vector<int64_t> repeats;
+    if (node->inputs().size() < 2 ||
+        !getConstantInts(node->inputs()[1], graph, &repeats)) {
+      return false;
+    }
+    for (int64_t repeat : repeats) {
+      if (repeat != 1) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Reads the optional input i of node into values if it is given, false
+  // if it is not a constant.
+  static bool optionalConstantInts(Node* node, size_t i, const Graph& graph,
+                                   std::vector<int64_t>* values) {
+    if (i >= node->inputs().size() ||
+        node->inputs()[i]->node()->kind() == kUndefined) {
+      return true;
+    }
+    return getConstantInts(node->inputs()[i], graph, values);
+  }
+
+  // Every sliced axis is taken with a step of 1, from a start that clamps to
+  // 0 to an end that clamps to its dim.
+  static bool isNopSlice(Node* node, const Graph& graph, int opset_version) {
+    const Value* input = node->inputs()[0];
+    std::vector<int64_t> starts, ends, axes, steps;
+    if (opset_version < 10) {
+      if (!node->hasAttribute(kstarts) || !node->hasAttribute(kends)) {
+        return false;
+      }
+      starts = node->is(kstarts);
+      ends = node->is(kends);
+      if (node->hasAttribute(kaxes)) {
+        axes = node->is(kaxes);
+      }
+    } else {
+      if (node->inputs().size() < 3 ||
+          !getConstantInts(node->inputs()[1], graph, &starts) ||
+          !getConstantInts(node->inputs()[2], graph, &ends) ||
+          !optionalConstantInts(node, 3, graph, &axes) ||
+          !optionalConstantInts(node, 4, graph, &steps)) {
+        return false;
+      }
+    }
+    if (axes.empty()) {
+      for (size_t i = 0; i < starts.size(); ++i) {
+        axes.push_back(static_cast<int64_t>(i));
+      }
+    }
+    if (starts.size() != ends.size() || axes.size() != starts.size() ||
+        (!steps.empty() && steps.size() != starts.size())) {
+      return false;
+    }
+    for (size_t i = 0; i < axes.size(); ++i) {
+      if (!steps.empty() && steps[i] != 1) {
+        return false;
+      }
+      int64_t axis = axes[i];
+      if (axis < 0) {
+        if (!input->has_sizes()) {
+          return false;
+        }
+        axis += static_cast<int64_t>(input->sizes().size());
+      }
+      const bool static_dim =
+          input->has_sizes() && axis >= 0 &&
+          axis < static_cast<int64_t>(input->sizes().size()) &&
+          input->sizes()[axis].is_int;
+      const int64_t dim = static_dim ? input->sizes()[axis].dim : 0;
+      const bool full_start =
+          starts[i] == 0 || (static_dim && starts[i] <= -dim);
+      // Ends past any dim a tensor may have, as exporters write them
+      const bool full_end =
+          ends[i] >= std::numeric_limits<int32_t>::max() ||
+          (static_dim && ends[i] >= dim);
+      if (!full_start || !full_end) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Scales of 1, or sizes equal to the input dims, under a coordinate
+  // transformation which maps every output pixel onto the input pixel at
+  // the same position.
+  static bool isNopResize(Node* node, const Graph& graph,
+                          int opset_version) {
+    const Value* input = node->inputs()[0];
+    if (node->hasAttribute(kcoordinate_transformation_mode)) {
+      const std::string& mode = node->s(kcoordinate_transformation_mode);
+      if (mode == "tf_crop_and_resize" || mode == "tf_half_pixel_for_nn") {
+        return false;
+      }
+    }
+    const size_t scales_index = opset_version < 11 ? 1 : 2;
+    std::vector<float> scales;
+    if (scales_index < node->inputs().size() &&
+        node->inputs()[scales_index]->node()->kind() != kUndefined &&
+        getConstantFloats(node->inputs()[scales_index], graph, &scales) &&
+        !scales.empty()) {
+      for (float scale : scales) {
+        if (scale != 1.0f) {
+          return false;
+        }
+      }
+      return true;
+    }
+    std::vector<int64_t> sizes;
+    if (scales_index != 2 || node->inputs().size() < 4 ||
+        node->hasAttribute(kaxes) || !input->has_sizes() ||
+        !getConstantInts(node->inputs()[3], graph, &sizes) ||
+        sizes.size() != input->sizes().size()) {
+      return false;
+    }
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      if (!isStaticDim(input->sizes()[i], sizes[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
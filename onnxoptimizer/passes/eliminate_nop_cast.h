@@ -21,6 +21,10 @@ struct EliminateNopCast final : public PredicateBasedPass {
     return "eliminate_nop_cast";
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kCast};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     return (node->kind() == kCast && node->hasAttribute(kto) &&
             node->input()->elemType() == node->i(kto));
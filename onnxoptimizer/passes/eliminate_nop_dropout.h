@@ -21,6 +21,10 @@ struct EliminateNopDropout final : public PredicateBasedPass {
     return "eliminate_nop_dropout";
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kDropout};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     // in opset 12, ratio is an input of Dropout rather than an attribute,
     // however we don't want to to remove Dropout fro opset 12+, since it
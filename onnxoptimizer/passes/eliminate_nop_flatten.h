@@ -21,6 +21,10 @@ struct EliminateNopFlatten final : public PredicateBasedPass {
     return "eliminate_nop_flatten";
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {Symbol("Flatten")};
+  }
+
   bool patternMatchPredicate(Node *node) override {
     if (node->kind() != Symbol("Flatten")) {
       return false;
@@ -36,10 +36,11 @@ struct EliminateNopPad final : public PredicateBasedPass {
     } else {
       // opset 11 and above
       const auto& pads_name = node->inputs()[1]->uniqueName();
-      const auto pads_initializer = graph.getInitializer(pads_name);
+      InitializerIndex& initializers = InitializerIndex::get(graph);
+      const auto pads_initializer = initializers.find(pads_name);
       // 'pad' node has the 'pads' input which has not been initialized -
       // can't proceed with elimination
-      if (pads_initializer == graph.initializers().end())
+      if (pads_initializer == initializers.end())
         return false;
 
       // validate values within 'pads'
@@ -58,6 +59,10 @@ struct EliminateNopPad final : public PredicateBasedPass {
     return false;
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kPad};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kPad;
   }
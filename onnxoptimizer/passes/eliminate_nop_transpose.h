@@ -28,6 +28,10 @@ struct EliminateNopTranspose final : public PredicateBasedPass {
     return true;
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kTranspose};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     return (node->kind() == kTranspose && node->hasAttribute(kperm)) &&
            is_nop_transpose(node->is(kperm));
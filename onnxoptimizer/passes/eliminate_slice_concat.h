@@ -0,0 +1,361 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   A, B = Split(X, axis=1)
+//   Y = Concat(W, A, B, axis=1)
+//   Z = Slice(Y, starts=[0], ends=[16], axes=[1]), W has shape [batch, 16]
+// After:
+//   Y = Concat(W, X, axis=1)
+//   Z = W
+//
+// Removes the round-trips through Concat: the pieces of a tensor that a
+// Split or contiguous Slices take along the axis of the Concat using them,
+// in order and all of them, are replaced by that tensor; and a Slice or a
+// Split of a Concat which takes out exactly its inputs along the same axis
+// is replaced by them. Slice bounds have to be constant, they are compared
+// with the static dims of the inputs, or the dim of every output of a Split
+// with the one of the Concat input it stands for. Running
+// fuse_consecutive_concats first turns nested Concats into a single one.
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct EliminateSliceConcat final : public PredicateBasedPass {
+  explicit EliminateSliceConcat()
+      : PredicateBasedPass(PassType::Nop, PassEfficiency::Complete,
+                           PassOptimizationType::ComputeMemory) {}
+
+  std::string getPassName() const override {
+    return "eliminate_slice_concat";
+  }
+
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kConcat, kSlice, Symbol("Split")};
+  }
+
+  bool initializePass(Graph& graph) override {
+    // Subgraphs don't know their opset, so the one of the model is used
+    opset_version = getOpsetVersion(graph);
+    return false;
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    const NodeKind kind = node->kind();
+    if (kind == kConcat) {
+      return node->hasAttribute(kaxis) && node->inputs().size() > 1;
+    }
+    return (kind == kSlice || kind == Symbol("Split")) &&
+           !node->inputs().empty() &&
+           node->inputs()[0]->node()->kind() == kConcat &&
+           node->inputs()[0]->node()->hasAttribute(kaxis);
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    if (node->kind() == kConcat) {
+      return joinPieces(node, graph, destroy_current);
+    }
+    if (node->kind() == kSlice) {
+      return sliceConcat(node, graph, destroy_current);
+    }
+    return splitConcat(node, destroy_current);
+  }
+
+ private:
+  // The opset of the model, 0 if unknown
+  int opset_version = 0;
+
+  // The end of a range which goes to the end of the axis, its dim unknown
+  static constexpr int64_t kToEnd = std::numeric_limits<int64_t>::max();
+
+  // A range along an axis of a tensor
+  struct Piece {
+    Value* source;
+    int64_t axis;
+    int64_t start;
+    int64_t end;
+  };
+
+  // Makes a negative axis of a tensor with the sizes of value count from 0
+  static bool normalizeAxis(const Value* value, int64_t* axis) {
+    if (*axis >= 0) {
+      return true;
+    }
+    if (!value->has_sizes()) {
+      return false;
+    }
+    *axis += static_cast<int64_t>(value->sizes().size());
+    return *axis >= 0;
+  }
+
+  static bool staticDim(const Value* value, int64_t axis, int64_t* dim) {
+    if (!value->has_sizes() ||
+        axis >= static_cast<int64_t>(value->sizes().size()) ||
+        !value->sizes()[axis].is_int) {
+      return false;
+    }
+    *dim = value->sizes()[axis].dim;
+    return true;
+  }
+
+  // The range a Slice with step 1 along a single axis takes, with negative
+  // bounds counted from the end and bounds past it clamped to the dim if it
+  // is static. The inputs of Slice depend on the opset, so it is only read
+  // if that is known.
+  bool slicePiece(Node* slice, const Graph& graph, Piece* piece) const {
+    std::vector<int64_t> starts, ends, axes, steps;
+    if (opset_version == 0) {
+      return false;
+    }
+    if (opset_version < 10) {
+      if (!slice->hasAttribute(kstarts) || !slice->hasAttribute(kends)) {
+        return false;
+      }
+      starts = slice->is(kstarts);
+      ends = slice->is(kends);
+      if (slice->hasAttribute(kaxes)) {
+        axes = slice->is(kaxes);
+      }
+    } else {
+      const auto& inputs = slice->inputs();
+      if (inputs.size() < 3 ||
+          !getConstantInts(inputs[1], graph, &starts) ||
+          !getConstantInts(inputs[2], graph, &ends) ||
+          (inputs.size() > 3 && inputs[3]->node()->kind() != kUndefined &&
+           !getConstantInts(inputs[3], graph, &axes)) ||
+          (inputs.size() > 4 && inputs[4]->node()->kind() != kUndefined &&
+           !getConstantInts(inputs[4], graph, &steps))) {
+        return false;
+      }
+    }
+    if (starts.size() != 1 || ends.size() != 1 || axes.size() > 1 ||
+        (!steps.empty() && (steps.size() != 1 || steps[0] != 1))) {
+      return false;
+    }
+    piece->source = slice->inputs()[0];
+    piece->axis = axes.empty() ? 0 : axes[0];
+    if (!normalizeAxis(piece->source, &piece->axis)) {
+      return false;
+    }
+    int64_t start = starts[0];
+    int64_t end = ends[0];
+    int64_t dim = 0;
+    if (staticDim(piece->source, piece->axis, &dim)) {
+      start = start < 0 ? std::max<int64_t>(start + dim, 0)
+                        : std::min(start, dim);
+      end = end < 0 ? std::max<int64_t>(end + dim, 0) : std::min(end, dim);
+    } else if (start < 0 || end < 0) {
+      return false;
+    } else if (end >= std::numeric_limits<int32_t>::max()) {
+      // Ends past any dim a tensor may have, as exporters write them
+      end = kToEnd;
+    }
+    if (start > end) {
+      return false;
+    }
+    piece->start = start;
+    piece->end = end;
+    return true;
+  }
+
+  // Whether piece ends at the end of its axis
+  static bool reachesEnd(const Piece& piece) {
+    int64_t dim = 0;
+    return piece.end == kToEnd ||
+           (staticDim(piece.source, piece.axis, &dim) && piece.end == dim);
+  }
+
+  // The number of inputs of concat from first on which are the outputs of a
+  // Split along axis, all of them and in order, or 0.
+  static size_t splitRun(Node* concat, size_t first, int64_t axis) {
+    Value* value = concat->inputs()[first];
+    Node* split = value->node();
+    if (split->kind() != Symbol("Split") || split->inputs().empty() ||
+        value->offset() != 0) {
+      return 0;
+    }
+    int64_t split_axis = split->hasAttribute(kaxis) ? split->i(kaxis) : 0;
+    const size_t count = split->outputs().size();
+    if (!normalizeAxis(split->inputs()[0], &split_axis) ||
+        split_axis != axis || first + count > concat->inputs().size()) {
+      return 0;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (concat->inputs()[first + i] != split->outputs()[i]) {
+        return 0;
+      }
+    }
+    return count;
+  }
+
+  // The number of inputs of concat from first which are Slices along axis
+  // of a tensor, one after another from its start to its end, or 0.
+  size_t sliceRun(Node* concat, size_t first, int64_t axis,
+                  const Graph& graph) const {
+    Piece first_piece;
+    if (concat->inputs()[first]->node()->kind() != kSlice ||
+        !slicePiece(concat->inputs()[first]->node(), graph, &first_piece) ||
+        first_piece.axis != axis || first_piece.start != 0) {
+      return 0;
+    }
+    Piece last = first_piece;
+    for (size_t i = first; i < concat->inputs().size(); ++i) {
+      if (i > first) {
+        Piece piece;
+        Node* slice = concat->inputs()[i]->node();
+        if (slice->kind() != kSlice || !slicePiece(slice, graph, &piece) ||
+            piece.source != last.source || piece.axis != axis ||
+            last.end == kToEnd || piece.start != last.end) {
+          return 0;
+        }
+        last = piece;
+      }
+      if (reachesEnd(last)) {
+        return i - first + 1;
+      }
+    }
+    return 0;
+  }
+
+  bool joinPieces(Node* concat, Graph& graph,
+                  NodeDestroyType& destroy_current) {
+    int64_t axis = concat->i(kaxis);
+    if (!normalizeAxis(concat->output(), &axis)) {
+      return false;
+    }
+    std::vector<Node*> pieces;
+    Value* whole = nullptr;
+    for (size_t i = 0; i < concat->inputs().size(); ++i) {
+      size_t count = splitRun(concat, i, axis);
+      if (count == 0) {
+        count = sliceRun(concat, i, axis, graph);
+      }
+      if (count == 0) {
+        continue;
+      }
+      Value* source = concat->inputs()[i]->node()->inputs()[0];
+      if (count == concat->inputs().size()) {
+        whole = source;
+      }
+      for (size_t j = 0; j < count; ++j) {
+        pieces.push_back(concat->inputs()[i + j]->node());
+      }
+      if (whole != nullptr) {
+        break;
+      }
+      concat->replaceInput(i, source);
+      for (size_t j = 1; j < count; ++j) {
+        concat->removeInput(i + 1);
+      }
+    }
+    if (pieces.empty()) {
+      return false;
+    }
+    if (whole != nullptr) {
+      if (!tryReplacingAllUsesWith(concat->output(), whole)) {
+        return false;
+      }
+      concat->removeAllInputs();
+      destroy_current = NodeDestroyType::DestroyOne;
+    }
+    destroyDeadNodes(pieces);
+    return true;
+  }
+
+  // A Slice of a Concat which takes out one of its inputs
+  bool sliceConcat(Node* slice, const Graph& graph,
+                   NodeDestroyType& destroy_current) {
+    Node* concat = slice->inputs()[0]->node();
+    Piece piece;
+    int64_t axis = concat->i(kaxis);
+    if (!normalizeAxis(concat->output(), &axis) ||
+        !slicePiece(slice, graph, &piece) || piece.axis != axis) {
+      return false;
+    }
+    const auto& inputs = concat->inputs();
+    int64_t offset = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      int64_t dim = 0;
+      const bool static_dim = staticDim(inputs[i], axis, &dim);
+      if (piece.start == offset &&
+          ((static_dim && piece.end == offset + dim) ||
+           (i + 1 == inputs.size() && reachesEnd(piece)))) {
+        return replaceWith(slice, inputs[i], destroy_current);
+      }
+      if (!static_dim) {
+        return false;
+      }
+      offset += dim;
+    }
+    return false;
+  }
+
+  // A Split of a Concat into outputs of the same shapes as its inputs
+  bool splitConcat(Node* split, NodeDestroyType& destroy_current) {
+    Node* concat = split->inputs()[0]->node();
+    int64_t concat_axis = concat->i(kaxis);
+    int64_t split_axis = split->hasAttribute(kaxis) ? split->i(kaxis) : 0;
+    const auto& inputs = concat->inputs();
+    if (!normalizeAxis(concat->output(), &concat_axis) ||
+        !normalizeAxis(concat->output(), &split_axis) ||
+        concat_axis != split_axis ||
+        split->outputs().size() != inputs.size()) {
+      return false;
+    }
+    // A value replacing a graph output takes its name, so it can't replace
+    // two of them, as when the Concat takes the same input twice.
+    const auto& graph_outputs = split->owningGraph()->outputs();
+    std::vector<const Value*> replacing_graph_outputs;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      if (!sameSizes(split->outputs()[i], inputs[i]) ||
+          areTwoValuesBothInputOrOutput(split->outputs()[i], inputs[i])) {
+        return false;
+      }
+      if (std::find(graph_outputs.begin(), graph_outputs.end(),
+                    split->outputs()[i]) == graph_outputs.end()) {
+        continue;
+      }
+      if (std::find(replacing_graph_outputs.begin(),
+                    replacing_graph_outputs.end(),
+                    inputs[i]) != replacing_graph_outputs.end()) {
+        return false;
+      }
+      replacing_graph_outputs.push_back(inputs[i]);
+    }
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      split->outputs()[i]->replaceAllUsesWith(inputs[i]);
+    }
+    return replaceWith(split, nullptr, destroy_current);
+  }
+
+  // Replaces the output of node with value, unless it is nullptr, and
+  // destroys node and the nodes it leaves unused.
+  static bool replaceWith(Node* node, Value* value,
+                          NodeDestroyType& destroy_current) {
+    if (value != nullptr && !tryReplacingAllUsesWith(node->output(), value)) {
+      return false;
+    }
+    Node* concat = node->inputs()[0]->node();
+    node->removeAllInputs();
+    destroyDeadNodes({concat});
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
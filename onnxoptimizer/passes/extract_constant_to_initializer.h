@@ -29,6 +29,10 @@ struct ExtractConstantToInitializer final : public PredicateBasedPass {
     return "extract_constant_to_initializer";
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kConstant};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kConstant;
   }
@@ -36,17 +40,19 @@ struct ExtractConstantToInitializer final : public PredicateBasedPass {
   bool runTransform(Node* node, Graph& graph,
                     NodeDestroyType& destroy_current) override {
     Tensor t = node->t(kvalue);
+    InitializerIndex& initializers = InitializerIndex::get(graph);
     Value* new_init;
     if (node->output()->has_unique_name() &&
         std::find(graph.outputs().rbegin(), graph.outputs().rend(),
                   node->output()) == graph.outputs().rend()) {
-      new_init = graph.addInitializerAndInput(t, node->output()->uniqueName());
+      new_init =
+          initializers.addInitializerAndInput(t, node->output()->uniqueName());
       node->output()->setUniqueName(
           ONNX_NAMESPACE::to_string(graph.getNextUnique()), false);
     } else {
       // the unique_name will be set in `replaceAllUsesWith` if
       // node->output() is in graph output
-      new_init = graph.addInitializerAndInput(t);
+      new_init = initializers.addInitializerAndInput(t);
     }
     const bool replacing_success =
         tryReplacingAllUsesWith(node->output(), new_init);
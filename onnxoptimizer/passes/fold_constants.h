@@ -0,0 +1,150 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   A, B are in the initializer list
+//   S = Shape(X), X having static dims
+//   C = Add(A, B)
+//   D = Reshape(C, S)
+// After:
+//   A, B, D are in the initializer list
+//
+// Computes the nodes whose inputs are all initializers or Constant nodes
+// with the reference kernels, and replaces their outputs with initializers.
+// Shape and Size only need the dims of their input to be static. Folding
+// stops at outputs that would be much larger than the inputs, e.g. of
+// ConstantOfShape and Expand, to keep the model small.
+
+#include <algorithm>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/reference_kernels.h"
+#include "onnxoptimizer/tensor_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct FoldConstants final : public PredicateBasedPass {
+  explicit FoldConstants()
+      : PredicateBasedPass(PassType::Fuse, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "fold_constants";
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    if (node->kind() == kConstant || !isDefaultDomain(node) ||
+        !HasReferenceKernel(node->kind()) || node->outputs().empty()) {
+      return false;
+    }
+    const Graph& graph = *node->owningGraph();
+    for (Value* output : node->outputs()) {
+      if (std::find(graph.outputs().rbegin(), graph.outputs().rend(),
+                    output) != graph.outputs().rend()) {
+        return false;
+      }
+    }
+    if (isShapeOnly(node)) {
+      return hasStaticDims(node->input());
+    }
+    for (Value* input : node->inputs()) {
+      if (input->node()->kind() != kUndefined &&
+          !isConstantValue(input, graph)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    InitializerIndex& initializers = InitializerIndex::get(graph);
+    // Keeps the tensors of the inputs alive while the kernel runs.
+    std::vector<Tensor> values;
+    values.reserve(node->inputs().size());
+    std::vector<const Tensor*> inputs;
+    size_t input_bytes = 0;
+    for (Value* input : node->inputs()) {
+      const Node* producer = input->node();
+      if (producer->kind() == kUndefined) {
+        inputs.push_back(nullptr);
+      } else if (isShapeOnly(node)) {
+        Tensor tensor;
+        tensor.elem_type() = input->elemType();
+        for (const Dimension& dim : input->sizes()) {
+          tensor.sizes().push_back(dim.dim);
+        }
+        values.push_back(std::move(tensor));
+        inputs.push_back(&values.back());
+      } else if (producer->kind() == kConstant) {
+        inputs.push_back(&producer->t(kvalue));
+      } else {
+        const auto initializer = initializers.find(input->uniqueName());
+        if (initializer == initializers.end()) {
+          return false;
+        }
+        inputs.push_back(&*initializer);
+      }
+      if (inputs.back() != nullptr) {
+        input_bytes += ElementCount(inputs.back()->sizes()) *
+                       ElementSize(inputs.back()->elem_type());
+      }
+    }
+    // Outputs may always be this large, even when the inputs are smaller.
+    const size_t max_growth_bytes = 64 * 1024;
+    std::vector<Tensor> outputs;
+    if (!RunReferenceKernel(node, inputs,
+                            std::max(input_bytes, max_growth_bytes),
+                            &outputs)) {
+      return false;
+    }
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      Value* output = node->outputs()[i];
+      Value* new_init;
+      if (output->has_unique_name()) {
+        new_init = initializers.addInitializerAndInput(outputs[i],
+                                                       output->uniqueName());
+        output->setUniqueName(
+            ONNX_NAMESPACE::to_string(graph.getNextUnique()), false);
+      } else {
+        new_init = initializers.addInitializerAndInput(outputs[i]);
+      }
+      if (!tryReplacingAllUsesWith(output, new_init)) {
+        return false;
+      }
+    }
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+
+ private:
+  static bool isDefaultDomain(const Node* node) {
+    return node->domain().empty() || node->domain() == "ai.onnx";
+  }
+
+  static bool isShapeOnly(const Node* node) {
+    return node->kind() == Symbol("Shape") || node->kind() == Symbol("Size");
+  }
+
+  static bool hasStaticDims(const Value* value) {
+    if (!value->has_sizes() || value->elemType() == 0) {
+      return false;
+    }
+    for (const Dimension& dim : value->sizes()) {
+      if (!dim.is_int || dim.dim < 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,167 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   Z = Conv(X, W, B)
+//   Y = Relu(Z)
+// After:
+//   Y = com.microsoft.FusedConv(X, W, B) with activation = "Relu"
+//
+// the pass can handle the case satisfy all following conditions:
+//   condition 1: the activation is Relu, Clip, LeakyRelu or HardSigmoid,
+//                the latter with its alpha and beta passed in
+//                activation_params, Clip with its min and max, which must
+//                be attributes, Constant nodes or initializers
+//   condition 2: Output of initial conv has no other uses
+//   condition 3: Conv computes in FLOAT, the only type FusedConv supports
+//
+// FusedConv is a contrib operator of ONNX Runtime, not part of the ONNX
+// standard, so the pass is of type Other: it is not one of the fuse and
+// elimination passes and only runs when asked for by name. It adds the
+// com.microsoft opset to the model when it fuses anything.
+
+#include <limits>
+
+#include "onnx/common/assertions.h"
+#include "onnxoptimizer/pass.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct FuseActivationIntoConv final : public PredicateBasedPass {
+  explicit FuseActivationIntoConv()
+      : PredicateBasedPass(PassType::Other, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "fuse_activation_into_conv";
+  }
+
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {Symbol("Relu"), Symbol("Clip"), Symbol("LeakyRelu"),
+            Symbol("HardSigmoid")};
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    const NodeKind kind = node->kind();
+    if (kind != Symbol("Relu") && kind != Symbol("Clip") &&
+        kind != Symbol("LeakyRelu") && kind != Symbol("HardSigmoid")) {
+      return false;
+    }
+    const Node* conv = node->inputs()[0]->node();
+    return isDefaultDomain(node) && conv->kind() == kConv &&
+           isDefaultDomain(conv) && conv->outputs().size() == 1;
+  }
+
+  bool runTransform(Node* act, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    Node* conv = act->inputs()[0]->node();
+    if (conv->output()->uses().size() > 1 || act->outputs().size() > 1 ||
+        computeType(conv) != TensorProto_DataType_FLOAT) {
+      return false;
+    }
+    std::vector<double> params;
+    if (!activationParams(act, graph, params)) {
+      return false;
+    }
+
+    Node* fused = graph.create(Symbol("FusedConv"), conv->inputs(), 1);
+    fused->setDomain(microsoftDomain());
+    fused->copyAttributes(*conv);
+    fused->s_(Symbol("activation"), act->kind().toString());
+    if (!params.empty()) {
+      fused->fs_(Symbol("activation_params"), std::move(params));
+    }
+    fused->output()->copyMetadata(act->output());
+    fused->insertBefore(act);
+    if (!tryReplacingAllUsesWith(act->output(), fused->output())) {
+      fused->destroy();
+      return false;
+    }
+    // Leaves act without inputs, so that conv can go before it
+    act->removeAllInputs();
+    conv->destroy();
+    fused_ = true;
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+
+  bool finalizePass(Graph& graph) override {
+    if (!fused_) {
+      return false;
+    }
+    fused_ = false;
+    ensureOpsetImport(graph, microsoftDomain(), 1);
+    return true;
+  }
+
+ private:
+  static const char* microsoftDomain() {
+    return "com.microsoft";
+  }
+
+  // Whether some node was rewritten, so that the opset must be imported.
+  bool fused_ = false;
+
+  static bool isDefaultDomain(const Node* node) {
+    return node->domain().empty() || node->domain() == "ai.onnx";
+  }
+
+  // The element type of conv, as known from its output or inputs.
+  static int32_t computeType(const Node* conv) {
+    if (conv->output()->elemType() != TensorProto_DataType_UNDEFINED) {
+      return conv->output()->elemType();
+    }
+    for (const Value* input : conv->inputs()) {
+      if (input->elemType() != TensorProto_DataType_UNDEFINED) {
+        return input->elemType();
+      }
+    }
+    return TensorProto_DataType_UNDEFINED;
+  }
+
+  // The activation_params of FusedConv for act, in the order ONNX Runtime
+  // reads them.
+  static bool activationParams(const Node* act, Graph& graph,
+                               std::vector<double>& params) {
+    const NodeKind kind = act->kind();
+    if (kind == Symbol("LeakyRelu")) {
+      params.push_back(act->hasAttribute(kalpha) ? act->f(kalpha) : 0.01);
+    } else if (kind == Symbol("HardSigmoid")) {
+      params.push_back(act->hasAttribute(kalpha) ? act->f(kalpha) : 0.2);
+      params.push_back(act->hasAttribute(kbeta) ? act->f(kbeta) : 0.5);
+    } else if (kind == Symbol("Clip")) {
+      float min = std::numeric_limits<float>::lowest();
+      float max = std::numeric_limits<float>::max();
+      if (act->hasAttribute(Symbol("min"))) {
+        min = static_cast<float>(act->f(Symbol("min")));
+      }
+      if (act->hasAttribute(Symbol("max"))) {
+        max = static_cast<float>(act->f(Symbol("max")));
+      }
+      // Since opset 11, min and max are optional inputs
+      const auto& inputs = act->inputs();
+      if (inputs.size() > 1 && inputs[1]->node()->kind() != kUndefined &&
+          !getConstantScalar(inputs[1], graph, &min)) {
+        return false;
+      }
+      if (inputs.size() > 2 && inputs[2]->node()->kind() != kUndefined &&
+          !getConstantScalar(inputs[2], graph, &max)) {
+        return false;
+      }
+      params.push_back(min);
+      params.push_back(max);
+    }
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
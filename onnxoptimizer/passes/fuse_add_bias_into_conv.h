@@ -32,6 +32,9 @@ struct FuseAddBiasIntoConv final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_add_bias_into_conv";
   }
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kAdd};
+  }
   bool patternMatchPredicate(Node *node) override {
     return node->kind() == kAdd && node->inputs()[0]->node()->kind() == kConv &&
            node->inputs()[0]->node()->inputs().size() == 2;
@@ -51,7 +54,7 @@ struct FuseAddBiasIntoConv final : public PredicateBasedPass {
       t.sizes().push_back(axes.size());
       t.int64s() = axes;
       t.elem_type() = TensorProto_DataType_INT64;
-      Value *tv = graph.addInitializerAndInput(t);
+      Value *tv = InitializerIndex::get(graph).addInitializerAndInput(t);
       squeeze->addInput(tv);
     }
     squeeze->insertBefore(target_node);
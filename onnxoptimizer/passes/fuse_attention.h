@@ -0,0 +1,418 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   S = MatMul(Q, Transpose(K, perm = [0, 1, 3, 2]))
+//   T = Div(S, c), or Mul(S, 1 / c), optional
+//   U = Add(T, Mask) or Add(Mask, T), optional
+//   P = Softmax(U, axis = -1)
+//   O = MatMul(P, V)
+// where Q, K and V are [batch, heads, seq, head_size] tensors.
+//
+// After, with fuse_attention_standard_ops, from opset 23 on:
+//   O = Attention(Q, K, V, Mask) with scale = 1 / c
+//
+// After, with fuse_attention, if the heads are split from and merged back
+// into [batch, seq, heads * head_size] tensors, i.e.
+//   Q = Transpose(Reshape(X_q, [batch, seq, heads, head_size]), [0, 2, 1, 3])
+//   K, V likewise, K possibly transposed by [0, 2, 3, 1] at once
+//   Y = Reshape(Transpose(O, [0, 2, 1, 3]), [batch, seq, heads * head_size])
+// and Mask, if any, is known to be [batch or 1, heads or 1, seq of X_q,
+// seq of X_k]:
+//   Y = com.microsoft.MultiHeadAttention(X_q, X_k, X_v, , , Mask)
+//       with num_heads = heads and scale = 1 / c
+//
+// The intermediate results must have no other uses, and c must be a Constant
+// node or an initializer, e.g. as left by fold_constants. MultiHeadAttention
+// is a contrib operator of ONNX Runtime, so fuse_attention is of type Other
+// and only runs when asked for by name, while fuse_attention_standard_ops
+// emits standard operators only.
+
+#include "onnxoptimizer/pass.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct FuseAttention : public FullGraphBasedPass {
+  explicit FuseAttention(bool standard_ops_only = false)
+      : FullGraphBasedPass(
+            standard_ops_only ? PassType::Fuse : PassType::Other,
+            PassEfficiency::Complete, PassOptimizationType::Compute),
+        standard_ops_only(standard_ops_only) {}
+
+  std::string getPassName() const override {
+    return standard_ops_only ? "fuse_attention_standard_ops"
+                             : "fuse_attention";
+  }
+  PassAnalysisType getPassAnalysisType() const override {
+    return PassAnalysisType::CountBased;
+  }
+
+  std::shared_ptr<PostPassAnalysis> runPass(Graph& graph) override {
+    InitializerIndexScope initializer_index_scope;
+    const int opset_version = PredicateBasedPass::getOpsetVersion(graph);
+    unsigned int num_fused = 0;
+    // Attention is part of the standard since opset 23
+    if (!standard_ops_only || opset_version >= 23) {
+      num_fused = fuseAll(graph, opset_version);
+    }
+    if (num_fused > 0 && !standard_ops_only) {
+      ensureOpsetImport(graph, "com.microsoft", 1);
+    }
+    return std::shared_ptr<PostPassAnalysis>(
+        new CountBasedPassAnalysis(this, num_fused, false, false));
+  }
+
+ private:
+  const bool standard_ops_only;
+
+  // The values and nodes of a match of the pattern before the rewrite.
+  struct Match {
+    Value* q;
+    Value* k_transposed;
+    Value* v;
+    Value* mask = nullptr;
+    float scale = 1.0f;
+    // MatMul(P, V)
+    Node* output;
+    // Nodes which may be dead after the rewrite.
+    std::vector<Node*> nodes;
+  };
+
+  unsigned int fuseAll(Graph& graph, int opset_version) {
+    unsigned int num_fused = 0;
+    std::vector<Node*> softmaxes;
+    for (Node* n : graph.nodes()) {
+      DescendOnGraphAttributesUnconstrained(
+          n, [this, &num_fused, opset_version](Graph& g) {
+            num_fused += fuseAll(g, opset_version);
+          });
+      if (n->kind() == Symbol("Softmax")) {
+        softmaxes.push_back(n);
+      }
+    }
+    // A rewrite only destroys nodes of its own match, so none of the
+    // other softmaxes.
+    for (Node* softmax : softmaxes) {
+      Match match;
+      if (!matchAttention(softmax, graph, opset_version, match)) {
+        continue;
+      }
+      if (standard_ops_only ? fuseIntoAttention(graph, match)
+                            : fuseIntoMultiHeadAttention(graph, match)) {
+        ++num_fused;
+      }
+    }
+    return num_fused;
+  }
+
+  static Node* singleUser(const Value* value) {
+    return value->uses().size() == 1 ? value->uses()[0].user : nullptr;
+  }
+
+  // The rank of value, if known from its sizes or a Transpose producing it,
+  // -1 otherwise.
+  static int64_t rankOf(const Value* value) {
+    if (value->has_sizes()) {
+      return static_cast<int64_t>(value->sizes().size());
+    }
+    const Node* producer = value->node();
+    if (producer->kind() == kTranspose && producer->hasAttribute(kperm)) {
+      return static_cast<int64_t>(producer->is(kperm).size());
+    }
+    return -1;
+  }
+
+  static bool matchAttention(Node* softmax, Graph& graph, int opset_version,
+                             Match& match) {
+    // Before opset 13, Softmax flattens the input into 2D from axis 1 on
+    int64_t axis = opset_version >= 13 ? -1 : 1;
+    if (softmax->hasAttribute(kaxis)) {
+      axis = softmax->i(kaxis);
+    }
+    if (axis != -1 && axis != 3) {
+      return false;
+    }
+    Node* pv = singleUser(softmax->output());
+    if (pv == nullptr || pv->kind() != kMatMul ||
+        pv->inputs()[0] != softmax->output()) {
+      return false;
+    }
+    match.output = pv;
+    match.v = pv->inputs()[1];
+    match.nodes = {pv, softmax};
+
+    Value* scores = softmax->input();
+    if (singleUser(scores) == nullptr) {
+      return false;
+    }
+    Node* add = scores->node();
+    if (add->kind() != kAdd) {
+      return matchScaledScores(scores, graph, match);
+    }
+    // The mask may be either operand of the Add
+    for (size_t i = 0; i < 2; ++i) {
+      Match masked = match;
+      masked.mask = add->inputs()[1 - i];
+      const int64_t mask_rank = rankOf(masked.mask);
+      if (mask_rank < 0 || mask_rank > 4) {
+        continue;
+      }
+      masked.nodes.push_back(add);
+      if (matchScaledScores(add->inputs()[i], graph, masked)) {
+        match = std::move(masked);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Matches scores = MatMul(Q, K^T), optionally divided or multiplied by a
+  // constant.
+  static bool matchScaledScores(Value* scores, Graph& graph, Match& match) {
+    if (singleUser(scores) == nullptr) {
+      return false;
+    }
+    Node* producer = scores->node();
+    if (producer->kind() == Symbol("Div")) {
+      float divisor;
+      if (!getConstantScalar(producer->inputs()[1], graph, &divisor) ||
+          divisor == 0) {
+        return false;
+      }
+      match.scale = 1 / divisor;
+      match.nodes.push_back(producer->inputs()[1]->node());
+      match.nodes.push_back(producer);
+      scores = producer->inputs()[0];
+    } else if (producer->kind() == kMul) {
+      size_t i = 0;
+      for (; i < 2; ++i) {
+        if (getConstantScalar(producer->inputs()[i], graph, &match.scale)) {
+          break;
+        }
+      }
+      if (i == 2) {
+        return false;
+      }
+      match.nodes.push_back(producer->inputs()[i]->node());
+      match.nodes.push_back(producer);
+      scores = producer->inputs()[1 - i];
+    }
+    if (singleUser(scores) == nullptr) {
+      return false;
+    }
+    producer = scores->node();
+    if (producer->kind() != kMatMul) {
+      return false;
+    }
+    match.nodes.push_back(producer);
+    match.q = producer->inputs()[0];
+    match.k_transposed = producer->inputs()[1];
+    return rankOf(match.q) == 4 && rankOf(match.k_transposed) == 4 &&
+           rankOf(match.v) == 4;
+  }
+
+  // Finds x and x_perm such that Transpose(value, perm) equals
+  // Transpose(x, x_perm), looking through the Transposes producing value.
+  static Value* stripTransposes(Value* value, std::vector<int64_t> perm,
+                                std::vector<int64_t>& x_perm,
+                                std::vector<Node*>& nodes) {
+    Node* producer = value->node();
+    while (producer->kind() == kTranspose && producer->hasAttribute(kperm) &&
+           producer->is(kperm).size() == perm.size()) {
+      const std::vector<int64_t>& producer_perm = producer->is(kperm);
+      for (auto& axis : perm) {
+        axis = producer_perm[axis];
+      }
+      nodes.push_back(producer);
+      value = producer->input();
+      producer = value->node();
+    }
+    x_perm = std::move(perm);
+    return value;
+  }
+
+  static bool isIdentityPerm(const std::vector<int64_t>& perm) {
+    for (size_t i = 0; i < perm.size(); ++i) {
+      if (perm[i] != static_cast<int64_t>(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The [batch, seq, heads * head_size] input of the Reshape producing
+  // value, if it splits the heads, nullptr otherwise.
+  static Value* splitHeadsInput(Value* value, Graph& graph,
+                                std::vector<int64_t>& shape,
+                                std::vector<Node*>& nodes) {
+    Node* reshape = value->node();
+    if (reshape->kind() != Symbol("Reshape") ||
+        reshape->inputs().size() != 2 ||
+        !getConstantInts(reshape->inputs()[1], graph, &shape) ||
+        shape.size() != 4 || shape[2] <= 0 || shape[3] <= 0 ||
+        rankOf(reshape->inputs()[0]) != 3) {
+      return nullptr;
+    }
+    nodes.push_back(reshape);
+    return reshape->inputs()[0];
+  }
+
+  // The value standing for an omitted optional input.
+  static Value* undefinedValue(Graph& graph) {
+    for (Node* node : graph.nodes()) {
+      if (node->kind() == kUndefined) {
+        return node->output();
+      }
+    }
+    Node* undefined = graph.create(kUndefined, 1);
+    undefined->output()->setUniqueName("");
+    undefined->insertBefore(*graph.nodes().begin());
+    return undefined->output();
+  }
+
+  // Whether mask can be the attention_bias of MultiHeadAttention, i.e. is
+  // known to be [batch or 1, heads or 1, seq of q, seq of k].
+  static bool isAttentionBias(const Value* mask, const Value* q,
+                              const Value* k, int64_t heads) {
+    if (!mask->has_sizes() || mask->sizes().size() != 4 || !q->has_sizes() ||
+        q->sizes().size() != 3 || !k->has_sizes() || k->sizes().size() != 3) {
+      return false;
+    }
+    const std::vector<Dimension>& sizes = mask->sizes();
+    const auto isOne = [](const Dimension& dim) {
+      return dim.is_int && dim.dim == 1;
+    };
+    return (isOne(sizes[0]) || sameDim(sizes[0], q->sizes()[0])) &&
+           (isOne(sizes[1]) || (sizes[1].is_int && sizes[1].dim == heads)) &&
+           sameDim(sizes[2], q->sizes()[1]) &&
+           sameDim(sizes[3], k->sizes()[1]);
+  }
+
+  static bool replaceOutput(Value* old_value, Node* fused) {
+    fused->output()->copyMetadata(old_value);
+    if (!tryReplacingAllUsesWith(old_value, fused->output())) {
+      fused->destroy();
+      return false;
+    }
+    return true;
+  }
+
+  static bool fuseIntoAttention(Graph& graph, Match& match) {
+    std::vector<int64_t> k_perm;
+    Value* k = stripTransposes(match.k_transposed, {0, 1, 3, 2}, k_perm,
+                               match.nodes);
+    Node* transpose = nullptr;
+    if (!isIdentityPerm(k_perm)) {
+      transpose = graph.create(kTranspose, 1);
+      transpose->addInput(k);
+      transpose->is_(kperm, std::move(k_perm));
+      transpose->insertBefore(match.output);
+      k = transpose->output();
+    }
+    Node* attention = graph.create(Symbol("Attention"), 1);
+    attention->addInput(match.q);
+    attention->addInput(k);
+    attention->addInput(match.v);
+    if (match.mask != nullptr) {
+      attention->addInput(match.mask);
+    }
+    attention->f_(Symbol("scale"), match.scale);
+    attention->insertBefore(match.output);
+    if (!replaceOutput(match.output->output(), attention)) {
+      if (transpose != nullptr) {
+        transpose->destroy();
+      }
+      return false;
+    }
+    destroyDeadNodes(match.nodes);
+    return true;
+  }
+
+  static bool fuseIntoMultiHeadAttention(Graph& graph, Match& match) {
+    const std::vector<int64_t> heads_perm = {0, 2, 1, 3};
+    std::vector<int64_t> q_perm, k_perm, v_perm;
+    Value* q = stripTransposes(match.q, {0, 1, 2, 3}, q_perm, match.nodes);
+    Value* k =
+        stripTransposes(match.k_transposed, {0, 1, 3, 2}, k_perm, match.nodes);
+    Value* v = stripTransposes(match.v, {0, 1, 2, 3}, v_perm, match.nodes);
+    if (q_perm != heads_perm || k_perm != heads_perm || v_perm != heads_perm) {
+      return false;
+    }
+    std::vector<int64_t> q_shape, k_shape, v_shape;
+    q = splitHeadsInput(q, graph, q_shape, match.nodes);
+    k = splitHeadsInput(k, graph, k_shape, match.nodes);
+    v = splitHeadsInput(v, graph, v_shape, match.nodes);
+    if (q == nullptr || k == nullptr || v == nullptr ||
+        k_shape[2] != q_shape[2] || v_shape[2] != q_shape[2] ||
+        k_shape[3] != q_shape[3] || v_shape[3] != q_shape[3]) {
+      return false;
+    }
+    const int64_t heads = q_shape[2];
+    const int64_t hidden_size = heads * q_shape[3];
+    if (match.mask != nullptr && !isAttentionBias(match.mask, q, k, heads)) {
+      return false;
+    }
+
+    // The heads must be merged back into [batch, seq, hidden_size]
+    Node* transpose = singleUser(match.output->output());
+    if (transpose == nullptr || transpose->kind() != kTranspose ||
+        !transpose->hasAttribute(kperm) ||
+        transpose->is(kperm) != heads_perm) {
+      return false;
+    }
+    Node* reshape = singleUser(transpose->output());
+    std::vector<int64_t> shape;
+    if (reshape == nullptr || reshape->kind() != Symbol("Reshape") ||
+        reshape->inputs()[0] != transpose->output() ||
+        !getConstantInts(reshape->inputs()[1], graph, &shape) ||
+        shape.size() != 3) {
+      return false;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      if (shape[i] != 0 && shape[i] != q_shape[i]) {
+        return false;
+      }
+    }
+    if (shape[2] != hidden_size &&
+        (shape[2] != -1 || shape[0] == -1 || shape[1] == -1)) {
+      return false;
+    }
+    match.nodes.push_back(transpose);
+    match.nodes.push_back(reshape);
+
+    Node* attention = graph.create(Symbol("MultiHeadAttention"), 1);
+    attention->setDomain("com.microsoft");
+    attention->addInput(q);
+    attention->addInput(k);
+    attention->addInput(v);
+    if (match.mask != nullptr) {
+      // Skips bias and key_padding_mask
+      Value* undefined = undefinedValue(graph);
+      attention->addInput(undefined);
+      attention->addInput(undefined);
+      attention->addInput(match.mask);
+    }
+    attention->i_(Symbol("num_heads"), heads);
+    attention->f_(Symbol("scale"), match.scale);
+    attention->insertBefore(reshape);
+    if (!replaceOutput(reshape->output(), attention)) {
+      return false;
+    }
+    destroyDeadNodes(match.nodes);
+    return true;
+  }
+};
+
+struct FuseAttentionStandardOps final : public FuseAttention {
+  explicit FuseAttentionStandardOps() : FuseAttention(true) {}
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
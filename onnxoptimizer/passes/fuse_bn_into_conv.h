@@ -20,7 +20,8 @@
 //	   condition 1: Run in testing mode
 //     condition 2: Inputs 1 - 4 of bn are all initializer_size
 //     condition 3: Output of initial conv has no other uses
-//     condition 3: Currently works for only DOUBLE, FLOAT32 tensor types
+//     condition 3: Currently works for only DOUBLE, FLOAT32, FLOAT16 and
+//                  BFLOAT16 tensor types, the latter two computed in FLOAT32
 //
 // Formula for transformation
 // $$ X_{bn} = \frac{s(X - m)}{\sqrt{\sigma + \epsilon}} + b_{bn}$$
@@ -33,52 +34,122 @@
 
 #include "onnx/common/assertions.h"
 #include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/tensor_util.h"
+#include "onnxoptimizer/vector_math.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
-// TODO: Currently broken for complex values and float16
-struct FuseBNIntoConv final : public PredicateBasedPass {
+// TODO: Currently broken for complex values, which are left alone
+struct FuseBNIntoConv final : public InitializerFoldingPass {
   explicit FuseBNIntoConv()
-      : PredicateBasedPass(PassType::Fuse, PassEfficiency::Complete,
-                           PassOptimizationType::Compute) {}
+      : InitializerFoldingPass(PassType::Fuse, PassEfficiency::Complete,
+                               PassOptimizationType::Compute) {}
 
   std::string getPassName() const override {
     return "fuse_bn_into_conv";
   }
 
   void replace_inputs(Tensor& W, Tensor& b, Node* conv, Graph& graph) {
-    Value* new_W_value = graph.addInitializerAndInput(W);
+    InitializerIndex& initializers = InitializerIndex::get(graph);
+    Value* new_W_value = initializers.addInitializerAndInput(W);
     Value* old_W_value = conv->inputs()[1];
     conv->replaceInput(1, new_W_value);
     if (old_W_value->uses().size() == 0) {
-      graph.eraseInitializerAndInput(old_W_value);
+      initializers.eraseInitializerAndInput(old_W_value);
     }
 
     if (conv->inputs().size() == 3) {
-      Value* new_b_value = graph.addInitializerAndInput(b);
+      Value* new_b_value = initializers.addInitializerAndInput(b);
       Value* old_b_value = conv->inputs()[2];
       conv->replaceInput(2, new_b_value);
       if (old_b_value->uses().size() == 0) {
-        graph.eraseInitializerAndInput(old_b_value);
+        initializers.eraseInitializerAndInput(old_b_value);
       }
     } else {
-      Value* new_b_value = graph.addInitializerAndInput(b);
+      Value* new_b_value = initializers.addInitializerAndInput(b);
       conv->addInput(new_b_value);
     }
   }
 
-  bool modify_conv(Node* conv, Node* bn, Graph& graph) {
+  // Reads the elements of tensor converted to compute_type, the type id of
+  // T.
+  template <typename T>
+  static bool load(const Tensor& tensor, int32_t compute_type,
+                   std::vector<T>& values) {
+    std::string scratch;
+    const char* data;
+    size_t size;
+    const size_t count = ElementCount(tensor.sizes());
+    if (!ElementBytes(tensor, scratch, &data, &size) ||
+        size != count * ElementSize(tensor.elem_type())) {
+      return false;
+    }
+    values.resize(count);
+    return ConvertElements(tensor.elem_type(), data, compute_type,
+                           values.data(), count);
+  }
+
+  // A tensor like like, holding values converted back to its type.
+  template <typename T>
+  static Tensor store(const Tensor& like, int32_t compute_type,
+                      const std::vector<T>& values) {
+    std::string bytes(values.size() * ElementSize(like.elem_type()), '\0');
+    ConvertElements(compute_type, values.data(), like.elem_type(), &bytes[0],
+                    values.size());
+    return MakeRawTensor(like.elem_type(), like.sizes(), std::move(bytes));
+  }
+
+  template <typename T>
+  static bool fold(int32_t compute_type, const Tensor& s_tensor,
+                   const Tensor& bbn_tensor, const Tensor& m_tensor,
+                   const Tensor& var_tensor, const Tensor& W_tensor,
+                   const Tensor* bc_tensor, float epsilon, Tensor& W_out,
+                   Tensor& bc_out) {
+    std::vector<T> s, bbn, m, var, W, bc;
+    if (!load(s_tensor, compute_type, s) ||
+        !load(bbn_tensor, compute_type, bbn) ||
+        !load(m_tensor, compute_type, m) ||
+        !load(var_tensor, compute_type, var) ||
+        !load(W_tensor, compute_type, W)) {
+      return false;
+    }
+    const size_t channels = s.size();
+    if (bc_tensor == nullptr) {
+      bc.assign(channels, 0);
+    } else if (!load(*bc_tensor, compute_type, bc)) {
+      return false;
+    }
+    // s becomes the factor s / sqrt(var + epsilon)
+    BatchNormScale(s.data(), var.data(), static_cast<T>(epsilon), channels,
+                   s.data());
+    ScaleRows(W.data(), s.data(), channels,
+              channels == 0 ? 0 : W.size() / channels, W.data());
+    for (size_t i = 0; i < channels; ++i) {
+      bc[i] = (bc[i] - m[i]) * s[i] + bbn[i];
+    }
+    W_out = store(W_tensor, compute_type, W);
+    bc_out = store(s_tensor, compute_type, bc);
+    return true;
+  }
+
+  Folding prepareFolding(Node* bn, Graph& graph,
+                         std::vector<Value*>& inputs) override {
+    Node* conv = bn->inputs()[0]->node();
+    if (bn->inputs()[0]->uses().size() > 1 || bn->outputs().size() > 1) {
+      return nullptr;
+    }
     const auto& bn_inputs = bn->inputs();
     const auto& conv_inputs = conv->inputs();
-    auto end_iter = graph.initializers().end();
-    auto s_iter = graph.getInitializer(bn_inputs[1]->uniqueName());
-    auto bbn_iter = graph.getInitializer(bn_inputs[2]->uniqueName());
-    auto m_iter = graph.getInitializer(bn_inputs[3]->uniqueName());
-    auto var_iter = graph.getInitializer(bn_inputs[4]->uniqueName());
-    auto W_iter = graph.getInitializer(conv_inputs[1]->uniqueName());
+    InitializerIndex& initializers = InitializerIndex::get(graph);
+    auto end_iter = initializers.end();
+    auto s_iter = initializers.find(bn_inputs[1]->uniqueName());
+    auto bbn_iter = initializers.find(bn_inputs[2]->uniqueName());
+    auto m_iter = initializers.find(bn_inputs[3]->uniqueName());
+    auto var_iter = initializers.find(bn_inputs[4]->uniqueName());
+    auto W_iter = initializers.find(conv_inputs[1]->uniqueName());
     if (s_iter == end_iter || bbn_iter == end_iter || m_iter == end_iter ||
         var_iter == end_iter || W_iter == end_iter) {
-      return false;
+      return nullptr;
     }
 
     ONNX_ASSERT(s_iter->sizes().size() == 1);
@@ -94,68 +165,65 @@ struct FuseBNIntoConv final : public PredicateBasedPass {
                 s_iter->elem_type() == m_iter->elem_type() &&
                 s_iter->elem_type() == var_iter->elem_type() &&
                 s_iter->elem_type() == W_iter->elem_type());
-    if (s_iter->elem_type() != ONNX_NAMESPACE::TensorProto_DataType_FLOAT &&
-        s_iter->elem_type() != ONNX_NAMESPACE::TensorProto_DataType_DOUBLE) {
-      return false;
-    }
-
-    Tensor bc;
+    const int32_t elem_type = s_iter->elem_type();
+    const Tensor* bc_tensor = nullptr;
     if (conv_inputs.size() == 3) {
-      auto bc_iter = graph.getInitializer(conv_inputs[2]->uniqueName());
+      auto bc_iter = initializers.find(conv_inputs[2]->uniqueName());
       if (bc_iter == end_iter) {
-        return false;
+        return nullptr;
       }
-      bc = *bc_iter;
-      ONNX_ASSERT(bc.sizes().size() == 1 &&
-                  bc.sizes()[0] == s_iter->sizes()[0]);
+      bc_tensor = &*bc_iter;
+      ONNX_ASSERT(bc_tensor->sizes().size() == 1 &&
+                  bc_tensor->sizes()[0] == s_iter->sizes()[0]);
     }
 
-    Tensor s = *s_iter;
-    const Tensor& bbn = *bbn_iter;
-    const Tensor& m = *m_iter;
-    Tensor var = *var_iter;
-    Tensor W = *W_iter;
     float epsilon = bn->hasAttribute(kepsilon) ? (float)bn->f(kepsilon) : 1e-5f;
-    Tensor eps;
-
-#define DO_COMPUTATION(TENSOR_TYPE, vec)                                 \
-  eps.sizes().push_back(s.sizes()[0]);                                   \
-  eps.elem_type() = ONNX_NAMESPACE::TensorProto_DataType_##TENSOR_TYPE;  \
-  for (int64_t i = 0; i < eps.sizes()[0]; ++i) {                         \
-    eps.vec().push_back(epsilon);                                        \
-  }                                                                      \
-  if (conv_inputs.size() != 3) {                                         \
-    bc.sizes().push_back(s.sizes()[0]);                                  \
-    bc.elem_type() = ONNX_NAMESPACE::TensorProto_DataType_##TENSOR_TYPE; \
-    for (int64_t i = 0; i < eps.sizes()[0]; ++i) {                       \
-      bc.vec().push_back(0.f);                                           \
-    }                                                                    \
-  }                                                                      \
-  var.add(eps);                                                          \
-  var.sqrt();                                                            \
-  s.divide(var);                                                         \
-  W.scale_by_first_dim(s);                                               \
-  bc.subtract(m);                                                        \
-  bc.multiply(s);                                                        \
-  bc.add(bbn);
-
-    switch (s.elem_type()) {
-      case ONNX_NAMESPACE::TensorProto_DataType_FLOAT: {
-        DO_COMPUTATION(FLOAT, floats)
-        break;
-      }
-      case ONNX_NAMESPACE::TensorProto_DataType_DOUBLE: {
-        DO_COMPUTATION(DOUBLE, doubles)
-        break;
-      }
+    for (size_t i = 1; i < bn_inputs.size(); ++i) {
+      inputs.push_back(bn_inputs[i]);
+    }
+    inputs.insert(inputs.end(), conv_inputs.begin() + 1, conv_inputs.end());
+
+    const Tensor* s = &*s_iter;
+    const Tensor* bbn = &*bbn_iter;
+    const Tensor* m = &*m_iter;
+    const Tensor* var = &*var_iter;
+    const Tensor* W = &*W_iter;
+    switch (elem_type) {
+      case ONNX_NAMESPACE::TensorProto_DataType_FLOAT:
+      case ONNX_NAMESPACE::TensorProto_DataType_FLOAT16:
+      case ONNX_NAMESPACE::TensorProto_DataType_BFLOAT16:
+        // Half precision types are computed in float
+        return [=](std::vector<Tensor>& folded) {
+          folded.resize(2);
+          return fold<float>(ONNX_NAMESPACE::TensorProto_DataType_FLOAT, *s,
+                             *bbn, *m, *var, *W, bc_tensor, epsilon,
+                             folded[0], folded[1]);
+        };
+      case ONNX_NAMESPACE::TensorProto_DataType_DOUBLE:
+        return [=](std::vector<Tensor>& folded) {
+          folded.resize(2);
+          return fold<double>(ONNX_NAMESPACE::TensorProto_DataType_DOUBLE, *s,
+                              *bbn, *m, *var, *W, bc_tensor, epsilon,
+                              folded[0], folded[1]);
+        };
       default:
-        return false;
+        return nullptr;
     }
-#undef DO_COMPUTATION
-    replace_inputs(W, bc, conv, graph);
+  }
+
+  bool modify_conv(Node* conv, Node* bn, Graph& graph) {
+    std::vector<Tensor> folded;
+    if (!foldedInitializers(bn, graph, folded)) {
+      return false;
+    }
+    replace_inputs(folded[0], folded[1], conv, graph);
     return true;
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kBatchNormalization};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kBatchNormalization &&
            node->inputs()[0]->node()->kind() == kConv;
@@ -174,7 +242,7 @@ struct FuseBNIntoConv final : public PredicateBasedPass {
       if (bn->inputs()[i]->uses().size() == 1) {
         auto input = bn->inputs()[i];
         bn->removeInput(i);
-        graph.eraseInitializerAndInput(input);
+        InitializerIndex::get(graph).eraseInitializerAndInput(input);
       }
     }
     const bool replacing_success =
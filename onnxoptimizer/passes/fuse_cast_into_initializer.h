@@ -19,30 +19,26 @@
 //   Z = B + Y
 //
 
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/tensor_util.h"
+#include "onnxoptimizer/vector_math.h"
+
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
-namespace {
-
-template <typename T, typename A, typename B>
-void copyData(std::vector<A>& dst, const B* src, const size_t len) {
-    dst.reserve(len);
-    for (size_t i=0; i<len; ++i) {
-        dst.push_back(static_cast<T>(src[i]));
-    }
-}
-
-}  // namespace
-
-struct FuseCastIntoInitializer final : public PredicateBasedPass {
+struct FuseCastIntoInitializer final : public InitializerFoldingPass {
   explicit FuseCastIntoInitializer()
-      : PredicateBasedPass(PassType::Fuse, PassEfficiency::Partial,
-                           PassOptimizationType::Compute) {}
+      : InitializerFoldingPass(PassType::Fuse, PassEfficiency::Partial,
+                               PassOptimizationType::Compute) {}
 
   std::string getPassName() const override {
     return "fuse_cast_into_initializer";
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kCast};
+  }
+
   bool patternMatchPredicate(Node *node) override {
     // Matches on Cast nodes that have an initializer (kParam) as their input and the initializer does not already
     // have the type specified in the "to" attribute (kto) of the Cast node. If the latter is the case this is an nop
@@ -50,249 +46,45 @@ struct FuseCastIntoInitializer final : public PredicateBasedPass {
     return node->kind() == kCast && node->input()->node()->kind() == kParam && node->input()->elemType() != node->i(kto);
   }
 
-  bool runTransform(Node *node, Graph &graph,
-                    NodeDestroyType &destroy_current) override {
-    const Tensor* oldTensor = nullptr;
-    for (auto &initializer : graph.initializers()) {
-        if (initializer.hasName() && initializer.name() == node->input()->uniqueName()) {
-            oldTensor = &initializer;
-            break;
-        }
+  Folding prepareFolding(Node *node, Graph &graph,
+                         std::vector<Value *> &inputs) override {
+    InitializerIndex &initializers = InitializerIndex::get(graph);
+    const auto oldInitializer = initializers.find(node->input()->uniqueName());
+    if (oldInitializer == initializers.end()) {
+        return nullptr;
     }
-
-    if (oldTensor == nullptr) {
+    inputs.push_back(node->input());
+    const Tensor* oldTensor = &*oldInitializer;
+    const int32_t to = node->i(kto);
+    return [oldTensor, to](std::vector<Tensor>& folded) {
+      const size_t num_elements = ElementCount(oldTensor->sizes());
+      std::string scratch;
+      const char* data;
+      size_t size;
+      if (!ElementBytes(*oldTensor, scratch, &data, &size) ||
+          size != num_elements * ElementSize(oldTensor->elem_type())) {
         return false;
-    }
-
-    Tensor newTensor;
-    newTensor.elem_type() = node->i(kto);
-    newTensor.sizes() = oldTensor->sizes();
-    size_t num_elements = oldTensor->sizes().empty() ? 1 :num_elements = oldTensor->size_from_dim(0); 
-
-    switch (newTensor.elem_type()) {
-    case TensorProto_DataType_FLOAT:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_UINT8:
-        case TensorProto_DataType_INT8:
-        case TensorProto_DataType_UINT16:
-        case TensorProto_DataType_INT16:
-        case TensorProto_DataType_INT32:
-          copyData<float>(newTensor.floats(), oldTensor->data<int32_t>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<float>(newTensor.floats(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<float>(newTensor.floats(), oldTensor->data<double>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT32:
-        case TensorProto_DataType_UINT64:
-          copyData<float>(newTensor.floats(), oldTensor->data<uint64_t>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-    
-    case TensorProto_DataType_UINT8:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<uint8_t>(newTensor.int32s(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<uint8_t>(newTensor.int32s(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<uint8_t>(newTensor.int32s(), oldTensor->data<double>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT32:
-        case TensorProto_DataType_UINT64:
-          copyData<uint8_t>(newTensor.int32s(), oldTensor->data<uint64_t>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    case TensorProto_DataType_INT8:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<int8_t>(newTensor.int32s(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<int8_t>(newTensor.int32s(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<int8_t>(newTensor.int32s(), oldTensor->data<double>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT32:
-        case TensorProto_DataType_UINT64:
-          copyData<int8_t>(newTensor.int32s(), oldTensor->data<uint64_t>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    case TensorProto_DataType_UINT16:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<uint16_t>(newTensor.int32s(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<uint16_t>(newTensor.int32s(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<uint16_t>(newTensor.int32s(), oldTensor->data<double>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT32:
-        case TensorProto_DataType_UINT64:
-          copyData<uint16_t>(newTensor.int32s(), oldTensor->data<uint64_t>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    case TensorProto_DataType_INT16:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<int16_t>(newTensor.int32s(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<int16_t>(newTensor.int32s(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<int16_t>(newTensor.int32s(), oldTensor->data<double>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT32:
-        case TensorProto_DataType_UINT64:
-          copyData<int16_t>(newTensor.int32s(), oldTensor->data<uint64_t>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    case TensorProto_DataType_INT32:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<int32_t>(newTensor.int32s(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<int32_t>(newTensor.int32s(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<int32_t>(newTensor.int32s(), oldTensor->data<double>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT32:
-        case TensorProto_DataType_UINT64:
-          copyData<int32_t>(newTensor.int32s(), oldTensor->data<uint64_t>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    case TensorProto_DataType_INT64:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<int64_t>(newTensor.int64s(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT8:
-        case TensorProto_DataType_INT8:
-        case TensorProto_DataType_UINT16:
-        case TensorProto_DataType_INT16:
-        case TensorProto_DataType_INT32:
-          copyData<int64_t>(newTensor.int64s(), oldTensor->data<int32_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<int64_t>(newTensor.int64s(), oldTensor->data<double>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT32:
-        case TensorProto_DataType_UINT64:
-          copyData<int64_t>(newTensor.int64s(), oldTensor->data<uint64_t>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    case TensorProto_DataType_DOUBLE:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<double>(newTensor.doubles(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT8:
-        case TensorProto_DataType_INT8:
-        case TensorProto_DataType_UINT16:
-        case TensorProto_DataType_INT16:
-        case TensorProto_DataType_INT32:
-          copyData<double>(newTensor.doubles(), oldTensor->data<int32_t>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<double>(newTensor.doubles(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT32:
-        case TensorProto_DataType_UINT64:
-          copyData<double>(newTensor.doubles(), oldTensor->data<uint64_t>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    case TensorProto_DataType_UINT32:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<uint32_t>(newTensor.uint64s(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT8:
-        case TensorProto_DataType_INT8:
-        case TensorProto_DataType_UINT16:
-        case TensorProto_DataType_INT16:
-        case TensorProto_DataType_INT32:
-          copyData<uint32_t>(newTensor.uint64s(), oldTensor->data<int32_t>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<uint32_t>(newTensor.uint64s(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<uint32_t>(newTensor.uint64s(), oldTensor->data<double>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    case TensorProto_DataType_UINT64:
-      switch (oldTensor->elem_type()) {
-        case TensorProto_DataType_FLOAT:
-          copyData<uint64_t>(newTensor.uint64s(), oldTensor->data<float>(), num_elements);
-          break;
-        case TensorProto_DataType_UINT8:
-        case TensorProto_DataType_INT8:
-        case TensorProto_DataType_UINT16:
-        case TensorProto_DataType_INT16:
-        case TensorProto_DataType_INT32:
-          copyData<uint64_t>(newTensor.uint64s(), oldTensor->data<int32_t>(), num_elements);
-          break;
-        case TensorProto_DataType_INT64:
-          copyData<uint64_t>(newTensor.uint64s(), oldTensor->data<int64_t>(), num_elements);
-          break;
-        case TensorProto_DataType_DOUBLE:
-          copyData<uint64_t>(newTensor.uint64s(), oldTensor->data<double>(), num_elements);
-          break;
-        default:
-          return false;
-        }
-        break;
-
-    default:
+      }
+      std::string bytes(num_elements * ElementSize(to), '\0');
+      if (!ConvertElements(oldTensor->elem_type(), data, to, &bytes[0],
+                           num_elements)) {
         return false;
+      }
+      folded.push_back(MakeRawTensor(to, oldTensor->sizes(), std::move(bytes)));
+      return true;
+    };
+  }
+
+  bool runTransform(Node *node, Graph &graph,
+                    NodeDestroyType &destroy_current) override {
+    InitializerIndex &initializers = InitializerIndex::get(graph);
+    std::vector<Tensor> folded;
+    if (!foldedInitializers(node, graph, folded)) {
+      return false;
     }
-    
-    Value* newValue = graph.addInitializerAndInput(newTensor);
+    const Tensor& newTensor = folded[0];
+
+    Value* newValue = initializers.addInitializerAndInput(newTensor);
     if (!tryReplacingAllUsesWith(node->output(), newValue)) {
       return false;
     }
@@ -38,6 +38,10 @@ struct FuseConsecutiveConcats final : public PredicateBasedPass {
     }
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kConcat};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     // we don't check if our concat node has inputs which are also concat nodes
     // because this requires a for loop through the inputs. If it turns out
@@ -53,13 +53,17 @@ struct FuseConsecutiveReduceUnsqueeze final : public PredicateBasedPass {
       if (axes_value->node()->kind() == kConstant) {
         axes_t = axes_value->node()->t(kvalue);
       } else {
-        const auto axes_i = graph.getInitializer(axes_value->uniqueName());
+        const auto axes_i =
+            InitializerIndex::get(graph).find(axes_value->uniqueName());
         axes_t = *axes_i;
       }
       axes = ParseData<int64_t>(&axes_t);
     }
     return true;
   }
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kUnsqueeze};
+  }
   bool patternMatchPredicate(Node *node) override {
     // check that the current node is of type Unsqueeze and has defined axes
     bool cur_node_check = node->kind() == kUnsqueeze;
@@ -45,9 +45,8 @@ struct FuseConsecutiveSqueezes final : public PredicateBasedPass {
       if (axes_value->node()->kind() == kConstant) {
         axes_t = axes_value->node()->t(kvalue);
       } else {
-        // this hack is due to `getInitializer` lacks a const version
-        Graph &mut_graph = const_cast<Graph &>(graph);
-        const auto axes_i = mut_graph.getInitializer(axes_value->uniqueName());
+        const auto axes_i =
+            InitializerIndex::get(graph).find(axes_value->uniqueName());
         axes_t = *axes_i;
       }
       axes = ParseData<int64_t>(&axes_t);
@@ -98,6 +97,10 @@ struct FuseConsecutiveSqueezes final : public PredicateBasedPass {
     return true;
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kSqueeze};
+  }
+
   bool patternMatchPredicate(Node *node) override {
     return node->kind() == kSqueeze &&
            node->inputs()[0]->node()->kind() == kSqueeze;
@@ -122,13 +125,14 @@ struct FuseConsecutiveSqueezes final : public PredicateBasedPass {
       t.int64s() = rs;
       t.elem_type() = TensorProto_DataType_INT64;
       auto axes_v = n->inputs()[1];
-      Value *tv = graph.addInitializerAndInput(t);
+      InitializerIndex &initializers = InitializerIndex::get(graph);
+      Value *tv = initializers.addInitializerAndInput(t);
       n->replaceInput(1, tv);
       if (axes_v->uses().size() == 0) {
         if (axes_v->node()->kind() == kConstant) {
           axes_v->node()->destroy();
         } else {
-          graph.eraseInitializerAndInput(axes_v);
+          initializers.eraseInitializerAndInput(axes_v);
         }
       }
     }
@@ -23,8 +23,8 @@ struct FuseConsecutiveTransposes final : public PredicateBasedPass {
 
   // returns a vector `ret` such that transposing by `ret` is equivalent
   // to transposing by `t1` and then by `t2`
-  std::vector<int64_t> compose_transposes(const std::vector<int64_t>& t1,
-                                          const std::vector<int64_t>& t2) {
+  static std::vector<int64_t> compose_transposes(
+      const std::vector<int64_t>& t1, const std::vector<int64_t>& t2) {
     ONNX_ASSERT(t1.size() == t2.size());
     std::vector<int64_t> ret;
     ret.reserve(t1.size());
@@ -37,6 +37,10 @@ struct FuseConsecutiveTransposes final : public PredicateBasedPass {
     return ret;
   }
 
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kTranspose};
+  }
+
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kTranspose &&
            node->input()->node()->kind() == kTranspose;
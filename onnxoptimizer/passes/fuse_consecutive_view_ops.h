@@ -0,0 +1,132 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   A = Unsqueeze(X, [2]), X has shape [batch, 16]
+//   B = Flatten(A, axis=2)
+//   Y = Reshape(B, [-1, 4, 4]), Y has shape [batch, 4, 4]
+// After:
+//   Y = Reshape(X, [0, 4, 4])
+//
+// Reshape, Flatten, Squeeze and Unsqueeze only change the shape of their
+// input, so a chain of them is a single Reshape of the input of the chain to
+// the shape of its output, or nothing if both have the same shape. The
+// shape of the output has to be known, its static dims are written as they
+// are, dims the same as the ones of the chain input as 0 and a single
+// remaining dim as -1. The node producing B is destroyed if nothing else
+// uses it, the rest of the chain is left to eliminate_deadend.
+
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct FuseConsecutiveViewOps final : public PredicateBasedPass {
+  explicit FuseConsecutiveViewOps()
+      : PredicateBasedPass(PassType::Fuse, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "fuse_consecutive_view_ops";
+  }
+
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kReshape, kFlatten, kSqueeze, kUnsqueeze};
+  }
+
+  bool initializePass(Graph& graph) override {
+    // Subgraphs don't know their opset, so the one of the model is used
+    opset_version = getOpsetVersion(graph);
+    return false;
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    return isViewOp(node) && isViewOp(node->inputs()[0]->node()) &&
+           node->inputs()[0]->node()->owningGraph() == node->owningGraph();
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    Value* input = node->inputs()[0];
+    while (isViewOp(input->node()) &&
+           input->node()->owningGraph() == node->owningGraph()) {
+      input = input->node()->inputs()[0];
+    }
+    Value* output = node->output();
+    Value* result = input;
+    if (!sameSizes(input, output)) {
+      std::vector<int64_t> shape;
+      // Reshape takes its shape as an input since opset 5
+      if (opset_version < 5 || !reshapeDims(input, output, shape)) {
+        return false;
+      }
+      Tensor t;
+      t.sizes().push_back(static_cast<int64_t>(shape.size()));
+      t.int64s() = std::move(shape);
+      t.elem_type() = TensorProto_DataType_INT64;
+      Node* reshape = graph.create(kReshape, 1);
+      reshape->addInput(input);
+      reshape->addInput(InitializerIndex::get(graph).addInitializerAndInput(t));
+      reshape->insertBefore(node);
+      result = reshape->output();
+      result->copyMetadata(output);
+    }
+    if (!tryReplacingAllUsesWith(output, result)) {
+      return false;
+    }
+    // Leaves node without inputs, so that the chain can go before it
+    removeInputsAndDeadProducers(node);
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+
+ private:
+  // The opset of the model, 0 if unknown
+  int opset_version = 0;
+
+  static bool isViewOp(const Node* node) {
+    const NodeKind kind = node->kind();
+    return (kind == kReshape || kind == kFlatten || kind == kSqueeze ||
+            kind == kUnsqueeze) &&
+           !node->inputs().empty() && node->outputs().size() == 1;
+  }
+
+  // The shape input of a Reshape of input into the shape of output.
+  static bool reshapeDims(const Value* input, const Value* output,
+                          std::vector<int64_t>& shape) {
+    if (!output->has_sizes()) {
+      return false;
+    }
+    const auto& dims = output->sizes();
+    const size_t input_rank = input->has_sizes() ? input->sizes().size() : 0;
+    bool inferred_dim = false;
+    bool empty = false;
+    for (size_t i = 0; i < dims.size(); ++i) {
+      empty = empty || (dims[i].is_int && dims[i].dim == 0);
+      if (dims[i].is_int && dims[i].dim != 0) {
+        shape.push_back(dims[i].dim);
+      } else if (i < input_rank && sameDim(input->sizes()[i], dims[i])) {
+        shape.push_back(0);
+      } else if (!inferred_dim && !dims[i].is_int) {
+        shape.push_back(-1);
+        inferred_dim = true;
+      } else {
+        return false;
+      }
+    }
+    // A dim can't be inferred from the others if one of them is 0
+    return !(inferred_dim && empty);
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
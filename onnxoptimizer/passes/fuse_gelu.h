@@ -0,0 +1,269 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   Y = Mul(Mul(X, 0.5), Add(Erf(Div(X, sqrt(2))), 1))
+// After:
+//   Y = Gelu(X)
+//
+// Before:
+//   C = Mul(0.044715, Pow(X, 3))
+//   Y = Mul(Mul(X, 0.5), Add(Tanh(Mul(sqrt(2 / pi), Add(X, C))), 1))
+// After:
+//   Y = Gelu(X) with approximate = "tanh"
+//
+// The products may be in any order and grouping, and Div(X, sqrt(2)) may
+// be Mul(X, 1 / sqrt(2)), Pow(X, 3) Mul(X, Mul(X, X)). The constants must be
+// scalar Constant nodes or initializers and the intermediate results must
+// have no other uses. The nodes the pattern leaves without uses are
+// destroyed once the graph has been traversed.
+//
+// Gelu is part of the standard since opset 20. For older opsets,
+// fuse_gelu_with_contrib_ops emits the Gelu and FastGelu contrib operators
+// of ONNX Runtime in the com.microsoft domain instead, which is why that
+// pass is of type Other and only runs when asked for by name.
+
+#include <cmath>
+#include <string>
+#include <unordered_set>
+
+#include "onnxoptimizer/pass.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct FuseGelu : public PredicateBasedPass {
+  explicit FuseGelu(bool allow_contrib_ops = false)
+      : PredicateBasedPass(allow_contrib_ops ? PassType::Other
+                                             : PassType::Fuse,
+                           PassEfficiency::Complete,
+                           PassOptimizationType::Compute),
+        allow_contrib_ops(allow_contrib_ops) {}
+
+  std::string getPassName() const override {
+    return allow_contrib_ops ? "fuse_gelu_with_contrib_ops" : "fuse_gelu";
+  }
+
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kMul};
+  }
+
+  bool initializePass(Graph& graph) override {
+    // Subgraphs don't know their opset, so the one of the model is used
+    opset_version = getOpsetVersion(graph);
+    dead_values.clear();
+    return false;
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    return node->kind() == kMul && (allow_contrib_ops || opset_version >= 20);
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    Value* x;
+    bool tanh;
+    if (!matchGelu(node, graph, &x, &tanh)) {
+      return false;
+    }
+    Node* gelu;
+    if (opset_version >= 20) {
+      gelu = graph.create(Symbol("Gelu"), 1);
+      if (tanh) {
+        gelu->s_(Symbol("approximate"), "tanh");
+      }
+    } else {
+      gelu = graph.create(Symbol(tanh ? "FastGelu" : "Gelu"), 1);
+      gelu->setDomain("com.microsoft");
+      emitted_contrib_ops = true;
+    }
+    gelu->addInput(x);
+    gelu->output()->copyMetadata(node->output());
+    gelu->insertBefore(node);
+    if (!tryReplacingAllUsesWith(node->output(), gelu->output())) {
+      gelu->destroy();
+      return false;
+    }
+    // Leaves node without inputs, so that the rest of the pattern can go
+    // before it
+    removeInputsAndDeadProducers(node, dead_values);
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+
+  bool finalizePass(Graph& graph) override {
+    bool finalized = destroyDeadProducers(graph, dead_values);
+    if (emitted_contrib_ops) {
+      emitted_contrib_ops = false;
+      ensureOpsetImport(graph, "com.microsoft", 1);
+      finalized = true;
+    }
+    return finalized;
+  }
+
+ private:
+  const bool allow_contrib_ops;
+  // The opset of the model, 0 if unknown
+  int opset_version = 0;
+  bool emitted_contrib_ops = false;
+  // Values of fused patterns, see destroyDeadProducers
+  std::unordered_set<std::string> dead_values;
+
+  static bool hasSingleUse(const Value* value) {
+    return value->uses().size() == 1;
+  }
+
+  static bool isConstant(const Value* value, Graph& graph, double expected) {
+    float actual;
+    return getConstantScalar(value, graph, &actual) &&
+           std::fabs(actual - expected) <= 1e-4 * std::fabs(expected);
+  }
+
+  // Collects the factors of the product computed by the Muls from value up,
+  // the ones but value having no other uses.
+  static void collectFactors(Value* value, bool is_root,
+                             std::vector<Value*>& factors) {
+    Node* producer = value->node();
+    // Patterns have at most 4 factors
+    if (producer->kind() != kMul || (!is_root && !hasSingleUse(value)) ||
+        factors.size() > 4) {
+      factors.push_back(value);
+      return;
+    }
+    for (Value* input : producer->inputs()) {
+      collectFactors(input, false, factors);
+    }
+  }
+
+  // Removes the factor equal to the constant expected, if any.
+  static bool takeConstant(std::vector<Value*>& factors, Graph& graph,
+                           double expected) {
+    for (auto it = factors.begin(); it != factors.end(); ++it) {
+      if (isConstant(*it, graph, expected)) {
+        factors.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether value is Erf(X / sqrt(2)), setting x.
+  static bool matchErf(Value* value, Graph& graph, Value** x) {
+    Node* erf = value->node();
+    if (erf->kind() != Symbol("Erf")) {
+      return false;
+    }
+    Value* scaled = erf->input();
+    Node* producer = scaled->node();
+    if (!hasSingleUse(scaled)) {
+      return false;
+    }
+    if (producer->kind() == Symbol("Div") &&
+        isConstant(producer->inputs()[1], graph, std::sqrt(2.0))) {
+      *x = producer->inputs()[0];
+      return true;
+    }
+    if (producer->kind() == kMul) {
+      std::vector<Value*> factors;
+      collectFactors(scaled, true, factors);
+      if (factors.size() != 2 ||
+          !takeConstant(factors, graph, std::sqrt(0.5))) {
+        return false;
+      }
+      *x = factors[0];
+      return true;
+    }
+    return false;
+  }
+
+  // Whether value is Tanh(sqrt(2 / pi) * (X + 0.044715 * X^3)), setting x.
+  static bool matchTanh(Value* value, Graph& graph, Value** x) {
+    Node* tanh = value->node();
+    if (tanh->kind() != Symbol("Tanh") || !hasSingleUse(tanh->input())) {
+      return false;
+    }
+    std::vector<Value*> factors;
+    collectFactors(tanh->input(), true, factors);
+    const double pi = 3.14159265358979323846;
+    if (factors.size() != 2 ||
+        !takeConstant(factors, graph, std::sqrt(2 / pi))) {
+      return false;
+    }
+    Node* add = factors[0]->node();
+    if (add->kind() != kAdd || !hasSingleUse(factors[0])) {
+      return false;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      Value* cube_term = add->inputs()[1 - i];
+      std::vector<Value*> cube_factors;
+      if (!hasSingleUse(cube_term)) {
+        continue;
+      }
+      collectFactors(cube_term, true, cube_factors);
+      if (!takeConstant(cube_factors, graph, 0.044715)) {
+        continue;
+      }
+      *x = add->inputs()[i];
+      bool is_cube = true;
+      if (cube_factors.size() == 1) {
+        Node* pow = cube_factors[0]->node();
+        is_cube = pow->kind() == Symbol("Pow") && pow->inputs()[0] == *x &&
+                  hasSingleUse(cube_factors[0]) &&
+                  isConstant(pow->inputs()[1], graph, 3);
+      } else {
+        is_cube = cube_factors.size() == 3;
+        for (Value* factor : cube_factors) {
+          is_cube &= factor == *x;
+        }
+      }
+      if (is_cube) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Matches the pattern ending with node.
+  static bool matchGelu(Node* node, Graph& graph, Value** x, bool* tanh) {
+    std::vector<Value*> factors;
+    collectFactors(node->output(), true, factors);
+    if (factors.size() != 3 || !takeConstant(factors, graph, 0.5)) {
+      return false;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      // One factor is X, the other one Add(E, 1) or Add(1, E)
+      Node* add = factors[i]->node();
+      if (add->kind() != kAdd || !hasSingleUse(factors[i])) {
+        continue;
+      }
+      for (size_t j = 0; j < 2; ++j) {
+        Value* e = add->inputs()[j];
+        if (!hasSingleUse(e) || !isConstant(add->inputs()[1 - j], graph, 1)) {
+          continue;
+        }
+        Value* e_x = nullptr;
+        *tanh = e->node()->kind() == Symbol("Tanh");
+        if ((*tanh ? matchTanh(e, graph, &e_x) : matchErf(e, graph, &e_x)) &&
+            e_x == factors[1 - i]) {
+          *x = e_x;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+};
+
+struct FuseGeluWithContribOps final : public FuseGelu {
+  explicit FuseGeluWithContribOps() : FuseGelu(true) {}
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,343 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   M = ReduceMean(X, axes = [-1])
+//   D = Sub(X, M)
+//   V = ReduceMean(Pow(D, 2), axes = [-1]), or Mul(D, D)
+//   N = Div(D, Sqrt(Add(V, epsilon)))
+//   Y = Add(Mul(N, Scale), B), Add and Mul being optional
+// After:
+//   Y = LayerNormalization(X, Scale, B) with axis = -1
+//
+// the pass can handle the case satisfy all following conditions:
+//   condition 1: the axes of both ReduceMean are the last ones of X, their
+//                keepdims is set
+//   condition 2: epsilon is a constant scalar, Scale and B constants with
+//                one dim per normalized axis
+//   condition 3: Scale is present, or the normalized dims of X are static
+//   condition 4: the intermediate results have no other uses
+//
+// The nodes the pattern leaves without uses are destroyed once the graph
+// has been traversed, so that a run to a fixed point only sees the producers
+// of the last node go during the traversal.
+//
+// LayerNormalization is part of the standard since opset 17. For older
+// opsets, fuse_layer_norm_with_contrib_ops emits the LayerNormalization
+// operator ONNX Runtime registers for them as a contrib operator, in the
+// default domain but unknown to ONNX, which is why that pass is of type
+// Other and only runs when asked for by name.
+
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/tensor_util.h"
+#include "onnxoptimizer/vector_math.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct FuseLayerNorm : public PredicateBasedPass {
+  explicit FuseLayerNorm(bool allow_contrib_ops = false)
+      : PredicateBasedPass(allow_contrib_ops ? PassType::Other
+                                             : PassType::Fuse,
+                           PassEfficiency::Complete,
+                           PassOptimizationType::Compute),
+        allow_contrib_ops(allow_contrib_ops) {}
+
+  std::string getPassName() const override {
+    return allow_contrib_ops ? "fuse_layer_norm_with_contrib_ops"
+                             : "fuse_layer_norm";
+  }
+
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kAdd, kMul, Symbol("Div")};
+  }
+
+  bool initializePass(Graph& graph) override {
+    // Subgraphs don't know their opset, so the one of the model is used
+    opset_version = getOpsetVersion(graph);
+    dead_values.clear();
+    return false;
+  }
+
+  bool finalizePass(Graph& graph) override {
+    return destroyDeadProducers(graph, dead_values);
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    if (!allow_contrib_ops && opset_version < 17) {
+      return false;
+    }
+    Match match;
+    if (!matchLayerNorm(node, match)) {
+      return false;
+    }
+    // The Mul or Add applying Scale or B to the result, if any, ends the
+    // pattern instead, unless it adds something else, e.g. a residual
+    Node* user = singleUser(node->output());
+    Match outer;
+    return user == nullptr || !matchLayerNorm(user, outer) ||
+           !matchConstants(*user->owningGraph(), outer);
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    Match match;
+    if (!matchLayerNorm(node, match) || !matchConstants(graph, match)) {
+      return false;
+    }
+    Value* scale = match.scale;
+    if (scale == nullptr) {
+      scale = makeOnes(graph, match);
+      if (scale == nullptr) {
+        return false;
+      }
+    }
+    Node* layer_norm = graph.create(Symbol("LayerNormalization"), 1);
+    layer_norm->addInput(match.x);
+    layer_norm->addInput(scale);
+    if (match.bias != nullptr) {
+      layer_norm->addInput(match.bias);
+    }
+    layer_norm->i_(kaxis, match.axis);
+    layer_norm->f_(kepsilon, match.epsilon);
+    layer_norm->output()->copyMetadata(node->output());
+    layer_norm->insertBefore(node);
+    if (!tryReplacingAllUsesWith(node->output(), layer_norm->output())) {
+      layer_norm->destroy();
+      return false;
+    }
+    // Leaves node without inputs, so that the rest of the pattern can go
+    // before it
+    removeInputsAndDeadProducers(node, dead_values);
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+
+ private:
+  const bool allow_contrib_ops;
+  // The opset of the model, 0 if unknown
+  int opset_version = 0;
+  // Values of fused patterns, see destroyDeadProducers
+  std::unordered_set<std::string> dead_values;
+
+  struct Match {
+    Value* x = nullptr;
+    // The first normalized axis, negative
+    int64_t axis = 0;
+    Value* epsilon_value = nullptr;
+    float epsilon = 0;
+    Value* scale = nullptr;
+    Value* bias = nullptr;
+  };
+
+  static Node* singleUser(const Value* value) {
+    return value->uses().size() == 1 ? value->uses()[0].user : nullptr;
+  }
+
+  static bool hasSingleUse(const Value* value) {
+    return value->uses().size() == 1;
+  }
+
+  // The axes a ReduceMean keeping the reduced dims normalizes, converted
+  // into the first one of them, negative, if they are the last axes. rank
+  // is the one of X, -1 if unknown.
+  static bool normalizedAxis(const Node* reduce, int64_t rank,
+                             int64_t* axis) {
+    if (reduce->kind() != kReduceMean ||
+        (reduce->hasAttribute(kkeepdims) && reduce->i(kkeepdims) == 0)) {
+      return false;
+    }
+    std::vector<int64_t> axes;
+    if (reduce->hasAttribute(kaxes)) {
+      axes = reduce->is(kaxes);
+    } else if (reduce->inputs().size() < 2 ||
+               !getConstantInts(reduce->inputs()[1],
+                                *reduce->owningGraph(), &axes)) {
+      return false;
+    }
+    for (auto& a : axes) {
+      if (a >= 0) {
+        if (rank < 0) {
+          return false;
+        }
+        a -= rank;
+      }
+    }
+    std::sort(axes.begin(), axes.end());
+    if (axes.empty() || (rank >= 0 && axes.front() < -rank)) {
+      return false;
+    }
+    for (size_t i = 0; i < axes.size(); ++i) {
+      if (axes[i] != static_cast<int64_t>(i) -
+                         static_cast<int64_t>(axes.size())) {
+        return false;
+      }
+    }
+    *axis = axes.front();
+    return true;
+  }
+
+  // Matches the pattern ending with last, without looking at constants.
+  static bool matchLayerNorm(Node* last, Match& match) {
+    Node* div = last;
+    if (div->kind() == kAdd) {
+      div = affineProducer(div, true, &match.bias);
+      if (div == nullptr) {
+        return false;
+      }
+    }
+    if (div->kind() == kMul) {
+      div = affineProducer(div, false, &match.scale);
+      if (div == nullptr) {
+        return false;
+      }
+    }
+    if (div->kind() != Symbol("Div")) {
+      return false;
+    }
+    Node* sub = div->inputs()[0]->node();
+    Node* sqrt = div->inputs()[1]->node();
+    if (sub->kind() != Symbol("Sub") || sqrt->kind() != kSqrt ||
+        !hasSingleUse(sqrt->output())) {
+      return false;
+    }
+    Node* mean = sub->inputs()[1]->node();
+    match.x = sub->inputs()[0];
+    const int64_t rank = match.x->has_sizes()
+                             ? static_cast<int64_t>(match.x->sizes().size())
+                             : -1;
+    if (mean->inputs().empty() || mean->inputs()[0] != match.x ||
+        !hasSingleUse(mean->output()) ||
+        !normalizedAxis(mean, rank, &match.axis)) {
+      return false;
+    }
+    Node* add_epsilon = sqrt->input()->node();
+    if (add_epsilon->kind() != kAdd || !hasSingleUse(add_epsilon->output())) {
+      return false;
+    }
+    size_t i = add_epsilon->inputs()[0]->node()->kind() == kReduceMean ? 0 : 1;
+    Node* variance = add_epsilon->inputs()[i]->node();
+    match.epsilon_value = add_epsilon->inputs()[1 - i];
+    int64_t variance_axis;
+    if (!normalizedAxis(variance, rank, &variance_axis) ||
+        variance_axis != match.axis || !hasSingleUse(variance->output())) {
+      return false;
+    }
+    // D is used by Div and the square of it
+    Node* square = variance->inputs()[0]->node();
+    Value* d = sub->output();
+    if (!hasSingleUse(square->output())) {
+      return false;
+    }
+    if (square->kind() == kMul) {
+      if (square->inputs()[0] != d || square->inputs()[1] != d ||
+          d->uses().size() != 3) {
+        return false;
+      }
+    } else if (square->kind() == Symbol("Pow")) {
+      float exponent;
+      if (square->inputs()[0] != d || d->uses().size() != 2 ||
+          !getConstantScalar(square->inputs()[1], *square->owningGraph(),
+                             &exponent) ||
+          exponent != 2) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // The producer of the operand of the Mul or Add node which Scale or B
+  // applies to, a Div or with allow_mul a Mul, with operand set to the other
+  // operand. nullptr if there is none without other uses.
+  static Node* affineProducer(Node* node, bool allow_mul, Value** operand) {
+    for (size_t i = 0; i < 2; ++i) {
+      Value* input = node->inputs()[i];
+      const NodeKind kind = input->node()->kind();
+      if ((kind == Symbol("Div") || (allow_mul && kind == kMul)) &&
+          hasSingleUse(input)) {
+        *operand = node->inputs()[1 - i];
+        return input->node();
+      }
+    }
+    return nullptr;
+  }
+
+  // Reads epsilon and checks Scale and B are constants LayerNormalization
+  // takes as they are.
+  static bool matchConstants(Graph& graph, Match& match) {
+    if (!getConstantScalar(match.epsilon_value, graph, &match.epsilon)) {
+      return false;
+    }
+    for (Value* value : {match.scale, match.bias}) {
+      if (value == nullptr) {
+        continue;
+      }
+      if (!isConstantValue(value, graph) || !value->has_sizes() ||
+          static_cast<int64_t>(value->sizes().size()) != -match.axis) {
+        return false;
+      }
+      // Broadcasting it must not change the shape of X
+      if (match.x->has_sizes()) {
+        const auto& x_sizes = match.x->sizes();
+        const auto& sizes = value->sizes();
+        for (size_t i = 0; i < sizes.size(); ++i) {
+          const Dimension& x_dim = x_sizes[x_sizes.size() - sizes.size() + i];
+          if (!sizes[i].is_int ||
+              (x_dim.is_int && x_dim.dim != sizes[i].dim)) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // A Scale of ones, if the normalized dims of X are static.
+  static Value* makeOnes(Graph& graph, const Match& match) {
+    const Value* x = match.x;
+    if (!x->has_sizes() || x->elemType() == TensorProto_DataType_UNDEFINED) {
+      return nullptr;
+    }
+    const auto& sizes = x->sizes();
+    const size_t normalized_rank = static_cast<size_t>(-match.axis);
+    if (sizes.size() < normalized_rank) {
+      return nullptr;
+    }
+    std::vector<int64_t> dims;
+    for (size_t i = sizes.size() - normalized_rank; i < sizes.size(); ++i) {
+      if (!sizes[i].is_int) {
+        return nullptr;
+      }
+      dims.push_back(sizes[i].dim);
+    }
+    const int64_t count = ElementCount(dims);
+    std::vector<float> ones(count, 1.0f);
+    std::string bytes(count * ElementSize(x->elemType()), '\0');
+    if (!ConvertElements(TensorProto_DataType_FLOAT, ones.data(),
+                         x->elemType(), &bytes[0], count)) {
+      return nullptr;
+    }
+    return InitializerIndex::get(graph).addInitializerAndInput(
+        MakeRawTensor(x->elemType(), dims, std::move(bytes)));
+  }
+};
+
+struct FuseLayerNormWithContribOps final : public FuseLayerNorm {
+  explicit FuseLayerNormWithContribOps() : FuseLayerNorm(true) {}
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -9,7 +9,7 @@
 
 // Before:
 //   Z = MatMul(X, Y)
-//   A = Z + Bias
+//   A = Z + Bias (or Bias + Z)
 // After:
 //   A = Gemm(X, Y, Bias)
 //
@@ -17,6 +17,15 @@
 //   case 1: Bias is 1D tensor and Bias.dim[0] == Z.dim[1]
 //   case 2: Bias is 2D tensor and Bias.dim[0] == Z.dim[0] or 1
 //           and Bias.dim[1] = Z.dim[1]
+//
+// When X has rank 3 or more, e.g. [batch, seq, K], and Y is 2D, X is
+// flattened to 2D around the Gemm, provided Bias is 1D:
+//   X2 = Reshape(X, [-1, K])
+//   A2 = Gemm(X2, Y, Bias)
+//   A = Reshape(A2, [batch, seq, N])
+// The leading dims of X may be dynamic. If more than one of them is, the
+// shape of A is computed from Shape(X). The operators this adds depend on
+// the opset of the model, so X is only flattened if it is known.
 
 #include <numeric>
 
@@ -33,16 +42,102 @@ struct FuseMatMulAddBiasIntoGemm final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_matmul_add_bias_into_gemm";
   }
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kAdd};
+  }
+  bool initializePass(Graph& graph) override {
+    // Subgraphs don't know their opset, so the one of the model is used
+    opset_version = getOpsetVersion(graph);
+    return false;
+  }
   bool patternMatchPredicate(Node* node) override {
-    return node->kind() == kAdd && node->inputs()[0]->node()->kind() == kMatMul;
+    return node->kind() == kAdd &&
+           (node->inputs()[0]->node()->kind() == kMatMul ||
+            node->inputs()[1]->node()->kind() == kMatMul);
   }
   bool runTransform(Node* n, Graph& graph,
                     NodeDestroyType& destroy_current) override {
-    // due to current broadcasting's constraint, MatMul has to be the first
-    // operand
     destroy_current = NodeDestroyType::DestroyZero;
-    auto orig_matmul = n->inputs()[0];
-    auto orig_bias = n->inputs()[1];
+    // Add is commutative, so MatMul may be either operand
+    for (size_t i = 0; i < 2; ++i) {
+      Node* matmul = n->inputs()[i]->node();
+      if (matmul->kind() == kMatMul &&
+          fuse(n, matmul, n->inputs()[1 - i], graph)) {
+        // Leaves n without inputs, so that matmul can go before it
+        n->removeAllInputs();
+        matmul->destroy();
+        destroy_current = NodeDestroyType::DestroyOne;
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  // The opset of the model, 0 if unknown
+  int opset_version = 0;
+
+  static Value* makeInt64Initializer(Graph& graph,
+                                     std::vector<int64_t> values) {
+    Tensor t;
+    t.sizes().push_back(values.size());
+    t.int64s() = std::move(values);
+    t.elem_type() = TensorProto_DataType_INT64;
+    return InitializerIndex::get(graph).addInitializerAndInput(t);
+  }
+
+  static Value* makeReshape(Graph& graph, Value* input, Value* shape,
+                            Node* target_node) {
+    Node* reshape = graph.create(Symbol("Reshape"), 1);
+    reshape->addInput(input);
+    reshape->addInput(shape);
+    reshape->insertBefore(target_node);
+    return reshape->output();
+  }
+
+  // The shape x_shape[:-1] + [N] as a value, an initializer if at most one
+  // of the leading dims is unknown, otherwise computed from Shape(x).
+  Value* makeOutputShape(Graph& graph, Value* x, int64_t N,
+                         Node* target_node) const {
+    const auto& x_shape = x->sizes();
+    std::vector<int64_t> shape;
+    int unknown_dims = 0;
+    for (size_t i = 0; i + 1 < x_shape.size(); ++i) {
+      if (x_shape[i].is_int) {
+        shape.push_back(x_shape[i].dim);
+      } else {
+        shape.push_back(-1);
+        ++unknown_dims;
+      }
+    }
+    shape.push_back(N);
+    if (unknown_dims <= 1) {
+      return makeInt64Initializer(graph, std::move(shape));
+    }
+    Node* shape_of_x = graph.create(Symbol("Shape"), 1);
+    shape_of_x->addInput(x);
+    shape_of_x->insertBefore(target_node);
+    Node* slice = graph.create(Symbol("Slice"), 1);
+    slice->addInput(shape_of_x->output());
+    const int64_t rank = static_cast<int64_t>(x_shape.size());
+    if (opset_version < 10) {
+      slice->is_(Symbol("starts"), {0});
+      slice->is_(Symbol("ends"), {rank - 1});
+    } else {
+      slice->addInput(makeInt64Initializer(graph, {0}));
+      slice->addInput(makeInt64Initializer(graph, {rank - 1}));
+    }
+    slice->insertBefore(target_node);
+    Node* concat = graph.create(kConcat, 1);
+    concat->addInput(slice->output());
+    concat->addInput(makeInt64Initializer(graph, {N}));
+    concat->i_(kaxis, 0);
+    concat->insertBefore(target_node);
+    return concat->output();
+  }
+
+  bool fuse(Node* n, Node* matmul, Value* orig_bias, Graph& graph) {
+    Value* orig_matmul = matmul->output();
     // check if bias is Const or in graph's initializers
     if (orig_bias->node()->kind() != kConstant &&
         orig_bias->node()->kind() != kParam) {
@@ -52,18 +147,24 @@ struct FuseMatMulAddBiasIntoGemm final : public PredicateBasedPass {
     if (orig_matmul->uses().size() > 1) {
       return false;
     }
-    auto x_shape = orig_matmul->node()->inputs()[0]->sizes();
-    auto y_shape = orig_matmul->node()->inputs()[1]->sizes();
+    Value* x = matmul->inputs()[0];
+    Value* y = matmul->inputs()[1];
+    auto x_shape = x->sizes();
+    auto y_shape = y->sizes();
+    const auto x_rank = static_cast<int64_t>(x_shape.size());
     int64_t z_N = -1;
     int64_t z_M = -1;
+    int64_t K = -1;
     // try to get feature N from x_shape
-    if (static_cast<int64_t>(x_shape.size()) == 2 && x_shape[0].is_int) {
+    if (x_rank == 2 && x_shape[0].is_int) {
       z_N = x_shape[0].dim;
-    } else {
+    } else if (x_rank < 2) {
       return false;
     }
-    // try to get feature M from y_shape
-    if (static_cast<int64_t>(y_shape.size()) == 2 && y_shape[1].is_int) {
+    // try to get K and feature M from y_shape
+    if (static_cast<int64_t>(y_shape.size()) == 2 && y_shape[0].is_int &&
+        y_shape[1].is_int) {
+      K = y_shape[0].dim;
       z_M = y_shape[1].dim;
     } else {
       return false;
@@ -76,7 +177,8 @@ struct FuseMatMulAddBiasIntoGemm final : public PredicateBasedPass {
     if (bias_dim == 1 && bias_shape[0].is_int) {
       bias_N = 1;
       bias_M = bias_shape[0].dim;
-    } else if (bias_dim == 2 && bias_shape[0].is_int && bias_shape[1].is_int) {
+    } else if (x_rank == 2 && bias_dim == 2 && bias_shape[0].is_int &&
+               bias_shape[1].is_int) {
       bias_N = bias_shape[0].dim;
       bias_M = bias_shape[1].dim;
     } else {
@@ -85,23 +187,36 @@ struct FuseMatMulAddBiasIntoGemm final : public PredicateBasedPass {
     if ((bias_N != z_N && bias_N != 1) || bias_M != z_M) {
       return false;
     }
+    // Reshape takes its shape as an input since opset 5
+    if (x_rank > 2 && opset_version < 5) {
+      return false;
+    }
     // proceed to fuse MatMul and Add into Gemm
-    Node* gemm =
-        graph.create(kGemm, orig_matmul->node()->inputs(), n->outputs().size());
-    gemm->addInput(n->inputs()[1]);
-    for (int i = 0; i < static_cast<int64_t>(gemm->outputs().size()); ++i) {
-      gemm->outputs()[i]->copyMetadata(n->outputs()[i]);
+    Value* gemm_input = x;
+    if (x_rank > 2) {
+      gemm_input = makeReshape(graph, x, makeInt64Initializer(graph, {-1, K}),
+                               n);
+      gemm_input->setElemType(x->elemType());
     }
+    Node* gemm = graph.create(kGemm, 1);
+    gemm->addInput(gemm_input);
+    gemm->addInput(y);
+    gemm->addInput(orig_bias);
     gemm->f_(kalpha, 1.0);
     gemm->f_(kbeta, 1.0);
     gemm->i_(ktransA, 0);
     gemm->i_(ktransB, 0);
-    gemm->insertBefore(orig_matmul->node());
-    const bool replacing_success = tryReplacingAllUsesWith(n, gemm);
-    if (!replacing_success) {
+    gemm->insertBefore(n);
+    Value* result = gemm->output();
+    if (x_rank > 2) {
+      result->setElemType(n->output()->elemType());
+      result =
+          makeReshape(graph, result, makeOutputShape(graph, x, z_M, n), n);
+    }
+    result->copyMetadata(n->output());
+    if (!tryReplacingAllUsesWith(n->output(), result)) {
       return false;
     }
-    destroy_current = NodeDestroyType::DestroyTwo;
     return true;
   }
 };
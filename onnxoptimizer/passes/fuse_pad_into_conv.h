@@ -31,6 +31,9 @@ struct FusePadIntoConv final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_pad_into_conv";
   }
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kConv};
+  }
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kConv && node->inputs()[0]->node()->kind() == kPad;
   }
@@ -55,10 +58,11 @@ struct FusePadIntoConv final : public PredicateBasedPass {
       // opset 11 and above - first check if 'pad' node has 'pads' input
       // initialized
       const auto& pads_name = pad->inputs()[1]->uniqueName();
-      const auto pads_initializer = graph.getInitializer(pads_name);
+      InitializerIndex& initializers = InitializerIndex::get(graph);
+      const auto pads_initializer = initializers.find(pads_name);
       // 'pad' node has the 'pads' input which has not been initialized -
       // can't proceed with fusing
-      if (pads_initializer == graph.initializers().end()) {
+      if (pads_initializer == initializers.end()) {
         return false;
       }
 
@@ -93,11 +97,12 @@ struct FusePadIntoConv final : public PredicateBasedPass {
       // opset 11 and above - check if the 'pad' node has the optional
       // 'Constant_value' input check if it has data initialized
       const auto& value_name = pad->inputs()[2]->uniqueName();
-      const auto value_initializer = graph.getInitializer(value_name);
+      InitializerIndex& initializers = InitializerIndex::get(graph);
+      const auto value_initializer = initializers.find(value_name);
 
       // 'pad' node has the 'Constant_value' input which has not been
       // initialized - can't proceed with fusing
-      if (value_initializer == graph.initializers().end()) {
+      if (value_initializer == initializers.end()) {
         return false;
       }
 
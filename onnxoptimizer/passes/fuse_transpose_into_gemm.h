@@ -19,6 +19,9 @@ struct FuseTransposeIntoGemm final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_transpose_into_gemm";
   }
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    return {kGemm};
+  }
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kGemm;
   }
@@ -0,0 +1,54 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Plans the memory of the tensors computed by the nodes of the main graph
+// with PlanMemory, on the shapes the pass manager propagated, and leaves the
+// graph alone. The Optimizer stores the plan of the last run as JSON in the
+// "onnxoptimizer.memory_plan" metadata_props entry of the optimized model,
+// so the pass has to go last, after every pass that changes the graph, and
+// the Optimizer rejects pass lists where it doesn't. The entry is removed
+// from models optimized without the pass.
+//
+// Tensors with dim_params are planned once the model binds them in its
+// "onnxoptimizer.dim_params" metadata_props entry, a comma separated list of
+// name=value such as "batch=8,seq=128"; they are unplanned otherwise.
+
+#include "onnxoptimizer/memory_plan.h"
+#include "onnxoptimizer/pass.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct MemoryPlanAnalysis : PostPassAnalysis {
+  MemoryPlan plan;
+};
+
+struct PlanActivationMemory final : public FullGraphBasedPass {
+  explicit PlanActivationMemory()
+      : FullGraphBasedPass(PassType::Immutable, PassEfficiency::Complete,
+                           PassOptimizationType::None) {}
+
+  std::string getPassName() const override {
+    return "plan_activation_memory";
+  }
+
+  PassAnalysisType getPassAnalysisType() const override {
+    return PassAnalysisType::MemoryPlanBased;
+  }
+
+  std::shared_ptr<PostPassAnalysis> runPass(Graph& graph) override {
+    std::shared_ptr<MemoryPlanAnalysis> analysis =
+        std::make_shared<MemoryPlanAnalysis>();
+    analysis->plan = PlanMemory(graph, 64, DimParamsScope::active());
+    return analysis;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,552 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   Z = Transpose(X, perm = [0, 2, 3, 1])
+//   Y = Relu(Add(Z, B))
+//   W = Transpose(Y, perm = [0, 3, 1, 2])
+// After:
+//   W = Relu(Add(X, Transpose(B, perm = [0, 3, 1, 2])))
+//
+// Transposes are moved below the layout-agnostic operators consuming them:
+// elementwise operators, Concat, Pad, Resize and the Reduce operators,
+// whose axes, pads, scales or sizes are permuted accordingly. Consecutive
+// Transposes are merged on the way, and removed altogether when they cancel
+// out.
+//
+// The other inputs of an elementwise operator or Concat must follow the
+// permutation: constants are transposed once here, scalars are left alone
+// and other values get a Transpose of their own. A Transpose is only moved
+// if that does not add Transposes to the graph, counting the one it moves
+// below the operator and the ones its inputs no longer need.
+
+#include <algorithm>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/fuse_consecutive_transposes.h"
+#include "onnxoptimizer/tensor_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct PushDownTransposes final : public PredicateBasedPass {
+  explicit PushDownTransposes()
+      : PredicateBasedPass(PassType::Fuse, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "push_down_transposes";
+  }
+
+  std::vector<NodeKind> getMatchedNodeKinds() const override {
+    std::vector<NodeKind> kinds = {kTranspose, kConcat, Symbol("Pad"),
+                                   Symbol("Resize")};
+    for (const std::vector<NodeKind>* group :
+         {&unaryKinds(), &broadcastKinds(), &reduceKinds()}) {
+      kinds.insert(kinds.end(), group->begin(), group->end());
+    }
+    return kinds;
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    if (!isDefaultDomain(node) || node->outputs().size() != 1) {
+      return false;
+    }
+    const size_t num_layout_inputs = numLayoutInputs(node);
+    for (size_t i = 0; i < num_layout_inputs; ++i) {
+      const Node* producer = node->inputs()[i]->node();
+      if (producer->kind() == kTranspose && producer->hasAttribute(kperm)) {
+        return node->kind() != kTranspose || node->hasAttribute(kperm);
+      }
+    }
+    return false;
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    if (node->kind() == kTranspose) {
+      return mergeTransposes(node, destroy_current);
+    }
+
+    const size_t num_layout_inputs = numLayoutInputs(node);
+    std::vector<int64_t> perm;
+    for (size_t i = 0; i < num_layout_inputs && perm.empty(); ++i) {
+      const Node* producer = node->inputs()[i]->node();
+      if (producer->kind() == kTranspose && producer->hasAttribute(kperm)) {
+        perm = producer->is(kperm);
+      }
+    }
+    const std::vector<int64_t> inverse = invertPerm(perm);
+    const int64_t rank = static_cast<int64_t>(perm.size());
+
+    // How each layout input follows the permutation
+    enum class Action { Bypass, Keep, TransposeConstant, InsertTranspose };
+    std::vector<Action> actions;
+    std::vector<Node*> removed;
+    size_t num_inserted = 0;
+    for (size_t i = 0; i < num_layout_inputs; ++i) {
+      Value* input = node->inputs()[i];
+      const Node* producer = input->node();
+      if (producer->kind() == kTranspose && producer->hasAttribute(kperm) &&
+          producer->is(kperm) == perm) {
+        actions.push_back(Action::Bypass);
+        if (onlyUsedBy(input, node) &&
+            std::find(removed.begin(), removed.end(), producer) ==
+                removed.end()) {
+          removed.push_back(input->node());
+        }
+        continue;
+      }
+      if (!input->has_sizes()) {
+        return false;
+      }
+      const int64_t input_rank = static_cast<int64_t>(input->sizes().size());
+      // Concat needs all inputs of the same rank, the other operators
+      // broadcast them
+      if (input_rank > rank ||
+          (node->kind() == kConcat && input_rank != rank)) {
+        return false;
+      }
+      if (isScalar(input) && node->kind() != kConcat) {
+        actions.push_back(Action::Keep);
+      } else if (isConstantValue(input, graph)) {
+        actions.push_back(Action::TransposeConstant);
+      } else if (input_rank == rank) {
+        actions.push_back(Action::InsertTranspose);
+        ++num_inserted;
+      } else {
+        return false;
+      }
+    }
+
+    // The permutation of the output, empty if it needs no Transpose, and
+    // the axis of Concat, the pads of Pad or the axes of Reduce for X
+    std::vector<int64_t> output_perm = perm;
+    std::vector<int64_t> ints;
+    if (!permutedInts(node, graph, perm, ints, output_perm)) {
+      return false;
+    }
+    const size_t num_output_transposes = output_perm.empty() ? 0 : 1;
+    if (num_inserted + num_output_transposes > removed.size()) {
+      return false;
+    }
+    // The roi, scales and sizes of Resize for X, by input index
+    std::vector<std::pair<size_t, Value*>> resize_inputs;
+    if (node->kind() == Symbol("Resize") &&
+        !permutedResizeInputs(node, graph, perm, resize_inputs)) {
+      return false;
+    }
+    std::vector<Value*> constants(num_layout_inputs, nullptr);
+    for (size_t i = 0; i < num_layout_inputs; ++i) {
+      if (actions[i] != Action::TransposeConstant) {
+        continue;
+      }
+      constants[i] = addTransposedConstant(node->inputs()[i], inverse, graph);
+      if (constants[i] == nullptr) {
+        for (Value* constant : constants) {
+          if (constant != nullptr) {
+            InitializerIndex::get(graph).eraseInitializerAndInput(constant);
+          }
+        }
+        return false;
+      }
+    }
+
+    for (size_t i = 0; i < num_layout_inputs; ++i) {
+      Value* input = node->inputs()[i];
+      if (actions[i] == Action::Bypass) {
+        node->replaceInput(i, input->node()->input());
+      } else if (actions[i] == Action::TransposeConstant) {
+        replaceConstantInput(node, i, constants[i], graph);
+      } else if (actions[i] == Action::InsertTranspose) {
+        node->replaceInput(i, insertTranspose(node, input, inverse, graph));
+      }
+    }
+    setPermutedInts(node, graph, ints);
+    for (const auto& input : resize_inputs) {
+      replaceConstantInput(node, input.first, input.second, graph);
+    }
+
+    if (!output_perm.empty()) {
+      Value* output = node->output();
+      Node* transpose = graph.create(kTranspose, 1);
+      transpose->is_(kperm, std::vector<int64_t>(output_perm));
+      transpose->insertAfter(node);
+      output->replaceAllUsesWith(transpose->output());
+      transpose->addInput(output);
+      if (output->has_sizes()) {
+        const auto& sizes = transpose->output()->sizes();
+        std::vector<Dimension> permuted(sizes);
+        for (size_t i = 0; i < output_perm.size(); ++i) {
+          permuted[output_perm[i]] = sizes[i];
+        }
+        output->setSizes(permuted);
+      }
+    }
+    destroyDeadNodes(removed);
+    return true;
+  }
+
+  // The number of leading inputs of node laid out like its output, 0 if it
+  // is not an operator the pass handles.
+  static size_t numLayoutInputs(const Node* node) {
+    const NodeKind kind = node->kind();
+    if (kind == kConcat || contains(broadcastKinds(), kind)) {
+      return node->inputs().size();
+    }
+    if (kind == kTranspose || kind == Symbol("Pad") ||
+        kind == Symbol("Resize") || isReduce(node) ||
+        contains(unaryKinds(), kind)) {
+      return std::min<size_t>(node->inputs().size(), 1);
+    }
+    return 0;
+  }
+
+ private:
+  static bool isDefaultDomain(const Node* node) {
+    return node->domain().empty() || node->domain() == "ai.onnx";
+  }
+
+  static const std::vector<NodeKind>& unaryKinds() {
+    static const std::vector<NodeKind> kinds = {
+        Symbol("Abs"), Symbol("Cast"), Symbol("Ceil"), Symbol("Clip"),
+        Symbol("Cos"), Symbol("Elu"), Symbol("Erf"), Symbol("Exp"),
+        Symbol("Floor"), Symbol("HardSigmoid"), Symbol("Identity"),
+        Symbol("IsNaN"), Symbol("LeakyRelu"), Symbol("Log"), Symbol("Neg"),
+        Symbol("Not"), Symbol("Reciprocal"), Symbol("Relu"), Symbol("Round"),
+        Symbol("Selu"), Symbol("Sigmoid"), Symbol("Sign"), Symbol("Sin"),
+        Symbol("Softplus"), Symbol("Softsign"), kSqrt, Symbol("Tanh")};
+    return kinds;
+  }
+
+  static const std::vector<NodeKind>& broadcastKinds() {
+    static const std::vector<NodeKind> kinds = {
+        kAdd, Symbol("And"), Symbol("Div"), Symbol("Equal"), Symbol("Greater"),
+        Symbol("GreaterOrEqual"), Symbol("Less"), Symbol("LessOrEqual"),
+        Symbol("Max"), Symbol("Mean"), Symbol("Min"), Symbol("Mod"), kMul,
+        Symbol("Or"), Symbol("Pow"), Symbol("PRelu"), Symbol("Sub"),
+        Symbol("Sum"), Symbol("Where"), Symbol("Xor")};
+    return kinds;
+  }
+
+  static const std::vector<NodeKind>& reduceKinds() {
+    static const std::vector<NodeKind> kinds = {
+        Symbol("ReduceL1"), Symbol("ReduceL2"), Symbol("ReduceLogSum"),
+        Symbol("ReduceLogSumExp"), Symbol("ReduceMax"), kReduceMean,
+        Symbol("ReduceMin"), Symbol("ReduceProd"), Symbol("ReduceSum"),
+        Symbol("ReduceSumSquare")};
+    return kinds;
+  }
+
+  static bool contains(const std::vector<NodeKind>& kinds, NodeKind kind) {
+    return std::find(kinds.begin(), kinds.end(), kind) != kinds.end();
+  }
+
+  static bool isReduce(const Node* node) {
+    return contains(reduceKinds(), node->kind());
+  }
+
+  static bool onlyUsedBy(const Value* value, const Node* node) {
+    for (const Use& use : value->uses()) {
+      if (use.user != node) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Whether value has a single element, which broadcasts the same way
+  // whatever the layout.
+  static bool isScalar(const Value* value) {
+    for (const Dimension& dim : value->sizes()) {
+      if (!dim.is_int || dim.dim != 1) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static std::vector<int64_t> invertPerm(const std::vector<int64_t>& perm) {
+    std::vector<int64_t> inverse(perm.size());
+    for (size_t i = 0; i < perm.size(); ++i) {
+      inverse[perm[i]] = static_cast<int64_t>(i);
+    }
+    return inverse;
+  }
+
+  static bool isIdentityPerm(const std::vector<int64_t>& perm) {
+    for (size_t i = 0; i < perm.size(); ++i) {
+      if (perm[i] != static_cast<int64_t>(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static Value* insertTranspose(Node* node, Value* input,
+                                const std::vector<int64_t>& perm,
+                                Graph& graph) {
+    Node* transpose = graph.create(kTranspose, 1);
+    transpose->addInput(input);
+    transpose->is_(kperm, std::vector<int64_t>(perm));
+    transpose->insertBefore(node);
+    transpose->output()->setElemType(input->elemType());
+    if (input->has_sizes()) {
+      std::vector<Dimension> sizes;
+      for (int64_t axis : perm) {
+        sizes.push_back(input->sizes()[axis]);
+      }
+      transpose->output()->setSizes(sizes);
+    }
+    return transpose->output();
+  }
+
+  // Replaces input i of node by value, dropping the constant it was if
+  // nothing else uses it.
+  static void replaceConstantInput(Node* node, size_t i, Value* value,
+                                   Graph& graph) {
+    Value* old_value = node->inputs()[i];
+    node->replaceInput(i, value);
+    if (old_value->uses().size() != 0) {
+      return;
+    }
+    if (old_value->node()->kind() == kConstant) {
+      old_value->node()->destroy();
+    } else {
+      InitializerIndex::get(graph).eraseInitializerAndInput(old_value);
+    }
+  }
+
+  static Value* addInts(const std::vector<int64_t>& values, Graph& graph) {
+    Tensor t;
+    t.sizes().push_back(values.size());
+    t.int64s() = values;
+    t.elem_type() = TensorProto_DataType_INT64;
+    return InitializerIndex::get(graph).addInitializerAndInput(t);
+  }
+
+  static bool mergeTransposes(Node* node, NodeDestroyType& destroy_current) {
+    Node* inner = node->input()->node();
+    std::vector<int64_t> perm =
+        FuseConsecutiveTransposes::compose_transposes(inner->is(kperm),
+                                                      node->is(kperm));
+    if (isIdentityPerm(perm)) {
+      if (!tryReplacingAllUsesWith(node->output(), inner->input())) {
+        return false;
+      }
+      destroy_current = NodeDestroyType::DestroyOne;
+    } else {
+      node->is_(kperm, std::move(perm));
+    }
+    node->replaceInput(0, inner->input());
+    if (!inner->hasUses()) {
+      inner->destroy();
+    }
+    return true;
+  }
+
+  // Concat(Transpose(X, perm), ..., axis) is
+  // Transpose(Concat(X, ..., perm[axis]), perm), the same goes for the pads
+  // of Pad. Reduce(Transpose(X, perm), axes) is
+  // Transpose(Reduce(X, perm[axes]), output_perm), output_perm being perm
+  // without the reduced axes when they are not kept. Sets ints to the axis,
+  // pads or axes for X, leaving node as it is.
+  static bool permutedInts(const Node* node, Graph& graph,
+                           const std::vector<int64_t>& perm,
+                           std::vector<int64_t>& ints,
+                           std::vector<int64_t>& output_perm) {
+    const int64_t rank = static_cast<int64_t>(perm.size());
+    if (node->kind() == kConcat) {
+      if (!node->hasAttribute(kaxis)) {
+        return false;
+      }
+      int64_t axis = node->i(kaxis);
+      if (axis < 0) {
+        axis += rank;
+      }
+      if (axis < 0 || axis >= rank) {
+        return false;
+      }
+      ints = {perm[axis]};
+    } else if (node->kind() == Symbol("Pad")) {
+      return permutedPads(node, graph, perm, ints);
+    } else if (isReduce(node)) {
+      return permutedReduceAxes(node, graph, perm, ints, output_perm);
+    }
+    return true;
+  }
+
+  static void setPermutedInts(Node* node, Graph& graph,
+                              std::vector<int64_t>& ints) {
+    const Symbol pads_attr("pads");
+    if (node->kind() == kConcat) {
+      node->i_(kaxis, ints[0]);
+    } else if (node->kind() == Symbol("Pad")) {
+      if (node->hasAttribute(pads_attr)) {
+        node->is_(pads_attr, std::move(ints));
+      } else {
+        replaceConstantInput(node, 1, addInts(ints, graph), graph);
+      }
+    } else if (isReduce(node) && !ints.empty()) {
+      if (node->hasAttribute(kaxes)) {
+        node->is_(kaxes, std::move(ints));
+      } else {
+        replaceConstantInput(node, 1, addInts(ints, graph), graph);
+      }
+    }
+  }
+
+  // The pads are an attribute before opset 11, an input since.
+  static bool permutedPads(const Node* node, Graph& graph,
+                           const std::vector<int64_t>& perm,
+                           std::vector<int64_t>& permuted) {
+    const size_t rank = perm.size();
+    const Symbol pads_attr("pads");
+    std::vector<int64_t> pads;
+    if (node->hasAttribute(pads_attr)) {
+      pads = node->is(pads_attr);
+    } else if (node->inputs().size() < 2 ||
+               !getConstantInts(node->inputs()[1], graph, &pads)) {
+      return false;
+    }
+    // The axes input of opset 18 is not handled
+    if (pads.size() != 2 * rank ||
+        (node->inputs().size() > 3 &&
+         node->inputs()[3]->node()->kind() != kUndefined)) {
+      return false;
+    }
+    permuted.resize(pads.size());
+    for (size_t i = 0; i < rank; ++i) {
+      permuted[perm[i]] = pads[i];
+      permuted[rank + perm[i]] = pads[rank + i];
+    }
+    return true;
+  }
+
+  // Resize(Transpose(X, perm), roi, scales, sizes) is
+  // Transpose(Resize(X, roi', scales', sizes'), perm), the inputs being
+  // permuted like the pads of Pad. Adds initializers holding the non-empty
+  // ones to inputs, which must be constants, unless the axes attribute of
+  // opset 18 is set.
+  static bool permutedResizeInputs(
+      const Node* node, Graph& graph, const std::vector<int64_t>& perm,
+      std::vector<std::pair<size_t, Value*>>& inputs) {
+    if (node->hasAttribute(kaxes)) {
+      return false;
+    }
+    const size_t rank = perm.size();
+    for (size_t i = 1; i < node->inputs().size(); ++i) {
+      const Value* input = node->inputs()[i];
+      if (input->node()->kind() == kUndefined) {
+        continue;
+      }
+      const Tensor* tensor = getConstantTensor(input, graph);
+      std::string scratch;
+      const char* data;
+      size_t size;
+      if (tensor == nullptr || tensor->sizes().size() != 1 ||
+          !ElementBytes(*tensor, scratch, &data, &size)) {
+        return removeInputs(graph, inputs);
+      }
+      const size_t count = static_cast<size_t>(tensor->sizes()[0]);
+      const size_t element_size = ElementSize(tensor->elem_type());
+      if (count == 0) {
+        continue;
+      }
+      // roi holds the starts of all axes, then their ends
+      if ((count != rank && count != 2 * rank) || element_size == 0 ||
+          size != count * element_size) {
+        return removeInputs(graph, inputs);
+      }
+      std::string permuted(size, '\0');
+      for (size_t j = 0; j < count; ++j) {
+        const size_t k = (j / rank) * rank + perm[j % rank];
+        permuted.replace(k * element_size, element_size,
+                         data + j * element_size, element_size);
+      }
+      inputs.emplace_back(
+          i, InitializerIndex::get(graph).addInitializerAndInput(MakeRawTensor(
+                 tensor->elem_type(), tensor->sizes(), std::move(permuted))));
+    }
+    return true;
+  }
+
+  static bool removeInputs(Graph& graph,
+                           std::vector<std::pair<size_t, Value*>>& inputs) {
+    for (const auto& input : inputs) {
+      InitializerIndex::get(graph).eraseInitializerAndInput(input.second);
+    }
+    inputs.clear();
+    return false;
+  }
+
+  // The axes are an attribute, or an input since opset 18. Leaves axes empty
+  // if they are.
+  static bool permutedReduceAxes(const Node* node, Graph& graph,
+                                 const std::vector<int64_t>& perm,
+                                 std::vector<int64_t>& axes,
+                                 std::vector<int64_t>& output_perm) {
+    const int64_t rank = static_cast<int64_t>(perm.size());
+    if (node->hasAttribute(kaxes)) {
+      axes = node->is(kaxes);
+    } else if (node->inputs().size() > 1 &&
+               node->inputs()[1]->node()->kind() != kUndefined &&
+               !getConstantInts(node->inputs()[1], graph, &axes)) {
+      return false;
+    }
+    const bool keepdims =
+        !node->hasAttribute(kkeepdims) || node->i(kkeepdims) != 0;
+    const Symbol noop_attr("noop_with_empty_axes");
+    if (axes.empty()) {
+      // Either nothing or everything is reduced, the latter leaving a
+      // tensor with a single element
+      if (!node->hasAttribute(noop_attr) || node->i(noop_attr) == 0) {
+        output_perm.clear();
+      }
+      return true;
+    }
+    std::vector<bool> reduced(rank, false);
+    for (int64_t& axis : axes) {
+      if (axis < 0) {
+        axis += rank;
+      }
+      if (axis < 0 || axis >= rank) {
+        return false;
+      }
+      axis = perm[axis];
+      reduced[axis] = true;
+    }
+    std::sort(axes.begin(), axes.end());
+    if (std::count(reduced.begin(), reduced.end(), true) == rank) {
+      output_perm.clear();
+    } else if (!keepdims) {
+      // Renumbers the axes left after the reduction
+      std::vector<int64_t> new_index(rank);
+      int64_t num_kept = 0;
+      for (int64_t i = 0; i < rank; ++i) {
+        new_index[i] = num_kept;
+        num_kept += reduced[i] ? 0 : 1;
+      }
+      output_perm.clear();
+      for (int64_t axis : perm) {
+        if (!reduced[axis]) {
+          output_perm.push_back(new_index[axis]);
+        }
+      }
+      if (isIdentityPerm(output_perm)) {
+        output_perm.clear();
+      }
+    }
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -15,6 +15,7 @@ namespace optimization {
 static constexpr const char* impure_operators[] = {
     "RandomNormal",  "RandomNormalLike",
     "RandomUniform", "RandomUniformLike",
+    "Bernoulli",     "Multinomial",
     "Loop",          "If",
     "Scan",
 };
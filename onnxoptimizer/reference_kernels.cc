@@ -0,0 +1,1661 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "onnxoptimizer/reference_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+#include "onnxoptimizer/tensor_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+// A tensor with its elements packed as in raw_data.
+struct Array {
+  int32_t elem_type = TensorProto_DataType_UNDEFINED;
+  std::vector<int64_t> dims;
+  std::string bytes;
+
+  int64_t count() const {
+    return ElementCount(dims);
+  }
+  size_t elementSize() const {
+    return ElementSize(elem_type);
+  }
+};
+
+struct KernelContext {
+  Node* node;
+  // nullptr for missing optional inputs.
+  std::vector<const Array*> inputs;
+  size_t max_output_bytes;
+  std::vector<Array> outputs;
+
+  const Array* input(size_t i) const {
+    return i < inputs.size() ? inputs[i] : nullptr;
+  }
+
+  // Creates output i, filled with zeros. Returns nullptr if dims are invalid
+  // or the output would be too large.
+  Array* output(size_t i, int32_t elem_type, std::vector<int64_t> dims) {
+    const size_t element_size = ElementSize(elem_type);
+    if (element_size == 0) {
+      return nullptr;
+    }
+    size_t count = 1;
+    for (int64_t dim : dims) {
+      if (dim < 0) {
+        return nullptr;
+      }
+    }
+    if (std::find(dims.begin(), dims.end(), 0) != dims.end()) {
+      count = 0;
+    }
+    for (size_t k = 0; k < dims.size() && count != 0; ++k) {
+      const size_t dim = static_cast<size_t>(dims[k]);
+      if (count > max_output_bytes / dim) {
+        return nullptr;
+      }
+      count *= dim;
+    }
+    if (count > max_output_bytes / element_size) {
+      return nullptr;
+    }
+    if (outputs.size() <= i) {
+      outputs.resize(i + 1);
+    }
+    Array& out = outputs[i];
+    out.elem_type = elem_type;
+    out.dims = std::move(dims);
+    out.bytes.assign(count * element_size, '\0');
+    return &out;
+  }
+};
+
+typedef bool (*Kernel)(KernelContext& ctx);
+
+bool hasIntAttribute(Node* node, Symbol name) {
+  return node->hasAttribute(name) && node->kindOf(name) == AttributeKind::i;
+}
+
+bool hasIntsAttribute(Node* node, Symbol name) {
+  return node->hasAttribute(name) && node->kindOf(name) == AttributeKind::is;
+}
+
+int64_t intAttribute(Node* node, const char* name, int64_t default_value) {
+  const Symbol symbol(name);
+  return hasIntAttribute(node, symbol) ? node->i(symbol) : default_value;
+}
+
+bool isFloating(int32_t elem_type) {
+  return elem_type == TensorProto_DataType_FLOAT ||
+      elem_type == TensorProto_DataType_DOUBLE ||
+      elem_type == TensorProto_DataType_FLOAT16 ||
+      elem_type == TensorProto_DataType_BFLOAT16;
+}
+
+// Integer types whose values fit an int64_t.
+bool isInteger(int32_t elem_type) {
+  return elem_type == TensorProto_DataType_BOOL ||
+      elem_type == TensorProto_DataType_INT8 ||
+      elem_type == TensorProto_DataType_INT16 ||
+      elem_type == TensorProto_DataType_INT32 ||
+      elem_type == TensorProto_DataType_INT64 ||
+      elem_type == TensorProto_DataType_UINT8 ||
+      elem_type == TensorProto_DataType_UINT16 ||
+      elem_type == TensorProto_DataType_UINT32;
+}
+
+template <typename T>
+T loadAt(const std::string& bytes, size_t i) {
+  T value;
+  std::memcpy(&value, bytes.data() + i * sizeof(T), sizeof(T));
+  return value;
+}
+
+template <typename T>
+void storeAt(std::string& bytes, size_t i, T value) {
+  std::memcpy(&bytes[i * sizeof(T)], &value, sizeof(T));
+}
+
+template <typename T, typename R>
+void loadAll(const Array& array, std::vector<R>* values) {
+  values->resize(array.bytes.size() / sizeof(T));
+  for (size_t i = 0; i < values->size(); ++i) {
+    (*values)[i] = static_cast<R>(loadAt<T>(array.bytes, i));
+  }
+}
+
+bool toDoubles(const Array& array, std::vector<double>* values) {
+  switch (array.elem_type) {
+    case TensorProto_DataType_FLOAT:
+      loadAll<float>(array, values);
+      return true;
+    case TensorProto_DataType_DOUBLE:
+      loadAll<double>(array, values);
+      return true;
+    case TensorProto_DataType_FLOAT16:
+    case TensorProto_DataType_BFLOAT16: {
+      std::vector<uint16_t> bits;
+      loadAll<uint16_t>(array, &bits);
+      values->resize(bits.size());
+      for (size_t i = 0; i < bits.size(); ++i) {
+        (*values)[i] = array.elem_type == TensorProto_DataType_FLOAT16
+            ? HalfToFloat(bits[i])
+            : BFloat16ToFloat(bits[i]);
+      }
+      return true;
+    }
+    case TensorProto_DataType_BOOL:
+    case TensorProto_DataType_UINT8:
+      loadAll<uint8_t>(array, values);
+      return true;
+    case TensorProto_DataType_INT8:
+      loadAll<int8_t>(array, values);
+      return true;
+    case TensorProto_DataType_INT16:
+      loadAll<int16_t>(array, values);
+      return true;
+    case TensorProto_DataType_UINT16:
+      loadAll<uint16_t>(array, values);
+      return true;
+    case TensorProto_DataType_INT32:
+      loadAll<int32_t>(array, values);
+      return true;
+    case TensorProto_DataType_UINT32:
+      loadAll<uint32_t>(array, values);
+      return true;
+    case TensorProto_DataType_INT64:
+      loadAll<int64_t>(array, values);
+      return true;
+    case TensorProto_DataType_UINT64:
+      loadAll<uint64_t>(array, values);
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool toInt64s(const Array& array, std::vector<int64_t>* values) {
+  switch (array.elem_type) {
+    case TensorProto_DataType_BOOL:
+    case TensorProto_DataType_UINT8:
+      loadAll<uint8_t>(array, values);
+      return true;
+    case TensorProto_DataType_INT8:
+      loadAll<int8_t>(array, values);
+      return true;
+    case TensorProto_DataType_INT16:
+      loadAll<int16_t>(array, values);
+      return true;
+    case TensorProto_DataType_UINT16:
+      loadAll<uint16_t>(array, values);
+      return true;
+    case TensorProto_DataType_INT32:
+      loadAll<int32_t>(array, values);
+      return true;
+    case TensorProto_DataType_UINT32:
+      loadAll<uint32_t>(array, values);
+      return true;
+    case TensorProto_DataType_INT64:
+      loadAll<int64_t>(array, values);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Stores values into out, which already has its type and dims, rounding
+// them to its floating point type.
+void fromDoubles(const std::vector<double>& values, Array* out) {
+  for (size_t i = 0; i < values.size(); ++i) {
+    const double value = values[i];
+    switch (out->elem_type) {
+      case TensorProto_DataType_FLOAT:
+        storeAt(out->bytes, i, static_cast<float>(value));
+        break;
+      case TensorProto_DataType_DOUBLE:
+        storeAt(out->bytes, i, value);
+        break;
+      case TensorProto_DataType_FLOAT16:
+        storeAt(out->bytes, i, FloatToHalf(static_cast<float>(value)));
+        break;
+      case TensorProto_DataType_BFLOAT16:
+        storeAt(out->bytes, i, FloatToBFloat16(static_cast<float>(value)));
+        break;
+      case TensorProto_DataType_BOOL:
+        storeAt(out->bytes, i, static_cast<uint8_t>(value != 0));
+        break;
+    }
+  }
+}
+
+// Stores values into out, which already has its type and dims, wrapping
+// them around to its integer type.
+void fromInt64s(const std::vector<int64_t>& values, Array* out) {
+  for (size_t i = 0; i < values.size(); ++i) {
+    const int64_t value = values[i];
+    switch (out->elem_type) {
+      case TensorProto_DataType_BOOL:
+        storeAt(out->bytes, i, static_cast<uint8_t>(value != 0));
+        break;
+      case TensorProto_DataType_UINT8:
+        storeAt(out->bytes, i, static_cast<uint8_t>(value));
+        break;
+      case TensorProto_DataType_INT8:
+        storeAt(out->bytes, i, static_cast<int8_t>(value));
+        break;
+      case TensorProto_DataType_INT16:
+        storeAt(out->bytes, i, static_cast<int16_t>(value));
+        break;
+      case TensorProto_DataType_UINT16:
+        storeAt(out->bytes, i, static_cast<uint16_t>(value));
+        break;
+      case TensorProto_DataType_INT32:
+        storeAt(out->bytes, i, static_cast<int32_t>(value));
+        break;
+      case TensorProto_DataType_UINT32:
+        storeAt(out->bytes, i, static_cast<uint32_t>(value));
+        break;
+      case TensorProto_DataType_INT64:
+        storeAt(out->bytes, i, value);
+        break;
+      case TensorProto_DataType_UINT64:
+        storeAt(out->bytes, i, static_cast<uint64_t>(value));
+        break;
+    }
+  }
+}
+
+// The values of a tensor of integers, such as shapes and axes.
+bool int64Values(const Array* array, std::vector<int64_t>* values) {
+  return array != nullptr && toInt64s(*array, values);
+}
+
+std::vector<int64_t> rowMajorStrides(const std::vector<int64_t>& dims) {
+  std::vector<int64_t> strides(dims.size(), 1);
+  for (size_t k = dims.size(); k > 1; --k) {
+    strides[k - 2] = strides[k - 1] * dims[k - 1];
+  }
+  return strides;
+}
+
+// Fills out, which already has its type and dims, with the elements of in
+// at offset + sum(index[k] * strides[k]), for every index of out in
+// row-major order. All offsets must be within in.
+void copyStrided(
+    const Array& in,
+    int64_t offset,
+    const std::vector<int64_t>& strides,
+    Array* out) {
+  const size_t element_size = in.elementSize();
+  const int64_t count = out->count();
+  const size_t rank = out->dims.size();
+  std::vector<int64_t> index(rank, 0);
+  int64_t in_offset = offset;
+  for (int64_t i = 0; i < count; ++i) {
+    std::memcpy(
+        &out->bytes[i * element_size],
+        in.bytes.data() + in_offset * element_size,
+        element_size);
+    // Advances to the next index, carrying over full dimensions.
+    for (size_t k = rank; k > 0; --k) {
+      const size_t axis = k - 1;
+      in_offset += strides[axis];
+      if (++index[axis] < out->dims[axis]) {
+        break;
+      }
+      in_offset -= strides[axis] * index[axis];
+      index[axis] = 0;
+    }
+  }
+}
+
+bool broadcastDims(
+    const std::vector<int64_t>& a,
+    const std::vector<int64_t>& b,
+    std::vector<int64_t>* dims) {
+  const size_t rank = std::max(a.size(), b.size());
+  dims->assign(rank, 1);
+  for (size_t k = 0; k < rank; ++k) {
+    const int64_t a_dim = k < rank - a.size() ? 1 : a[k - (rank - a.size())];
+    const int64_t b_dim = k < rank - b.size() ? 1 : b[k - (rank - b.size())];
+    if (a_dim != b_dim && a_dim != 1 && b_dim != 1) {
+      return false;
+    }
+    (*dims)[k] = a_dim == 1 ? b_dim : a_dim;
+  }
+  return true;
+}
+
+// Repeats the elements of in along its dimensions of size 1 to fill dims.
+bool broadcastTo(
+    const Array& in,
+    const std::vector<int64_t>& dims,
+    Array* out) {
+  std::vector<int64_t> check;
+  if (!broadcastDims(in.dims, dims, &check) || check != dims) {
+    return false;
+  }
+  out->elem_type = in.elem_type;
+  out->dims = dims;
+  if (in.dims == dims) {
+    out->bytes = in.bytes;
+    return true;
+  }
+  out->bytes.assign(out->count() * in.elementSize(), '\0');
+  const std::vector<int64_t> in_strides = rowMajorStrides(in.dims);
+  std::vector<int64_t> strides(dims.size(), 0);
+  const size_t leading = dims.size() - in.dims.size();
+  for (size_t k = 0; k < in.dims.size(); ++k) {
+    strides[leading + k] = in.dims[k] == 1 ? 0 : in_strides[k];
+  }
+  copyStrided(in, 0, strides, out);
+  return true;
+}
+
+// Broadcasts the inputs of ctx, which must all be present, to their common
+// shape.
+bool broadcastInputs(
+    const KernelContext& ctx,
+    std::vector<Array>* arrays,
+    std::vector<int64_t>* dims) {
+  dims->clear();
+  for (const Array* input : ctx.inputs) {
+    if (input == nullptr) {
+      return false;
+    }
+    std::vector<int64_t> broadcast;
+    if (!broadcastDims(*dims, input->dims, &broadcast)) {
+      return false;
+    }
+    dims->swap(broadcast);
+  }
+  arrays->resize(ctx.inputs.size());
+  for (size_t i = 0; i < ctx.inputs.size(); ++i) {
+    if (!broadcastTo(*ctx.inputs[i], *dims, &(*arrays)[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Elementwise operators, integer ones return false when the result is
+// undefined.
+typedef double (*FloatBinaryOp)(double, double);
+typedef bool (*IntBinaryOp)(int64_t, int64_t, int64_t*);
+typedef double (*FloatUnaryOp)(double);
+typedef bool (*IntUnaryOp)(int64_t, int64_t*);
+
+// Folds the broadcast inputs with op from left to right. Comparisons
+// produce booleans, other operators the type of their inputs. Either op may
+// be nullptr if the operator does not support the corresponding types.
+bool elementwise(
+    KernelContext& ctx,
+    FloatBinaryOp float_op,
+    IntBinaryOp int_op,
+    bool comparison) {
+  std::vector<Array> arrays;
+  std::vector<int64_t> dims;
+  if (ctx.inputs.empty() || !broadcastInputs(ctx, &arrays, &dims)) {
+    return false;
+  }
+  const int32_t elem_type = arrays[0].elem_type;
+  for (const Array& array : arrays) {
+    if (array.elem_type != elem_type) {
+      return false;
+    }
+  }
+  Array* out = ctx.output(
+      0, comparison ? TensorProto_DataType_BOOL : elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  if (isFloating(elem_type) && float_op != nullptr) {
+    std::vector<double> result;
+    std::vector<double> values;
+    toDoubles(arrays[0], &result);
+    for (size_t k = 1; k < arrays.size(); ++k) {
+      toDoubles(arrays[k], &values);
+      for (size_t i = 0; i < result.size(); ++i) {
+        result[i] = float_op(result[i], values[i]);
+      }
+    }
+    fromDoubles(result, out);
+    return true;
+  }
+  if (isInteger(elem_type) && int_op != nullptr) {
+    std::vector<int64_t> result;
+    std::vector<int64_t> values;
+    toInt64s(arrays[0], &result);
+    for (size_t k = 1; k < arrays.size(); ++k) {
+      toInt64s(arrays[k], &values);
+      for (size_t i = 0; i < result.size(); ++i) {
+        if (!int_op(result[i], values[i], &result[i])) {
+          return false;
+        }
+      }
+    }
+    fromInt64s(result, out);
+    return true;
+  }
+  return false;
+}
+
+bool unary(KernelContext& ctx, FloatUnaryOp float_op, IntUnaryOp int_op) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  Array* out = ctx.output(0, in->elem_type, in->dims);
+  if (out == nullptr) {
+    return false;
+  }
+  if (isFloating(in->elem_type) && float_op != nullptr) {
+    std::vector<double> values;
+    toDoubles(*in, &values);
+    for (double& value : values) {
+      value = float_op(value);
+    }
+    fromDoubles(values, out);
+    return true;
+  }
+  if (isInteger(in->elem_type) && int_op != nullptr) {
+    std::vector<int64_t> values;
+    toInt64s(*in, &values);
+    for (int64_t& value : values) {
+      if (!int_op(value, &value)) {
+        return false;
+      }
+    }
+    fromInt64s(values, out);
+    return true;
+  }
+  return false;
+}
+
+// Integer arithmetic wraps around like the narrower types it stands for.
+int64_t wrappingAdd(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+int64_t wrappingSub(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b));
+}
+int64_t wrappingMul(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+}
+
+bool Add(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a + b; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = wrappingAdd(a, b);
+        return true;
+      },
+      false);
+}
+
+bool Sub(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a - b; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = wrappingSub(a, b);
+        return true;
+      },
+      false);
+}
+
+bool Mul(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a * b; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = wrappingMul(a, b);
+        return true;
+      },
+      false);
+}
+
+bool Div(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a / b; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        if (b == 0 || (a == std::numeric_limits<int64_t>::min() && b == -1)) {
+          return false;
+        }
+        *r = a / b;
+        return true;
+      },
+      false);
+}
+
+bool Mod(KernelContext& ctx) {
+  if (intAttribute(ctx.node, "fmod", 0) != 0) {
+    return elementwise(
+        ctx,
+        [](double a, double b) { return std::fmod(a, b); },
+        [](int64_t a, int64_t b, int64_t* r) {
+          if (b == 0 || b == -1) {
+            *r = 0;
+            return b != 0;
+          }
+          *r = a % b;
+          return true;
+        },
+        false);
+  }
+  // Like Python, the result takes the sign of the divisor.
+  return elementwise(
+      ctx,
+      nullptr,
+      [](int64_t a, int64_t b, int64_t* r) {
+        if (b == 0 || b == -1) {
+          *r = 0;
+          return b != 0;
+        }
+        *r = a % b;
+        if (*r != 0 && ((*r < 0) != (b < 0))) {
+          *r += b;
+        }
+        return true;
+      },
+      false);
+}
+
+bool Max(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) {
+        return std::isnan(a) || std::isnan(b) ? a + b : std::max(a, b);
+      },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = std::max(a, b);
+        return true;
+      },
+      false);
+}
+
+bool Min(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) {
+        return std::isnan(a) || std::isnan(b) ? a + b : std::min(a, b);
+      },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = std::min(a, b);
+        return true;
+      },
+      false);
+}
+
+bool Sum(KernelContext& ctx) {
+  return Add(ctx);
+}
+
+bool Equal(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a == b ? 1.0 : 0.0; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = a == b;
+        return true;
+      },
+      true);
+}
+
+bool Less(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a < b ? 1.0 : 0.0; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = a < b;
+        return true;
+      },
+      true);
+}
+
+bool LessOrEqual(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a <= b ? 1.0 : 0.0; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = a <= b;
+        return true;
+      },
+      true);
+}
+
+bool Greater(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a > b ? 1.0 : 0.0; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = a > b;
+        return true;
+      },
+      true);
+}
+
+bool GreaterOrEqual(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      [](double a, double b) { return a >= b ? 1.0 : 0.0; },
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = a >= b;
+        return true;
+      },
+      true);
+}
+
+bool And(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      nullptr,
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = a != 0 && b != 0;
+        return true;
+      },
+      false);
+}
+
+bool Or(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      nullptr,
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = a != 0 || b != 0;
+        return true;
+      },
+      false);
+}
+
+bool Xor(KernelContext& ctx) {
+  return elementwise(
+      ctx,
+      nullptr,
+      [](int64_t a, int64_t b, int64_t* r) {
+        *r = (a != 0) != (b != 0);
+        return true;
+      },
+      false);
+}
+
+bool Pow(KernelContext& ctx) {
+  const Array* base = ctx.input(0);
+  const Array* exponent = ctx.input(1);
+  std::vector<int64_t> dims;
+  if (base == nullptr || exponent == nullptr ||
+      !broadcastDims(base->dims, exponent->dims, &dims)) {
+    return false;
+  }
+  Array bases;
+  Array exponents;
+  std::vector<double> exponent_values;
+  if (!broadcastTo(*base, dims, &bases) ||
+      !broadcastTo(*exponent, dims, &exponents) ||
+      !toDoubles(exponents, &exponent_values)) {
+    return false;
+  }
+  Array* out = ctx.output(0, base->elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  if (isFloating(base->elem_type)) {
+    std::vector<double> values;
+    toDoubles(bases, &values);
+    for (size_t i = 0; i < values.size(); ++i) {
+      values[i] = std::pow(values[i], exponent_values[i]);
+    }
+    fromDoubles(values, out);
+    return true;
+  }
+  std::vector<int64_t> values;
+  if (!toInt64s(bases, &values)) {
+    return false;
+  }
+  for (size_t i = 0; i < values.size(); ++i) {
+    const double e = exponent_values[i];
+    if (e < 0 || e != std::floor(e) || e > 64) {
+      return false;
+    }
+    int64_t result = 1;
+    for (int64_t k = 0; k < static_cast<int64_t>(e); ++k) {
+      result = wrappingMul(result, values[i]);
+    }
+    values[i] = result;
+  }
+  fromInt64s(values, out);
+  return true;
+}
+
+bool Where(KernelContext& ctx) {
+  std::vector<Array> arrays;
+  std::vector<int64_t> dims;
+  if (ctx.inputs.size() != 3 || !broadcastInputs(ctx, &arrays, &dims) ||
+      arrays[0].elem_type != TensorProto_DataType_BOOL ||
+      arrays[1].elem_type != arrays[2].elem_type) {
+    return false;
+  }
+  Array* out = ctx.output(0, arrays[1].elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  const size_t element_size = out->elementSize();
+  for (int64_t i = 0; i < out->count(); ++i) {
+    const Array& chosen = arrays[0].bytes[i] != 0 ? arrays[1] : arrays[2];
+    std::memcpy(
+        &out->bytes[i * element_size],
+        chosen.bytes.data() + i * element_size,
+        element_size);
+  }
+  return true;
+}
+
+bool Neg(KernelContext& ctx) {
+  return unary(
+      ctx,
+      [](double a) { return -a; },
+      [](int64_t a, int64_t* r) {
+        *r = wrappingSub(0, a);
+        return true;
+      });
+}
+
+bool Abs(KernelContext& ctx) {
+  return unary(
+      ctx,
+      [](double a) { return std::fabs(a); },
+      [](int64_t a, int64_t* r) {
+        *r = a < 0 ? wrappingSub(0, a) : a;
+        return true;
+      });
+}
+
+bool Sign(KernelContext& ctx) {
+  return unary(
+      ctx,
+      [](double a) { return a > 0 ? 1.0 : a < 0 ? -1.0 : a; },
+      [](int64_t a, int64_t* r) {
+        *r = a > 0 ? 1 : a < 0 ? -1 : 0;
+        return true;
+      });
+}
+
+bool Relu(KernelContext& ctx) {
+  return unary(
+      ctx,
+      [](double a) { return a < 0 ? 0.0 : a; },
+      [](int64_t a, int64_t* r) {
+        *r = std::max<int64_t>(a, 0);
+        return true;
+      });
+}
+
+bool Not(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr || in->elem_type != TensorProto_DataType_BOOL) {
+    return false;
+  }
+  return unary(ctx, nullptr, [](int64_t a, int64_t* r) {
+    *r = a == 0;
+    return true;
+  });
+}
+
+bool Sqrt(KernelContext& ctx) {
+  return unary(ctx, [](double a) { return std::sqrt(a); }, nullptr);
+}
+
+bool Exp(KernelContext& ctx) {
+  return unary(ctx, [](double a) { return std::exp(a); }, nullptr);
+}
+
+bool Log(KernelContext& ctx) {
+  return unary(ctx, [](double a) { return std::log(a); }, nullptr);
+}
+
+bool Reciprocal(KernelContext& ctx) {
+  return unary(ctx, [](double a) { return 1 / a; }, nullptr);
+}
+
+bool Floor(KernelContext& ctx) {
+  return unary(ctx, [](double a) { return std::floor(a); }, nullptr);
+}
+
+bool Ceil(KernelContext& ctx) {
+  return unary(ctx, [](double a) { return std::ceil(a); }, nullptr);
+}
+
+bool Round(KernelContext& ctx) {
+  // Rounds half to even, the default rounding mode.
+  return unary(ctx, [](double a) { return std::nearbyint(a); }, nullptr);
+}
+
+bool Sigmoid(KernelContext& ctx) {
+  return unary(ctx, [](double a) { return 1 / (1 + std::exp(-a)); }, nullptr);
+}
+
+bool Tanh(KernelContext& ctx) {
+  return unary(ctx, [](double a) { return std::tanh(a); }, nullptr);
+}
+
+// Whether value, already truncated, is representable by the integer type.
+bool fitsIn(int32_t elem_type, double value) {
+  switch (elem_type) {
+    case TensorProto_DataType_UINT8:
+      return value >= 0 && value <= 255;
+    case TensorProto_DataType_INT8:
+      return value >= -128 && value <= 127;
+    case TensorProto_DataType_UINT16:
+      return value >= 0 && value <= 65535;
+    case TensorProto_DataType_INT16:
+      return value >= -32768 && value <= 32767;
+    case TensorProto_DataType_UINT32:
+      return value >= 0 && value <= 4294967295.0;
+    case TensorProto_DataType_INT32:
+      return value >= -2147483648.0 && value <= 2147483647.0;
+    case TensorProto_DataType_INT64:
+      return value >= -9223372036854775808.0 && value < 9223372036854775808.0;
+    case TensorProto_DataType_UINT64:
+      return value >= 0 && value < 18446744073709551616.0;
+    default:
+      return false;
+  }
+}
+
+bool castTo(KernelContext& ctx, int32_t to) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  if (!isFloating(in->elem_type) && !isInteger(in->elem_type) &&
+      !(in->elem_type == TensorProto_DataType_UINT64 && isFloating(to))) {
+    return false;
+  }
+  Array* out = ctx.output(0, to, in->dims);
+  if (out == nullptr) {
+    return false;
+  }
+  if (isFloating(to) || to == TensorProto_DataType_BOOL) {
+    std::vector<double> values;
+    toDoubles(*in, &values);
+    fromDoubles(values, out);
+    return true;
+  }
+  if (isInteger(in->elem_type)) {
+    std::vector<int64_t> values;
+    toInt64s(*in, &values);
+    fromInt64s(values, out);
+    return true;
+  }
+  // Out of range conversions from floating point types are undefined.
+  std::vector<double> values;
+  toDoubles(*in, &values);
+  std::vector<int64_t> truncated(values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    const double value = std::trunc(values[i]);
+    if (!fitsIn(to, value)) {
+      return false;
+    }
+    truncated[i] = to == TensorProto_DataType_UINT64
+        ? static_cast<int64_t>(static_cast<uint64_t>(value))
+        : static_cast<int64_t>(value);
+  }
+  fromInt64s(truncated, out);
+  return true;
+}
+
+bool Cast(KernelContext& ctx) {
+  if (!hasIntAttribute(ctx.node, kto)) {
+    return false;
+  }
+  return castTo(ctx, static_cast<int32_t>(ctx.node->i(kto)));
+}
+
+bool CastLike(KernelContext& ctx) {
+  const Array* target = ctx.input(1);
+  return target != nullptr && castTo(ctx, target->elem_type);
+}
+
+bool Identity(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  Array* out = ctx.output(0, in->elem_type, in->dims);
+  if (out == nullptr) {
+    return false;
+  }
+  out->bytes = in->bytes;
+  return true;
+}
+
+// Identity with different dims, which must hold as many elements.
+bool reshapeTo(KernelContext& ctx, std::vector<int64_t> dims) {
+  const Array* in = ctx.input(0);
+  if (ElementCount(dims) != in->count()) {
+    return false;
+  }
+  Array* out = ctx.output(0, in->elem_type, std::move(dims));
+  if (out == nullptr) {
+    return false;
+  }
+  out->bytes = in->bytes;
+  return true;
+}
+
+bool Reshape(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  std::vector<int64_t> shape;
+  if (hasIntsAttribute(ctx.node, kshape)) {
+    shape = ctx.node->is(kshape);
+  } else if (!int64Values(ctx.input(1), &shape)) {
+    return false;
+  }
+  if (in == nullptr) {
+    return false;
+  }
+  const bool allow_zero = intAttribute(ctx.node, "allowzero", 0) != 0;
+  int64_t inferred_axis = -1;
+  int64_t known = 1;
+  for (size_t k = 0; k < shape.size(); ++k) {
+    if (shape[k] == 0 && !allow_zero) {
+      if (k >= in->dims.size()) {
+        return false;
+      }
+      shape[k] = in->dims[k];
+    }
+    if (shape[k] == -1) {
+      if (inferred_axis >= 0) {
+        return false;
+      }
+      inferred_axis = static_cast<int64_t>(k);
+    } else if (shape[k] < 0) {
+      return false;
+    } else {
+      known *= shape[k];
+    }
+  }
+  if (inferred_axis >= 0) {
+    if (known == 0 || in->count() % known != 0) {
+      return false;
+    }
+    shape[inferred_axis] = in->count() / known;
+  }
+  return reshapeTo(ctx, std::move(shape));
+}
+
+bool Flatten(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(in->dims.size());
+  int64_t axis = intAttribute(ctx.node, "axis", 1);
+  if (axis < 0) {
+    axis += rank;
+  }
+  if (axis < 0 || axis > rank) {
+    return false;
+  }
+  const std::vector<int64_t> outer(in->dims.begin(), in->dims.begin() + axis);
+  const std::vector<int64_t> inner(in->dims.begin() + axis, in->dims.end());
+  return reshapeTo(ctx, {ElementCount(outer), ElementCount(inner)});
+}
+
+// Axes from the axes attribute, or else from the given input. Returns true
+// with has_axes unset when there are neither.
+bool axesOf(KernelContext& ctx, size_t input, std::vector<int64_t>* axes,
+            bool* has_axes) {
+  *has_axes = true;
+  if (hasIntsAttribute(ctx.node, kaxes)) {
+    *axes = ctx.node->is(kaxes);
+    return true;
+  }
+  if (ctx.input(input) != nullptr) {
+    return int64Values(ctx.input(input), axes);
+  }
+  *has_axes = false;
+  return true;
+}
+
+// Makes axes non-negative and checks they are below rank and unique.
+bool normalizeAxes(std::vector<int64_t>* axes, int64_t rank) {
+  std::vector<bool> seen(rank, false);
+  for (int64_t& axis : *axes) {
+    if (axis < 0) {
+      axis += rank;
+    }
+    if (axis < 0 || axis >= rank || seen[axis]) {
+      return false;
+    }
+    seen[axis] = true;
+  }
+  return true;
+}
+
+bool Squeeze(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  std::vector<int64_t> axes;
+  bool has_axes;
+  if (in == nullptr || !axesOf(ctx, 1, &axes, &has_axes)) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(in->dims.size());
+  if (!has_axes) {
+    for (int64_t k = 0; k < rank; ++k) {
+      if (in->dims[k] == 1) {
+        axes.push_back(k);
+      }
+    }
+  }
+  if (!normalizeAxes(&axes, rank)) {
+    return false;
+  }
+  std::vector<int64_t> dims;
+  for (int64_t k = 0; k < rank; ++k) {
+    if (std::find(axes.begin(), axes.end(), k) == axes.end()) {
+      dims.push_back(in->dims[k]);
+    } else if (in->dims[k] != 1) {
+      return false;
+    }
+  }
+  return reshapeTo(ctx, std::move(dims));
+}
+
+bool Unsqueeze(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  std::vector<int64_t> axes;
+  bool has_axes;
+  if (in == nullptr || !axesOf(ctx, 1, &axes, &has_axes) || !has_axes) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(in->dims.size() + axes.size());
+  if (!normalizeAxes(&axes, rank)) {
+    return false;
+  }
+  std::vector<int64_t> dims;
+  size_t next = 0;
+  for (int64_t k = 0; k < rank; ++k) {
+    if (std::find(axes.begin(), axes.end(), k) != axes.end()) {
+      dims.push_back(1);
+    } else {
+      dims.push_back(in->dims[next++]);
+    }
+  }
+  return reshapeTo(ctx, std::move(dims));
+}
+
+bool Transpose(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(in->dims.size());
+  std::vector<int64_t> perm;
+  if (hasIntsAttribute(ctx.node, kperm)) {
+    perm = ctx.node->is(kperm);
+  } else {
+    for (int64_t k = rank; k > 0; --k) {
+      perm.push_back(k - 1);
+    }
+  }
+  if (static_cast<int64_t>(perm.size()) != rank ||
+      !normalizeAxes(&perm, rank)) {
+    return false;
+  }
+  const std::vector<int64_t> in_strides = rowMajorStrides(in->dims);
+  std::vector<int64_t> dims(rank);
+  std::vector<int64_t> strides(rank);
+  for (int64_t k = 0; k < rank; ++k) {
+    dims[k] = in->dims[perm[k]];
+    strides[k] = in_strides[perm[k]];
+  }
+  Array* out = ctx.output(0, in->elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  copyStrided(*in, 0, strides, out);
+  return true;
+}
+
+bool Concat(KernelContext& ctx) {
+  if (ctx.inputs.empty() || ctx.input(0) == nullptr ||
+      !hasIntAttribute(ctx.node, kaxis)) {
+    return false;
+  }
+  const Array& first = *ctx.input(0);
+  const int64_t rank = static_cast<int64_t>(first.dims.size());
+  int64_t axis = ctx.node->i(kaxis);
+  if (axis < 0) {
+    axis += rank;
+  }
+  if (axis < 0 || axis >= rank) {
+    return false;
+  }
+  std::vector<int64_t> dims = first.dims;
+  dims[axis] = 0;
+  for (const Array* input : ctx.inputs) {
+    if (input == nullptr || input->elem_type != first.elem_type ||
+        input->dims.size() != first.dims.size()) {
+      return false;
+    }
+    for (int64_t k = 0; k < rank; ++k) {
+      if (k != axis && input->dims[k] != first.dims[k]) {
+        return false;
+      }
+    }
+    dims[axis] += input->dims[axis];
+  }
+  Array* out = ctx.output(0, first.elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  const std::vector<int64_t> outer_dims(dims.begin(), dims.begin() + axis);
+  const int64_t outer = ElementCount(outer_dims);
+  size_t position = 0;
+  for (int64_t i = 0; i < outer; ++i) {
+    for (const Array* input : ctx.inputs) {
+      const size_t block = input->bytes.size() / std::max<int64_t>(outer, 1);
+      out->bytes.replace(position, block, input->bytes, i * block, block);
+      position += block;
+    }
+  }
+  return true;
+}
+
+bool Gather(KernelContext& ctx) {
+  const Array* data = ctx.input(0);
+  std::vector<int64_t> indices;
+  if (data == nullptr || !int64Values(ctx.input(1), &indices)) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(data->dims.size());
+  int64_t axis = intAttribute(ctx.node, "axis", 0);
+  if (axis < 0) {
+    axis += rank;
+  }
+  if (axis < 0 || axis >= rank) {
+    return false;
+  }
+  const int64_t axis_dim = data->dims[axis];
+  for (int64_t& index : indices) {
+    if (index < 0) {
+      index += axis_dim;
+    }
+    if (index < 0 || index >= axis_dim) {
+      return false;
+    }
+  }
+  std::vector<int64_t> dims(data->dims.begin(), data->dims.begin() + axis);
+  const std::vector<int64_t>& indices_dims = ctx.input(1)->dims;
+  dims.insert(dims.end(), indices_dims.begin(), indices_dims.end());
+  dims.insert(dims.end(), data->dims.begin() + axis + 1, data->dims.end());
+  Array* out = ctx.output(0, data->elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  const std::vector<int64_t> inner_dims(
+      data->dims.begin() + axis + 1, data->dims.end());
+  const size_t block = ElementCount(inner_dims) * data->elementSize();
+  const int64_t outer = data->count() == 0
+      ? 0
+      : data->count() / (axis_dim * ElementCount(inner_dims));
+  size_t position = 0;
+  for (int64_t i = 0; i < outer; ++i) {
+    for (int64_t index : indices) {
+      out->bytes.replace(
+          position, block, data->bytes, (i * axis_dim + index) * block, block);
+      position += block;
+    }
+  }
+  return true;
+}
+
+bool Slice(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(in->dims.size());
+  std::vector<int64_t> starts;
+  std::vector<int64_t> ends;
+  std::vector<int64_t> axes;
+  std::vector<int64_t> steps;
+  if (ctx.node->hasAttribute(Symbol("starts"))) {
+    if (!hasIntsAttribute(ctx.node, Symbol("starts")) ||
+        !hasIntsAttribute(ctx.node, Symbol("ends"))) {
+      return false;
+    }
+    starts = ctx.node->is(Symbol("starts"));
+    ends = ctx.node->is(Symbol("ends"));
+    if (hasIntsAttribute(ctx.node, kaxes)) {
+      axes = ctx.node->is(kaxes);
+    }
+  } else {
+    if (!int64Values(ctx.input(1), &starts) ||
+        !int64Values(ctx.input(2), &ends) ||
+        (ctx.input(3) != nullptr && !int64Values(ctx.input(3), &axes)) ||
+        (ctx.input(4) != nullptr && !int64Values(ctx.input(4), &steps))) {
+      return false;
+    }
+  }
+  if (axes.empty()) {
+    for (size_t k = 0; k < starts.size(); ++k) {
+      axes.push_back(static_cast<int64_t>(k));
+    }
+  }
+  if (steps.empty()) {
+    steps.assign(starts.size(), 1);
+  }
+  if (ends.size() != starts.size() || axes.size() != starts.size() ||
+      steps.size() != starts.size() || !normalizeAxes(&axes, rank)) {
+    return false;
+  }
+  const std::vector<int64_t> in_strides = rowMajorStrides(in->dims);
+  std::vector<int64_t> dims = in->dims;
+  std::vector<int64_t> strides = in_strides;
+  int64_t offset = 0;
+  for (size_t i = 0; i < axes.size(); ++i) {
+    const int64_t dim = in->dims[axes[i]];
+    const int64_t step = steps[i];
+    if (step == 0) {
+      return false;
+    }
+    int64_t start = starts[i] < 0 ? starts[i] + dim : starts[i];
+    int64_t end = ends[i] < 0 ? ends[i] + dim : ends[i];
+    int64_t count;
+    if (step > 0) {
+      start = std::min(std::max<int64_t>(start, 0), dim);
+      end = std::min(std::max<int64_t>(end, 0), dim);
+      count = end > start ? (end - start + step - 1) / step : 0;
+    } else {
+      start = std::min(std::max<int64_t>(start, 0), dim - 1);
+      end = std::min(std::max<int64_t>(end, -1), dim - 1);
+      count = start > end ? (start - end - step - 1) / -step : 0;
+    }
+    dims[axes[i]] = count;
+    if (count > 0) {
+      offset += start * in_strides[axes[i]];
+    }
+    strides[axes[i]] = step * in_strides[axes[i]];
+  }
+  Array* out = ctx.output(0, in->elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  copyStrided(*in, offset, strides, out);
+  return true;
+}
+
+bool Split(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(in->dims.size());
+  int64_t axis = intAttribute(ctx.node, "axis", 0);
+  if (axis < 0) {
+    axis += rank;
+  }
+  if (axis < 0 || axis >= rank) {
+    return false;
+  }
+  const int64_t num_outputs = static_cast<int64_t>(ctx.node->outputs().size());
+  const int64_t dim = in->dims[axis];
+  std::vector<int64_t> split;
+  if (hasIntsAttribute(ctx.node, Symbol("split"))) {
+    split = ctx.node->is(Symbol("split"));
+  } else if (ctx.input(1) != nullptr) {
+    if (!int64Values(ctx.input(1), &split)) {
+      return false;
+    }
+  } else {
+    const int64_t chunk = (dim + num_outputs - 1) / num_outputs;
+    for (int64_t i = 0; i < num_outputs; ++i) {
+      split.push_back(std::max<int64_t>(std::min(chunk, dim - chunk * i), 0));
+    }
+  }
+  int64_t total = 0;
+  for (int64_t size : split) {
+    if (size < 0) {
+      return false;
+    }
+    total += size;
+  }
+  if (static_cast<int64_t>(split.size()) != num_outputs || total != dim) {
+    return false;
+  }
+  const std::vector<int64_t> strides = rowMajorStrides(in->dims);
+  int64_t start = 0;
+  for (int64_t i = 0; i < num_outputs; ++i) {
+    std::vector<int64_t> dims = in->dims;
+    dims[axis] = split[i];
+    Array* out = ctx.output(i, in->elem_type, dims);
+    if (out == nullptr) {
+      return false;
+    }
+    copyStrided(*in, start * strides[axis], strides, out);
+    start += split[i];
+  }
+  return true;
+}
+
+bool Tile(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  std::vector<int64_t> repeats;
+  if (in == nullptr || !int64Values(ctx.input(1), &repeats) ||
+      repeats.size() != in->dims.size()) {
+    return false;
+  }
+  std::vector<int64_t> dims = in->dims;
+  for (size_t k = 0; k < dims.size(); ++k) {
+    if (repeats[k] < 0) {
+      return false;
+    }
+    dims[k] *= repeats[k];
+  }
+  Array* out = ctx.output(0, in->elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  const std::vector<int64_t> in_strides = rowMajorStrides(in->dims);
+  const size_t element_size = in->elementSize();
+  std::vector<int64_t> index(dims.size(), 0);
+  for (int64_t i = 0; i < out->count(); ++i) {
+    int64_t in_offset = 0;
+    for (size_t k = 0; k < dims.size(); ++k) {
+      in_offset += (index[k] % in->dims[k]) * in_strides[k];
+    }
+    std::memcpy(
+        &out->bytes[i * element_size],
+        in->bytes.data() + in_offset * element_size,
+        element_size);
+    for (size_t k = dims.size(); k > 0; --k) {
+      if (++index[k - 1] < dims[k - 1]) {
+        break;
+      }
+      index[k - 1] = 0;
+    }
+  }
+  return true;
+}
+
+bool Expand(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  std::vector<int64_t> shape;
+  std::vector<int64_t> dims;
+  if (in == nullptr || !int64Values(ctx.input(1), &shape) ||
+      !broadcastDims(in->dims, shape, &dims)) {
+    return false;
+  }
+  Array* out = ctx.output(0, in->elem_type, dims);
+  return out != nullptr && broadcastTo(*in, dims, out);
+}
+
+bool Shape(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(in->dims.size());
+  int64_t start = intAttribute(ctx.node, "start", 0);
+  int64_t end = intAttribute(ctx.node, "end", rank);
+  start = std::min(std::max<int64_t>(start < 0 ? start + rank : start, 0), rank);
+  end = std::min(std::max<int64_t>(end < 0 ? end + rank : end, 0), rank);
+  const std::vector<int64_t> values(
+      in->dims.begin() + start, in->dims.begin() + std::max(start, end));
+  Array* out = ctx.output(
+      0, TensorProto_DataType_INT64, {static_cast<int64_t>(values.size())});
+  if (out == nullptr) {
+    return false;
+  }
+  fromInt64s(values, out);
+  return true;
+}
+
+bool Size(KernelContext& ctx) {
+  const Array* in = ctx.input(0);
+  if (in == nullptr) {
+    return false;
+  }
+  Array* out = ctx.output(0, TensorProto_DataType_INT64, {});
+  if (out == nullptr) {
+    return false;
+  }
+  fromInt64s({in->count()}, out);
+  return true;
+}
+
+bool ConstantOfShape(KernelContext& ctx) {
+  std::vector<int64_t> dims;
+  if (!int64Values(ctx.input(0), &dims)) {
+    return false;
+  }
+  int32_t elem_type = TensorProto_DataType_FLOAT;
+  std::string value(sizeof(float), '\0');
+  if (ctx.node->hasAttribute(kvalue)) {
+    if (ctx.node->kindOf(kvalue) != AttributeKind::t) {
+      return false;
+    }
+    const Tensor& tensor = ctx.node->t(kvalue);
+    std::string scratch;
+    const char* data;
+    size_t size;
+    elem_type = tensor.elem_type();
+    if (ElementSize(elem_type) == 0 ||
+        !ElementBytes(tensor, scratch, &data, &size) ||
+        size != ElementSize(elem_type)) {
+      return false;
+    }
+    value.assign(data, size);
+  }
+  Array* out = ctx.output(0, elem_type, dims);
+  if (out == nullptr) {
+    return false;
+  }
+  for (int64_t i = 0; i < out->count(); ++i) {
+    out->bytes.replace(i * value.size(), value.size(), value);
+  }
+  return true;
+}
+
+bool Range(KernelContext& ctx) {
+  const Array* start = ctx.input(0);
+  const Array* limit = ctx.input(1);
+  const Array* delta = ctx.input(2);
+  if (start == nullptr || limit == nullptr || delta == nullptr ||
+      start->count() != 1 || limit->count() != 1 || delta->count() != 1 ||
+      limit->elem_type != start->elem_type ||
+      delta->elem_type != start->elem_type) {
+    return false;
+  }
+  if (isFloating(start->elem_type)) {
+    std::vector<double> values[3];
+    toDoubles(*start, &values[0]);
+    toDoubles(*limit, &values[1]);
+    toDoubles(*delta, &values[2]);
+    const double first = values[0][0];
+    const double step = values[2][0];
+    const double count = std::ceil((values[1][0] - first) / step);
+    if (step == 0 || !(count < 1e12)) {
+      return false;
+    }
+    Array* out = ctx.output(
+        0, start->elem_type, {std::max<int64_t>(static_cast<int64_t>(count), 0)});
+    if (out == nullptr) {
+      return false;
+    }
+    std::vector<double> result(out->count());
+    for (size_t i = 0; i < result.size(); ++i) {
+      result[i] = first + static_cast<double>(i) * step;
+    }
+    fromDoubles(result, out);
+    return true;
+  }
+  std::vector<int64_t> values[3];
+  if (!toInt64s(*start, &values[0]) || !toInt64s(*limit, &values[1]) ||
+      !toInt64s(*delta, &values[2]) || values[2][0] == 0) {
+    return false;
+  }
+  const int64_t first = values[0][0];
+  const int64_t step = values[2][0];
+  // Computed in double precision to avoid overflows, exact for any count
+  // small enough to be folded.
+  const double span = static_cast<double>(values[1][0]) - first;
+  const double count = std::ceil(span / step);
+  if (!(count < 1e12)) {
+    return false;
+  }
+  Array* out = ctx.output(
+      0, start->elem_type, {std::max<int64_t>(static_cast<int64_t>(count), 0)});
+  if (out == nullptr) {
+    return false;
+  }
+  std::vector<int64_t> result(out->count());
+  for (size_t i = 0; i < result.size(); ++i) {
+    result[i] = first + static_cast<int64_t>(i) * step;
+  }
+  fromInt64s(result, out);
+  return true;
+}
+
+const std::unordered_map<NodeKind, Kernel>& kernels() {
+  static const std::unordered_map<NodeKind, Kernel> kernels = {
+      {Symbol("Abs"), Abs},
+      {Symbol("Add"), Add},
+      {Symbol("And"), And},
+      {Symbol("Cast"), Cast},
+      {Symbol("CastLike"), CastLike},
+      {Symbol("Ceil"), Ceil},
+      {Symbol("Concat"), Concat},
+      {Symbol("ConstantOfShape"), ConstantOfShape},
+      {Symbol("Div"), Div},
+      {Symbol("Equal"), Equal},
+      {Symbol("Exp"), Exp},
+      {Symbol("Expand"), Expand},
+      {Symbol("Flatten"), Flatten},
+      {Symbol("Floor"), Floor},
+      {Symbol("Gather"), Gather},
+      {Symbol("Greater"), Greater},
+      {Symbol("GreaterOrEqual"), GreaterOrEqual},
+      {Symbol("Identity"), Identity},
+      {Symbol("Less"), Less},
+      {Symbol("LessOrEqual"), LessOrEqual},
+      {Symbol("Log"), Log},
+      {Symbol("Max"), Max},
+      {Symbol("Min"), Min},
+      {Symbol("Mod"), Mod},
+      {Symbol("Mul"), Mul},
+      {Symbol("Neg"), Neg},
+      {Symbol("Not"), Not},
+      {Symbol("Or"), Or},
+      {Symbol("Pow"), Pow},
+      {Symbol("Range"), Range},
+      {Symbol("Reciprocal"), Reciprocal},
+      {Symbol("Relu"), Relu},
+      {Symbol("Reshape"), Reshape},
+      {Symbol("Round"), Round},
+      {Symbol("Shape"), Shape},
+      {Symbol("Sigmoid"), Sigmoid},
+      {Symbol("Sign"), Sign},
+      {Symbol("Size"), Size},
+      {Symbol("Slice"), Slice},
+      {Symbol("Split"), Split},
+      {Symbol("Sqrt"), Sqrt},
+      {Symbol("Squeeze"), Squeeze},
+      {Symbol("Sub"), Sub},
+      {Symbol("Sum"), Sum},
+      {Symbol("Tanh"), Tanh},
+      {Symbol("Tile"), Tile},
+      {Symbol("Transpose"), Transpose},
+      {Symbol("Unsqueeze"), Unsqueeze},
+      {Symbol("Where"), Where},
+      {Symbol("Xor"), Xor},
+  };
+  return kernels;
+}
+
+bool toArray(const Tensor& tensor, bool with_data, Array* array) {
+  array->elem_type = tensor.elem_type();
+  array->dims = tensor.sizes();
+  for (int64_t dim : array->dims) {
+    if (dim < 0) {
+      return false;
+    }
+  }
+  if (!with_data) {
+    return true;
+  }
+  const size_t element_size = array->elementSize();
+  std::string scratch;
+  const char* data;
+  size_t size;
+  if (element_size == 0 || !ElementBytes(tensor, scratch, &data, &size) ||
+      size != static_cast<size_t>(array->count()) * element_size) {
+    return false;
+  }
+  array->bytes.assign(data, size);
+  return true;
+}
+
+} // namespace
+
+bool HasReferenceKernel(NodeKind kind) {
+  return kernels().count(kind) > 0;
+}
+
+bool RunReferenceKernel(
+    Node* node,
+    const std::vector<const Tensor*>& inputs,
+    size_t max_output_bytes,
+    std::vector<Tensor>* outputs) {
+  const auto kernel = kernels().find(node->kind());
+  if (kernel == kernels().end()) {
+    return false;
+  }
+  // Shape and Size only look at the dims of their input.
+  const bool with_data =
+      node->kind() != Symbol("Shape") && node->kind() != Symbol("Size");
+  std::vector<Array> arrays(inputs.size());
+  KernelContext ctx;
+  ctx.node = node;
+  ctx.max_output_bytes = max_output_bytes;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (inputs[i] == nullptr) {
+      ctx.inputs.push_back(nullptr);
+      continue;
+    }
+    if (!toArray(*inputs[i], with_data, &arrays[i])) {
+      return false;
+    }
+    ctx.inputs.push_back(&arrays[i]);
+  }
+  // Trailing missing inputs are the same as absent ones.
+  while (!ctx.inputs.empty() && ctx.inputs.back() == nullptr) {
+    ctx.inputs.pop_back();
+  }
+  if (!kernel->second(ctx) || ctx.outputs.size() != node->outputs().size()) {
+    return false;
+  }
+  outputs->clear();
+  for (Array& array : ctx.outputs) {
+    outputs->push_back(MakeRawTensor(
+        array.elem_type, std::move(array.dims), std::move(array.bytes)));
+  }
+  return true;
+}
+
+} // namespace optimization
+} // namespace ONNX_NAMESPACE
@@ -0,0 +1,36 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <vector>
+
+#include "onnx/common/ir.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// Simple CPU implementations of the ONNX operators that commonly appear in
+// constant subgraphs: elementwise arithmetic, comparisons and logic, casts
+// and the shape manipulation operators. They favor obviously correct code
+// over speed, and only run on the small tensors of constant folding.
+
+// Whether there is a reference kernel for nodes of the default domain of
+// the given kind.
+bool HasReferenceKernel(NodeKind kind);
+
+// Computes the outputs of node with its reference kernel, given the values
+// of its inputs, nullptr standing for missing optional inputs. Returns
+// false, leaving outputs in an unspecified state, if the kernel does not
+// support the attributes or input types of node, if the result is undefined
+// (e.g. an integer division by zero), or if an output would need more than
+// max_output_bytes.
+bool RunReferenceKernel(Node *node, const std::vector<const Tensor *> &inputs,
+                        size_t max_output_bytes, std::vector<Tensor> *outputs);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,572 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#include "onnxoptimizer/shape_inference.h"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "onnx/defs/schema.h"
+#include "onnx/defs/shape_inference.h"
+#include "onnxoptimizer/initializer_index.h"
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/tensor_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+// Opset version by domain, the default domain being "".
+typedef std::unordered_map<std::string, int> OpsetVersions;
+// Shapes held by values at runtime, as computed by data propagation.
+typedef std::unordered_map<const Value*, TensorShapeProto> ShapeDataMap;
+
+bool isComplete(const Value* value) {
+  if (value->elemType() == TensorProto_DataType_UNDEFINED ||
+      !value->has_sizes()) {
+    return false;
+  }
+  for (const Dimension& dim : value->sizes()) {
+    if (dim.is_unknown) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether value may be a shape, i.e. an INT64 tensor of rank 0 or 1, as far
+// as its type tells.
+bool mayHoldShape(const Value* value) {
+  return (value->elemType() == TensorProto_DataType_UNDEFINED ||
+          value->elemType() == TensorProto_DataType_INT64) &&
+         (!value->has_sizes() || value->sizes().size() <= 1);
+}
+
+// The type of value, false if nothing is known about it.
+bool encodeType(const Value* value, TypeProto& type) {
+  if (value->elemType() == TensorProto_DataType_UNDEFINED &&
+      !value->has_sizes()) {
+    return false;
+  }
+  TypeProto_Tensor* tensor_type = type.mutable_tensor_type();
+  if (value->elemType() != TensorProto_DataType_UNDEFINED) {
+    tensor_type->set_elem_type(value->elemType());
+  }
+  if (value->has_sizes()) {
+    TensorShapeProto* shape = tensor_type->mutable_shape();
+    for (const Dimension& dim : value->sizes()) {
+      TensorShapeProto_Dimension* encoded = shape->add_dim();
+      if (dim.is_int) {
+        encoded->set_dim_value(dim.dim);
+      } else if (!dim.is_unknown) {
+        encoded->set_dim_param(dim.param);
+      }
+    }
+  }
+  return true;
+}
+
+// Sets what value does not know yet of type, returns whether it did.
+bool refine(Value* value, const TypeProto& type) {
+  if (!type.has_tensor_type()) {
+    return false;
+  }
+  const TypeProto_Tensor& tensor_type = type.tensor_type();
+  bool refined = false;
+  if (value->elemType() == TensorProto_DataType_UNDEFINED &&
+      tensor_type.elem_type() != TensorProto_DataType_UNDEFINED) {
+    value->setElemType(tensor_type.elem_type());
+    refined = true;
+  }
+  if (!tensor_type.has_shape()) {
+    return refined;
+  }
+  std::vector<Dimension> dims;
+  for (const TensorShapeProto_Dimension& dim : tensor_type.shape().dim()) {
+    if (dim.has_dim_value()) {
+      dims.emplace_back(static_cast<int64_t>(dim.dim_value()));
+    } else if (dim.has_dim_param() && !dim.dim_param().empty()) {
+      dims.emplace_back(dim.dim_param());
+    } else {
+      dims.emplace_back();
+    }
+  }
+  if (!value->has_sizes()) {
+    value->setSizes(std::move(dims));
+    return true;
+  }
+  std::vector<Dimension> sizes = value->sizes();
+  if (sizes.size() != dims.size()) {
+    return refined;
+  }
+  bool refined_sizes = false;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    if (sizes[i].is_unknown && !dims[i].is_unknown) {
+      sizes[i] = dims[i];
+      refined_sizes = true;
+    }
+  }
+  if (refined_sizes) {
+    value->setSizes(std::move(sizes));
+  }
+  return refined || refined_sizes;
+}
+
+bool encodeTensor(const Tensor& tensor, TensorProto& encoded) {
+  for (int64_t size : tensor.sizes()) {
+    encoded.add_dims(size);
+  }
+  encoded.set_data_type(tensor.elem_type());
+  if (tensor.elem_type() == TensorProto_DataType_STRING) {
+    for (const std::string& element : tensor.strings()) {
+      encoded.add_string_data(element);
+    }
+    return true;
+  }
+  std::string scratch;
+  const char* data;
+  size_t size;
+  if (!ElementBytes(tensor, scratch, &data, &size)) {
+    return false;
+  }
+  encoded.set_raw_data(data, size);
+  return true;
+}
+
+bool encodeAttribute(const Node* n, Symbol name, AttributeProto& attr) {
+  attr.set_name(name.toString());
+  switch (n->kindOf(name)) {
+    case AttributeKind::f:
+      attr.set_type(AttributeProto_AttributeType_FLOAT);
+      attr.set_f(static_cast<float>(n->f(name)));
+      return true;
+    case AttributeKind::fs:
+      attr.set_type(AttributeProto_AttributeType_FLOATS);
+      for (double value : n->fs(name)) {
+        attr.add_floats(static_cast<float>(value));
+      }
+      return true;
+    case AttributeKind::i:
+      attr.set_type(AttributeProto_AttributeType_INT);
+      attr.set_i(n->i(name));
+      return true;
+    case AttributeKind::is:
+      attr.set_type(AttributeProto_AttributeType_INTS);
+      for (int64_t value : n->is(name)) {
+        attr.add_ints(value);
+      }
+      return true;
+    case AttributeKind::s:
+      attr.set_type(AttributeProto_AttributeType_STRING);
+      attr.set_s(n->s(name));
+      return true;
+    case AttributeKind::ss:
+      attr.set_type(AttributeProto_AttributeType_STRINGS);
+      for (const std::string& value : n->ss(name)) {
+        attr.add_strings(value);
+      }
+      return true;
+    case AttributeKind::t:
+      attr.set_type(AttributeProto_AttributeType_TENSOR);
+      return encodeTensor(n->t(name), *attr.mutable_t());
+    case AttributeKind::ts:
+      attr.set_type(AttributeProto_AttributeType_TENSORS);
+      for (const Tensor& tensor : n->ts(name)) {
+        if (!encodeTensor(tensor, *attr.add_tensors())) {
+          return false;
+        }
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+// The constant value as a Constant node or initializer, looked up in the
+// graph that owns it.
+const Tensor* constantTensor(const Value* value) {
+  return getConstantTensor(value, *value->owningGraph());
+}
+
+// Serves the inputs of a node to the type and shape inference function of
+// its schema. Attributes and constant inputs are only converted to protos
+// when the function asks for them.
+class NodeInferenceContext final : public InferenceContext {
+ public:
+  NodeInferenceContext(Node* n, const ShapeDataMap& shape_data)
+      : node(n),
+        shape_data(shape_data),
+        input_types(n->inputs().size()),
+        has_input_types(n->inputs().size()),
+        input_data(n->inputs().size()),
+        output_types(n->outputs().size()) {
+    for (size_t i = 0; i < n->inputs().size(); ++i) {
+      has_input_types[i] = encodeType(n->inputs()[i], input_types[i]);
+    }
+  }
+
+  // Whether every input given to the node has a type, which the inference
+  // functions take for granted.
+  bool inputTypesKnown() const {
+    for (size_t i = 0; i < node->inputs().size(); ++i) {
+      if (!has_input_types[i] &&
+          node->inputs()[i]->node()->kind() != kUndefined) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const AttributeProto* getAttribute(const std::string& name) const override {
+    auto it = attributes.find(name);
+    if (it != attributes.end()) {
+      return it->second.get();
+    }
+    const Symbol symbol(name);
+    std::unique_ptr<AttributeProto> attr;
+    if (node->hasAttribute(symbol)) {
+      attr.reset(new AttributeProto());
+      if (!encodeAttribute(node, symbol, *attr)) {
+        attr.reset();
+      }
+    }
+    return (attributes[name] = std::move(attr)).get();
+  }
+
+  size_t getNumInputs() const override {
+    return node->inputs().size();
+  }
+
+  const TypeProto* getInputType(size_t index) const override {
+    if (index >= input_types.size() || !has_input_types[index]) {
+      return nullptr;
+    }
+    return &input_types[index];
+  }
+
+  // Constant inputs, as well as the shapes computed by data propagation
+  // whose dims are all static, which the schemas predating
+  // getSymbolicInput only look for here.
+  const TensorProto* getInputData(size_t index) const override {
+    if (index >= input_data.size()) {
+      return nullptr;
+    }
+    if (!input_data[index]) {
+      const Value* input = node->inputs()[index];
+      std::unique_ptr<TensorProto> data(new TensorProto());
+      const Tensor* tensor = constantTensor(input);
+      if (tensor != nullptr ? !encodeTensor(*tensor, *data)
+                            : !encodeShapeData(input, *data)) {
+        return nullptr;
+      }
+      input_data[index] = std::move(data);
+    }
+    return input_data[index].get();
+  }
+
+  size_t getNumOutputs() const override {
+    return output_types.size();
+  }
+
+  TypeProto* getOutputType(size_t index) override {
+    return index < output_types.size() ? &output_types[index] : nullptr;
+  }
+
+  GraphInferencer* getGraphAttributeInferencer(const std::string&) override {
+    return nullptr;
+  }
+
+  const SparseTensorProto* getInputSparseData(size_t) const override {
+    return nullptr;
+  }
+
+  const TensorShapeProto* getSymbolicInput(size_t index) const override {
+    if (index >= node->inputs().size()) {
+      return nullptr;
+    }
+    auto it = shape_data.find(node->inputs()[index]);
+    return it == shape_data.end() ? nullptr : &it->second;
+  }
+
+  const std::vector<TypeProto>& outputTypes() const {
+    return output_types;
+  }
+
+ private:
+  bool encodeShapeData(const Value* input, TensorProto& data) const {
+    auto it = shape_data.find(input);
+    if (it == shape_data.end() || !input->has_sizes() ||
+        input->sizes().size() > 1 ||
+        input->elemType() != TensorProto_DataType_INT64) {
+      return false;
+    }
+    for (const TensorShapeProto_Dimension& dim : it->second.dim()) {
+      if (!dim.has_dim_value()) {
+        return false;
+      }
+      data.add_int64_data(dim.dim_value());
+    }
+    if (input->sizes().size() == 1) {
+      data.add_dims(data.int64_data_size());
+    } else if (data.int64_data_size() != 1) {
+      return false;
+    }
+    data.set_data_type(TensorProto_DataType_INT64);
+    return true;
+  }
+
+  Node* node;
+  const ShapeDataMap& shape_data;
+  std::vector<TypeProto> input_types;
+  std::vector<bool> has_input_types;
+  mutable std::vector<std::unique_ptr<TensorProto>> input_data;
+  mutable std::unordered_map<std::string, std::unique_ptr<AttributeProto>>
+      attributes;
+  std::vector<TypeProto> output_types;
+};
+
+// Serves the shapes held by the inputs of a node to the data propagation
+// function of its schema, and records the ones it computes for the outputs.
+class NodeDataPropagationContext final : public DataPropagationContext {
+ public:
+  NodeDataPropagationContext(Node* n, const NodeInferenceContext& inference,
+                             ShapeDataMap& shape_data)
+      : node(n), inference(inference), shape_data(shape_data) {
+    for (Value* output : n->outputs()) {
+      output_types.emplace_back();
+      encodeType(output, output_types.back());
+    }
+  }
+
+  const AttributeProto* getAttribute(const std::string& name) const override {
+    return inference.getAttribute(name);
+  }
+
+  size_t getNumInputs() const override {
+    return inference.getNumInputs();
+  }
+
+  const TypeProto* getInputType(size_t index) const override {
+    return inference.getInputType(index);
+  }
+
+  size_t getNumOutputs() const override {
+    return output_types.size();
+  }
+
+  const TypeProto* getOutputType(size_t index) const override {
+    return index < output_types.size() ? &output_types[index] : nullptr;
+  }
+
+  // Integer constants of rank 0 or 1 hold shapes as well.
+  const TensorShapeProto* getInputData(size_t index) override {
+    if (index >= node->inputs().size()) {
+      return nullptr;
+    }
+    const Value* input = node->inputs()[index];
+    auto it = shape_data.find(input);
+    if (it != shape_data.end()) {
+      return &it->second;
+    }
+    const Tensor* tensor = constantTensor(input);
+    std::vector<int64_t> ints;
+    if (tensor == nullptr || tensor->sizes().size() > 1 ||
+        !getConstantInts(input, *input->owningGraph(), &ints)) {
+      return nullptr;
+    }
+    TensorShapeProto& shape = constant_data[index];
+    shape.Clear();
+    for (int64_t value : ints) {
+      shape.add_dim()->set_dim_value(value);
+    }
+    return &shape;
+  }
+
+  void addOutputData(size_t index, TensorShapeProto&& shape) override {
+    if (index < node->outputs().size()) {
+      shape_data[node->outputs()[index]] = std::move(shape);
+    }
+  }
+
+ private:
+  Node* node;
+  const NodeInferenceContext& inference;
+  ShapeDataMap& shape_data;
+  std::vector<TypeProto> output_types;
+  std::unordered_map<size_t, TensorShapeProto> constant_data;
+};
+
+class ShapePropagation {
+ public:
+  ShapePropagation(const OpsetVersions& opset_versions,
+                   std::unordered_set<std::string>* inferred)
+      : opset_versions(opset_versions), inferred(inferred) {}
+
+  size_t run(Graph& graph) {
+    size_t num_refined = 0;
+    for (Node* n : graph.nodes()) {
+      bool has_subgraphs = false;
+      for (Symbol name : n->attributeNames()) {
+        if (n->kindOf(name) == AttributeKind::g) {
+          num_refined += run(*n->g(name));
+          has_subgraphs = true;
+        } else if (n->kindOf(name) == AttributeKind::gs) {
+          for (const std::shared_ptr<Graph>& subgraph : n->gs(name)) {
+            num_refined += run(*subgraph);
+          }
+          has_subgraphs = true;
+        }
+      }
+      if (!has_subgraphs) {
+        num_refined += infer(n);
+      }
+    }
+    return num_refined;
+  }
+
+ private:
+  const OpSchema* findSchema(const Node* n) const {
+    std::string domain = n->domain();
+    if (domain == "ai.onnx") {
+      domain = "";
+    }
+    auto it = opset_versions.find(domain);
+    if (it == opset_versions.end()) {
+      return nullptr;
+    }
+    return OpSchemaRegistry::Schema(n->kind().toString(), it->second, domain);
+  }
+
+  size_t infer(Node* n) {
+    if (n->kind() == kConstant && n->hasAttribute(kvalue) &&
+        n->kindOf(kvalue) == AttributeKind::t) {
+      return inferConstant(n);
+    }
+    const OpSchema* schema = findSchema(n);
+    if (schema == nullptr) {
+      return 0;
+    }
+    bool complete = true;
+    for (const Value* output : n->outputs()) {
+      complete = complete && isComplete(output);
+    }
+    const bool propagates_data = schema->has_data_propagation_function() &&
+                                 n->outputs().size() == 1 &&
+                                 mayHoldShape(n->output());
+    if (complete && !propagates_data) {
+      return 0;
+    }
+    NodeInferenceContext context(n, shape_data);
+    if (!context.inputTypesKnown()) {
+      return 0;
+    }
+    size_t num_refined = 0;
+    if (!complete && schema->has_type_and_shape_inference_function()) {
+      try {
+        schema->GetTypeAndShapeInferenceFunction()(context);
+        for (size_t i = 0; i < n->outputs().size(); ++i) {
+          num_refined +=
+              refineOutput(n->outputs()[i], context.outputTypes()[i]);
+        }
+      } catch (const std::exception&) {
+        // Leaves the outputs as they are, as if the schema had no inference
+        // function.
+      }
+    }
+    if (propagates_data) {
+      NodeDataPropagationContext data_context(n, context, shape_data);
+      try {
+        schema->GetDataPropagationFunction()(data_context);
+      } catch (const std::exception&) {
+      }
+    }
+    return num_refined;
+  }
+
+  // The type of a Constant node is that of its tensor, without converting
+  // the tensor to a proto as the inference function would need.
+  size_t inferConstant(Node* n) {
+    const Tensor& tensor = n->t(kvalue);
+    TypeProto type;
+    TypeProto_Tensor* tensor_type = type.mutable_tensor_type();
+    tensor_type->set_elem_type(tensor.elem_type());
+    TensorShapeProto* shape = tensor_type->mutable_shape();
+    for (int64_t size : tensor.sizes()) {
+      shape->add_dim()->set_dim_value(size);
+    }
+    return refineOutput(n->output(), type);
+  }
+
+  // Refines the output from type, recording it in inferred if it had no
+  // type before.
+  size_t refineOutput(Value* output, const TypeProto& type) {
+    const bool untyped =
+        output->elemType() == TensorProto_DataType_UNDEFINED &&
+        !output->has_sizes();
+    if (!refine(output, type)) {
+      return 0;
+    }
+    if (untyped && inferred != nullptr) {
+      inferred->insert(output->uniqueName());
+    }
+    return 1;
+  }
+
+  const OpsetVersions& opset_versions;
+  std::unordered_set<std::string>* inferred;
+  ShapeDataMap shape_data;
+};
+
+void forgetInferredShapes(Graph& graph,
+                          const std::unordered_set<std::string>& inferred) {
+  for (Node* n : graph.nodes()) {
+    for (Symbol name : n->attributeNames()) {
+      if (n->kindOf(name) == AttributeKind::g) {
+        forgetInferredShapes(*n->g(name), inferred);
+      } else if (n->kindOf(name) == AttributeKind::gs) {
+        for (const std::shared_ptr<Graph>& subgraph : n->gs(name)) {
+          forgetInferredShapes(*subgraph, inferred);
+        }
+      }
+    }
+    for (Value* output : n->outputs()) {
+      if (inferred.count(output->uniqueName()) != 0) {
+        output->setElemType(TensorProto_DataType_UNDEFINED);
+        output->wipeSizes();
+      }
+    }
+  }
+}
+
+}  // namespace
+
+size_t PropagateShapes(Graph& graph,
+                       std::unordered_set<std::string>* inferred) {
+  OpsetVersions opset_versions;
+  for (const OpSetID& opset : graph.opset_versions_mutable()) {
+    const std::string domain =
+        opset.domain() == "ai.onnx" ? std::string() : opset.domain();
+    opset_versions[domain] = static_cast<int>(opset.version());
+  }
+  InitializerIndexScope initializer_index_scope;
+  return ShapePropagation(opset_versions, inferred).run(graph);
+}
+
+void ForgetInferredShapes(Graph& graph,
+                          const std::unordered_set<std::string>& inferred) {
+  if (!inferred.empty()) {
+    forgetInferredShapes(graph, inferred);
+  }
+}
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,44 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+
+#include "onnx/common/ir.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// Fills in the elem types and shapes that the inference functions of the
+// operator schemas deduce for the values of graph and of its subgraphs,
+// node by node in topological order. Dims are static or symbolic, so the
+// "batch" dim_param of a graph input reaches every value it determines.
+// Shapes computed at runtime are followed through the data propagation
+// functions of the schemas as well, from Shape through Gather, Concat and
+// the like into Reshape or Expand.
+//
+// What the values already carry is refined but never replaced, so running
+// this again after the graph has been rewritten only infers the new values
+// and the dims still unknown. Nodes of operators without a schema, with
+// subgraph attributes or whose inference fails are left alone, the nodes of
+// their subgraphs are inferred though. Returns the number of values whose
+// elem type or shape has been refined. The names of the values that had no
+// type at all before are added to inferred, unless it is nullptr.
+size_t PropagateShapes(Graph &graph,
+                       std::unordered_set<std::string> *inferred = nullptr);
+
+// Takes the types back from the values of graph and of its subgraphs named
+// in inferred, so that the shapes only inferred for the passes to match
+// don't end up in the value_info of the optimized model.
+void ForgetInferredShapes(Graph &graph,
+                          const std::unordered_set<std::string> &inferred);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,281 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "onnxoptimizer/tensor_util.h"
+
+#include <cstring>
+
+#include "onnxoptimizer/external_data.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+template <typename T>
+void appendLittleEndian(std::string& bytes, T value, size_t num_bytes) {
+  for (size_t i = 0; i < num_bytes; ++i) {
+    bytes.push_back(static_cast<char>(value & 0xff));
+    value >>= 8;
+  }
+}
+
+template <typename T>
+void appendElements(
+    std::string& bytes,
+    const std::vector<T>& values,
+    size_t num_bytes) {
+  bytes.reserve(bytes.size() + values.size() * num_bytes);
+  for (const T& value : values) {
+    appendLittleEndian(bytes, static_cast<uint64_t>(value), num_bytes);
+  }
+}
+
+template <typename F, typename U>
+void appendFloatingElements(std::string& bytes, const std::vector<F>& values) {
+  static_assert(sizeof(F) == sizeof(U), "bit pattern size mismatch");
+  bytes.reserve(bytes.size() + values.size() * sizeof(F));
+  for (const F& value : values) {
+    U bits;
+    std::memcpy(&bits, &value, sizeof(F));
+    appendLittleEndian(bytes, bits, sizeof(F));
+  }
+}
+
+} // namespace
+
+size_t ElementSize(int32_t elem_type) {
+  switch (elem_type) {
+    case TensorProto_DataType_BOOL:
+    case TensorProto_DataType_INT8:
+    case TensorProto_DataType_UINT8:
+      return 1;
+    case TensorProto_DataType_INT16:
+    case TensorProto_DataType_UINT16:
+    case TensorProto_DataType_FLOAT16:
+    case TensorProto_DataType_BFLOAT16:
+      return 2;
+    case TensorProto_DataType_INT32:
+    case TensorProto_DataType_UINT32:
+    case TensorProto_DataType_FLOAT:
+      return 4;
+    case TensorProto_DataType_INT64:
+    case TensorProto_DataType_UINT64:
+    case TensorProto_DataType_DOUBLE:
+    case TensorProto_DataType_COMPLEX64:
+      return 8;
+    case TensorProto_DataType_COMPLEX128:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+int64_t ElementCount(const std::vector<int64_t>& dims) {
+  int64_t count = 1;
+  for (int64_t dim : dims) {
+    count *= dim;
+  }
+  return count;
+}
+
+bool ElementBytes(
+    const Tensor& tensor,
+    std::string& scratch,
+    const char** data,
+    size_t* size) {
+  if (tensor.is_raw_data()) {
+    ExternalDataStore* external_data = ExternalDataStore::active();
+    if (tensor.raw().empty() && external_data != nullptr &&
+        external_data->detached(tensor.name())) {
+      return external_data->view(tensor.name(), data, size);
+    }
+    *data = tensor.raw().data();
+    *size = tensor.raw().size();
+    return true;
+  }
+  scratch.clear();
+  switch (tensor.elem_type()) {
+    case TensorProto_DataType_FLOAT:
+    case TensorProto_DataType_COMPLEX64:
+      appendFloatingElements<float, uint32_t>(scratch, tensor.floats());
+      break;
+    case TensorProto_DataType_DOUBLE:
+    case TensorProto_DataType_COMPLEX128:
+      appendFloatingElements<double, uint64_t>(scratch, tensor.doubles());
+      break;
+    case TensorProto_DataType_BOOL:
+    case TensorProto_DataType_INT8:
+    case TensorProto_DataType_UINT8:
+      appendElements(scratch, tensor.int32s(), 1);
+      break;
+    case TensorProto_DataType_INT16:
+    case TensorProto_DataType_UINT16:
+    case TensorProto_DataType_FLOAT16:
+    case TensorProto_DataType_BFLOAT16:
+      appendElements(scratch, tensor.int32s(), 2);
+      break;
+    case TensorProto_DataType_INT32:
+      appendElements(scratch, tensor.int32s(), 4);
+      break;
+    case TensorProto_DataType_INT64:
+      appendElements(scratch, tensor.int64s(), 8);
+      break;
+    case TensorProto_DataType_UINT32:
+      appendElements(scratch, tensor.uint64s(), 4);
+      break;
+    case TensorProto_DataType_UINT64:
+      appendElements(scratch, tensor.uint64s(), 8);
+      break;
+    case TensorProto_DataType_STRING:
+      for (const auto& str : tensor.strings()) {
+        appendLittleEndian(scratch, static_cast<uint64_t>(str.size()), 8);
+        scratch += str;
+      }
+      break;
+    default:
+      return false;
+  }
+  *data = scratch.data();
+  *size = scratch.size();
+  return true;
+}
+
+Tensor MakeRawTensor(
+    int32_t elem_type,
+    std::vector<int64_t> dims,
+    std::string bytes) {
+  Tensor tensor;
+  tensor.elem_type() = elem_type;
+  tensor.sizes() = std::move(dims);
+  tensor.set_raw_data(std::move(bytes));
+  return tensor;
+}
+
+bool TransposeElements(
+    int32_t elem_type,
+    const std::vector<int64_t>& dims,
+    const std::vector<int64_t>& perm,
+    const char* data,
+    std::string& result) {
+  const size_t element_size = ElementSize(elem_type);
+  const size_t rank = dims.size();
+  if (element_size == 0 || perm.size() != rank) {
+    return false;
+  }
+  std::vector<int64_t> strides(rank, 1);
+  for (size_t i = rank; i > 1; --i) {
+    strides[i - 2] = strides[i - 1] * dims[i - 1];
+  }
+  // The dims and input strides of the output, walked in row-major order
+  std::vector<int64_t> out_dims(rank);
+  std::vector<int64_t> out_strides(rank);
+  for (size_t i = 0; i < rank; ++i) {
+    out_dims[i] = dims[perm[i]];
+    out_strides[i] = strides[perm[i]];
+  }
+  const int64_t count = ElementCount(dims);
+  result.resize(count * element_size);
+  std::vector<int64_t> index(rank, 0);
+  int64_t offset = 0;
+  for (int64_t i = 0; i < count; ++i) {
+    std::memcpy(
+        &result[i * element_size], data + offset * element_size, element_size);
+    for (size_t axis = rank; axis > 0; --axis) {
+      offset += out_strides[axis - 1];
+      if (++index[axis - 1] < out_dims[axis - 1]) {
+        break;
+      }
+      offset -= out_strides[axis - 1] * out_dims[axis - 1];
+      index[axis - 1] = 0;
+    }
+  }
+  return true;
+}
+
+float HalfToFloat(uint16_t value) {
+  const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    // Subnormal, normalized for float.
+    exponent = 113;
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+  const uint32_t exponent = (bits >> 23) & 0xff;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (exponent == 0xff) {
+    // Infinity, or a quiet NaN.
+    return sign | 0x7c00 | (mantissa != 0 ? 0x200 | (mantissa >> 13) : 0);
+  }
+  const int32_t half_exponent = static_cast<int32_t>(exponent) - 112;
+  if (half_exponent >= 0x1f) {
+    return sign | 0x7c00;
+  }
+  if (half_exponent <= 0) {
+    if (half_exponent < -10) {
+      return sign;
+    }
+    // Subnormal, rounded to nearest even.
+    mantissa |= 0x800000;
+    const uint32_t shift = static_cast<uint32_t>(14 - half_exponent);
+    const uint32_t halfway = 1u << (shift - 1);
+    uint32_t result = mantissa >> shift;
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    if (remainder > halfway || (remainder == halfway && (result & 1) != 0)) {
+      ++result;
+    }
+    return sign | static_cast<uint16_t>(result);
+  }
+  uint32_t result =
+      (static_cast<uint32_t>(half_exponent) << 10) | (mantissa >> 13);
+  const uint32_t remainder = mantissa & 0x1fff;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1) != 0)) {
+    // May carry into the exponent, up to infinity, which is correct.
+    ++result;
+  }
+  return sign | static_cast<uint16_t>(result);
+}
+
+float BFloat16ToFloat(uint16_t value) {
+  const uint32_t bits = static_cast<uint32_t>(value) << 16;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+uint16_t FloatToBFloat16(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    // Quiet NaN, keeping the sign.
+    return static_cast<uint16_t>((bits >> 16) | 0x40);
+  }
+  // Round to nearest even.
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return static_cast<uint16_t>(bits >> 16);
+}
+
+} // namespace optimization
+} // namespace ONNX_NAMESPACE
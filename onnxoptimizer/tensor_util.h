@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "onnx/common/ir.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// Size in bytes of an element of elem_type when stored in raw_data, 0 for
+// strings and unknown types.
+size_t ElementSize(int32_t elem_type);
+
+// Number of elements of a tensor with the given dims.
+int64_t ElementCount(const std::vector<int64_t> &dims);
+
+// Points data and size at the elements of the tensor as raw_data would
+// store them, i.e. little-endian and packed, whether the tensor uses
+// raw_data or the typed fields. Tensors in typed fields are converted into
+// scratch, external data is read in place. Strings are stored as their
+// 8 byte length followed by their bytes. Returns false for unsupported types
+// and unreadable external data.
+bool ElementBytes(const Tensor &tensor, std::string &scratch,
+                  const char **data, size_t *size);
+
+// A tensor of elem_type with the given dims, holding bytes as raw data.
+Tensor MakeRawTensor(int32_t elem_type, std::vector<int64_t> dims,
+                     std::string bytes);
+
+// Transposes the elements of a tensor of elem_type with the given dims,
+// stored as raw_data would store them, by perm as the Transpose operator
+// does, into result. Returns false for strings and unknown types.
+bool TransposeElements(int32_t elem_type, const std::vector<int64_t> &dims,
+                       const std::vector<int64_t> &perm, const char *data,
+                       std::string &result);
+
+float HalfToFloat(uint16_t value);
+uint16_t FloatToHalf(float value);
+float BFloat16ToFloat(uint16_t value);
+uint16_t FloatToBFloat16(float value);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
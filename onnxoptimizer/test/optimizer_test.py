@@ -8,8 +8,10 @@ from __future__ import unicode_literals
 from collections import OrderedDict
 from typing import Sequence, Text, Any, Tuple, List, Callable, Optional, Dict, Union
 import io
+import json
 import unittest
 import os
+import tempfile
 
 import numpy as np  # type: ignore
 
@@ -441,6 +443,122 @@ class TestOptimizer(unittest.TestCase):
         assert len(optimized_model.graph.node) == 1
         assert optimized_model.graph.node[0].op_type == "Identity"
 
+    def test_nop_flatten_computed_shape(self):  # type: () -> None
+        # Without value_info, the rank of "R" is only known by following
+        # Shape(X)[0] through Concat into Reshape, whose schema takes such
+        # symbolic shapes since opset 14.
+        nodes = [
+            helper.make_node("Shape", ["X"], ["S"]),
+            helper.make_node("Gather", ["S", "zero"], ["N"]),
+            helper.make_node("Unsqueeze", ["N", "zero_1d"], ["N_1d"]),
+            helper.make_node("Concat", ["N_1d", "twelve"], ["shape"],
+                             axis=0),
+            helper.make_node("Reshape", ["X", "shape"], ["R"]),
+            helper.make_node("Flatten", ["R"], ["Y"], axis=1)]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", 3, 4))],
+            [helper.make_tensor_value_info(
+                "Y", TensorProto.FLOAT, ("batch", 12))],
+            initializer=[
+                helper.make_tensor("zero", TensorProto.INT64, (), [0]),
+                helper.make_tensor("zero_1d", TensorProto.INT64, (1,), [0]),
+                helper.make_tensor("twelve", TensorProto.INT64, (1,), [12])])
+        orig_model = helper.make_model(
+            graph, producer_name='onnx-test', opset_imports=[
+                helper.make_opsetid("", 14)])
+        optimized_model = self._optimized(
+            orig_model, ["eliminate_nop_flatten"], compare_result=False)
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Shape", "Gather", "Unsqueeze", "Concat", "Reshape"]
+        # The inferred shapes are not exported
+        assert len(optimized_model.graph.value_info) == 0
+        if has_ort:
+            assert self._compare(optimized_model, orig_model,
+                                 input_shapes={"X": [2, 3, 4]})
+
+    def test_eliminate_common_subexpressions(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Shape", ["X"], ["A"]),
+            helper.make_node("Gather", ["A", "i"], ["B"], axis=0),
+            helper.make_node("Shape", ["X"], ["C"]),
+            helper.make_node("Gather", ["C", "i"], ["D"], axis=0),
+            helper.make_node("Concat", ["B", "D"], ["E"], axis=0),
+            helper.make_node("Transpose", ["X"], ["T1"], perm=[1, 0]),
+            helper.make_node("Transpose", ["X"], ["T2"], perm=[1, 0]),
+            helper.make_node("Transpose", ["X"], ["T3"]),
+            helper.make_node("Constant", [], ["c1"], value=helper.make_tensor(
+                "c1", TensorProto.FLOAT, (), [2.0])),
+            helper.make_node("Constant", [], ["c2"], value=helper.make_tensor(
+                "c2", TensorProto.FLOAT, (), [2.0])),
+            helper.make_node("Mul", ["T1", "c1"], ["M1"]),
+            helper.make_node("Mul", ["T2", "c2"], ["M2"]),
+            helper.make_node("Add", ["M1", "M2"], ["F"]),
+            helper.make_node("Sub", ["F", "T3"], ["G"]),
+            # Random and graph outputs
+            helper.make_node("RandomUniformLike", ["X"], ["R1"]),
+            helper.make_node("RandomUniformLike", ["X"], ["R2"]),
+            helper.make_node("Relu", ["X"], ["Y1"]),
+            helper.make_node("Relu", ["X"], ["Y2"]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (3, 3))],
+            [helper.make_tensor_value_info("E", TensorProto.INT64, (2,)),
+             helper.make_tensor_value_info("G", TensorProto.FLOAT, (3, 3)),
+             helper.make_tensor_value_info("R1", TensorProto.FLOAT, (3, 3)),
+             helper.make_tensor_value_info("R2", TensorProto.FLOAT, (3, 3)),
+             helper.make_tensor_value_info("Y1", TensorProto.FLOAT, (3, 3)),
+             helper.make_tensor_value_info("Y2", TensorProto.FLOAT, (3, 3))],
+            [numpy_helper.from_array(np.array(1, np.int64), "i")])
+        optimized_model = self._optimized(
+            graph, ["eliminate_common_subexpressions"], compare_result=False)
+
+        self.assertEqual(
+            [(n.op_type, list(n.input)) for n in optimized_model.graph.node],
+            [("Shape", ["X"]), ("Gather", ["A", "i"]), ("Concat", ["B", "B"]),
+             ("Transpose", ["X"]), ("Transpose", ["X"]), ("Constant", []),
+             ("Mul", ["T1", "c1"]), ("Add", ["M1", "M1"]),
+             ("Sub", ["F", "T3"]), ("RandomUniformLike", ["X"]),
+             ("RandomUniformLike", ["X"]), ("Relu", ["X"]), ("Relu", ["X"])])
+
+    def test_eliminate_common_subexpressions_impure(self):  # type: () -> None
+        nodes = [
+            # Random in training mode only
+            helper.make_node("Dropout", ["X", "r", "on"], ["D1"]),
+            helper.make_node("Dropout", ["X", "r", "on"], ["D2"]),
+            helper.make_node("Dropout", ["X", "r", "off"], ["D3"]),
+            helper.make_node("Dropout", ["X", "r", "off"], ["D4"]),
+            # Nothing tells whether they are pure
+            helper.make_node("Custom", ["X"], ["C1"], domain="custom"),
+            helper.make_node("Custom", ["X"], ["C2"], domain="custom"),
+            helper.make_node("Sum", ["D1", "D2", "D3", "D4", "C1", "C2"],
+                             ["Y"]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (3, 3))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (3, 3))],
+            [numpy_helper.from_array(np.array(0.5, np.float32), "r"),
+             numpy_helper.from_array(np.array(True), "on"),
+             numpy_helper.from_array(np.array(False), "off")])
+        model = helper.make_model(
+            graph, opset_imports=[helper.make_opsetid("", 13),
+                                  helper.make_opsetid("custom", 1)])
+        optimized_model = self._optimized(
+            model, ["eliminate_common_subexpressions"], compare_result=False)
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["Dropout", "Dropout", "Dropout", "Custom", "Custom", "Sum"])
+        self.assertEqual(list(optimized_model.graph.node[-1].input),
+                         ["D1", "D2", "D3", "D3", "C1", "C2"])
+
     def test_eliminate_duplicate_initializer(self):  # type: () -> None
         add_1 = helper.make_node("Add", ["A", "I_0"], ["B"])
         add_2 = helper.make_node("Add", ["B", "I_1"], ["C"])
@@ -465,6 +583,39 @@ class TestOptimizer(unittest.TestCase):
         assert len(optimized_model.graph.input) == 1
         assert optimized_model.graph.node[0].input[1] == "I_0"
 
+    def test_eliminate_duplicate_initializer_all_dtypes(self):  # type: () -> None
+        nodes = []
+        initializers = []
+        outputs = []
+        for dtype, np_dtype in [(TensorProto.FLOAT16, np.float16),
+                                (TensorProto.INT8, np.int8),
+                                (TensorProto.BOOL, np.bool_)]:
+            name = TensorProto.DataType.Name(dtype)
+            i = (np.random.rand(5) * 10 - 5).astype(np_dtype)
+            # The same content stored as raw data and in the typed field
+            initializers.append(helper.make_tensor(
+                name + "_0", dtype, dims=(5,), vals=i.tobytes(), raw=True))
+            initializers.append(numpy_helper.from_array(i, name + "_1"))
+            for suffix in ["_0", "_1"]:
+                nodes.append(helper.make_node(
+                    "Identity", [name + suffix], [name + suffix + "_out"]))
+                outputs.append(helper.make_tensor_value_info(
+                    name + suffix + "_out", dtype, (5,)))
+        # Same bytes as the INT8 initializers but a different type
+        initializers.append(helper.make_tensor(
+            "U", TensorProto.UINT8, dims=(5,),
+            vals=initializers[2].raw_data, raw=True))
+        nodes.append(helper.make_node("Identity", ["U"], ["U_out"]))
+        outputs.append(helper.make_tensor_value_info(
+            "U_out", TensorProto.UINT8, (5,)))
+        graph = helper.make_graph(nodes, "test", [], outputs, initializers)
+        optimized_model = self._optimized(
+            graph, ["eliminate_duplicate_initializer"])
+        assert sorted(i.name for i in optimized_model.graph.initializer) == [
+            "BOOL_0", "FLOAT16_0", "INT8_0", "U"]
+        for node in optimized_model.graph.node[:-1]:
+            assert node.input[0].endswith("_0")
+
     def test_nop_cast(self):  # type: () -> None
         identity = helper.make_node("Identity", ["X"], ["A"])
         cast = helper.make_node("Cast", ["A"], ["B"], to=TensorProto.FLOAT)
@@ -538,6 +689,233 @@ class TestOptimizer(unittest.TestCase):
 
         assert optimized_model.graph == graph
 
+    def test_eliminate_nop_by_shape(self):  # type: () -> None
+        int64_max = np.iinfo(np.int64).max
+        nodes = [
+            helper.make_node("Identity", ["X"], ["A"]),
+            helper.make_node("Reshape", ["A", "shape"], ["R"]),
+            helper.make_node("Expand", ["R", "expand_shape"], ["E"]),
+            helper.make_node("Tile", ["E", "repeats"], ["T"]),
+            helper.make_node("Slice", ["T", "starts", "ends", "axes"], ["S"]),
+            helper.make_node("Split", ["S"], ["P"], axis=1),
+            helper.make_node("Concat", ["P"], ["C"], axis=0),
+            helper.make_node("Resize", ["C", "", "scales"], ["Z"],
+                             mode="linear"),
+            helper.make_node("Relu", ["Z"], ["Y"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 4))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 3, 4))],
+            initializer=[
+                helper.make_tensor("shape", TensorProto.INT64, (3,),
+                                   [0, -1, 4]),
+                helper.make_tensor("expand_shape", TensorProto.INT64, (2,),
+                                   [3, 1]),
+                helper.make_tensor("repeats", TensorProto.INT64, (3,),
+                                   [1, 1, 1]),
+                helper.make_tensor("starts", TensorProto.INT64, (2,),
+                                   [-5, 0]),
+                helper.make_tensor("ends", TensorProto.INT64, (2,),
+                                   [int64_max, 4]),
+                helper.make_tensor("axes", TensorProto.INT64, (2,),
+                                   [1, -1]),
+                helper.make_tensor("scales", TensorProto.FLOAT, (3,),
+                                   [1, 1, 1])])
+        optimized_model = self._optimized(graph, ["eliminate_nop_by_shape"])
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Identity", "Relu"]
+
+    def test_eliminate_nop_by_shape_in_subgraph(self):  # type: () -> None
+        # Slice takes attributes before opset 10 and Resize its scales as
+        # input 1 in opset 10, the body has no opset of its own
+        scales = helper.make_tensor("scales", TensorProto.FLOAT, (2,), [1, 1])
+        for opset_version, nop in [
+                (9, helper.make_node("Slice", ["A"], ["S"], starts=[0],
+                                     ends=[np.iinfo(np.int64).max], axes=[1])),
+                (10, helper.make_node("Resize", ["A", "scales"], ["S"]))]:
+            then_graph = helper.make_graph(
+                [helper.make_node("Constant", [], ["scales"], value=scales),
+                 helper.make_node("Relu", ["X"], ["A"]),
+                 nop,
+                 helper.make_node("Relu", ["S"], ["Y_then"])],
+                "then_graph", [],
+                [helper.make_tensor_value_info(
+                    "Y_then", TensorProto.FLOAT, (2, 3))])
+            else_graph = helper.make_graph(
+                [helper.make_node("Identity", ["X"], ["Y_else"])],
+                "else_graph", [],
+                [helper.make_tensor_value_info(
+                    "Y_else", TensorProto.FLOAT, (2, 3))])
+            graph = helper.make_graph(
+                [helper.make_node("If", ["cond"], ["Y"],
+                                  then_branch=then_graph,
+                                  else_branch=else_graph)],
+                "test",
+                [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3)),
+                 helper.make_tensor_value_info("cond", TensorProto.BOOL, ())],
+                [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 3))])
+            optimized_model = self._optimized(
+                graph, ["eliminate_nop_by_shape"],
+                opset_imports=[helper.make_opsetid("", opset_version)])
+
+            body = [a.g for a in optimized_model.graph.node[0].attribute
+                    if a.name == "then_branch"][0]
+            self.assertEqual([n.op_type for n in body.node],
+                             ["Constant", "Relu", "Relu"])
+
+    def test_eliminate_nop_by_shape_symbolic(self):  # type: () -> None
+        int64_max = np.iinfo(np.int64).max
+        nodes = [
+            helper.make_node("Relu", ["X"], ["A"]),
+            helper.make_node("Reshape", ["A", "shape"], ["R"]),
+            helper.make_node("Slice", ["R", "starts", "ends", "axes"], ["S"]),
+            # Not a nop, the second dim becomes 2
+            helper.make_node("Slice", ["S", "starts", "two", "axes"], ["Y"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", "seq", 16))],
+            [helper.make_tensor_value_info(
+                "Y", TensorProto.FLOAT, ("batch", 2, 16))],
+            initializer=[
+                helper.make_tensor("shape", TensorProto.INT64, (3,),
+                                   [-1, 0, 16]),
+                helper.make_tensor("starts", TensorProto.INT64, (1,), [0]),
+                helper.make_tensor("ends", TensorProto.INT64, (1,),
+                                   [int64_max]),
+                helper.make_tensor("two", TensorProto.INT64, (1,), [2]),
+                helper.make_tensor("axes", TensorProto.INT64, (1,), [1])])
+        orig_model = helper.make_model(
+            graph, producer_name='onnx-test', opset_imports=[
+                helper.make_opsetid("", LATEST_STABLE_OPSET_VERSION)])
+        optimized_model = self._optimized(
+            orig_model, ["eliminate_nop_by_shape"], compare_result=False)
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Relu", "Slice"]
+        if has_ort:
+            assert self._compare(optimized_model, orig_model,
+                                 input_shapes={"X": [2, 5, 16]})
+
+    def test_eliminate_slice_concat(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Split", ["X", "split"], ["A", "B"], axis=1),
+            helper.make_node("Concat", ["W", "A", "B"], ["Y"], axis=1),
+            helper.make_node("Slice", ["Y", "starts", "ends", "axes"], ["S"]),
+            helper.make_node("Relu", ["S"], ["Z"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 8)),
+             helper.make_tensor_value_info("W", TensorProto.FLOAT, (2, 4))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 12)),
+             helper.make_tensor_value_info("Z", TensorProto.FLOAT, (2, 4))],
+            initializer=[
+                helper.make_tensor("split", TensorProto.INT64, (2,), [3, 5]),
+                helper.make_tensor("starts", TensorProto.INT64, (1,), [0]),
+                helper.make_tensor("ends", TensorProto.INT64, (1,), [4]),
+                helper.make_tensor("axes", TensorProto.INT64, (1,), [1])])
+        optimized_model = self._optimized(graph, ["eliminate_slice_concat"])
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Concat", "Relu"]
+        assert list(optimized_model.graph.node[0].input) == ["W", "X"]
+        assert list(optimized_model.graph.node[1].input) == ["W"]
+
+    def test_eliminate_slice_concat_in_subgraph(self):  # type: () -> None
+        # The body has no opset of its own, Slice takes attributes in the
+        # opset 9 of the model
+        def make_branch(prefix):  # type: (Text) -> GraphProto
+            return helper.make_graph(
+                [helper.make_node("Slice", ["X"], [prefix + "A"], starts=[0],
+                                  ends=[3], axes=[1]),
+                 helper.make_node("Slice", ["X"], [prefix + "B"], starts=[3],
+                                  ends=[8], axes=[1]),
+                 helper.make_node("Concat", [prefix + "A", prefix + "B"],
+                                  [prefix + "C"], axis=1),
+                 helper.make_node("Relu", [prefix + "C"], [prefix + "Y"])],
+                prefix + "graph", [],
+                [helper.make_tensor_value_info(
+                    prefix + "Y", TensorProto.FLOAT, (2, 8))])
+        graph = helper.make_graph(
+            [helper.make_node("If", ["cond"], ["Y"],
+                              then_branch=make_branch("then_"),
+                              else_branch=make_branch("else_"))],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 8)),
+             helper.make_tensor_value_info("cond", TensorProto.BOOL, ())],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 8))])
+        optimized_model = self._optimized(
+            graph, ["eliminate_slice_concat"],
+            opset_imports=[helper.make_opsetid("", 9)])
+
+        for attr in optimized_model.graph.node[0].attribute:
+            assert [n.op_type for n in attr.g.node] == ["Relu"]
+            assert list(attr.g.node[0].input) == ["X"]
+
+    def test_eliminate_slice_concat_duplicate_input(self):  # type: () -> None
+        # A can't stand for both graph outputs
+        nodes = [
+            helper.make_node("Relu", ["X"], ["A"]),
+            helper.make_node("Concat", ["A", "A"], ["C"], axis=1),
+            helper.make_node("Split", ["C"], ["O1", "O2"], axis=1)]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 4))],
+            [helper.make_tensor_value_info("O1", TensorProto.FLOAT, (2, 4)),
+             helper.make_tensor_value_info("O2", TensorProto.FLOAT, (2, 4))])
+        optimized_model = self._optimized(graph, ["eliminate_slice_concat"])
+
+        assert [o.name for o in optimized_model.graph.output] == ["O1", "O2"]
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Relu", "Concat", "Split"]
+
+    def test_eliminate_slice_concat_symbolic(self):  # type: () -> None
+        int64_max = np.iinfo(np.int64).max
+        nodes = [
+            helper.make_node("Relu", ["X"], ["A"]),
+            helper.make_node("Sigmoid", ["X"], ["G"]),
+            helper.make_node("Slice", ["A", "zero", "three", "axes"], ["S0"]),
+            helper.make_node("Slice", ["A", "three", "end", "axes"], ["S1"]),
+            helper.make_node("Concat", ["S0", "S1"], ["J"], axis=-1),
+            helper.make_node("Concat", ["A", "G"], ["C"], axis=2),
+            helper.make_node("Split", ["C", "split"], ["P", "Q"], axis=-1),
+            helper.make_node("Add", ["J", "P"], ["Y"]),
+            helper.make_node("Mul", ["Q", "Q"], ["Z"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", "seq", 8))],
+            [helper.make_tensor_value_info(
+                "Y", TensorProto.FLOAT, ("batch", "seq", 8)),
+             helper.make_tensor_value_info(
+                "Z", TensorProto.FLOAT, ("batch", "seq", 8))],
+            initializer=[
+                helper.make_tensor("zero", TensorProto.INT64, (1,), [0]),
+                helper.make_tensor("three", TensorProto.INT64, (1,), [3]),
+                helper.make_tensor("end", TensorProto.INT64, (1,),
+                                   [int64_max]),
+                helper.make_tensor("axes", TensorProto.INT64, (1,), [2]),
+                helper.make_tensor("split", TensorProto.INT64, (2,), [8, 8])])
+        orig_model = helper.make_model(
+            graph, producer_name='onnx-test', opset_imports=[
+                helper.make_opsetid("", LATEST_STABLE_OPSET_VERSION)])
+        optimized_model = self._optimized(
+            orig_model, ["eliminate_slice_concat"], compare_result=False)
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Relu", "Sigmoid", "Add", "Mul"]
+        assert list(optimized_model.graph.node[2].input) == ["A", "A"]
+        assert list(optimized_model.graph.node[3].input) == ["G", "G"]
+        if has_ort:
+            assert self._compare(optimized_model, orig_model,
+                                 input_shapes={"X": [2, 5, 8]})
+
     def test_nop_pad_opset10(self):  # type: () -> None
         identity = helper.make_node("Identity", ["A"], ["X"])
         pad = helper.make_node("Pad", ["X"], ["Y"], pads=[0, 0, 0, 0])
@@ -799,6 +1177,26 @@ class TestOptimizer(unittest.TestCase):
             "A", "B", "C", "G", "D", "E", "F"]
         assert optimized_model.graph.node[0].op_type == "Concat"
 
+    def test_fuse_concats_chain_fixed_point(self):  # type: () -> None
+        nodes = [helper.make_node("Concat", ["A", "B"], ["X"], axis=0),
+                 helper.make_node("Concat", ["C", "X"], ["Y"], axis=0),
+                 helper.make_node("Concat", ["Y", "D"], ["Z"], axis=0),
+                 helper.make_node("Concat", ["E", "A"], ["Y2"], axis=0),
+                 helper.make_node("Concat", ["E", "Z", "Y2"], ["W"], axis=0)]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(name, TensorProto.FLOAT, (2, 3))
+             for name in ["A", "B", "C", "D", "E"]],
+            [helper.make_tensor_value_info("W", TensorProto.FLOAT, (16, 3))])
+        optimized_model = self._optimized(
+            graph, ["fuse_consecutive_concats"], True)
+
+        assert len(optimized_model.graph.node) == 1
+        assert optimized_model.graph.node[0].op_type == "Concat"
+        assert optimized_model.graph.node[0].input == [
+            "E", "C", "A", "B", "D", "E", "A"]
+
     def test_fuse_concats_different_axis(self):  # type: () -> None
         nodes = [helper.make_node("Concat", ["A", "B", "C"], ["X"], axis=0),
                  helper.make_node("Concat", ["D", "E", "F"], ["Y"], axis=1),
@@ -897,6 +1295,470 @@ class TestOptimizer(unittest.TestCase):
         assert len(list(optimized_model.graph.node)) == 4
         assert optimized_model.graph == graph
 
+    def test_fuse_and_eliminate_transposes_fixed_point(self):  # type: () -> None
+        nodes = [helper.make_node("Relu", ["A"], ["X"]),
+                 helper.make_node("Identity", ["X"], ["X1"]),
+                 helper.make_node("Transpose", ["X1"], ["Y"], perm=[1, 0, 2]),
+                 helper.make_node("Identity", ["Y"], ["Y1"]),
+                 helper.make_node("Transpose", ["Y1"], ["Z"], perm=[1, 0, 2]),
+                 helper.make_node("Identity", ["Z"], ["Z1"]),
+                 helper.make_node("Relu", ["Z1"], ["B"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("A", TensorProto.FLOAT, (2, 3, 4))],
+            [helper.make_tensor_value_info("B", TensorProto.FLOAT, (2, 3, 4))])
+        optimized_model = self._optimized(
+            graph, ["eliminate_identity", "fuse_consecutive_transposes",
+                    "eliminate_nop_transpose"], True)
+
+        assert len(list(optimized_model.graph.node)) == 2
+        assert optimized_model.graph.node[0].op_type == "Relu"
+        assert optimized_model.graph.node[1].op_type == "Relu"
+        assert optimized_model.graph.node[1].input == ["X"]
+
+    def test_fuse_and_elimination_passes_multi_level_fixed_point(self):  # type: () -> None
+        # The fusions match patterns several nodes deep, which the worklist
+        # must keep track of while the other passes run along with them
+        graphs = [(self._make_layer_norm_graph(), 17, "LayerNormalization"),
+                  (self._make_gelu_graph(), 20, "Gelu")]
+        for graph, opset_version, op_type in graphs:
+            optimized_model = self._optimized(
+                graph, onnxoptimizer.get_fuse_and_elimination_passes(), True,
+                opset_imports=[helper.make_opsetid("", opset_version)])
+            self.assertEqual(
+                [n.op_type for n in optimized_model.graph.node], [op_type] * 2)
+
+    def test_optimize_statistics(self):  # type: () -> None
+        nodes = [helper.make_node("Identity", ["X"], ["Y"]),
+                 helper.make_node("Add", ["Y", "A"], ["Z"]),
+                 helper.make_node("Add", ["Z", "B"], ["W"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2,))],
+            [helper.make_tensor_value_info("W", TensorProto.FLOAT, (2,))],
+            [helper.make_tensor("A", TensorProto.FLOAT, (2,), [1, 2]),
+             helper.make_tensor("B", TensorProto.FLOAT, (2,), [1, 2])])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        for fixed_point in [False, True]:
+            optimized_model, statistics = onnxoptimizer.optimize(
+                model, ["eliminate_identity", "eliminate_duplicate_initializer"],
+                fixed_point, return_statistics=True)
+            assert len(optimized_model.graph.node) == 2
+            assert statistics['num_fixed_point_iterations'] >= 1
+            assert statistics['seconds'] >= 0
+            passes = statistics['passes']
+            assert [p['name'] for p in passes] == [
+                "eliminate_identity", "eliminate_duplicate_initializer"]
+            assert passes[0]['num_runs'] >= 1
+            assert passes[0]['num_transforms'] == 1
+            # Fused into a group, the pass is only offered the Identity
+            assert passes[0]['num_nodes_visited'] >= (1 if fixed_point else 3)
+            assert passes[1]['num_transforms'] == 1
+            assert passes[1]['num_initializers_added'] == 0
+            assert passes[1]['num_initializers_erased'] == 1
+
+    def test_optimize_statistics_of_fused_passes(self):  # type: () -> None
+        nodes = [helper.make_node("Identity", ["X"], ["Y"]),
+                 helper.make_node("Transpose", ["Y"], ["Z"], perm=[0, 1]),
+                 helper.make_node("Identity", ["Z"], ["W"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3))],
+            [helper.make_tensor_value_info("W", TensorProto.FLOAT, (2, 3))])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        # The fixed point pass manager runs both passes in a single traversal
+        optimized_model, statistics = onnxoptimizer.optimize(
+            model, ["eliminate_identity", "eliminate_nop_transpose"], True,
+            return_statistics=True)
+        assert len(optimized_model.graph.node) == 1
+        passes = statistics['passes']
+        assert [p['name'] for p in passes] == [
+            "eliminate_identity", "eliminate_nop_transpose"]
+        assert passes[0]['num_transforms'] == 1
+        assert passes[1]['num_transforms'] == 1
+        for p in passes:
+            assert p['num_runs'] >= 1
+            assert p['num_nodes_visited'] >= 1
+            assert p['seconds'] > 0
+
+    def test_plan_activation_memory(self):  # type: () -> None
+        nodes = [helper.make_node("Relu", ["X"], ["A"]),
+                 helper.make_node("Sigmoid", ["A"], ["B"]),
+                 helper.make_node("Tanh", ["B"], ["C"]),
+                 helper.make_node("Exp", ["C"], ["Y"]),
+                 helper.make_node("Neg", ["S"], ["T"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (1, 16)),
+             helper.make_tensor_value_info(
+                 "S", TensorProto.FLOAT, ("batch", 4))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (1, 16)),
+             helper.make_tensor_value_info(
+                 "T", TensorProto.FLOAT, ("batch", 4))])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        for fixed_point in [False, True]:
+            optimized_model = onnxoptimizer.optimize(
+                model, ["plan_activation_memory"], fixed_point)
+            assert optimized_model.graph == model.graph
+            metadata = {p.key: p.value
+                        for p in optimized_model.metadata_props}
+            plan = json.loads(metadata["onnxoptimizer.memory_plan"])
+            assert plan["alignment"] == 64
+            assert plan["unplanned"] == ["T"]
+            buffers = {b["name"]: b for b in plan["buffers"]}
+            assert [b["name"] for b in plan["buffers"]] == [
+                "A", "B", "C", "Y"]
+            # Y is an output, alive until the last node
+            assert [(buffers[name]["first_node"],
+                     buffers[name]["last_node"]) for name in "ABCY"] == [
+                (0, 1), (1, 2), (2, 3), (3, 4)]
+            assert all(b["size"] == 64 for b in plan["buffers"])
+            # Buffers alive at the same time don't overlap
+            for a in plan["buffers"]:
+                for b in plan["buffers"]:
+                    if a is not b and \
+                            a["first_node"] <= b["last_node"] and \
+                            b["first_node"] <= a["last_node"]:
+                        assert a["offset"] + a["size"] <= b["offset"] or \
+                            b["offset"] + b["size"] <= a["offset"]
+            assert plan["peak_bytes"] == 128
+            assert plan["arena_bytes"] == 128
+
+    def test_plan_activation_memory_goes_last(self):  # type: () -> None
+        nodes = [helper.make_node("Identity", ["X"], ["A"]),
+                 helper.make_node("Relu", ["A"], ["Y"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (1, 16))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (1, 16))])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        with self.assertRaises(RuntimeError):
+            onnxoptimizer.optimize(
+                model, ["plan_activation_memory", "eliminate_identity"])
+
+        planned_model = onnxoptimizer.optimize(
+            model, ["eliminate_identity", "plan_activation_memory"])
+        metadata = {p.key: p.value for p in planned_model.metadata_props}
+        plan = json.loads(metadata["onnxoptimizer.memory_plan"])
+        assert [b["name"] for b in plan["buffers"]] == ["Y"]
+
+        # The plan of an earlier run is dropped rather than kept stale
+        optimized_model = onnxoptimizer.optimize(
+            planned_model, ["eliminate_identity"])
+        assert "onnxoptimizer.memory_plan" not in [
+            p.key for p in optimized_model.metadata_props]
+
+    def test_plan_activation_memory_overflow(self):  # type: () -> None
+        # 2^64 elements don't fit into an int64_t
+        shape = (2 ** 32, 2 ** 32)
+        graph = helper.make_graph(
+            [helper.make_node("Relu", ["X"], ["Y"])],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, shape)],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, shape)])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        optimized_model = onnxoptimizer.optimize(
+            model, ["plan_activation_memory"])
+        metadata = {p.key: p.value for p in optimized_model.metadata_props}
+        plan = json.loads(metadata["onnxoptimizer.memory_plan"])
+        assert plan["buffers"] == []
+        assert plan["unplanned"] == ["Y"]
+
+    def test_plan_activation_memory_dim_params(self):  # type: () -> None
+        nodes = [helper.make_node("Relu", ["X"], ["A"]),
+                 helper.make_node("Transpose", ["A"], ["Y"], perm=[1, 0]),
+                 helper.make_node("Neg", ["S"], ["T"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", "seq")),
+             helper.make_tensor_value_info("S", TensorProto.FLOAT, ("n",))],
+            [helper.make_tensor_value_info(
+                "Y", TensorProto.FLOAT, ("seq", "batch")),
+             helper.make_tensor_value_info("T", TensorProto.FLOAT, ("n",))])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        # n is left unbound
+        helper.set_model_props(
+            model, {"onnxoptimizer.dim_params": "batch=3, seq=5"})
+        optimized_model = onnxoptimizer.optimize(
+            model, ["plan_activation_memory"])
+        metadata = {p.key: p.value for p in optimized_model.metadata_props}
+        plan = json.loads(metadata["onnxoptimizer.memory_plan"])
+        assert [(b["name"], b["size"]) for b in plan["buffers"]] == [
+            ("A", 60), ("Y", 60)]
+        assert plan["unplanned"] == ["T"]
+
+        # Nothing is bound by a malformed entry
+        helper.set_model_props(
+            model, {"onnxoptimizer.dim_params": "batch=3, seq"})
+        optimized_model = onnxoptimizer.optimize(
+            model, ["plan_activation_memory"])
+        metadata = {p.key: p.value for p in optimized_model.metadata_props}
+        plan = json.loads(metadata["onnxoptimizer.memory_plan"])
+        assert plan["buffers"] == []
+        assert sorted(plan["unplanned"]) == ["A", "T", "Y"]
+
+    def test_optimize_keeps_initializer_data(self):  # type: () -> None
+        # The initializers are moved through the optimizer rather than
+        # copied, whatever way they store their content
+        a = np.arange(1024, dtype=np.float32)
+        nodes = [helper.make_node("Identity", ["X"], ["Y"]),
+                 helper.make_node("Add", ["Y", "A"], ["Z"]),
+                 helper.make_node("Mul", ["Z", "B"], ["W"]),
+                 helper.make_node("Sub", ["W", "C"], ["V"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (1024,)),
+             helper.make_tensor_value_info("A", TensorProto.FLOAT, (1024,))],
+            [helper.make_tensor_value_info("V", TensorProto.FLOAT, (1024,))],
+            [numpy_helper.from_array(a, "A"),
+             helper.make_tensor("B", TensorProto.FLOAT, (1,), [2]),
+             helper.make_tensor("C", TensorProto.FLOAT, (), [3])])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        optimized_model = onnxoptimizer.optimize(model, ["eliminate_identity"])
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Add", "Mul", "Sub"]
+        assert [i.name for i in optimized_model.graph.input] == ["X", "A"]
+        initializers = {t.name: t for t in optimized_model.graph.initializer}
+        assert initializers["A"].HasField("raw_data")
+        assert np.array_equal(to_array(initializers["A"]), a)
+        assert initializers["B"].float_data == [2]
+        assert to_array(initializers["C"]) == 3
+        checker.check_model(optimized_model)
+        # The model passed in is left alone
+        assert model.graph.initializer[0] == numpy_helper.from_array(a, "A")
+
+    def test_optimize_serialized_model(self):  # type: () -> None
+        nodes = [helper.make_node("Identity", ["X"], ["Y"]),
+                 helper.make_node("Relu", ["Y"], ["Z"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2,))],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT, (2,))])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        expected = onnxoptimizer.optimize(model, ["eliminate_identity"])
+        model_str = model.SerializeToString()
+        for serialized in [model_str, bytearray(model_str), memoryview(model_str)]:
+            assert onnxoptimizer.optimize(
+                serialized, ["eliminate_identity"]) == expected
+            optimized_model_str = onnxoptimizer.optimize_serialized(
+                serialized, ["eliminate_identity"])
+            assert isinstance(optimized_model_str, bytes)
+            assert onnx.load_from_string(optimized_model_str) == expected
+        with self.assertRaises(ValueError):
+            onnxoptimizer.optimize(memoryview(model_str + model_str)[::2],
+                                   ["eliminate_identity"])
+
+    def test_optimize_without_propagating_shapes(self):  # type: () -> None
+        nodes = [helper.make_node("Relu", ["X"], ["R"]),
+                 helper.make_node("Reshape", ["R", "shape"], ["S"]),
+                 helper.make_node("Relu", ["S"], ["Y"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 3))],
+            [helper.make_tensor("shape", TensorProto.INT64, (2,), [0, 0])])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        passes = ["eliminate_nop_by_shape"]
+        for fixed_point in [False, True]:
+            # The shape of R is only known once inferred
+            optimized_model = onnxoptimizer.optimize(
+                model, passes, fixed_point)
+            assert [n.op_type for n in optimized_model.graph.node] == [
+                "Relu", "Relu"]
+            optimized_model = onnxoptimizer.optimize(
+                model, passes, fixed_point, propagate_shapes=False)
+            assert [n.op_type for n in optimized_model.graph.node] == [
+                "Relu", "Reshape", "Relu"]
+            assert optimized_model == onnxoptimizer.optimize_batch(
+                [model], passes, fixed_point, propagate_shapes=False)[0]
+
+    def test_optimize_batch(self):  # type: () -> None
+        models = []
+        for i in range(8):
+            # An identity followed by i transposes
+            nodes = [helper.make_node("Identity", ["X"], ["T"])]
+            previous = "T"
+            for j in range(i):
+                nodes.append(helper.make_node("Transpose", [previous],
+                                              ["T%d" % j], perm=[1, 0]))
+                previous = "T%d" % j
+            nodes.append(helper.make_node("Relu", [previous], ["Y"]))
+            shape = (2, 3) if i % 2 == 0 else (3, 2)
+            graph = helper.make_graph(
+                nodes,
+                "test",
+                [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3))],
+                [helper.make_tensor_value_info("Y", TensorProto.FLOAT, shape)])
+            models.append(helper.make_model(graph, producer_name='onnx-test'))
+        passes = ["eliminate_identity", "fuse_consecutive_transposes",
+                  "eliminate_nop_transpose"]
+        serialized = [models[0].SerializeToString()] + models[1:]
+        for fixed_point in [False, True]:
+            optimized_models = onnxoptimizer.optimize_batch(
+                serialized, passes, fixed_point, num_threads=3)
+            assert len(optimized_models) == len(models)
+            for model, optimized_model in zip(models, optimized_models):
+                assert optimized_model == onnxoptimizer.optimize(
+                    model, passes, fixed_point)
+
+    def test_optimize_file(self):  # type: () -> None
+        nodes = [helper.make_node("Identity", ["X"], ["Y"]),
+                 helper.make_node("Add", ["Y", "A"], ["Z"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (64,))],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT, (64,))],
+            [helper.make_tensor("A", TensorProto.FLOAT, (64,),
+                                np.arange(64, dtype=np.float32).tobytes(),
+                                raw=True)])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        with tempfile.TemporaryDirectory() as directory:
+            input_path = os.path.join(directory, "model.onnx")
+            output_path = os.path.join(directory, "optimized.onnx")
+            onnx.save(model, input_path)
+            statistics = onnxoptimizer.optimize_file(
+                input_path, output_path, ["eliminate_identity"],
+                external_data_threshold=128)
+            assert len(statistics['passes']) == 1
+            assert os.path.exists(output_path + ".data")
+            optimized_model = onnx.load(output_path)
+        assert len(optimized_model.graph.node) == 1
+        assert optimized_model.graph.node[0].input == ["X", "A"]
+        assert np.array_equal(to_array(optimized_model.graph.initializer[0]),
+                              np.arange(64, dtype=np.float32))
+
+    def test_optimize_file_external_data_threshold(self):  # type: () -> None
+        a = np.arange(64, dtype=np.float32)
+        b = np.arange(128, dtype=np.float32)
+        nodes = [helper.make_node("Add", ["X", "A"], ["Y"]),
+                 helper.make_node("Mul", ["Y", "S"], ["Z"]),
+                 helper.make_node("Concat", ["Z", "B"], ["W"], axis=0)]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (64,))],
+            [helper.make_tensor_value_info("W", TensorProto.FLOAT, (192,))],
+            [numpy_helper.from_array(a, "A"),
+             numpy_helper.from_array(np.ones(1, dtype=np.float32), "S"),
+             numpy_helper.from_array(b, "B")])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        with tempfile.TemporaryDirectory() as directory:
+            input_path = os.path.join(directory, "model.onnx")
+            output_path = os.path.join(directory, "optimized.onnx")
+            onnx.save(model, input_path)
+            onnxoptimizer.optimize_file(
+                input_path, output_path, ["eliminate_identity"],
+                external_data_threshold=256)
+            assert os.path.getsize(output_path + ".data") == 768
+            reference = onnx.load(output_path, load_external_data=False)
+            optimized_model = onnx.load(output_path)
+        # The initializers of at least 256 bytes are written one after the
+        # other, the others stay in the model
+        external_data = {
+            t.name: {e.key: e.value for e in t.external_data}
+            for t in reference.graph.initializer}
+        assert external_data["A"] == {"location": "optimized.onnx.data",
+                                      "offset": "0", "length": "256"}
+        assert external_data["B"] == {"location": "optimized.onnx.data",
+                                      "offset": "256", "length": "512"}
+        assert external_data["S"] == {}
+        initializers = {t.name: to_array(t)
+                        for t in optimized_model.graph.initializer}
+        assert np.array_equal(initializers["A"], a)
+        assert np.array_equal(initializers["B"], b)
+        assert np.array_equal(initializers["S"], [1])
+
+    def _save_with_external_data(self, path, location, size_threshold=0):  # type: (Text, Text, int) -> None
+        nodes = [helper.make_node("Pad", ["X", "P"], ["Y"]),
+                 helper.make_node("Add", ["Y", "A"], ["Z"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (64,))],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT, (64,))],
+            [helper.make_tensor("P", TensorProto.INT64, (2,),
+                                np.zeros(2, dtype=np.int64).tobytes(),
+                                raw=True),
+             helper.make_tensor("A", TensorProto.FLOAT, (64,),
+                                np.arange(64, dtype=np.float32).tobytes(),
+                                raw=True)])
+        model = helper.make_model(graph, producer_name='onnx-test')
+        onnx.save(model, path, save_as_external_data=True,
+                  all_tensors_to_one_file=True, location=location,
+                  size_threshold=size_threshold)
+
+    def test_optimize_file_external_data(self):  # type: () -> None
+        with tempfile.TemporaryDirectory() as directory:
+            input_path = os.path.join(directory, "model.onnx")
+            output_path = os.path.join(directory, "optimized.onnx")
+            self._save_with_external_data(input_path, "weights.bin")
+            # eliminate_nop_pad loads the pads P from weights.bin
+            onnxoptimizer.optimize_file(
+                input_path, output_path, ["eliminate_nop_pad"])
+            assert not os.path.exists(output_path + ".data")
+            reference = onnx.load(output_path, load_external_data=False)
+            optimized_model = onnx.load(output_path)
+        assert [n.op_type for n in optimized_model.graph.node] == ["Add"]
+        # A is still read from where the input model keeps it
+        initializer = next(t for t in reference.graph.initializer
+                           if t.name == "A")
+        assert initializer.data_location == TensorProto.EXTERNAL
+        assert not initializer.HasField("raw_data")
+        assert {e.key: e.value for e in initializer.external_data}[
+            "location"] == "weights.bin"
+        initializer = next(t for t in optimized_model.graph.initializer
+                           if t.name == "A")
+        assert np.array_equal(to_array(initializer),
+                              np.arange(64, dtype=np.float32))
+
+    def test_optimize_file_external_data_to_other_directory(self):  # type: () -> None
+        with tempfile.TemporaryDirectory() as directory:
+            os.mkdir(os.path.join(directory, "in"))
+            os.mkdir(os.path.join(directory, "out"))
+            input_path = os.path.join(directory, "in", "model.onnx")
+            output_path = os.path.join(directory, "out", "optimized.onnx")
+            self._save_with_external_data(input_path, "weights.bin")
+            onnxoptimizer.optimize_file(
+                input_path, output_path, ["eliminate_nop_pad"])
+            reference = onnx.load(output_path, load_external_data=False)
+            optimized_model = onnx.load(output_path)
+        assert [n.op_type for n in optimized_model.graph.node] == ["Add"]
+        initializer = next(t for t in reference.graph.initializer
+                           if t.name == "A")
+        assert initializer.data_location == TensorProto.EXTERNAL
+        assert {e.key: e.value for e in initializer.external_data}[
+            "location"] == "optimized.onnx.data"
+        initializer = next(t for t in optimized_model.graph.initializer
+                           if t.name == "A")
+        assert np.array_equal(to_array(initializer),
+                              np.arange(64, dtype=np.float32))
+
+    def test_optimize_file_refuses_to_overwrite_external_data(self):  # type: () -> None
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "model.onnx")
+            # A goes to model.onnx.data, which spilling P would overwrite
+            self._save_with_external_data(path, "model.onnx.data",
+                                          size_threshold=64)
+            with open(path + ".data", "rb") as f:
+                data = f.read()
+            with self.assertRaises(RuntimeError):
+                onnxoptimizer.optimize_file(
+                    path, path, ["eliminate_identity"],
+                    external_data_threshold=16)
+            with open(path + ".data", "rb") as f:
+                assert f.read() == data
+
     def test_fuse_transpose_into_gemm(self):  # type: () -> None
         nodes = [helper.make_node("Transpose", ["X"], ["A"], perm=[1, 0]),
                  helper.make_node("Transpose", ["Y"], ["B"], perm=[1, 0]),
@@ -1260,6 +2122,158 @@ class TestOptimizer(unittest.TestCase):
 
         assert optimized_model.graph == graph
 
+    def test_fuse_matmul_add_bias_into_gemm_commuted(self):  # type: () -> None
+        matmul = helper.make_node("MatMul", ["X", "Y"], ["Z"])
+        add = helper.make_node("Add", ["B", "Z"], ["A"])
+        graph = helper.make_graph(
+            [matmul, add],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (32, 10)),
+             helper.make_tensor_value_info("Y", TensorProto.FLOAT, (10, 16)),
+             helper.make_tensor_value_info("B", TensorProto.FLOAT, (16,))],
+            [helper.make_tensor_value_info("A", TensorProto.FLOAT, (32, 16))]
+        )
+        optimized_model = self._optimized(
+            graph, ["fuse_matmul_add_bias_into_gemm"])
+
+        assert len(list(optimized_model.graph.node)) == 1
+        assert optimized_model.graph.node[0].op_type == "Gemm"
+        assert list(optimized_model.graph.node[0].input) == ["X", "Y", "B"]
+
+    def test_fuse_matmul_add_bias_into_gemm_3d(self):  # type: () -> None
+        matmul = helper.make_node("MatMul", ["X", "Y"], ["Z"])
+        add = helper.make_node("Add", ["B", "Z"], ["A"])
+        graph = helper.make_graph(
+            [matmul, add],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 10))],
+            [helper.make_tensor_value_info("A", TensorProto.FLOAT, (2, 3, 16))],
+            initializer=[
+                numpy_helper.from_array(
+                    np.random.randn(10, 16).astype(np.float32), "Y"),
+                numpy_helper.from_array(
+                    np.random.randn(16).astype(np.float32), "B")]
+        )
+        optimized_model = self._optimized(
+            graph, ["fuse_matmul_add_bias_into_gemm"])
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Reshape", "Gemm", "Reshape"]
+
+    def test_fuse_matmul_add_bias_into_gemm_3d_dynamic(self):  # type: () -> None
+        matmul = helper.make_node("MatMul", ["X", "Y"], ["Z"])
+        add = helper.make_node("Add", ["Z", "B"], ["A"])
+        graph = helper.make_graph(
+            [matmul, add],
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", "seq", 10))],
+            [helper.make_tensor_value_info(
+                "A", TensorProto.FLOAT, ("batch", "seq", 16))],
+            initializer=[
+                numpy_helper.from_array(
+                    np.random.randn(10, 16).astype(np.float32), "Y"),
+                numpy_helper.from_array(
+                    np.random.randn(16).astype(np.float32), "B")]
+        )
+        orig_model = helper.make_model(
+            graph, producer_name='onnx-test', opset_imports=[
+                helper.make_opsetid("", LATEST_STABLE_OPSET_VERSION)])
+        optimized_model = self._optimized(
+            orig_model, ["fuse_matmul_add_bias_into_gemm"],
+            compare_result=False)
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Reshape", "Gemm", "Shape", "Slice", "Concat", "Reshape"]
+        if has_ort:
+            assert self._compare(optimized_model, orig_model,
+                                 input_shapes={"X": [2, 3, 10]})
+
+    def test_fuse_matmul_add_bias_into_gemm_3d_in_subgraph(self):  # type: () -> None
+        # The body has no opset of its own, Slice takes attributes in the
+        # opset 9 of the model
+        def make_branch(prefix):  # type: (Text) -> GraphProto
+            y = np.random.randn(10, 16).astype(np.float32)
+            b = np.random.randn(16).astype(np.float32)
+            return helper.make_graph(
+                [helper.make_node("Constant", [], [prefix + "Y"],
+                                  value=numpy_helper.from_array(y)),
+                 helper.make_node("Constant", [], [prefix + "B"],
+                                  value=numpy_helper.from_array(b)),
+                 helper.make_node("MatMul", ["X", prefix + "Y"], [prefix + "Z"]),
+                 helper.make_node("Add", [prefix + "Z", prefix + "B"],
+                                  [prefix + "A"])],
+                prefix + "graph", [],
+                [helper.make_tensor_value_info(
+                    prefix + "A", TensorProto.FLOAT, ("batch", "seq", 16))],
+                value_info=[
+                    helper.make_tensor_value_info(
+                        prefix + "Y", TensorProto.FLOAT, (10, 16)),
+                    helper.make_tensor_value_info(
+                        prefix + "B", TensorProto.FLOAT, (16,))])
+        graph = helper.make_graph(
+            [helper.make_node("Constant", [], ["cond"],
+                              value=helper.make_tensor(
+                                  "cond", TensorProto.BOOL, (), [True])),
+             helper.make_node("If", ["cond"], ["A"],
+                              then_branch=make_branch("then_"),
+                              else_branch=make_branch("else_"))],
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", "seq", 10))],
+            [helper.make_tensor_value_info(
+                "A", TensorProto.FLOAT, ("batch", "seq", 16))])
+        orig_model = helper.make_model(
+            graph, producer_name='onnx-test',
+            opset_imports=[helper.make_opsetid("", 9)])
+        optimized_model = self._optimized(
+            orig_model, ["fuse_matmul_add_bias_into_gemm"],
+            compare_result=False)
+
+        for attr in optimized_model.graph.node[1].attribute:
+            assert [n.op_type for n in attr.g.node] == [
+                "Constant", "Constant", "Reshape", "Gemm", "Shape", "Slice",
+                "Concat", "Reshape"]
+            slice_node = attr.g.node[5]
+            assert len(slice_node.input) == 1
+            assert sorted(a.name for a in slice_node.attribute) == [
+                "ends", "starts"]
+        if has_ort:
+            assert self._compare(optimized_model, orig_model,
+                                 input_shapes={"X": [2, 3, 10]})
+
+    # type: () -> None
+    def test_fuse_matmul_add_bias_into_gemm_without_value_info(self):
+        relu = helper.make_node("Relu", ["X"], ["R"])
+        matmul = helper.make_node("MatMul", ["R", "Y"], ["Z"])
+        add = helper.make_node("Add", ["Z", "B"], ["A"])
+        graph = helper.make_graph(
+            [relu, matmul, add],
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", "seq", 10))],
+            [helper.make_tensor_value_info(
+                "A", TensorProto.FLOAT, ("batch", "seq", 16))],
+            initializer=[
+                numpy_helper.from_array(
+                    np.random.randn(10, 16).astype(np.float32), "Y"),
+                numpy_helper.from_array(
+                    np.random.randn(16).astype(np.float32), "B")]
+        )
+        orig_model = helper.make_model(
+            graph, producer_name='onnx-test', opset_imports=[
+                helper.make_opsetid("", LATEST_STABLE_OPSET_VERSION)])
+        optimized_model = self._optimized(
+            orig_model, ["fuse_matmul_add_bias_into_gemm"],
+            compare_result=False)
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Relu", "Reshape", "Gemm", "Shape", "Slice", "Concat", "Reshape"]
+        assert "R" not in [v.name for v in optimized_model.graph.value_info]
+        if has_ort:
+            assert self._compare(optimized_model, orig_model,
+                                 input_shapes={"X": [2, 3, 10]})
+
     # type: () -> None
     def test_fuse_pad_into_conv_no_optional_value_opset10(self):
         pad = helper.make_node(
@@ -1786,6 +2800,100 @@ class TestOptimizer(unittest.TestCase):
                 assert list(to_array(init)) == [
                     0, 1, 4, 5, 6]
 
+    def test_fuse_consecutive_view_ops(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Relu", ["X"], ["A"]),
+            helper.make_node("Unsqueeze", ["A", "axes"], ["B"]),
+            helper.make_node("Flatten", ["B"], ["C"], axis=2),
+            helper.make_node("Reshape", ["C", "shape"], ["Y"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", 16))],
+            [helper.make_tensor_value_info(
+                "Y", TensorProto.FLOAT, ("batch", 4, 4))],
+            initializer=[
+                helper.make_tensor("axes", TensorProto.INT64, (1,), [2]),
+                helper.make_tensor("shape", TensorProto.INT64, (3,),
+                                   [-1, 4, 4])])
+        orig_model = helper.make_model(
+            graph, producer_name='onnx-test', opset_imports=[
+                helper.make_opsetid("", LATEST_STABLE_OPSET_VERSION)])
+        optimized_model = self._optimized(
+            orig_model, ["fuse_consecutive_view_ops", "eliminate_deadend"],
+            compare_result=False)
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Relu", "Reshape"]
+        assert optimized_model.graph.node[1].input[0] == "A"
+        for init in optimized_model.graph.initializer:
+            if init.name == optimized_model.graph.node[1].input[1]:
+                assert list(to_array(init)) == [0, 4, 4]
+        if has_ort:
+            assert self._compare(optimized_model, orig_model,
+                                 input_shapes={"X": [3, 16]})
+
+    def test_fuse_consecutive_view_ops_fixed_point(self):  # type: () -> None
+        # fold_constants folds the Cast first, which queues the Unsqueeze
+        # the fusion then leaves dead
+        nodes = [
+            helper.make_node("Cast", ["axes_i"], ["axes"], to=TensorProto.INT64),
+            helper.make_node("Relu", ["X"], ["A"]),
+            helper.make_node("Unsqueeze", ["A", "axes"], ["B"]),
+            helper.make_node("Flatten", ["B"], ["C"], axis=2),
+            helper.make_node("Reshape", ["C", "shape"], ["Y"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, ("batch", 16))],
+            [helper.make_tensor_value_info(
+                "Y", TensorProto.FLOAT, ("batch", 4, 4))],
+            initializer=[
+                helper.make_tensor("axes_i", TensorProto.INT32, (1,), [2]),
+                helper.make_tensor("shape", TensorProto.INT64, (3,),
+                                   [-1, 4, 4])])
+        orig_model = helper.make_model(
+            graph, producer_name='onnx-test', opset_imports=[
+                helper.make_opsetid("", LATEST_STABLE_OPSET_VERSION)])
+        optimized_model = self._optimized(
+            orig_model, ["fold_constants", "fuse_consecutive_view_ops",
+                         "eliminate_deadend"],
+            True, compare_result=False)
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Relu", "Reshape"]
+        assert optimized_model.graph.node[1].input[0] == "A"
+        if has_ort:
+            assert self._compare(optimized_model, orig_model,
+                                 input_shapes={"X": [3, 16]})
+
+    def test_fuse_consecutive_view_ops_identity(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Relu", ["X"], ["A"]),
+            helper.make_node("Unsqueeze", ["A", "axes"], ["B"]),
+            helper.make_node("Squeeze", ["B", "axes"], ["C"]),
+            helper.make_node("Relu", ["C"], ["Y"]),
+            # Keeps the Unsqueeze
+            helper.make_node("Reshape", ["B", "shape"], ["Z"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 3)),
+             helper.make_tensor_value_info("Z", TensorProto.FLOAT, (6,))],
+            initializer=[
+                helper.make_tensor("axes", TensorProto.INT64, (1,), [0]),
+                helper.make_tensor("shape", TensorProto.INT64, (1,), [6])])
+        optimized_model = self._optimized(
+            graph, ["fuse_consecutive_view_ops"])
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Relu", "Relu", "Reshape"]
+        assert optimized_model.graph.node[1].input[0] == "A"
+        assert optimized_model.graph.node[2].input[0] == "A"
+
     def test_fuse_consecutive_softmax_log_axis(self):  # type: () -> None
         for axis in range(3):
             softmax = helper.make_node("Softmax", ["X"], ["Y"], axis=axis)
@@ -1988,6 +3096,880 @@ class TestOptimizer(unittest.TestCase):
             np.testing.assert_almost_equal(
                 W * f[:, np.newaxis, np.newaxis, np.newaxis], new_W)
 
+    def test_fuse_bn_into_conv_half(self):  # type: () -> None
+        for tensor_type in [TensorProto.FLOAT16, TensorProto.BFLOAT16]:
+            conv = helper.make_node("Conv", ["X", "W"], ["Y"])
+            bn = helper.make_node("BatchNormalization", [
+                                  "Y", "scale", "b", "mean", "var"], ["Z"])
+
+            # Values exactly representable in both types
+            W = np.round(np.random.randn(4, 2, 3, 3) * 8) / 8
+            scale = np.round(np.random.randn(4,) * 8) / 8 + 2
+            b = np.round(np.random.randn(4,) * 8) / 8
+            mean = np.round(np.random.randn(4,) * 8) / 8
+            var = np.abs(np.round(np.random.randn(4,) * 8) / 8) + 1
+
+            initializers = [
+                helper.make_tensor(name, tensor_type, npa.shape,
+                                   npa.astype(np.float32).flatten().tolist())
+                for name, npa in [('W', W), ('scale', scale), ('b', b),
+                                  ('mean', mean), ('var', var)]
+            ]
+            graph = helper.make_graph(
+                [conv, bn],
+                "test",
+                [helper.make_tensor_value_info(
+                    "X", tensor_type, (1, 2, 8, 8))],
+                [helper.make_tensor_value_info(
+                    "Z", tensor_type, (1, 4, 6, 6))],
+                initializer=initializers,
+            )
+            optimized_model = self._optimized(
+                graph, ["fuse_bn_into_conv"], compare_result=False)
+
+            self.assertEqual(len(optimized_model.graph.node), 1)
+            self.assertEqual(optimized_model.graph.node[0].op_type, 'Conv')
+            self.assertEqual(len(optimized_model.graph.initializer), 2)
+            new_W, new_b = [
+                numpy_helper.to_array(i).astype(np.float32)
+                for i in optimized_model.graph.initializer]
+
+            f = scale / np.sqrt(var + 1e-5)
+            rtol = 1e-3 if tensor_type == TensorProto.FLOAT16 else 1e-2
+            np.testing.assert_allclose(
+                -mean * f + b, new_b, rtol=rtol, atol=rtol)
+            np.testing.assert_allclose(
+                W * f[:, np.newaxis, np.newaxis, np.newaxis], new_W,
+                rtol=rtol, atol=rtol)
+
+    def test_fuse_cast_into_initializer(self):  # type: () -> None
+        a = (np.random.randn(3, 37) * 100).astype(np.float32)
+        types = [(TensorProto.FLOAT16, np.float16),
+                 (TensorProto.DOUBLE, np.float64),
+                 (TensorProto.INT32, np.int32),
+                 (TensorProto.BOOL, np.bool_)]
+        nodes = []
+        outputs = []
+        for to, _ in types:
+            name = TensorProto.DataType.Name(to)
+            nodes.append(helper.make_node("Cast", ["A"], [name], to=to))
+            nodes.append(helper.make_node(
+                "Identity", [name], [name + "_out"]))
+            outputs.append(helper.make_tensor_value_info(
+                name + "_out", to, (3, 37)))
+        # Only matches once the first Cast is folded
+        nodes.append(helper.make_node(
+            "Cast", ["A"], ["A_int"], to=TensorProto.INT64))
+        nodes.append(helper.make_node(
+            "Cast", ["A_int"], ["A_float"], to=TensorProto.FLOAT16))
+        nodes.append(helper.make_node("Identity", ["A_float"], ["A_out"]))
+        outputs.append(helper.make_tensor_value_info(
+            "A_out", TensorProto.FLOAT16, (3, 37)))
+        graph = helper.make_graph(
+            nodes, "test", [], outputs, [numpy_helper.from_array(a, "A")])
+        optimized_model = self._optimized(
+            graph, ["fuse_cast_into_initializer"], compare_result=False)
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node], ["Identity"] * 5)
+        values = {i.name: numpy_helper.to_array(i)
+                  for i in optimized_model.graph.initializer}
+        for node, (_, np_type) in zip(optimized_model.graph.node, types):
+            np.testing.assert_array_equal(
+                values[node.input[0]], a.astype(np_type))
+        np.testing.assert_array_equal(
+            values[optimized_model.graph.node[4].input[0]],
+            a.astype(np.int64).astype(np.float16))
+
+    def test_fuse_cast_into_initializer_batches(self):  # type: () -> None
+        # Enough casts and data to be folded in several parallel batches
+        nodes = []
+        outputs = []
+        initializers = []
+        arrays = []
+        for i in range(150):
+            name = "A{}".format(i)
+            arrays.append(np.random.randn(64, 64).astype(np.float32))
+            initializers.append(numpy_helper.from_array(arrays[-1], name))
+            nodes.append(helper.make_node(
+                "Cast", [name], [name + "_cast"], to=TensorProto.DOUBLE))
+            nodes.append(helper.make_node(
+                "Identity", [name + "_cast"], [name + "_out"]))
+            outputs.append(helper.make_tensor_value_info(
+                name + "_out", TensorProto.DOUBLE, (64, 64)))
+        graph = helper.make_graph(nodes, "test", [], outputs, initializers)
+        optimized_model = self._optimized(
+            graph, ["fuse_cast_into_initializer"], compare_result=False)
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["Identity"] * 150)
+        values = {i.name: numpy_helper.to_array(i)
+                  for i in optimized_model.graph.initializer}
+        for node, a in zip(optimized_model.graph.node, arrays):
+            np.testing.assert_array_equal(
+                values[node.input[0]], a.astype(np.float64))
+
+    def test_fuse_cast_into_initializer_out_of_range(self):  # type: () -> None
+        # The result of such casts is undefined, they are left to the runtime
+        nodes = []
+        outputs = []
+        initializers = []
+        for name, value, to in [("nan", np.nan, TensorProto.INT32),
+                                ("big", 300.0, TensorProto.INT8),
+                                ("neg", -1.0, TensorProto.UINT8)]:
+            initializers.append(numpy_helper.from_array(
+                np.array([1.0, value], dtype=np.float32), name))
+            nodes.append(helper.make_node(
+                "Cast", [name], [name + "_out"], to=to))
+            outputs.append(helper.make_tensor_value_info(
+                name + "_out", to, (2,)))
+        graph = helper.make_graph(nodes, "test", [], outputs, initializers)
+        optimized_model = self._optimized(
+            graph, ["fuse_cast_into_initializer"], compare_result=False)
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node], ["Cast"] * 3)
+
+    def test_fuse_bn_into_conv_many(self):  # type: () -> None
+        # Independent folds sharing the BatchNormalization parameters
+        nodes = []
+        outputs = []
+        initializers = []
+        for name, npa in [('scale', np.random.rand(3) + 1),
+                          ('b', np.random.randn(3)),
+                          ('mean', np.random.randn(3)),
+                          ('var', np.random.rand(3) + 1)]:
+            initializers.append(
+                numpy_helper.from_array(npa.astype(np.float32), name))
+        for i in range(4):
+            W = "W" + str(i)
+            initializers.append(numpy_helper.from_array(
+                np.random.randn(3, 2, 3, 3).astype(np.float32), W))
+            nodes.append(helper.make_node("Conv", ["X", W], ["Y" + str(i)]))
+            nodes.append(helper.make_node(
+                "BatchNormalization",
+                ["Y" + str(i), "scale", "b", "mean", "var"], ["Z" + str(i)]))
+            outputs.append(helper.make_tensor_value_info(
+                "Z" + str(i), TensorProto.FLOAT, (1, 3, 4, 4)))
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, (1, 2, 6, 6))],
+            outputs,
+            initializer=initializers,
+        )
+        optimized_model = self._optimized(graph, ["fuse_bn_into_conv"])
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node], ["Conv"] * 4)
+
+    def test_fuse_activation_into_conv(self):  # type: () -> None
+        activations = [
+            (helper.make_node("Relu", ["Y0"], ["Z0"]), []),
+            (helper.make_node("Clip", ["Y1", "min", "max"], ["Z1"]),
+             [-0.5, 0.5]),
+            (helper.make_node("LeakyRelu", ["Y2"], ["Z2"], alpha=0.1), [0.1]),
+            (helper.make_node("HardSigmoid", ["Y3"], ["Z3"]), [0.2, 0.5]),
+        ]
+        nodes = []
+        outputs = []
+        for i, (act, _) in enumerate(activations):
+            nodes.append(helper.make_node(
+                "Conv", ["X", "W", "B"], ["Y" + str(i)], pads=[1, 1, 1, 1]))
+            nodes.append(act)
+            outputs.append(helper.make_tensor_value_info(
+                "Z" + str(i), TensorProto.FLOAT, (1, 3, 5, 5)))
+        # Not fused, as the output of Conv has another use
+        nodes.append(helper.make_node("Conv", ["X", "W"], ["Y4"]))
+        nodes.append(helper.make_node("Relu", ["Y4"], ["Z4"]))
+        for name in ["Y4", "Z4"]:
+            outputs.append(helper.make_tensor_value_info(
+                name, TensorProto.FLOAT, (1, 3, 3, 3)))
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, (1, 2, 5, 5))],
+            outputs,
+            initializer=[
+                numpy_helper.from_array(
+                    np.random.randn(3, 2, 3, 3).astype(np.float32), "W"),
+                numpy_helper.from_array(
+                    np.random.randn(3).astype(np.float32), "B"),
+                numpy_helper.from_array(np.array(-0.5, np.float32), "min"),
+                numpy_helper.from_array(np.array(0.5, np.float32), "max")],
+        )
+        optimized_model = self._optimized(
+            graph, ["fuse_activation_into_conv"])
+
+        self.assertNotIn("fuse_activation_into_conv",
+                         onnxoptimizer.get_fuse_and_elimination_passes())
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["FusedConv"] * 4 + ["Conv", "Relu"])
+        self.assertIn(("com.microsoft", 1),
+                      [(o.domain, o.version)
+                       for o in optimized_model.opset_import])
+        for node, (act, params) in zip(optimized_model.graph.node,
+                                       activations):
+            attrs = {a.name: helper.get_attribute_value(a)
+                     for a in node.attribute}
+            self.assertEqual(node.domain, "com.microsoft")
+            self.assertEqual(list(node.input), ["X", "W", "B"])
+            self.assertEqual(list(node.output), list(act.output))
+            self.assertEqual(attrs["activation"], act.op_type.encode())
+            self.assertEqual(attrs["pads"], [1, 1, 1, 1])
+            np.testing.assert_allclose(
+                attrs.get("activation_params", []), params, rtol=1e-6)
+
+    def _make_attention_graph(self, mask_shape=(2, 1, 3, 3),
+                              scaled_mask=False):
+        # type: (Tuple[int, ...], bool) -> GraphProto
+        # 2 heads of size 4, as exported from a transformer
+        nodes = []
+        value_info = []
+        initializers = [
+            numpy_helper.from_array(np.array(2, np.float32), "sqrt_d"),
+            numpy_helper.from_array(np.array([0, 0, 2, 4], np.int64),
+                                    "heads_shape"),
+            numpy_helper.from_array(np.array([0, 0, 8], np.int64),
+                                    "hidden_shape")]
+        for name, perm in [("q", [0, 2, 1, 3]), ("k", [0, 2, 3, 1]),
+                           ("v", [0, 2, 1, 3])]:
+            initializers.append(numpy_helper.from_array(
+                np.random.randn(8, 8).astype(np.float32), "W" + name))
+            nodes.append(helper.make_node(
+                "MatMul", ["X", "W" + name], [name + "3"]))
+            nodes.append(helper.make_node(
+                "Reshape", [name + "3", "heads_shape"], [name + "4"]))
+            nodes.append(helper.make_node(
+                "Transpose", [name + "4"], [name.upper()], perm=perm))
+        add_inputs = ["T", "mask"]
+        if scaled_mask:
+            # As in BERT, the scaled mask comes first
+            initializers.append(numpy_helper.from_array(
+                np.array(-10000, np.float32), "mask_scale"))
+            nodes.insert(0, helper.make_node(
+                "Mul", ["mask", "mask_scale"], ["mask_s"]))
+            value_info.append(helper.make_tensor_value_info(
+                "mask_s", TensorProto.FLOAT, mask_shape))
+            add_inputs = ["mask_s", "T"]
+        nodes.extend([
+            helper.make_node("MatMul", ["Q", "K"], ["S"]),
+            helper.make_node("Div", ["S", "sqrt_d"], ["T"]),
+            helper.make_node("Add", add_inputs, ["U"]),
+            helper.make_node("Softmax", ["U"], ["P"], axis=-1),
+            helper.make_node("MatMul", ["P", "V"], ["O"]),
+            helper.make_node("Transpose", ["O"], ["O_t"], perm=[0, 2, 1, 3]),
+            helper.make_node("Reshape", ["O_t", "hidden_shape"], ["Y"])])
+        return helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 8)),
+             helper.make_tensor_value_info(
+                 "mask", TensorProto.FLOAT, mask_shape)],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 3, 8))],
+            initializer=initializers,
+            value_info=value_info + [helper.make_tensor_value_info(
+                name + "3", TensorProto.FLOAT, (2, 3, 8))
+                for name in ["q", "k", "v"]],
+        )
+
+    def test_fuse_attention(self):  # type: () -> None
+        optimized_model = self._optimized(
+            self._make_attention_graph(), ["fuse_attention"])
+
+        self.assertNotIn("fuse_attention",
+                         onnxoptimizer.get_fuse_and_elimination_passes())
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["MatMul"] * 3 + ["MultiHeadAttention"])
+        attention = optimized_model.graph.node[3]
+        self.assertEqual(attention.domain, "com.microsoft")
+        self.assertEqual(list(attention.input),
+                         ["q3", "k3", "v3", "", "", "mask"])
+        attrs = {a.name: helper.get_attribute_value(a)
+                 for a in attention.attribute}
+        self.assertEqual(attrs["num_heads"], 2)
+        self.assertAlmostEqual(attrs["scale"], 0.5)
+        self.assertIn(("com.microsoft", 1),
+                      [(o.domain, o.version)
+                       for o in optimized_model.opset_import])
+
+    def test_fuse_attention_padding_mask(self):  # type: () -> None
+        # A [batch, 1, 1, seq] mask is no attention_bias of MultiHeadAttention
+        graph = self._make_attention_graph(mask_shape=(2, 1, 1, 3))
+        optimized_model = self._optimized(graph, ["fuse_attention"])
+        self.assertEqual(optimized_model.graph, graph)
+
+    def test_fuse_attention_mask_first(self):  # type: () -> None
+        optimized_model = self._optimized(
+            self._make_attention_graph(scaled_mask=True), ["fuse_attention"])
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["Mul"] + ["MatMul"] * 3 + ["MultiHeadAttention"])
+        self.assertEqual(list(optimized_model.graph.node[4].input),
+                         ["q3", "k3", "v3", "", "", "mask_s"])
+
+    # type: () -> GraphProto
+    def _make_layer_norm_graph(self):
+        nodes = []
+        for i, affine in enumerate([True, False]):
+            x, y = "X" + str(i), "Y" + str(i)
+            nodes.extend([
+                helper.make_node("ReduceMean", [x], [x + "_mean"], axes=[-1]),
+                helper.make_node("Sub", [x, x + "_mean"], [x + "_d"])])
+            if affine:
+                nodes.append(helper.make_node(
+                    "Pow", [x + "_d", "two"], [x + "_sq"]))
+            else:
+                nodes.append(helper.make_node(
+                    "Mul", [x + "_d", x + "_d"], [x + "_sq"]))
+            nodes.extend([
+                helper.make_node("ReduceMean", [x + "_sq"], [x + "_var"],
+                                 axes=[2]),
+                helper.make_node("Add", ["eps", x + "_var"], [x + "_var_eps"]),
+                helper.make_node("Sqrt", [x + "_var_eps"], [x + "_std"]),
+                helper.make_node("Div", [x + "_d", x + "_std"],
+                                 [x + "_n" if affine else y])])
+            if affine:
+                nodes.extend([
+                    helper.make_node("Mul", ["gamma", x + "_n"], [x + "_s"]),
+                    helper.make_node("Add", [x + "_s", "beta"], [y])])
+        return helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(x, TensorProto.FLOAT, (2, 3, 8))
+             for x in ["X0", "X1"]],
+            [helper.make_tensor_value_info(y, TensorProto.FLOAT, (2, 3, 8))
+             for y in ["Y0", "Y1"]],
+            initializer=[
+                numpy_helper.from_array(np.array(2, np.float32), "two"),
+                numpy_helper.from_array(np.array(1e-5, np.float32), "eps"),
+                numpy_helper.from_array(
+                    np.random.randn(8).astype(np.float32), "gamma"),
+                numpy_helper.from_array(
+                    np.random.randn(8).astype(np.float32), "beta")],
+        )
+
+    def test_fuse_layer_norm(self):  # type: () -> None
+        graph = self._make_layer_norm_graph()
+        optimized_model = self._optimized(
+            graph, ["fuse_layer_norm", "eliminate_unused_initializer"],
+            opset_imports=[helper.make_opsetid("", 17)])
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["LayerNormalization"] * 2)
+        self.assertEqual([list(n.input) for n in optimized_model.graph.node],
+                         [["X0", "gamma", "beta"],
+                          ["X1", optimized_model.graph.node[1].input[1]]])
+        for node in optimized_model.graph.node:
+            attrs = {a.name: helper.get_attribute_value(a)
+                     for a in node.attribute}
+            self.assertEqual(attrs["axis"], -1)
+            self.assertAlmostEqual(attrs["epsilon"], 1e-5)
+        self.assertEqual(len(optimized_model.graph.initializer), 3)
+
+        # LayerNormalization is not available yet
+        optimized_model = self._optimized(graph, ["fuse_layer_norm"])
+        self.assertEqual(optimized_model.graph, graph)
+        # ONNX Runtime has it as a contrib operator, which ONNX doesn't know
+        optimized_model = self._optimized(
+            graph, ["fuse_layer_norm_with_contrib_ops"],
+            compare_result=False, check=False)
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["LayerNormalization"] * 2)
+
+    def test_fuse_layer_norm_residual(self):  # type: () -> None
+        # The Add of the residual is not part of the pattern
+        nodes = [
+            helper.make_node("ReduceMean", ["X"], ["M"], axes=[-1]),
+            helper.make_node("Sub", ["X", "M"], ["D"]),
+            helper.make_node("Mul", ["D", "D"], ["S"]),
+            helper.make_node("ReduceMean", ["S"], ["V"], axes=[-1]),
+            helper.make_node("Add", ["V", "eps"], ["V_eps"]),
+            helper.make_node("Sqrt", ["V_eps"], ["STD"]),
+            helper.make_node("Div", ["D", "STD"], ["N"]),
+            helper.make_node("Add", ["N", "R"], ["Y"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(x, TensorProto.FLOAT, (2, 3, 8))
+             for x in ["X", "R"]],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 3, 8))],
+            initializer=[
+                numpy_helper.from_array(np.array(1e-5, np.float32), "eps")])
+        optimized_model = self._optimized(
+            graph, ["fuse_layer_norm"],
+            opset_imports=[helper.make_opsetid("", 17)])
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["LayerNormalization", "Add"])
+        self.assertEqual(list(optimized_model.graph.node[1].input),
+                         [optimized_model.graph.node[0].output[0], "R"])
+
+    # type: () -> GraphProto
+    def _make_gelu_graph(self):
+        initializers = [
+            numpy_helper.from_array(np.array(value, np.float32), name)
+            for name, value in [("half", 0.5), ("one", 1), ("three", 3),
+                                ("sqrt2", np.sqrt(2)),
+                                ("sqrt2_pi", np.sqrt(2 / np.pi)),
+                                ("c", 0.044715)]]
+        nodes = [
+            # 0.5 * X0 * (1 + erf(X0 / sqrt(2)))
+            helper.make_node("Div", ["X0", "sqrt2"], ["X0_s"]),
+            helper.make_node("Erf", ["X0_s"], ["X0_e"]),
+            helper.make_node("Add", ["X0_e", "one"], ["X0_a"]),
+            helper.make_node("Mul", ["X0", "X0_a"], ["X0_m"]),
+            helper.make_node("Mul", ["X0_m", "half"], ["Y0"]),
+            # X1 * 0.5 * (1 + tanh(sqrt(2 / pi) * (X1 + 0.044715 X1^3)))
+            helper.make_node("Pow", ["X1", "three"], ["X1_cube"]),
+            helper.make_node("Mul", ["c", "X1_cube"], ["X1_c"]),
+            helper.make_node("Add", ["X1", "X1_c"], ["X1_i"]),
+            helper.make_node("Mul", ["X1_i", "sqrt2_pi"], ["X1_s"]),
+            helper.make_node("Tanh", ["X1_s"], ["X1_t"]),
+            helper.make_node("Add", ["one", "X1_t"], ["X1_a"]),
+            helper.make_node("Mul", ["X1", "half"], ["X1_h"]),
+            helper.make_node("Mul", ["X1_h", "X1_a"], ["Y1"]),
+        ]
+        return helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(x, TensorProto.FLOAT, (2, 8))
+             for x in ["X0", "X1"]],
+            [helper.make_tensor_value_info(y, TensorProto.FLOAT, (2, 8))
+             for y in ["Y0", "Y1"]],
+            initializer=initializers,
+        )
+
+    def test_fuse_gelu(self):  # type: () -> None
+        graph = self._make_gelu_graph()
+        optimized_model = self._optimized(
+            graph, ["fuse_gelu"], opset_imports=[helper.make_opsetid("", 20)])
+
+        self.assertEqual(
+            [(n.op_type, n.domain, list(n.input))
+             for n in optimized_model.graph.node],
+            [("Gelu", "", ["X0"]), ("Gelu", "", ["X1"])])
+        self.assertEqual(len(optimized_model.graph.node[0].attribute), 0)
+        self.assertEqual(
+            helper.get_attribute_value(
+                optimized_model.graph.node[1].attribute[0]), b"tanh")
+
+        # Gelu is not available yet
+        optimized_model = self._optimized(graph, ["fuse_gelu"])
+        self.assertEqual(optimized_model.graph, graph)
+        optimized_model = self._optimized(
+            graph, ["fuse_gelu_with_contrib_ops"])
+        self.assertEqual(
+            [(n.op_type, n.domain) for n in optimized_model.graph.node],
+            [("Gelu", "com.microsoft"), ("FastGelu", "com.microsoft")])
+
+    def test_fuse_gelu_in_subgraph(self):  # type: () -> None
+        constants = [
+            helper.make_node("Constant", [], [name], value=numpy_helper.from_array(
+                np.array(value, np.float32), name))
+            for name, value in [("sqrt2", np.sqrt(2)), ("one", 1), ("half", 0.5)]]
+        then_graph = helper.make_graph(
+            constants + [
+                helper.make_node("Div", ["X", "sqrt2"], ["X_s"]),
+                helper.make_node("Erf", ["X_s"], ["X_e"]),
+                helper.make_node("Add", ["X_e", "one"], ["X_a"]),
+                helper.make_node("Mul", ["X", "X_a"], ["X_m"]),
+                helper.make_node("Mul", ["X_m", "half"], ["Y_then"])],
+            "then_graph", [],
+            [helper.make_tensor_value_info("Y_then", TensorProto.FLOAT, (2, 8))])
+        else_graph = helper.make_graph(
+            [helper.make_node("Identity", ["X"], ["Y_else"])],
+            "else_graph", [],
+            [helper.make_tensor_value_info("Y_else", TensorProto.FLOAT, (2, 8))])
+        graph = helper.make_graph(
+            [helper.make_node("If", ["cond"], ["Y"], then_branch=then_graph,
+                              else_branch=else_graph)],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 8)),
+             helper.make_tensor_value_info("cond", TensorProto.BOOL, ())],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 8))])
+
+        # The body has no opset of its own, the one of the model applies
+        optimized_model = self._optimized(graph, ["fuse_gelu"])
+        self.assertEqual(optimized_model.graph, graph)
+
+        optimized_model = self._optimized(
+            graph, ["fuse_gelu"], opset_imports=[helper.make_opsetid("", 20)])
+        body = [a.g for a in optimized_model.graph.node[0].attribute
+                if a.name == "then_branch"][0]
+        self.assertIn("Gelu", [n.op_type for n in body.node])
+
+    def test_fuse_layer_norm_and_gelu_fixed_point(self):  # type: () -> None
+        # fold_constants folds the Casts first, which queues the Pow nodes
+        # the fusions then leave dead
+        graphs = [
+            (self._make_layer_norm_graph(), "two", 2, 17, "LayerNormalization"),
+            (self._make_gelu_graph(), "three", 3, 20, "Gelu")]
+        for graph, exponent, value, opset_version, op_type in graphs:
+            for i, initializer in enumerate(graph.initializer):
+                if initializer.name == exponent:
+                    graph.initializer[i].CopyFrom(numpy_helper.from_array(
+                        np.array(value, np.int64), exponent + "_i"))
+            graph.node.insert(0, helper.make_node(
+                "Cast", [exponent + "_i"], [exponent], to=TensorProto.FLOAT))
+            optimized_model = self._optimized(
+                graph, ["fold_constants", "fuse_layer_norm", "fuse_gelu",
+                        "eliminate_deadend"],
+                True, opset_imports=[helper.make_opsetid("", opset_version)])
+            self.assertEqual(
+                [n.op_type for n in optimized_model.graph.node], [op_type] * 2)
+
+    @unittest.skipIf(onnx.defs.onnx_opset_version() < 23,
+                     "Attention is part of the standard since opset 23")
+    def test_fuse_attention_standard_ops(self):  # type: () -> None
+        graph = self._make_attention_graph()
+        # Attention is not available yet
+        optimized_model = self._optimized(
+            graph, ["fuse_attention_standard_ops"])
+        self.assertEqual(optimized_model.graph, graph)
+
+        optimized_model = self._optimized(
+            graph, ["fuse_attention_standard_ops"],
+            opset_imports=[helper.make_opsetid("", 23)])
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["MatMul", "Reshape", "Transpose", "MatMul", "Reshape",
+             "MatMul", "Reshape", "Transpose", "Transpose", "Attention",
+             "Transpose", "Reshape"])
+        # K is transposed from k4 at once
+        k_transpose, attention = optimized_model.graph.node[8:10]
+        self.assertEqual(list(k_transpose.input), ["k4"])
+        self.assertEqual(list(attention.input),
+                         ["Q", k_transpose.output[0], "V", "mask"])
+        self.assertEqual(
+            helper.get_attribute_value(attention.attribute[0]), 0.5)
+
+    def test_push_down_transposes(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Transpose", ["X"], ["X_t"], perm=[0, 3, 1, 2]),
+            helper.make_node("Add", ["X_t", "B"], ["A"]),
+            helper.make_node("Relu", ["A"], ["R"]),
+            helper.make_node("Pad", ["R", "pads"], ["P"]),
+            helper.make_node("Transpose", ["Y"], ["Y_t"], perm=[0, 3, 1, 2]),
+            helper.make_node("Concat", ["P", "Y_t"], ["C"], axis=1),
+            helper.make_node("Mul", ["C", "s"], ["M"]),
+            helper.make_node("Transpose", ["M"], ["Z"], perm=[0, 2, 3, 1]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (1, 4, 5, 3)),
+             helper.make_tensor_value_info("Y", TensorProto.FLOAT, (1, 6, 7, 2))],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT, (1, 6, 7, 5))],
+            initializer=[
+                numpy_helper.from_array(
+                    np.random.randn(3, 1, 1).astype(np.float32), "B"),
+                numpy_helper.from_array(
+                    np.array([0, 0, 1, 1, 0, 0, 1, 1], np.int64), "pads"),
+                numpy_helper.from_array(np.array(2, np.float32), "s")],
+        )
+        optimized_model = self._optimized(
+            graph, ["push_down_transposes", "eliminate_unused_initializer"])
+
+        self.assertEqual([n.op_type for n in optimized_model.graph.node],
+                         ["Add", "Relu", "Pad", "Concat", "Mul"])
+        add, _, pad, concat, _ = optimized_model.graph.node
+        self.assertEqual(add.input[0], "X")
+        self.assertEqual(concat.input[1], "Y")
+        self.assertEqual(concat.attribute[0].i, 3)
+        initializers = {init.name: numpy_helper.to_array(init)
+                        for init in optimized_model.graph.initializer}
+        self.assertEqual(initializers[add.input[1]].shape, (1, 1, 1, 3))
+        self.assertEqual(list(initializers[pad.input[1]]),
+                         [0, 1, 1, 0, 0, 1, 1, 0])
+
+    def test_push_down_transposes_reduce(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Transpose", ["X"], ["X_t"], perm=[2, 0, 1]),
+            helper.make_node("ReduceMax", ["X_t"], ["Y"], axes=[1],
+                             keepdims=0),
+            # Pushing the Transpose below Sub would need another one for W
+            helper.make_node("Transpose", ["X"], ["X_t2"], perm=[2, 0, 1]),
+            helper.make_node("Sub", ["X_t2", "W"], ["Z"]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 4)),
+             helper.make_tensor_value_info("W", TensorProto.FLOAT, (4, 2, 3))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (4, 3)),
+             helper.make_tensor_value_info("Z", TensorProto.FLOAT, (4, 2, 3))],
+        )
+        optimized_model = self._optimized(graph, ["push_down_transposes"])
+
+        self.assertEqual([n.op_type for n in optimized_model.graph.node],
+                         ["ReduceMax", "Transpose", "Transpose", "Sub"])
+        reduce, transpose = optimized_model.graph.node[:2]
+        self.assertEqual(list(reduce.input), ["X"])
+        self.assertEqual(list(reduce.attribute[0].ints), [0])
+        self.assertEqual(list(transpose.attribute[0].ints), [1, 0])
+        self.assertEqual(list(transpose.output), ["Y"])
+        self.assertEqual(optimized_model.graph.node[2:], graph.node[2:])
+
+    def test_push_down_transposes_initializer_index(self):  # type: () -> None
+        # Every rewrite adds a transposed initializer at the end and erases
+        # the one it replaces from the front, so the initializers looked up
+        # next have moved in between.
+        kinds = ["Add", "Mul", "Sub", "Div", "Max"]
+        nodes = [helper.make_node("Transpose", ["X"], ["T0"],
+                                  perm=[0, 3, 1, 2])]
+        initializers = []
+        for i, kind in enumerate(kinds):
+            name = "C" + str(i)
+            nodes.append(helper.make_node(
+                kind, ["T" + str(i), name], ["T" + str(i + 1)]))
+            initializers.append(numpy_helper.from_array(
+                np.random.rand(3, 1, 4).astype(np.float32) + 1, name))
+        nodes.append(helper.make_node(
+            "Transpose", ["T" + str(len(kinds))], ["Y"], perm=[0, 2, 3, 1]))
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT, (2, 5, 4, 3))],
+            [helper.make_tensor_value_info(
+                "Y", TensorProto.FLOAT, (2, 5, 4, 3))],
+            initializer=initializers,
+        )
+        optimized_model = self._optimized(graph, ["push_down_transposes"])
+
+        self.assertEqual([n.op_type for n in optimized_model.graph.node],
+                         kinds)
+        values = {init.name: numpy_helper.to_array(init)
+                  for init in optimized_model.graph.initializer}
+        self.assertEqual(len(values), len(kinds))
+        for node, init in zip(optimized_model.graph.node, initializers):
+            np.testing.assert_array_equal(
+                values[node.input[1]],
+                numpy_helper.to_array(init).transpose(1, 2, 0)[None])
+
+    def test_convert_to_nhwc(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Conv", ["X", "W1", "B1"], ["C1"],
+                             pads=[1, 1, 1, 1]),
+            helper.make_node("BatchNormalization",
+                             ["C1", "scale", "bias", "mean", "var"], ["N"]),
+            helper.make_node("Relu", ["N"], ["R"]),
+            helper.make_node("Resize", ["R", "", "scales"], ["U"]),
+            helper.make_node("Conv", ["U", "W2"], ["C2"]),
+            helper.make_node("GlobalAveragePool", ["C2"], ["Y"]),
+        ]
+        initializers = [
+            ("W1", (4, 3, 3, 3)), ("B1", (4,)), ("scale", (4,)), ("bias", (4,)),
+            ("mean", (4,)), ("W2", (5, 4, 1, 1))]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (1, 3, 8, 8))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (1, 5, 1, 1))],
+            initializer=[
+                numpy_helper.from_array(
+                    np.random.randn(*shape).astype(np.float32), name)
+                for name, shape in initializers] + [
+                numpy_helper.from_array(
+                    np.random.rand(4).astype(np.float32) + 0.5, "var"),
+                numpy_helper.from_array(
+                    np.array([1, 1, 2, 2], np.float32), "scales")],
+        )
+        # The pass needs the ranks and types of the intermediate values
+        model = shape_inference.infer_shapes(helper.make_model(
+            graph, opset_imports=[helper.make_opsetid("", 13)]))
+        # ONNX Runtime only has NhwcConv for GPUs
+        optimized_model = self._optimized(
+            model, ["convert_to_nhwc", "eliminate_unused_initializer"],
+            compare_result=False)
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["Transpose", "NhwcConv", "Mul", "Add", "Relu", "Resize",
+             "NhwcConv", "ReduceMean", "Transpose"])
+        self.assertIn("com.microsoft",
+                      [o.domain for o in optimized_model.opset_import])
+        initializers = {init.name: numpy_helper.to_array(init)
+                        for init in optimized_model.graph.initializer}
+        nodes = optimized_model.graph.node
+        self.assertEqual(list(nodes[1].input),
+                         [nodes[0].output[0], "W1", "B1"])
+        self.assertEqual(initializers[nodes[2].input[1]].shape, (1, 1, 1, 4))
+        self.assertEqual(list(initializers[nodes[5].input[2]]), [1, 2, 2, 1])
+        self.assertEqual(list(nodes[7].attribute[0].ints), [1, 2])
+
+        # NhwcConv computes what Conv computes between Transposes
+        for i in reversed(range(len(nodes))):
+            node = nodes[i]
+            if node.op_type != "NhwcConv":
+                continue
+            conv_nodes = [
+                helper.make_node("Transpose", [node.input[0]],
+                                 [node.output[0] + "_nchw"], perm=[0, 3, 1, 2]),
+                helper.make_node("Conv",
+                                 [node.output[0] + "_nchw"] + list(node.input[1:]),
+                                 [node.output[0] + "_conv"]),
+                helper.make_node("Transpose", [node.output[0] + "_conv"],
+                                 [node.output[0]], perm=[0, 2, 3, 1])]
+            conv_nodes[1].attribute.extend(node.attribute)
+            del nodes[i]
+            for conv_node in reversed(conv_nodes):
+                nodes.insert(i, conv_node)
+        assert self._compare(optimized_model, model)
+
+    def test_convert_to_nhwc_mixed_precision(self):  # type: () -> None
+        # Since opset 15 the parameters may be float while X is float16
+        nodes = [
+            helper.make_node("Conv", ["X", "W"], ["C"]),
+            helper.make_node("BatchNormalization",
+                             ["C", "scale", "bias", "mean", "var"], ["Y"]),
+        ]
+        params = {name: np.random.rand(4).astype(np.float32) + 0.5
+                  for name in ["scale", "bias", "mean", "var"]}
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info(
+                "X", TensorProto.FLOAT16, (1, 3, 8, 8))],
+            [helper.make_tensor_value_info(
+                "Y", TensorProto.FLOAT16, (1, 4, 8, 8))],
+            initializer=[numpy_helper.from_array(
+                np.random.randn(4, 3, 1, 1).astype(np.float16), "W")] + [
+                numpy_helper.from_array(value, name)
+                for name, value in params.items()],
+        )
+        model = shape_inference.infer_shapes(helper.make_model(
+            graph, opset_imports=[helper.make_opsetid("", 15)]))
+        optimized_model = self._optimized(
+            model, ["convert_to_nhwc", "eliminate_unused_initializer"],
+            compare_result=False)
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["Transpose", "NhwcConv", "Mul", "Add", "Transpose"])
+        initializers = {init.name: numpy_helper.to_array(init)
+                        for init in optimized_model.graph.initializer}
+        nodes = optimized_model.graph.node
+        factor = initializers[nodes[2].input[1]]
+        offset = initializers[nodes[3].input[1]]
+        self.assertEqual(factor.dtype, np.float16)
+        self.assertEqual(offset.dtype, np.float16)
+        f = params["scale"] / np.sqrt(params["var"] + 1e-5)
+        np.testing.assert_allclose(
+            factor.reshape(4), f, rtol=1e-3, atol=1e-3)
+        np.testing.assert_allclose(
+            offset.reshape(4), params["bias"] - params["mean"] * f,
+            rtol=1e-3, atol=1e-3)
+
+    def test_convert_to_nhwc_outside_region(self):  # type: () -> None
+        # Lowering them away from any converted operator gains nothing
+        nodes = [
+            helper.make_node("Conv", ["X", "W"], ["C"]),
+            helper.make_node("BatchNormalization",
+                             ["Z", "scale", "bias", "mean", "var"], ["N"]),
+            helper.make_node("GlobalAveragePool", ["N"], ["P"]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (1, 3, 8, 8)),
+             helper.make_tensor_value_info("Z", TensorProto.FLOAT, (1, 4, 8, 8))],
+            [helper.make_tensor_value_info("C", TensorProto.FLOAT, (1, 4, 8, 8)),
+             helper.make_tensor_value_info("P", TensorProto.FLOAT, (1, 4, 1, 1))],
+            initializer=[numpy_helper.from_array(
+                np.random.randn(4, 3, 1, 1).astype(np.float32), "W")] + [
+                numpy_helper.from_array(
+                    np.random.rand(4).astype(np.float32) + 0.5, name)
+                for name in ["scale", "bias", "mean", "var"]],
+        )
+        model = shape_inference.infer_shapes(helper.make_model(
+            graph, opset_imports=[helper.make_opsetid("", 13)]))
+        optimized_model = self._optimized(
+            model, ["convert_to_nhwc"], compare_result=False)
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["Transpose", "NhwcConv", "Transpose", "BatchNormalization",
+             "GlobalAveragePool"])
+
+    def test_convert_to_nhwc_max_pool(self):  # type: () -> None
+        nodes = [
+            helper.make_node("MaxPool", ["X"], ["P1"], kernel_shape=[2, 2],
+                             strides=[2, 2]),
+            helper.make_node("Resize", ["P1", "", "scales"], ["U"]),
+            helper.make_node("MaxPool", ["U"], ["Y"], kernel_shape=[3, 3]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.UINT8, (1, 3, 8, 8))],
+            [helper.make_tensor_value_info("Y", TensorProto.UINT8, (1, 3, 6, 6))],
+            initializer=[numpy_helper.from_array(
+                np.array([1, 1, 2, 2], np.float32), "scales")],
+        )
+        model = shape_inference.infer_shapes(helper.make_model(
+            graph, opset_imports=[helper.make_opsetid("", 13)]))
+        optimized_model = self._optimized(model, ["convert_to_nhwc"])
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node],
+            ["Transpose", "NhwcMaxPool", "Resize", "NhwcMaxPool", "Transpose"])
+
+    def test_convert_to_nhwc_in_subgraph(self):  # type: () -> None
+        # The body has no opset of its own, ReduceMean takes its axes as an
+        # attribute in the opset 13 of the model
+        def make_branch(prefix):  # type: (Text) -> GraphProto
+            return helper.make_graph(
+                [helper.make_node("Conv", ["X", "W"], [prefix + "C"]),
+                 helper.make_node("GlobalAveragePool", [prefix + "C"],
+                                  [prefix + "Y"])],
+                prefix + "graph", [],
+                [helper.make_tensor_value_info(
+                    prefix + "Y", TensorProto.FLOAT, (1, 4, 1, 1))])
+        graph = helper.make_graph(
+            [helper.make_node("If", ["cond"], ["Y"],
+                              then_branch=make_branch("then_"),
+                              else_branch=make_branch("else_"))],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (1, 3, 8, 8)),
+             helper.make_tensor_value_info("cond", TensorProto.BOOL, ())],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (1, 4, 1, 1))],
+            initializer=[numpy_helper.from_array(
+                np.random.randn(4, 3, 1, 1).astype(np.float32), "W")])
+        model = shape_inference.infer_shapes(helper.make_model(
+            graph, opset_imports=[helper.make_opsetid("", 13)]))
+        optimized_model = self._optimized(
+            model, ["convert_to_nhwc"], compare_result=False)
+
+        for attr in optimized_model.graph.node[0].attribute:
+            reduces = [n for n in attr.g.node if n.op_type == "ReduceMean"]
+            self.assertEqual(len(reduces), 1)
+            self.assertEqual(len(reduces[0].input), 1)
+            self.assertIn("axes", [a.name for a in reduces[0].attribute])
+
+    def test_convert_to_nhwc_double_conv(self):  # type: () -> None
+        # ONNX Runtime has no NhwcConv for double
+        graph = helper.make_graph(
+            [helper.make_node("Conv", ["X", "W"], ["Y"])],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.DOUBLE, (1, 3, 8, 8))],
+            [helper.make_tensor_value_info("Y", TensorProto.DOUBLE, (1, 4, 8, 8))],
+            initializer=[numpy_helper.from_array(
+                np.random.randn(4, 3, 1, 1), "W")])
+        model = helper.make_model(
+            graph, opset_imports=[helper.make_opsetid("", 13)])
+        optimized_model = self._optimized(
+            model, ["convert_to_nhwc"], compare_result=False)
+
+        self.assertEqual(
+            [n.op_type for n in optimized_model.graph.node], ["Conv"])
+
     def _internal_test_deadend_elimination(self, fixed):  # type: (bool) -> None
         softmax = helper.make_node("Softmax", ["X"], ["Y"], axis=2)
         log = helper.make_node("Log", ["Y"], ["Z"])
@@ -2320,6 +4302,67 @@ class TestOptimizer(unittest.TestCase):
                                 x.dim_value for x in optimized_model.graph.output[0].type.tensor_type.shape.dim)
                             assert optimized_output_shape == output_shape
 
+    def test_fold_constants_shape_computation(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Shape", ["X"], ["S"]),
+            helper.make_node("Constant", [], ["I"], value=helper.make_tensor(
+                "I", TensorProto.INT64, dims=(), vals=[0])),
+            helper.make_node("Gather", ["S", "I"], ["N"]),
+            helper.make_node("Constant", [], ["Axes"], value=helper.make_tensor(
+                "Axes", TensorProto.INT64, dims=(1,), vals=[0])),
+            helper.make_node("Unsqueeze", ["N", "Axes"], ["N_1"]),
+            helper.make_node("Concat", ["N_1", "Minus_1"], ["Shape"], axis=0),
+            helper.make_node("Reshape", ["X", "Shape"], ["Y"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 4))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 12))],
+            [helper.make_tensor("Minus_1", TensorProto.INT64, dims=(1,),
+                                vals=[-1])])
+        optimized_model = self._optimized(
+            graph, ["fold_constants", "eliminate_deadend",
+                    "eliminate_unused_initializer"], True)
+        assert len(optimized_model.graph.node) == 1
+        assert optimized_model.graph.node[0].op_type == "Reshape"
+        shape = [i for i in optimized_model.graph.initializer
+                 if i.name == optimized_model.graph.node[0].input[1]]
+        assert len(shape) == 1
+        assert list(numpy_helper.to_array(shape[0])) == [2, -1]
+
+    def test_fold_constants_elementwise(self):  # type: () -> None
+        a = np.random.rand(3, 4).astype(np.float32)
+        b = np.random.rand(4).astype(np.float32)
+        nodes = [
+            helper.make_node("Add", ["A", "B"], ["C"]),
+            helper.make_node("Cast", ["C"], ["D"], to=TensorProto.FLOAT16),
+            helper.make_node("Cast", ["D"], ["E"], to=TensorProto.FLOAT),
+            helper.make_node("Mul", ["X", "E"], ["Y"]),
+            # Integer division by zero is undefined and must not be folded
+            helper.make_node("Div", ["P", "Q"], ["R"]),
+            helper.make_node("Add", ["Z", "R"], ["W"])]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (3, 4)),
+             helper.make_tensor_value_info("Z", TensorProto.INT32, (2,))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (3, 4)),
+             helper.make_tensor_value_info("W", TensorProto.INT32, (2,))],
+            [numpy_helper.from_array(a, "A"),
+             numpy_helper.from_array(b, "B"),
+             numpy_helper.from_array(np.array([7, 8], dtype=np.int32), "P"),
+             numpy_helper.from_array(np.array([2, 0], dtype=np.int32), "Q")])
+        optimized_model = self._optimized(
+            graph, ["fold_constants"], True, compare_result=False)
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Mul", "Div", "Add"]
+        folded = [i for i in optimized_model.graph.initializer
+                  if i.name == optimized_model.graph.node[0].input[1]]
+        assert len(folded) == 1
+        np.testing.assert_array_equal(
+            numpy_helper.to_array(folded[0]),
+            (a + b).astype(np.float16).astype(np.float32))
+
     def test_split_predict_and_lift_lexical_references_for_caffe2_backend(self):
         model_str = b'\x08\x06\x12\x07pytorch\x1a\x031.9:\xe5\x02\n\'\x12\x011"\x08Constant*\x18\n\x05value*\x0c\x10\x07J\x08\x05\x00\x00\x00\x00\x00\x00\x00\xa0\x01\x04\n \x12\x012"\x08Constant*\x11\n\x05value*\x05\x10\tJ\x01\x01\xa0\x01\x04\n\xd1\x01\n\x011\n\x012\n\x03x.1\x12\x013"\x04Loop*\xba\x01\n\x04body2\xae\x01\n\x1a\n\x04x.11\n\x03i.1\x12\x017\x1a\x05Add_0"\x03Add\n\x1c\n\x012\x12\x018\x1a\nIdentity_1"\x08Identity\x12\x11torch-jit-export1Z\r\n\x03i.1\x12\x06\n\x04\x08\x07\x12\x00Z\x0e\n\x04cond\x12\x06\n\x04\x08\t\x12\x00Z\x1a\n\x04x.11\x12\x12\n\x10\x08\x07\x12\x0c\n\x02\x08\x01\n\x02\x08\x02\n\x02\x08\x03b\x0b\n\x018\x12\x06\n\x04\x08\t\x12\x00b\x17\n\x017\x12\x12\n\x10\x08\x07\x12\x0c\n\x02\x08\x01\n\x02\x08\x02\n\x02\x08\x03\xa0\x01\x05\x12\x10torch-jit-exportZ\x19\n\x03x.1\x12\x12\n\x10\x08\x07\x12\x0c\n\x02\x08\x01\n\x02\x08\x02\n\x02\x08\x03b\x17\n\x013\x12\x12\n\x10\x08\x07\x12\x0c\n\x02\x08\x01\n\x02\x08\x02\n\x02\x08\x03B\x02\x10\t'
         model = onnx.load_from_string(model_str)
@@ -0,0 +1,664 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "onnxoptimizer/vector_math.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "onnxoptimizer/tensor_util.h"
+
+// The vectorized loops are compiled for their instruction set with target
+// attributes, so the rest of the library keeps the baseline flags.
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define ONNX_OPTIMIZER_X86_DISPATCH 1
+#include <immintrin.h>
+#define ONNX_OPTIMIZER_AVX2 __attribute__((target("avx2,f16c")))
+#define ONNX_OPTIMIZER_AVX512 __attribute__((target("avx512f")))
+#endif
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+enum class VectorLevel { Scalar, Avx2, Avx512 };
+
+VectorLevel vectorLevel() {
+#ifdef ONNX_OPTIMIZER_X86_DISPATCH
+  static const VectorLevel level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return VectorLevel::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+      return VectorLevel::Avx2;
+    }
+    return VectorLevel::Scalar;
+  }();
+  return level;
+#else
+  return VectorLevel::Scalar;
+#endif
+}
+
+// Storage of the element types without a C++ counterpart.
+struct Half {
+  uint16_t bits;
+};
+struct BFloat16 {
+  uint16_t bits;
+};
+struct Bool {
+  uint8_t value;
+};
+
+// Converts elements to a type static_cast can convert from.
+template <typename T>
+T widen(T value) {
+  return value;
+}
+float widen(Half value) {
+  return HalfToFloat(value.bits);
+}
+float widen(BFloat16 value) {
+  return BFloat16ToFloat(value.bits);
+}
+uint8_t widen(Bool value) {
+  return value.value;
+}
+
+// Whether a value converted by widen can be cast to T: floating point
+// values cast to an integer type have to be in its range once truncated,
+// which NaN never is, as the cast is undefined otherwise.
+template <typename T, typename V>
+typename std::enable_if<
+    std::is_integral<T>::value && std::is_floating_point<V>::value,
+    bool>::type
+castable(V value) {
+  const V truncated = std::trunc(value);
+  return truncated >= static_cast<V>(std::numeric_limits<T>::min()) &&
+         truncated <
+             std::ldexp(static_cast<V>(1), std::numeric_limits<T>::digits);
+}
+template <typename T, typename V>
+typename std::enable_if<
+    !(std::is_integral<T>::value && std::is_floating_point<V>::value),
+    bool>::type
+castable(V) {
+  return true;
+}
+
+// Converts the result of widen to an element, false if it can't be.
+template <typename T>
+struct Narrow {
+  template <typename V>
+  static bool from(V value, T* result) {
+    if (!castable<T>(value)) {
+      return false;
+    }
+    *result = static_cast<T>(value);
+    return true;
+  }
+};
+template <>
+struct Narrow<Half> {
+  template <typename V>
+  static bool from(V value, Half* result) {
+    *result = Half{FloatToHalf(static_cast<float>(value))};
+    return true;
+  }
+};
+template <>
+struct Narrow<BFloat16> {
+  template <typename V>
+  static bool from(V value, BFloat16* result) {
+    *result = BFloat16{FloatToBFloat16(static_cast<float>(value))};
+    return true;
+  }
+};
+template <>
+struct Narrow<Bool> {
+  template <typename V>
+  static bool from(V value, Bool* result) {
+    *result = Bool{static_cast<uint8_t>(value != 0)};
+    return true;
+  }
+};
+
+template <typename From, typename To>
+bool convertScalar(const char* src, char* dst, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    From value;
+    std::memcpy(&value, src + i * sizeof(From), sizeof(From));
+    To result;
+    if (!Narrow<To>::from(widen(value), &result)) {
+      return false;
+    }
+    std::memcpy(dst + i * sizeof(To), &result, sizeof(To));
+  }
+  return true;
+}
+
+template <typename From>
+bool convertFrom(
+    const char* src,
+    int32_t to_type,
+    char* dst,
+    size_t begin,
+    size_t end) {
+  switch (to_type) {
+    case TensorProto_DataType_FLOAT:
+      return convertScalar<From, float>(src, dst, begin, end);
+    case TensorProto_DataType_DOUBLE:
+      return convertScalar<From, double>(src, dst, begin, end);
+    case TensorProto_DataType_FLOAT16:
+      return convertScalar<From, Half>(src, dst, begin, end);
+    case TensorProto_DataType_BFLOAT16:
+      return convertScalar<From, BFloat16>(src, dst, begin, end);
+    case TensorProto_DataType_BOOL:
+      return convertScalar<From, Bool>(src, dst, begin, end);
+    case TensorProto_DataType_INT8:
+      return convertScalar<From, int8_t>(src, dst, begin, end);
+    case TensorProto_DataType_INT16:
+      return convertScalar<From, int16_t>(src, dst, begin, end);
+    case TensorProto_DataType_INT32:
+      return convertScalar<From, int32_t>(src, dst, begin, end);
+    case TensorProto_DataType_INT64:
+      return convertScalar<From, int64_t>(src, dst, begin, end);
+    case TensorProto_DataType_UINT8:
+      return convertScalar<From, uint8_t>(src, dst, begin, end);
+    case TensorProto_DataType_UINT16:
+      return convertScalar<From, uint16_t>(src, dst, begin, end);
+    case TensorProto_DataType_UINT32:
+      return convertScalar<From, uint32_t>(src, dst, begin, end);
+    case TensorProto_DataType_UINT64:
+      return convertScalar<From, uint64_t>(src, dst, begin, end);
+    default:
+      return false;
+  }
+}
+
+// Converts the elements from begin to end.
+bool convertRange(
+    int32_t from_type,
+    const char* src,
+    int32_t to_type,
+    char* dst,
+    size_t begin,
+    size_t end) {
+  switch (from_type) {
+    case TensorProto_DataType_FLOAT:
+      return convertFrom<float>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_DOUBLE:
+      return convertFrom<double>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_FLOAT16:
+      return convertFrom<Half>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_BFLOAT16:
+      return convertFrom<BFloat16>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_BOOL:
+      return convertFrom<Bool>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_INT8:
+      return convertFrom<int8_t>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_INT16:
+      return convertFrom<int16_t>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_INT32:
+      return convertFrom<int32_t>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_INT64:
+      return convertFrom<int64_t>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_UINT8:
+      return convertFrom<uint8_t>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_UINT16:
+      return convertFrom<uint16_t>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_UINT32:
+      return convertFrom<uint32_t>(src, to_type, dst, begin, end);
+    case TensorProto_DataType_UINT64:
+      return convertFrom<uint64_t>(src, to_type, dst, begin, end);
+    default:
+      return false;
+  }
+}
+
+template <typename T>
+void batchNormScaleScalar(
+    const T* scale,
+    const T* var,
+    T epsilon,
+    size_t begin,
+    size_t count,
+    T* out) {
+  for (size_t i = begin; i < count; ++i) {
+    out[i] = scale[i] / std::sqrt(var[i] + epsilon);
+  }
+}
+
+template <typename T>
+void scaleScalar(const T* in, T factor, size_t begin, size_t count, T* out) {
+  for (size_t i = begin; i < count; ++i) {
+    out[i] = in[i] * factor;
+  }
+}
+
+#ifdef ONNX_OPTIMIZER_X86_DISPATCH
+
+// Each vectorized loop handles the largest multiple of its width and
+// returns where the scalar loop has to take over.
+
+// The AVX-512 intrinsics without a mask pass an undefined vector through,
+// which GCC warns may be used uninitialized, so the zero-masked ones are
+// used with every lane set instead. Both compile to the same instruction.
+const __mmask16 kAll16 = 0xffff;
+const __mmask8 kAll8 = 0xff;
+
+ONNX_OPTIMIZER_AVX2 size_t
+batchNormScaleAvx2(const float* scale, const float* var, float epsilon,
+                   size_t count, float* out) {
+  const __m256 eps = _mm256_set1_ps(epsilon);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 std_dev =
+        _mm256_sqrt_ps(_mm256_add_ps(_mm256_loadu_ps(var + i), eps));
+    _mm256_storeu_ps(out + i,
+                     _mm256_div_ps(_mm256_loadu_ps(scale + i), std_dev));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+batchNormScaleAvx2(const double* scale, const double* var, double epsilon,
+                   size_t count, double* out) {
+  const __m256d eps = _mm256_set1_pd(epsilon);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m256d std_dev =
+        _mm256_sqrt_pd(_mm256_add_pd(_mm256_loadu_pd(var + i), eps));
+    _mm256_storeu_pd(out + i,
+                     _mm256_div_pd(_mm256_loadu_pd(scale + i), std_dev));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX512 size_t
+batchNormScaleAvx512(const float* scale, const float* var, float epsilon,
+                     size_t count, float* out) {
+  const __m512 eps = _mm512_set1_ps(epsilon);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512 std_dev = _mm512_maskz_sqrt_ps(
+        kAll16, _mm512_add_ps(_mm512_loadu_ps(var + i), eps));
+    _mm512_storeu_ps(out + i,
+                     _mm512_div_ps(_mm512_loadu_ps(scale + i), std_dev));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX512 size_t
+batchNormScaleAvx512(const double* scale, const double* var, double epsilon,
+                     size_t count, double* out) {
+  const __m512d eps = _mm512_set1_pd(epsilon);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m512d std_dev = _mm512_maskz_sqrt_pd(
+        kAll8, _mm512_add_pd(_mm512_loadu_pd(var + i), eps));
+    _mm512_storeu_pd(out + i,
+                     _mm512_div_pd(_mm512_loadu_pd(scale + i), std_dev));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+scaleAvx2(const float* in, float factor, size_t count, float* out) {
+  const __m256 f = _mm256_set1_ps(factor);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), f));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+scaleAvx2(const double* in, double factor, size_t count, double* out) {
+  const __m256d f = _mm256_set1_pd(factor);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(in + i), f));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX512 size_t
+scaleAvx512(const float* in, float factor, size_t count, float* out) {
+  const __m512 f = _mm512_set1_ps(factor);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(in + i), f));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX512 size_t
+scaleAvx512(const double* in, double factor, size_t count, double* out) {
+  const __m512d f = _mm512_set1_pd(factor);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm512_storeu_pd(out + i, _mm512_mul_pd(_mm512_loadu_pd(in + i), f));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+floatToHalfAvx2(const char* src, char* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 values =
+        _mm256_loadu_ps(reinterpret_cast<const float*>(src) + i);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2),
+                     _mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+halfToFloatAvx2(const char* src, char* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128i halves =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+    _mm256_storeu_ps(reinterpret_cast<float*>(dst) + i,
+                     _mm256_cvtph_ps(halves));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX512 size_t
+floatToHalfAvx512(const char* src, char* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512 values =
+        _mm512_loadu_ps(reinterpret_cast<const float*>(src) + i);
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dst + i * 2),
+        _mm512_maskz_cvtps_ph(kAll16, values, _MM_FROUND_TO_NEAREST_INT));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX512 size_t
+halfToFloatAvx512(const char* src, char* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m256i halves =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2));
+    _mm512_storeu_ps(reinterpret_cast<float*>(dst) + i,
+                     _mm512_maskz_cvtph_ps(kAll16, halves));
+  }
+  return i;
+}
+
+// Same rounding and NaN handling as FloatToBFloat16.
+ONNX_OPTIMIZER_AVX2 size_t
+floatToBFloat16Avx2(const char* src, char* dst, size_t count) {
+  const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+  const __m256i infinity = _mm256_set1_epi32(0x7f800000);
+  const __m256i rounding_bias = _mm256_set1_epi32(0x7fff);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i quiet = _mm256_set1_epi32(0x40);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i bits = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(src + i * 4));
+    const __m256i is_nan =
+        _mm256_cmpgt_epi32(_mm256_and_si256(bits, abs_mask), infinity);
+    const __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+    const __m256i rounded = _mm256_srli_epi32(
+        _mm256_add_epi32(bits, _mm256_add_epi32(rounding_bias, lsb)), 16);
+    const __m256i nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16), quiet);
+    const __m256i result = _mm256_blendv_epi8(rounded, nan, is_nan);
+    // Packing works within 128 bit lanes, the permutation gathers the
+    // halves of both lanes in the low one.
+    const __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(result, result), 0xd8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2),
+                     _mm256_castsi256_si128(packed));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+bfloat16ToFloatAvx2(const char* src, char* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128i values =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dst + i * 4),
+        _mm256_slli_epi32(_mm256_cvtepu16_epi32(values), 16));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+floatToDoubleAvx2(const char* src, char* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128 values =
+        _mm_loadu_ps(reinterpret_cast<const float*>(src) + i);
+    _mm256_storeu_pd(reinterpret_cast<double*>(dst) + i,
+                     _mm256_cvtps_pd(values));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+doubleToFloatAvx2(const char* src, char* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m256d values =
+        _mm256_loadu_pd(reinterpret_cast<const double*>(src) + i);
+    _mm_storeu_ps(reinterpret_cast<float*>(dst) + i,
+                  _mm256_cvtpd_ps(values));
+  }
+  return i;
+}
+
+ONNX_OPTIMIZER_AVX2 size_t
+int32ToFloatAvx2(const char* src, char* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i values =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+    _mm256_storeu_ps(reinterpret_cast<float*>(dst) + i,
+                     _mm256_cvtepi32_ps(values));
+  }
+  return i;
+}
+
+// Converts as many elements as the vectorized loops support, returning
+// where the scalar loop has to take over.
+size_t convertVectorized(
+    int32_t from_type,
+    const char* src,
+    int32_t to_type,
+    char* dst,
+    size_t count) {
+  const VectorLevel level = vectorLevel();
+  if (level == VectorLevel::Scalar) {
+    return 0;
+  }
+  const bool avx512 = level == VectorLevel::Avx512;
+  if (from_type == TensorProto_DataType_FLOAT) {
+    switch (to_type) {
+      case TensorProto_DataType_FLOAT16:
+        return avx512 ? floatToHalfAvx512(src, dst, count)
+                      : floatToHalfAvx2(src, dst, count);
+      case TensorProto_DataType_BFLOAT16:
+        return floatToBFloat16Avx2(src, dst, count);
+      case TensorProto_DataType_DOUBLE:
+        return floatToDoubleAvx2(src, dst, count);
+    }
+  } else if (to_type == TensorProto_DataType_FLOAT) {
+    switch (from_type) {
+      case TensorProto_DataType_FLOAT16:
+        return avx512 ? halfToFloatAvx512(src, dst, count)
+                      : halfToFloatAvx2(src, dst, count);
+      case TensorProto_DataType_BFLOAT16:
+        return bfloat16ToFloatAvx2(src, dst, count);
+      case TensorProto_DataType_DOUBLE:
+        return doubleToFloatAvx2(src, dst, count);
+      case TensorProto_DataType_INT32:
+        return int32ToFloatAvx2(src, dst, count);
+    }
+  }
+  return 0;
+}
+
+template <typename T>
+size_t batchNormScaleVectorized(
+    const T* scale,
+    const T* var,
+    T epsilon,
+    size_t count,
+    T* out) {
+  switch (vectorLevel()) {
+    case VectorLevel::Avx512:
+      return batchNormScaleAvx512(scale, var, epsilon, count, out);
+    case VectorLevel::Avx2:
+      return batchNormScaleAvx2(scale, var, epsilon, count, out);
+    default:
+      return 0;
+  }
+}
+
+template <typename T>
+size_t scaleVectorized(const T* in, T factor, size_t count, T* out) {
+  switch (vectorLevel()) {
+    case VectorLevel::Avx512:
+      return scaleAvx512(in, factor, count, out);
+    case VectorLevel::Avx2:
+      return scaleAvx2(in, factor, count, out);
+    default:
+      return 0;
+  }
+}
+
+#else
+
+size_t convertVectorized(int32_t, const char*, int32_t, char*, size_t) {
+  return 0;
+}
+
+template <typename T>
+size_t batchNormScaleVectorized(const T*, const T*, T, size_t, T*) {
+  return 0;
+}
+
+template <typename T>
+size_t scaleVectorized(const T*, T, size_t, T*) {
+  return 0;
+}
+
+#endif
+
+template <typename T>
+void batchNormScale(
+    const T* scale,
+    const T* var,
+    T epsilon,
+    size_t count,
+    T* out) {
+  const size_t done =
+      batchNormScaleVectorized(scale, var, epsilon, count, out);
+  batchNormScaleScalar(scale, var, epsilon, done, count, out);
+}
+
+template <typename T>
+void scaleRows(
+    const T* in,
+    const T* scales,
+    size_t rows,
+    size_t row_size,
+    T* out) {
+  for (size_t row = 0; row < rows; ++row) {
+    const T* row_in = in + row * row_size;
+    T* row_out = out + row * row_size;
+    const size_t done = scaleVectorized(row_in, scales[row], row_size, row_out);
+    scaleScalar(row_in, scales[row], done, row_size, row_out);
+  }
+}
+
+} // namespace
+
+const char* VectorExtension() {
+  switch (vectorLevel()) {
+    case VectorLevel::Avx512:
+      return "avx512f";
+    case VectorLevel::Avx2:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
+
+bool ConvertElements(
+    int32_t from_type,
+    const void* src,
+    int32_t to_type,
+    void* dst,
+    size_t count) {
+  const char* src_bytes = static_cast<const char*>(src);
+  char* dst_bytes = static_cast<char*>(dst);
+  // Checks both types before writing anything.
+  if (!convertRange(from_type, src_bytes, to_type, dst_bytes, 0, 0)) {
+    return false;
+  }
+  if (from_type == to_type) {
+    std::memcpy(dst, src, count * ElementSize(from_type));
+    return true;
+  }
+  const size_t done =
+      convertVectorized(from_type, src_bytes, to_type, dst_bytes, count);
+  return convertRange(from_type, src_bytes, to_type, dst_bytes, done, count);
+}
+
+void BatchNormScale(
+    const float* scale,
+    const float* var,
+    float epsilon,
+    size_t count,
+    float* out) {
+  batchNormScale(scale, var, epsilon, count, out);
+}
+
+void BatchNormScale(
+    const double* scale,
+    const double* var,
+    double epsilon,
+    size_t count,
+    double* out) {
+  batchNormScale(scale, var, epsilon, count, out);
+}
+
+void ScaleRows(
+    const float* in,
+    const float* scales,
+    size_t rows,
+    size_t row_size,
+    float* out) {
+  scaleRows(in, scales, rows, row_size, out);
+}
+
+void ScaleRows(
+    const double* in,
+    const double* scales,
+    size_t rows,
+    size_t row_size,
+    double* out) {
+  scaleRows(in, scales, rows, row_size, out);
+}
+
+} // namespace optimization
+} // namespace ONNX_NAMESPACE
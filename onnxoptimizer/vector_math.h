@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "onnx/onnx_pb.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// Elementwise loops of the passes that rewrite initializers, such as
+// fuse_bn_into_conv and fuse_cast_into_initializer. They use AVX-512 or AVX2
+// when the CPU supports them, picked at run time, and otherwise plain loops
+// with identical results.
+
+// Name of the instruction set used, "avx512f", "avx2" or "scalar".
+const char *VectorExtension();
+
+// Converts count elements of from_type at src into to_type at dst, both
+// packed as in raw_data and not necessarily aligned. Floating point values
+// are rounded to nearest even, conversions to integers behave like
+// static_cast and any nonzero value becomes true. Returns false, leaving
+// dst untouched, if either type is not a number or a bool. Also returns
+// false, with dst partly written, if a floating point value converted to
+// an integer type is NaN or out of its range once truncated. Complex types
+// are not supported.
+bool ConvertElements(int32_t from_type, const void *src, int32_t to_type,
+                     void *dst, size_t count);
+
+// out[i] = scale[i] / sqrt(var[i] + epsilon), the factor by which
+// BatchNormalization multiplies channel i.
+void BatchNormScale(const float *scale, const float *var, float epsilon,
+                    size_t count, float *out);
+void BatchNormScale(const double *scale, const double *var, double epsilon,
+                    size_t count, double *out);
+
+// Multiplies row i of the rows x row_size matrix in by scales[i]. out may
+// be in.
+void ScaleRows(const float *in, const float *scales, size_t rows,
+               size_t row_size, float *out);
+void ScaleRows(const double *in, const double *scales, size_t rows,
+               size_t row_size, double *out);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE